@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Compression benchmark for the sofia2hdf5 C implementation
+# Converts a cube of correlated noise uncompressed, with deflate and with Zstd,
+# on one thread and on N threads, and prints time, size and thread speedup as a
+# Markdown table. Zstd is skipped for a binary built without make ZSTD=1.
+# Needs python3 with numpy.
+#
+# Usage: ./benchmark.sh [path/to/sofia2hdf5] [threads] [nx ny nz]
+
+BINARY=$(realpath "${1:-./sofia2hdf5}" 2>/dev/null)
+THREADS=${2:-$(nproc)}
+NX=${3:-700}
+NY=${4:-600}
+NZ=${5:-160}
+
+if [ ! -x "$BINARY" ]; then
+    echo "Error: sofia2hdf5 executable not found; build it with make first"
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Gaussian noise smoothed over 3 x 3 pixels, as in a cube with a beam of a few pixels
+python3 - "$WORK" "$NX" "$NY" "$NZ" << 'EOF' || exit 1
+import sys
+import numpy as np
+directory, nx, ny, nz = sys.argv[1], int(sys.argv[2]), int(sys.argv[3]), int(sys.argv[4])
+rng = np.random.default_rng(2026)
+header = ''.join(('%-8s= %20s' % (key, value)).ljust(80) for key, value in
+                 (('SIMPLE', 'T'), ('BITPIX', -32), ('NAXIS', 3), ('NAXIS1', nx), ('NAXIS2', ny), ('NAXIS3', nz)))
+header += 'END'.ljust(80)
+header += ' ' * (-len(header) % 2880)
+with open(directory + '/noise.fits', 'wb') as f:
+    f.write(header.encode())
+    for z in range(nz):
+        plane = rng.normal(0.0, 1.0, (ny + 2, nx + 2))
+        plane = sum(plane[y:y + ny, x:x + nx] for y in range(3) for x in range(3)) / 3.0
+        f.write(plane.astype('>f4').tobytes())
+    f.write(b'\0' * (-(nx * ny * nz * 4) % 2880))
+with open(directory + '/noise.par', 'w') as f:
+    f.write('input.data = noise.fits\noutput.directory = %s\noutput.filename = noise\n' % directory)
+EOF
+
+# convert ARGS...: seconds taken and size of the output in MB
+convert() {
+    rm -f "$WORK/noise.hdf5"
+    local start end
+    start=$(date +%s.%N)
+    (cd "$WORK" && "$BINARY" sofia_input=noise.par general.max_memory=256 "$@" > "$WORK/run.log" 2>&1)
+    end=$(date +%s.%N)
+    if grep -q -E "^Error" "$WORK/run.log"; then
+        echo "- -"
+    else
+        echo "$(awk "BEGIN {print $end - $start}") $(stat -c %s "$WORK/noise.hdf5")"
+    fi
+}
+
+convert > /dev/null  # Brings the cube into the page cache
+
+echo "Cube of ${NX} x ${NY} x ${NZ} float32 pixels; ${THREADS} thread(s) on $(nproc) core(s)"
+echo ""
+echo "| Storage          | 1 thread | $THREADS threads | Speedup | Size     |"
+echo "|------------------|----------|-----------|---------|----------|"
+
+for setting in "uncompressed:hdf5.compression=none" "deflate, level 1:hdf5.compression=deflate hdf5.compression_level=1" \
+               "deflate, level 4:hdf5.compression=deflate" "zstd, level 3:hdf5.compression=zstd"; do
+    name=${setting%%:*}
+    options=${setting#*:}
+    read -r single size <<< "$(convert $options general.multiprocessing=false)"
+    if [ "$single" = "-" ]; then
+        printf "| %-16s | %s |\n" "$name" "not available in this build"
+        continue
+    fi
+    read -r threaded size <<< "$(convert $options general.multiprocessing=true general.ncpu=$THREADS)"
+    awk -v name="$name" -v single="$single" -v threaded="$threaded" -v size="$size" \
+        'BEGIN {printf "| %-16s | %6.2f s | %7.2f s | %6.2fx | %5.1f MB |\n", name, single, threaded, single / threaded, size / 1048576}'
+done
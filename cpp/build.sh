@@ -45,6 +45,7 @@ if make; then
     echo ""
     echo "Build successful!"
     echo "Executable created: ./sofia2hdf5"
+    echo "Libraries created: ./libsofia2hdf5.a ./libsofia2hdf5.so"
     echo ""
     echo "Usage: ./sofia2hdf5 sofia_input=your_parameter_file.par"
 else
@@ -0,0 +1,209 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (checksum.c) - SoFiA to HDF5 Converter                   //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "checksum.h"
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+PRIVATE uint32_t fold32(uint64_t sum);
+PRIVATE uint64_t rotl64(const uint64_t x, const int r);
+PRIVATE uint64_t read_le64(const unsigned char *p);
+PRIVATE uint32_t read_le32(const unsigned char *p);
+PRIVATE uint64_t xxh64_round(uint64_t acc, const uint64_t input);
+PRIVATE uint64_t xxh64_merge(uint64_t acc, const uint64_t value);
+
+// ----------------------------------------------------------------- //
+// FITS checksum                                                     //
+// ----------------------------------------------------------------- //
+// As defined in the FITS standard: words are summed with end-       //
+// around carry. A piece starting at byte 'offset' is summed as if   //
+// aligned and then rotated right by 8 * (offset % 4) bits, which    //
+// is its exact contribution since 2^32 = 1 in this arithmetic.      //
+// ----------------------------------------------------------------- //
+
+uint32_t checksum_fits(const void *data, const size_t size, const size_t offset)
+{
+    check_null(data);
+    
+    const unsigned char *bytes = (const unsigned char *)data;
+    const size_t words = size / 4;
+    uint64_t sum = 0;
+    
+    for (size_t i = 0; i < words; i++) {
+        const unsigned char *p = bytes + 4 * i;
+        sum += ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+        
+        // Fold well before the 64-bit accumulator could overflow
+        if ((i & 0xFFFFFFF) == 0xFFFFFFF) sum = fold32(sum);
+    }
+    
+    // Trailing bytes count as a word padded with zeros
+    uint32_t last = 0;
+    for (size_t i = 4 * words; i < size; i++) last |= (uint32_t)bytes[i] << (24 - 8 * (i - 4 * words));
+    sum += last;
+    
+    const uint32_t aligned = fold32(sum);
+    const int shift = 8 * (int)(offset % 4);
+    
+    return shift == 0 ? aligned : (aligned >> shift) | (aligned << (32 - shift));
+}
+
+uint32_t checksum_fits_add(const uint32_t a, const uint32_t b)
+{
+    return fold32((uint64_t)a + b);
+}
+
+// ----------------------------------------------------------------- //
+// XXH64                                                             //
+// ----------------------------------------------------------------- //
+// Reference algorithm by Yann Collet (BSD licence), reading input   //
+// as little-endian words independent of the host byte order.        //
+// ----------------------------------------------------------------- //
+
+uint64_t checksum_xxh64(const void *data, const size_t size, const uint64_t seed)
+{
+    check_null(data);
+    
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + size;
+    uint64_t hash;
+    
+    if (size >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        
+        const unsigned char *limit = end - 32;
+        do {
+            v1 = xxh64_round(v1, read_le64(p));
+            v2 = xxh64_round(v2, read_le64(p + 8));
+            v3 = xxh64_round(v3, read_le64(p + 16));
+            v4 = xxh64_round(v4, read_le64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh64_merge(hash, v1);
+        hash = xxh64_merge(hash, v2);
+        hash = xxh64_merge(hash, v3);
+        hash = xxh64_merge(hash, v4);
+    } else {
+        hash = seed + XXH_PRIME64_5;
+    }
+    
+    hash += (uint64_t)size;
+    
+    while (p + 8 <= end) {
+        hash ^= xxh64_round(0, read_le64(p));
+        hash = rotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)read_le32(p) * XXH_PRIME64_1;
+        hash = rotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    
+    while (p < end) {
+        hash ^= (uint64_t)(*p) * XXH_PRIME64_5;
+        hash = rotl64(hash, 11) * XXH_PRIME64_1;
+        p++;
+    }
+    
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME64_3;
+    hash ^= hash >> 32;
+    
+    return hash;
+}
+
+// ----------------------------------------------------------------- //
+// Fletcher32                                                        //
+// ----------------------------------------------------------------- //
+// The variant of HDF5's fletcher32 filter: big-endian 16-bit words  //
+// with both sums folded every 360 words, and an odd trailing byte   //
+// taken as the high byte of a last word.                            //
+// ----------------------------------------------------------------- //
+
+uint32_t checksum_fletcher32(const void *data, const size_t size)
+{
+    check_null(data);
+    
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t words = size / 2;
+    uint32_t sum1 = 0;
+    uint32_t sum2 = 0;
+    
+    while (words > 0) {
+        size_t block = words > 360 ? 360 : words;
+        words -= block;
+        for (; block > 0; block--, bytes += 2) {
+            sum1 += ((uint32_t)bytes[0] << 8) | (uint32_t)bytes[1];
+            sum2 += sum1;
+        }
+        sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+        sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+    }
+    
+    if (size % 2) {
+        sum1 += (uint32_t)bytes[0] << 8;
+        sum2 += sum1;
+        sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+        sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+    }
+    
+    sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+    sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+    
+    return (sum2 << 16) | sum1;
+}
+
+// ----------------------------------------------------------------- //
+// Private functions                                                 //
+// ----------------------------------------------------------------- //
+
+// End-around carry of a 64-bit sum into 32 bits
+uint32_t fold32(uint64_t sum)
+{
+    while (sum >> 32) sum = (sum & 0xFFFFFFFFULL) + (sum >> 32);
+    return (uint32_t)sum;
+}
+
+uint64_t rotl64(const uint64_t x, const int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t read_le64(const unsigned char *p)
+{
+    return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+uint32_t read_le32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint64_t xxh64_round(uint64_t acc, const uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+uint64_t xxh64_merge(uint64_t acc, const uint64_t value)
+{
+    acc ^= xxh64_round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
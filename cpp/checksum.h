@@ -0,0 +1,45 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (checksum.h) - SoFiA to HDF5 Converter                   //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+
+/// @file   checksum.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  FITS checksums and content hashing of image data (header).
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include "common.h"
+
+// FITS checksum (ones' complement sum of big-endian 32-bit words) of 'size' bytes
+// that start 'offset' bytes into the summed unit, so that pieces of a data unit can
+// be summed independently and combined with checksum_fits_add() in any order.
+PUBLIC uint32_t checksum_fits(const void *data, const size_t size, const size_t offset);
+PUBLIC uint32_t checksum_fits_add(const uint32_t a, const uint32_t b);
+
+// 64-bit xxHash (XXH64) of 'size' bytes
+PUBLIC uint64_t checksum_xxh64(const void *data, const size_t size, const uint64_t seed);
+
+// Fletcher32 of 'size' bytes as HDF5 computes it for its fletcher32 filter
+PUBLIC uint32_t checksum_fletcher32(const void *data, const size_t size);
+
+#endif
@@ -6,6 +6,28 @@
 
 #include "common.h"
 
+#ifdef SOFIA2HDF5_MPI
+#include <mpi.h>
+#endif
+
+// Counters are updated from worker threads as well
+#if defined(__GNUC__)
+#define MEMORY_COUNT(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#else
+#define MEMORY_COUNT(counter, n) ((counter) += (n))
+#endif
+
+// Error traps are per thread, since a jump cannot leave the thread that set it
+#if defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+PRIVATE void error_raise(const int code, const char *message);
+
+PRIVATE MemoryStatistics memory_statistics = {0, 0, 0, 0, 0, 0, 0};
+
 // ----------------------------------------------------------------- //
 // Memory allocation functions                                       //
 // ----------------------------------------------------------------- //
@@ -14,6 +36,8 @@ void *memory_alloc(const size_t size)
 {
     void *ptr = malloc(size);
     check_null(ptr);
+    MEMORY_COUNT(memory_statistics.allocations, 1);
+    MEMORY_COUNT(memory_statistics.bytes, size);
     return ptr;
 }
 
@@ -21,15 +45,132 @@ void *memory_realloc(void *ptr, const size_t size)
 {
     ptr = realloc(ptr, size);
     check_null(ptr);
+    MEMORY_COUNT(memory_statistics.reallocations, 1);
+    MEMORY_COUNT(memory_statistics.bytes, size);
     return ptr;
 }
 
 void memory_free(void *ptr)
 {
-    if (ptr != NULL) free(ptr);
+    if (ptr != NULL) {
+        free(ptr);
+        MEMORY_COUNT(memory_statistics.frees, 1);
+    }
+    return;
+}
+
+void memory_get_statistics(MemoryStatistics *stats)
+{
+    check_null(stats);
+    *stats = memory_statistics;
+    return;
+}
+
+void memory_print_statistics(void)
+{
+    MemoryStatistics stats;
+    memory_get_statistics(&stats);
+    
+    printf("Memory: %zu allocations, %zu reallocations, %zu frees (%.1f MB requested)\n",
+           stats.allocations, stats.reallocations, stats.frees, (double)stats.bytes / MEGABYTE);
+    printf("Arenas: %zu allocations in %zu blocks (%.1f kB)\n",
+           stats.arena_allocations, stats.arena_blocks, (double)stats.arena_bytes / KILOBYTE);
     return;
 }
 
+// ----------------------------------------------------------------- //
+// Arena allocator                                                   //
+// ----------------------------------------------------------------- //
+
+#define ARENA_ALIGNMENT 16
+
+CLASS ArenaBlock {
+    ArenaBlock *next;
+    size_t size;
+    size_t used;
+    unsigned char *memory;
+};
+
+Arena *Arena_new(const size_t block_size)
+{
+    Arena *self = memory_alloc(sizeof(Arena));
+    self->head = NULL;
+    self->block_size = block_size > 0 ? block_size : 65536;
+    return self;
+}
+
+void Arena_delete(Arena *self)
+{
+    if (self != NULL) {
+        ArenaBlock *block = self->head;
+        while (block != NULL) {
+            ArenaBlock *next = block->next;
+            memory_free(block);
+            block = next;
+        }
+        memory_free(self);
+    }
+    return;
+}
+
+// Forget all allocations but keep the first block for reuse
+void Arena_reset(Arena *self)
+{
+    check_null(self);
+    
+    while (self->head != NULL && self->head->next != NULL) {
+        ArenaBlock *next = self->head->next;
+        memory_free(self->head);
+        self->head = next;
+    }
+    if (self->head != NULL) self->head->used = 0;
+    
+    return;
+}
+
+void *Arena_alloc(Arena *self, const size_t size)
+{
+    check_null(self);
+    
+    // Round up so that every allocation stays suitably aligned
+    const size_t padded = (size + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1);
+    
+    if (self->head == NULL || self->head->used + padded > self->head->size) {
+        // Start a new block; oversized requests get a block of their own
+        const size_t block_size = padded > self->block_size ? padded : self->block_size;
+        const size_t header = (sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1);
+        ArenaBlock *block = memory_alloc(header + block_size);
+        block->memory = (unsigned char *)block + header;
+        block->size = block_size;
+        block->used = 0;
+        block->next = self->head;
+        self->head = block;
+        MEMORY_COUNT(memory_statistics.arena_blocks, 1);
+    }
+    
+    void *ptr = self->head->memory + self->head->used;
+    self->head->used += padded;
+    MEMORY_COUNT(memory_statistics.arena_allocations, 1);
+    MEMORY_COUNT(memory_statistics.arena_bytes, padded);
+    return ptr;
+}
+
+char *Arena_string_copy(Arena *self, const char *str)
+{
+    check_null(str);
+    return Arena_string_ncopy(self, str, strlen(str));
+}
+
+char *Arena_string_ncopy(Arena *self, const char *str, const size_t len)
+{
+    check_null(str);
+    
+    char *copy = Arena_alloc(self, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
 // ----------------------------------------------------------------- //
 // String utility functions                                          //
 // ----------------------------------------------------------------- //
@@ -85,17 +226,41 @@ bool string_ends_with(const char *str, const char *suffix)
 // Error handling functions                                          //
 // ----------------------------------------------------------------- //
 
+PRIVATE THREAD_LOCAL jmp_buf *error_handler = NULL;
+
 void check_null(const void *ptr)
 {
-    if (ptr == NULL) {
-        fprintf(stderr, "Error: NULL pointer encountered\n");
-        exit(ERR_NULL_PTR);
-    }
+    if (ptr == NULL) error_raise(ERR_NULL_PTR, "NULL pointer encountered");
     return;
 }
 
 void error_exit(const char *message)
+{
+    error_raise(ERR_FAILURE, message);
+}
+
+jmp_buf *error_trap(jmp_buf *trap)
+{
+    jmp_buf *previous = error_handler;
+    error_handler = trap;
+    return previous;
+}
+
+void error_raise(const int code, const char *message)
 {
     fprintf(stderr, "Error: %s\n", message);
-    exit(ERR_FAILURE);
+    
+#ifdef SOFIA2HDF5_MPI
+    // The other ranks would wait forever in their next collective call
+    int initialised = 0;
+    int finalised = 0;
+    int size = 1;
+    MPI_Initialized(&initialised);
+    MPI_Finalized(&finalised);
+    if (initialised && !finalised) MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (size > 1) MPI_Abort(MPI_COMM_WORLD, code);
+#endif
+    
+    if (error_handler != NULL) longjmp(*error_handler, code);
+    exit(code);
 }
\ No newline at end of file
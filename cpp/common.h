@@ -30,6 +30,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
 
 #define SOFIA2HDF5_VERSION "1.0.0"
 #define SOFIA2HDF5_CREATION_DATE "2025-09-29"
@@ -48,6 +50,11 @@
 #define ERR_FILE_ACCESS  5
 #define ERR_USER_INPUT   7
 
+// Memory size constants
+#define KILOBYTE       1024  ///< Size of a kilobyte (in bytes).
+#define MEGABYTE    1048576  ///< Size of a megabyte (in bytes).
+#define GIGABYTE 1073741824  ///< Size of a gigabyte (in bytes).
+
 // Maximum string lengths
 #define MAX_PATH_LENGTH    1024
 #define MAX_STRING_LENGTH  256
@@ -58,14 +65,81 @@ void *memory_alloc(const size_t size);
 void *memory_realloc(void *ptr, const size_t size);
 void memory_free(void *ptr);
 
+// Allocation counters of the whole process (all threads)
+typedef CLASS MemoryStatistics {
+    size_t allocations;       // memory_alloc() calls
+    size_t reallocations;     // memory_realloc() calls
+    size_t frees;             // memory_free() calls on allocated memory
+    size_t bytes;             // Bytes requested from memory_alloc() and memory_realloc()
+    size_t arena_allocations; // Arena_alloc() calls
+    size_t arena_blocks;      // Blocks taken from memory_alloc() by arenas
+    size_t arena_bytes;       // Bytes handed out by arenas
+} MemoryStatistics;
+
+void memory_get_statistics(MemoryStatistics *stats);
+void memory_print_statistics(void);
+
+// ----------------------------------------------------------------- //
+// Class 'Arena'                                                     //
+// ----------------------------------------------------------------- //
+// Region allocator for many small, equally long-lived allocations.  //
+// Everything handed out by an arena is released in one go by        //
+// Arena_delete(), or recycled by Arena_reset(); individual          //
+// allocations are never freed. Objects that make many small         //
+// allocations (FitsFile, Parameter, SofiaCatalog) own one each.     //
+// ----------------------------------------------------------------- //
+
+typedef CLASS ArenaBlock ArenaBlock;
+
+typedef CLASS Arena {
+    ArenaBlock *head;     // Most recently allocated block
+    size_t block_size;    // Default size of new blocks in bytes
+} Arena;
+
+PUBLIC Arena *Arena_new(const size_t block_size);
+PUBLIC void Arena_delete(Arena *self);
+PUBLIC void Arena_reset(Arena *self);
+PUBLIC void *Arena_alloc(Arena *self, const size_t size);
+PUBLIC char *Arena_string_copy(Arena *self, const char *str);
+PUBLIC char *Arena_string_ncopy(Arena *self, const char *str, const size_t len);
+
 // String utilities
 char *string_copy(const char *str);
 char *string_trim(char *str);
 bool string_starts_with(const char *str, const char *prefix);
 bool string_ends_with(const char *str, const char *suffix);
 
-// Error handling
+// Pixel masks: all bits set for finite values, none for blanks and infinities,
+// taken from the exponent bits without a comparison. Selecting with such a mask
+// instead of a jump lets loops over pixels with blanks be vectorised, also on
+// processors without 64-bit integer comparisons.
+static inline uint64_t finite_mask(const double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint64_t exponent = (bits >> 52) & 0x7FF;
+    return ((exponent + 1) >> 11) - 1;
+}
+
+// 'value' where 'mask' is set, else 'other'
+static inline double select_value(const uint64_t mask, const double value, const double other)
+{
+    uint64_t a, b;
+    memcpy(&a, &value, sizeof(a));
+    memcpy(&b, &other, sizeof(b));
+    a = (a & mask) | (b & ~mask);
+    
+    double result;
+    memcpy(&result, &a, sizeof(result));
+    return result;
+}
+
+// Error handling. An error prints its message and ends the process, unless the
+// calling thread has installed a trap with error_trap(); the error then returns
+// to the setjmp() of that trap with the error code. error_trap() returns the
+// previous trap, to be restored once the guarded code has finished.
 void check_null(const void *ptr);
 void error_exit(const char *message);
+jmp_buf *error_trap(jmp_buf *trap);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,171 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (compress.c) - SoFiA to HDF5 Converter                    //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "compress.h"
+#include "checksum.h"
+#include <hdf5.h>
+#include <zlib.h>
+#ifdef SOFIA2HDF5_ZSTD
+#include <zstd.h>
+#endif
+
+// Byte-plane transpose for a fixed word size. The compiler turns the strided
+// gather of the inner loop into vector shuffles.
+
+#define SHUFFLE_KERNEL(NAME, WORD) \
+PRIVATE void NAME(const unsigned char *data, unsigned char *shuffled, const size_t n) \
+{ \
+    for (size_t b = 0; b < WORD; b++) { \
+        unsigned char *plane = shuffled + b * n; \
+        for (size_t i = 0; i < n; i++) plane[i] = data[i * WORD + b]; \
+    } \
+    return; \
+}
+
+SHUFFLE_KERNEL(shuffle_2, 2)
+SHUFFLE_KERNEL(shuffle_4, 4)
+SHUFFLE_KERNEL(shuffle_8, 8)
+
+#undef SHUFFLE_KERNEL
+
+#ifdef SOFIA2HDF5_ZSTD
+PRIVATE size_t compress_zstd_filter(unsigned int flags, size_t cd_nelmts, const unsigned int cd_values[],
+                                    size_t nbytes, size_t *buf_size, void **buf);
+#endif
+
+// Whether this build can compress with Zstd
+bool compress_zstd_available(void)
+{
+#ifdef SOFIA2HDF5_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Register the Zstd filter with HDF5 unless it is there already (e.g. as a plugin)
+void compress_register_zstd(void)
+{
+#ifdef SOFIA2HDF5_ZSTD
+    static const H5Z_class2_t zstd_class = {
+        H5Z_CLASS_T_VERS, (H5Z_filter_t)COMPRESS_FILTER_ZSTD, 1, 1, "zstd", NULL, NULL, compress_zstd_filter
+    };
+    if (H5Zfilter_avail(COMPRESS_FILTER_ZSTD) <= 0 && H5Zregister(&zstd_class) < 0) {
+        error_exit("Failed to register the Zstd filter with HDF5.");
+    }
+#endif
+    return;
+}
+
+// Largest number of bytes compress_chunk() produces from 'size' bytes
+size_t compress_bound(const size_t size)
+{
+    size_t bound = (size_t)compressBound((uLong)size);
+#ifdef SOFIA2HDF5_ZSTD
+    if (ZSTD_compressBound(size) > bound) bound = ZSTD_compressBound(size);
+#endif
+    return bound + 4;
+}
+
+// Compress one chunk of 'size' bytes into 'compressed' (compress_bound(size) bytes)
+// and return the number of bytes produced. 'scratch' holds 'size' bytes.
+size_t compress_chunk(const void *chunk, const size_t size, const size_t word_size, const bool shuffle,
+                      const bool zstd, const int level, const bool fletcher32, void *scratch, void *compressed)
+{
+    check_null(chunk);
+    check_null(compressed);
+    
+    const void *source = chunk;
+    if (shuffle && word_size > 1) {
+        check_null(scratch);
+        compress_shuffle(chunk, scratch, size, word_size);
+        source = scratch;
+    }
+    
+    size_t result = 0;
+    if (zstd) {
+#ifdef SOFIA2HDF5_ZSTD
+        result = ZSTD_compress(compressed, ZSTD_compressBound(size), source, size, level);
+        if (ZSTD_isError(result)) error_exit("Failed to compress a chunk with Zstd.");
+#else
+        error_exit("Zstd compression needs a build with make ZSTD=1.");
+#endif
+    } else {
+        uLongf compressed_size = compressBound((uLong)size);
+        if (compress2((Bytef *)compressed, &compressed_size, (const Bytef *)source, (uLong)size, level) != Z_OK) {
+            error_exit("Failed to deflate a chunk.");
+        }
+        result = compressed_size;
+    }
+    
+    // HDF5 stores the checksum of the filtered bytes after them, little-endian
+    if (fletcher32) {
+        const uint32_t sum = checksum_fletcher32(compressed, result);
+        unsigned char *tail = (unsigned char *)compressed + result;
+        for (int b = 0; b < 4; b++) tail[b] = (unsigned char)(sum >> (8 * b));
+        result += 4;
+    }
+    
+    return result;
+}
+
+// Transpose 'size' bytes of words into byte planes as HDF5's shuffle filter does;
+// bytes past the last whole word are copied as they are
+void compress_shuffle(const void *data, void *shuffled, const size_t size, const size_t word_size)
+{
+    const unsigned char *in = (const unsigned char *)data;
+    unsigned char *out = (unsigned char *)shuffled;
+    const size_t n = word_size > 0 ? size / word_size : 0;
+    
+    if (word_size == 2) shuffle_2(in, out, n);
+    else if (word_size == 4) shuffle_4(in, out, n);
+    else if (word_size == 8) shuffle_8(in, out, n);
+    else {
+        for (size_t b = 0; b < word_size; b++) {
+            for (size_t i = 0; i < n; i++) out[b * n + i] = in[i * word_size + b];
+        }
+    }
+    
+    memcpy(out + n * word_size, in + n * word_size, size - n * word_size);
+    return;
+}
+
+#ifdef SOFIA2HDF5_ZSTD
+// HDF5 filter 32015: one Zstd frame per chunk, the level in cd_values[0]. The
+// filter buffer is replaced by one allocated through HDF5, as HDF5 frees it.
+size_t compress_zstd_filter(unsigned int flags, size_t cd_nelmts, const unsigned int cd_values[],
+                            size_t nbytes, size_t *buf_size, void **buf)
+{
+    size_t size;
+    void *output;
+    
+    if (flags & H5Z_FLAG_REVERSE) {
+        const unsigned long long content = ZSTD_getFrameContentSize(*buf, nbytes);
+        if (content == ZSTD_CONTENTSIZE_ERROR || content == ZSTD_CONTENTSIZE_UNKNOWN) return 0;
+        
+        output = H5allocate_memory((size_t)content, false);
+        if (output == NULL) return 0;
+        size = ZSTD_decompress(output, (size_t)content, *buf, nbytes);
+    } else {
+        const int level = cd_nelmts > 0 ? (int)cd_values[0] : COMPRESS_ZSTD_LEVEL;
+        const size_t bound = ZSTD_compressBound(nbytes);
+        
+        output = H5allocate_memory(bound, false);
+        if (output == NULL) return 0;
+        size = ZSTD_compress(output, bound, *buf, nbytes, level);
+    }
+    
+    if (ZSTD_isError(size)) {
+        H5free_memory(output);
+        return 0;
+    }
+    
+    H5free_memory(*buf);
+    *buf = output;
+    *buf_size = (flags & H5Z_FLAG_REVERSE) ? size : ZSTD_compressBound(nbytes);
+    return size;
+}
+#endif
@@ -0,0 +1,58 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (compress.h) - SoFiA to HDF5 Converter                    //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+/// @file   compress.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Lossless compression of data set chunks (header).
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include "common.h"
+
+#define COMPRESS_DEFLATE_LEVEL     4      ///< Default deflate level.
+#define COMPRESS_ZSTD_LEVEL        3      ///< Default Zstd level.
+#define COMPRESS_FILTER_ZSTD       32015  ///< Registered HDF5 filter ID of Zstd.
+
+// ----------------------------------------------------------------- //
+// Chunk compression                                                 //
+// ----------------------------------------------------------------- //
+// Produces the bytes that HDF5's shuffle, deflate (or Zstd) and     //
+// fletcher32 filters would store for a chunk, so that chunks can    //
+// be compressed on several threads and written with                 //
+// H5Dwrite_chunk. The shuffle transposes the chunk into byte        //
+// planes (all first bytes, then all second bytes, ...), which       //
+// groups the slowly varying sign and exponent bytes of noisy        //
+// floating-point data. Zstd is only there in a build with           //
+// make ZSTD=1; it stores one Zstd frame per chunk, as the           //
+// registered filter 32015 does, and registers that filter with      //
+// HDF5 so that the converter can read such data sets back.          //
+// ----------------------------------------------------------------- //
+
+PUBLIC bool compress_zstd_available(void);
+PUBLIC void compress_register_zstd(void);
+PUBLIC size_t compress_bound(const size_t size);
+PUBLIC size_t compress_chunk(const void *chunk, const size_t size, const size_t word_size, const bool shuffle,
+                             const bool zstd, const int level, const bool fletcher32, void *scratch, void *compressed);
+PUBLIC void compress_shuffle(const void *data, void *shuffled, const size_t size, const size_t word_size);
+
+#endif
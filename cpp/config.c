@@ -6,6 +6,7 @@
 
 #include "config.h"
 #include <unistd.h>
+#include <strings.h>
 
 // ----------------------------------------------------------------- //
 // Constructor and destructor                                        //
@@ -21,6 +22,7 @@ Config *Config_new(void)
 void Config_delete(Config *self)
 {
     if (self != NULL) {
+        memory_free(self->mosaic);
         memory_free(self);
     }
     return;
@@ -54,8 +56,24 @@ Config *setup_config(int argc, char **argv)
         }
     }
     
-    // Check if sofia_input is provided
-    if (strlen(cfg->sofia_input) == 0) {
+    // A mosaic takes the parameter files of its tiles instead of sofia_input
+    if (cfg->mosaic != NULL) {
+        if (strlen(cfg->mosaic_output) == 0) error_exit("mosaic= needs mosaic.output= to name the HDF5 file of the mosaic.");
+        if (strlen(cfg->input_data) > 0) error_exit("input= cannot be combined with mosaic=.");
+        if (strlen(cfg->region) > 0) error_exit("region= cannot be combined with mosaic=.");
+        return cfg;
+    }
+    
+    if (strlen(cfg->region) > 0 && strlen(cfg->hdf5_input) > 0) {
+        error_exit("region= cannot be combined with hdf5_input=.");
+    }
+    
+    // Check if sofia_input is provided (not needed when converting back to FITS).
+    // It cannot be asked for if standard input carries the cube.
+    if (strlen(cfg->sofia_input) == 0 && strlen(cfg->hdf5_input) == 0 && strcmp(cfg->input_data, "-") == 0) {
+        error_exit("sofia_input= is required when the cube is read from standard input.");
+    }
+    if (strlen(cfg->sofia_input) == 0 && strlen(cfg->hdf5_input) == 0) {
         printf("You have to provide the input to the sofia run: ");
         if (fgets(cfg->sofia_input, MAX_PATH_LENGTH, stdin) != NULL) {
             // Remove newline if present
@@ -74,13 +92,51 @@ void Config_set_defaults(Config *self)
     self->print_examples = false;
     strcpy(self->sofia_catalog, "");
     strcpy(self->sofia_input, "");
+    strcpy(self->hdf5_input, "");
+    strcpy(self->input_data, "");
     strcpy(self->configuration_file, "");
+    self->mosaic = NULL;
+    strcpy(self->mosaic_output, "");
+    self->mosaic_match_radius = 2.0;
+    self->mosaic_match_channels = 2.0;
+    strcpy(self->region, "");
+    self->region_margin = 5.0;
     
     // Set general defaults
     self->general.verbose = true;
     self->general.ncpu = 0; // Will be determined later
     getcwd(self->general.directory, MAX_PATH_LENGTH);
     self->general.multiprocessing = true;
+    self->general.max_memory = 1024;
+    self->general.direct_io = false;
+    
+    // Set HDF5 output defaults
+    Hdf5Options_set_defaults(&self->hdf5);
+    
+    return;
+}
+
+void Hdf5Options_set_defaults(Hdf5Options *self)
+{
+    check_null(self);
+    
+    self->dense_attributes = false;
+    self->statistics = false;
+    self->mipmaps = false;
+    self->resume = false;
+    self->incremental = false;
+    self->checksums = false;
+    self->sparse = false;
+    self->external = false;
+    self->detections = false;
+    self->detection_margin = 5.0;
+    self->swizzle = SWIZZLE_NONE;
+    self->quantise = QUANTISE_NONE;
+    self->quantise_bits = 5;
+    self->compression = COMPRESSION_NONE;
+    self->compression_level = -1;
+    self->fs_profile = FS_PROFILE_NONE;
+    self->in_memory = 0;
     
     return;
 }
@@ -90,12 +146,45 @@ void Config_print_help(void)
     printf("\nUse sofia2hdf5 in this way:\n\n");
     printf("All config parameters can be set directly from the command line by setting the correct parameters, e.g:\n");
     printf("sofia2hdf5 sofia_input=cube.par\n\n");
+    printf("The cube can be read from a pipe instead of the file named in the parameter file:\n");
+    printf("zstd -dc cube.fits.zst | sofia2hdf5 sofia_input=cube.par input=-\n\n");
+    printf("To regenerate the FITS cube, mask and catalogue from an HDF5 file:\n");
+    printf("sofia2hdf5 hdf5_input=cube.hdf5 general.directory=out\n\n");
+    printf("To convert the tiles of a field and join them into one virtual cube:\n");
+    printf("sofia2hdf5 mosaic=tile1.par,tile2.par mosaic.output=field.hdf5\n\n");
     printf("Options:\n");
     printf("  -h, --help     Show this help message\n");
     printf("  -v, --version  Show version information\n");
     printf("  --verbose      Enable verbose output\n");
     printf("  --ncpu=N       Set number of CPUs to use\n");
     printf("  --directory=D  Set working directory\n");
+    printf("  --max-memory=M Memory budget for image data in MB (general.max_memory)\n");
+    printf("  general.direct_io=true       Read FITS data past the page cache\n");
+    printf("  --region=x0:x1,y0:y1,z0:z1   Convert only this part of the cube (pixels from 0)\n");
+    printf("  --region=catalog             Convert the part of the cube around the sources\n");
+    printf("  region.margin=N              Pixels added around the sources (5)\n");
+    printf("  mosaic=A.par,B.par,...       Convert tile runs and join them virtually\n");
+    printf("  mosaic.output=FILE           HDF5 file of the mosaic\n");
+    printf("  mosaic.match_radius=R        Pixels within which tile sources are merged (2)\n");
+    printf("  mosaic.match_channels=C      Channels within which tile sources are merged (2)\n");
+    printf("\nHDF5 output options:\n");
+    printf("  hdf5.dense_attributes=true   Store header attributes in dense storage\n");
+    printf("  hdf5.statistics=true         Precompute channel and cube statistics\n");
+    printf("  hdf5.mipmaps=true            Write downsampled planes\n");
+    printf("  hdf5.resume=true             Continue an interrupted conversion\n");
+    printf("  hdf5.incremental=true        Only rewrite products whose input changed\n");
+    printf("  hdf5.checksums=true          Verify FITS checksums and hash the data\n");
+    printf("  hdf5.sparse=true             Do not store chunks that are entirely blank\n");
+    printf("  hdf5.external=true           Refer to the FITS data instead of copying them\n");
+    printf("  hdf5.detections=true         Store only the chunks near catalogue sources or mask voxels\n");
+    printf("  hdf5.detection_margin=N      Pixels kept around each detection (5)\n");
+    printf("  hdf5.swizzle=ZYX|ZXY|none    Add a spectral-major copy of the cube\n");
+    printf("  hdf5.quantise=round|float16  Store the cube with reduced precision, compressed\n");
+    printf("  hdf5.quantise_bits=N         Bits kept below the channel RMS when rounding (5)\n");
+    printf("  hdf5.compression=deflate|zstd|none  Compress the image data losslessly (zstd: make ZSTD=1)\n");
+    printf("  hdf5.compression_level=N     Level of the compressor (deflate 4, zstd 3)\n");
+    printf("  --fs-profile=lustre|gpfs|local|none  Paged file layout for this file system\n");
+    printf("  --in-memory=M                Build outputs of up to M MB in memory, written at once\n");
     printf("\n");
 }
 
@@ -123,6 +212,37 @@ bool Config_parse_args(Config *self, int argc, char **argv)
         else if (string_starts_with(arg, "sofia_input=")) {
             strcpy(self->sofia_input, arg + 12);
         }
+        else if (string_starts_with(arg, "hdf5_input=")) {
+            strcpy(self->hdf5_input, arg + 11);
+        }
+        else if (string_starts_with(arg, "mosaic=")) {
+            memory_free(self->mosaic);
+            self->mosaic = string_copy(arg + 7);
+        }
+        else if (string_starts_with(arg, "mosaic.output=")) {
+            strcpy(self->mosaic_output, arg + 14);
+        }
+        else if (string_starts_with(arg, "mosaic.match_radius=")) {
+            self->mosaic_match_radius = strtod(arg + 20, NULL);
+        }
+        else if (string_starts_with(arg, "mosaic.match_channels=")) {
+            self->mosaic_match_channels = strtod(arg + 22, NULL);
+        }
+        else if (string_starts_with(arg, "--region=")) {
+            strcpy(self->region, arg + 9);
+        }
+        else if (string_starts_with(arg, "region=")) {
+            strcpy(self->region, arg + 7);
+        }
+        else if (string_starts_with(arg, "region.margin=")) {
+            self->region_margin = strtod(arg + 14, NULL);
+        }
+        else if (string_starts_with(arg, "input=")) {
+            strcpy(self->input_data, arg + 6);
+        }
+        else if (string_starts_with(arg, "input.data=")) {
+            strcpy(self->input_data, arg + 11);
+        }
         else if (string_starts_with(arg, "sofia_catalog=")) {
             strcpy(self->sofia_catalog, arg + 14);
         }
@@ -135,6 +255,18 @@ bool Config_parse_args(Config *self, int argc, char **argv)
         else if (string_starts_with(arg, "general.ncpu=")) {
             self->general.ncpu = atoi(arg + 13);
         }
+        else if (string_starts_with(arg, "general.max_memory=")) {
+            self->general.max_memory = strtoul(arg + 19, NULL, 10);
+        }
+        else if (string_starts_with(arg, "--max-memory=")) {
+            self->general.max_memory = strtoul(arg + 13, NULL, 10);
+        }
+        else if (string_starts_with(arg, "general.direct_io=")) {
+            self->general.direct_io = Config_parse_bool(arg + 18);
+        }
+        else if (Hdf5Options_parse(&self->hdf5, arg)) {
+            // An hdf5.* setting
+        }
         else if (strcmp(arg, "--verbose") == 0) {
             self->general.verbose = true;
         }
@@ -151,4 +283,96 @@ bool Config_parse_args(Config *self, int argc, char **argv)
     }
     
     return true;
+}
+
+// Apply one hdf5.* setting (or --fs-profile, --in-memory) as given on the command
+// line; returns false if 'arg' is none of them
+bool Hdf5Options_parse(Hdf5Options *self, const char *arg)
+{
+    check_null(self);
+    check_null(arg);
+    
+    if (string_starts_with(arg, "hdf5.dense_attributes=")) {
+        self->dense_attributes = Config_parse_bool(arg + 22);
+    }
+    else if (string_starts_with(arg, "hdf5.statistics=")) {
+        self->statistics = Config_parse_bool(arg + 16);
+    }
+    else if (string_starts_with(arg, "hdf5.mipmaps=")) {
+        self->mipmaps = Config_parse_bool(arg + 13);
+    }
+    else if (string_starts_with(arg, "hdf5.resume=")) {
+        self->resume = Config_parse_bool(arg + 12);
+    }
+    else if (string_starts_with(arg, "hdf5.incremental=")) {
+        self->incremental = Config_parse_bool(arg + 17);
+    }
+    else if (string_starts_with(arg, "hdf5.checksums=")) {
+        self->checksums = Config_parse_bool(arg + 15);
+    }
+    else if (string_starts_with(arg, "hdf5.sparse=")) {
+        self->sparse = Config_parse_bool(arg + 12);
+    }
+    else if (string_starts_with(arg, "hdf5.detections=")) {
+        self->detections = Config_parse_bool(arg + 16);
+    }
+    else if (string_starts_with(arg, "hdf5.detection_margin=")) {
+        self->detection_margin = strtod(arg + 22, NULL);
+    }
+    else if (string_starts_with(arg, "hdf5.external=")) {
+        self->external = Config_parse_bool(arg + 14);
+    }
+    else if (string_starts_with(arg, "hdf5.swizzle=")) {
+        const char *value = arg + 13;
+        if (strcasecmp(value, "zyx") == 0) self->swizzle = SWIZZLE_ZYX;
+        else if (strcasecmp(value, "zxy") == 0) self->swizzle = SWIZZLE_ZXY;
+        else if (strcasecmp(value, "none") == 0) self->swizzle = SWIZZLE_NONE;
+        else error_exit("Unknown value of hdf5.swizzle, expected ZYX, ZXY or none.");
+    }
+    else if (string_starts_with(arg, "hdf5.quantise=")) {
+        const char *value = arg + 14;
+        if (strcasecmp(value, "round") == 0) self->quantise = QUANTISE_ROUND;
+        else if (strcasecmp(value, "float16") == 0) self->quantise = QUANTISE_FLOAT16;
+        else if (strcasecmp(value, "none") == 0) self->quantise = QUANTISE_NONE;
+        else error_exit("Unknown value of hdf5.quantise, expected round, float16 or none.");
+    }
+    else if (string_starts_with(arg, "hdf5.quantise_bits=")) {
+        self->quantise_bits = atoi(arg + 19);
+        if (self->quantise_bits < 0 || self->quantise_bits > 30) error_exit("hdf5.quantise_bits must lie between 0 and 30.");
+    }
+    else if (string_starts_with(arg, "hdf5.compression=")) {
+        const char *value = arg + 17;
+        if (strcasecmp(value, "deflate") == 0) self->compression = COMPRESSION_DEFLATE;
+        else if (strcasecmp(value, "zstd") == 0) self->compression = COMPRESSION_ZSTD;
+        else if (strcasecmp(value, "none") == 0) self->compression = COMPRESSION_NONE;
+        else error_exit("Unknown value of hdf5.compression, expected deflate, zstd or none.");
+    }
+    else if (string_starts_with(arg, "--fs-profile=") || string_starts_with(arg, "hdf5.fs_profile=")) {
+        const char *value = strchr(arg, '=') + 1;
+        if (strcasecmp(value, "lustre") == 0) self->fs_profile = FS_PROFILE_LUSTRE;
+        else if (strcasecmp(value, "gpfs") == 0) self->fs_profile = FS_PROFILE_GPFS;
+        else if (strcasecmp(value, "local") == 0) self->fs_profile = FS_PROFILE_LOCAL;
+        else if (strcasecmp(value, "none") == 0) self->fs_profile = FS_PROFILE_NONE;
+        else error_exit("Unknown file system profile, expected lustre, gpfs, local or none.");
+    }
+    else if (string_starts_with(arg, "--in-memory=") || string_starts_with(arg, "hdf5.in_memory=")) {
+        self->in_memory = strtoul(strchr(arg, '=') + 1, NULL, 10);
+    }
+    else if (string_starts_with(arg, "hdf5.compression_level=")) {
+        self->compression_level = atoi(arg + 23);
+        if (self->compression_level < 1 || self->compression_level > 22) error_exit("hdf5.compression_level must lie between 1 and 22.");
+    }
+    else {
+        return false;
+    }
+    
+    return true;
+}
+
+bool Config_parse_bool(const char *value)
+{
+    check_null(value);
+    
+    return (strcasecmp(value, "true") == 0 || strcasecmp(value, "yes") == 0 ||
+            strcasecmp(value, "t") == 0 || strcmp(value, "1") == 0);
 }
\ No newline at end of file
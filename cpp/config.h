@@ -40,8 +40,65 @@ typedef CLASS General {
     int ncpu;
     char directory[MAX_PATH_LENGTH];
     bool multiprocessing;
+    size_t max_memory;       // Memory budget for image data in MB
+    bool direct_io;          // Read FITS data past the page cache
 } General;
 
+// Axis order of the optional spectral-major copy of the data (CARTA naming)
+typedef enum {
+    SWIZZLE_NONE,            // No copy
+    SWIZZLE_ZYX,             // [nx][ny][nz]
+    SWIZZLE_ZXY              // [ny][nx][nz]
+} SwizzleOrder;
+
+// Lossy storage of floating-point cubes
+typedef enum {
+    QUANTISE_NONE,           // Values as they are
+    QUANTISE_ROUND,          // Rounded relative to the channel RMS, then compressed
+    QUANTISE_FLOAT16         // Half precision, then compressed
+} QuantiseMode;
+
+// Lossless compression of DATA
+typedef enum {
+    COMPRESSION_NONE,        // Contiguous, or chunked without filters
+    COMPRESSION_DEFLATE,     // Shuffle and deflate, compressed by the converter on all threads
+    COMPRESSION_ZSTD         // Shuffle and Zstd (filter 32015), in a build with make ZSTD=1
+} CompressionMode;
+
+// File-space layout of the output, tuned to the file system it is written to
+typedef enum {
+    FS_PROFILE_NONE,         // HDF5 defaults
+    FS_PROFILE_LOCAL,        // Paged, small pages, for local disks and SSDs
+    FS_PROFILE_LUSTRE,       // Paged, pages and allocations aligned to the Lustre stripe size
+    FS_PROFILE_GPFS          // Paged, pages and allocations aligned to the GPFS block size
+} FsProfile;
+
+// ----------------------------------------------------------------- //
+// Class 'Hdf5Options'                                               //
+// ----------------------------------------------------------------- //
+// Structure to hold settings for the HDF5 output file               //
+// ----------------------------------------------------------------- //
+
+typedef CLASS Hdf5Options {
+    bool dense_attributes;   // Store header attributes in dense (B-tree) storage from the start
+    bool statistics;         // Write per-channel and cube statistics (CARTA schema)
+    bool mipmaps;            // Write mean-binned downsampled planes (CARTA schema)
+    bool resume;             // Continue an interrupted conversion into an existing file
+    bool incremental;        // Only rewrite products whose input changed since the last run
+    bool checksums;          // Verify FITS checksums, hash the data and use Fletcher32 on chunks
+    bool sparse;             // Chunked data sets without chunks that hold only the fill value
+    bool external;           // Refer to the image data in the FITS files instead of copying them
+    bool detections;         // Store only the chunks near the detections (implies sparse)
+    double detection_margin; // Pixels around each detection that are kept
+    SwizzleOrder swizzle;    // Write a transposed copy for fast spectrum access
+    QuantiseMode quantise;   // Reduce the precision of the cube
+    int quantise_bits;       // Bits kept below the channel RMS with QUANTISE_ROUND
+    CompressionMode compression;  // Compress DATA chunk by chunk
+    int compression_level;   // Level of the compressor; -1 for its default
+    FsProfile fs_profile;    // File-space strategy, page buffer and alignment of the file
+    size_t in_memory;        // Build the file in memory if it is estimated at up to this many MB; 0 = never
+} Hdf5Options;
+
 // ----------------------------------------------------------------- //
 // Class 'Config'                                                    //
 // ----------------------------------------------------------------- //
@@ -52,8 +109,17 @@ typedef CLASS Config {
     bool print_examples;
     char sofia_catalog[MAX_PATH_LENGTH];
     char sofia_input[MAX_PATH_LENGTH];
+    char hdf5_input[MAX_PATH_LENGTH];     // HDF5 file to convert back to FITS
+    char input_data[MAX_PATH_LENGTH];     // Replaces input.data of the parameter file; "-" is stdin
     char configuration_file[MAX_PATH_LENGTH];
+    char *mosaic;                         // Comma-separated parameter files of tile runs; NULL if none
+    char mosaic_output[MAX_PATH_LENGTH];  // HDF5 file of the mosaic
+    double mosaic_match_radius;           // Pixels within which tile sources are the same
+    double mosaic_match_channels;         // Channels within which tile sources are the same
+    char region[MAX_STRING_LENGTH];       // Part of the cube to convert (x0:x1,y0:y1,z0:z1 or "catalog"); "" for all
+    double region_margin;                 // Pixels added around the sources with region=catalog
     General general;
+    Hdf5Options hdf5;
 } Config;
 
 // Constructor and destructor
@@ -63,8 +129,11 @@ PUBLIC void Config_delete(Config *self);
 // Public methods
 PUBLIC Config *setup_config(int argc, char **argv);
 PUBLIC void Config_set_defaults(Config *self);
+PUBLIC void Hdf5Options_set_defaults(Hdf5Options *self);
+PUBLIC bool Hdf5Options_parse(Hdf5Options *self, const char *arg);
 PUBLIC void Config_print_help(void);
 PUBLIC void Config_print_version(void);
 PUBLIC bool Config_parse_args(Config *self, int argc, char **argv);
+PUBLIC bool Config_parse_bool(const char *value);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,214 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (detections.c) - SoFiA to HDF5 Converter                  //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "detections.h"
+#include <math.h>
+
+PRIVATE void DetectionMap_mark(unsigned char *keep, const DetectionMap *self, const size_t x0, const size_t x1, const size_t y0, const size_t y1);
+
+// ----------------------------------------------------------------- //
+// Constructor and destructor                                        //
+// ----------------------------------------------------------------- //
+
+// Empty map of an image stored in chunks of chunk_nx by chunk_ny pixels
+DetectionMap *DetectionMap_new(const FitsFile *fits, const size_t chunk_nx, const size_t chunk_ny)
+{
+    check_null(fits);
+    if (chunk_nx == 0 || chunk_ny == 0) error_exit("Chunks of a detection map must not be empty.");
+    
+    DetectionMap *self = memory_alloc(sizeof(DetectionMap));
+    self->nx = fits->nx;
+    self->ny = fits->ny;
+    self->nz = fits->nz;
+    self->nw = fits->nw;
+    self->chunk_nx = chunk_nx;
+    self->chunk_ny = chunk_ny;
+    self->chunks_x = (self->nx + chunk_nx - 1) / chunk_nx;
+    self->chunks_y = (self->ny + chunk_ny - 1) / chunk_ny;
+    
+    const size_t size = self->nz * self->chunks_x * self->chunks_y;
+    self->keep = memory_alloc(size > 0 ? size : 1);
+    memset(self->keep, 0, size);
+    
+    return self;
+}
+
+void DetectionMap_delete(DetectionMap *self)
+{
+    if (self != NULL) {
+        memory_free(self->keep);
+        memory_free(self);
+    }
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Public methods                                                    //
+// ----------------------------------------------------------------- //
+
+// Mark the chunks meeting the box from 'lower' to 'upper' (x, y, z in pixels, both
+// included); the parts of the box outside the image are ignored
+void DetectionMap_add_box(DetectionMap *self, const double *lower, const double *upper)
+{
+    check_null(self);
+    
+    const double size[3] = {(double)self->nx, (double)self->ny, (double)self->nz};
+    size_t first[3];
+    size_t last[3];
+    
+    for (int axis = 0; axis < 3; axis++) {
+        const double a = floor(lower[axis]);
+        const double b = ceil(upper[axis]);
+        if (isnan(a) || isnan(b) || b < 0.0 || a > size[axis] - 1.0 || b < a) return;
+        first[axis] = a > 0.0 ? (size_t)a : 0;
+        last[axis] = b < size[axis] - 1.0 ? (size_t)b : (size_t)size[axis] - 1;
+    }
+    
+    for (size_t z = first[2]; z <= last[2]; z++) {
+        DetectionMap_mark(self->keep + z * self->chunks_x * self->chunks_y, self, first[0], last[0], first[1], last[1]);
+    }
+    
+    return;
+}
+
+// Mark the bounding boxes of all sources, grown by 'margin' pixels on every side.
+// Sources without a bounding box are taken at their centroid.
+void DetectionMap_add_catalog(DetectionMap *self, const SofiaCatalog *catalog, const double margin)
+{
+    check_null(self);
+    check_null(catalog);
+    
+    for (size_t i = 0; i < catalog->size; i++) {
+        const CatalogSource *source = &catalog->sources[i];
+        const double low[3] = {source->x_min, source->y_min, source->z_min};
+        const double high[3] = {source->x_max, source->y_max, source->z_max};
+        const double centre[3] = {source->x, source->y, source->z};
+        double lower[3];
+        double upper[3];
+        
+        for (int axis = 0; axis < 3; axis++) {
+            const bool box = (high[axis] >= low[axis]);
+            lower[axis] = (box ? low[axis] : centre[axis]) - margin;
+            upper[axis] = (box ? high[axis] : centre[axis]) + margin;
+        }
+        
+        DetectionMap_add_box(self, lower, upper);
+    }
+    
+    return;
+}
+
+// Mark every non-zero voxel of a mask of the same shape, grown by 'margin' pixels.
+// The mask is read once, in slabs of at most 'max_memory' bytes.
+void DetectionMap_add_mask(DetectionMap *self, FitsFile *mask, const double margin, const size_t max_memory)
+{
+    check_null(self);
+    check_null(mask);
+    
+    if (mask->nx != self->nx || mask->ny != self->ny || mask->nz != self->nz) {
+        error_exit("Mask differs in shape from the image of the detection map.");
+    }
+    
+    const size_t grow = margin > 0.0 ? (size_t)ceil(margin) : 0;
+    const size_t per_plane = self->chunks_x * self->chunks_y;
+    const size_t n_planes = FitsFile_get_plane_count(mask);
+    const size_t plane_bytes = FitsFile_get_plane_bytes(mask);
+    const size_t word_size = mask->word_size;
+    
+    size_t slab_planes = max_memory / plane_bytes;
+    if (slab_planes < 1) slab_planes = 1;
+    if (slab_planes > n_planes) slab_planes = n_planes;
+    
+    void *buffer = mask->data == NULL ? memory_alloc(slab_planes * plane_bytes) : NULL;
+    unsigned char *hit = memory_alloc(per_plane);
+    
+    for (size_t first = 0; first < n_planes; first += slab_planes) {
+        const size_t count = n_planes - first < slab_planes ? n_planes - first : slab_planes;
+        const unsigned char *slab = FitsFile_get_planes(mask, first, count, buffer);
+        
+        for (size_t i = 0; i < count; i++) {
+            const unsigned char *plane = slab + i * plane_bytes;
+            bool any = false;
+            memset(hit, 0, per_plane);
+            
+            // Chunks within 'grow' pixels of a non-zero voxel of this plane
+            for (size_t y = 0; y < self->ny; y++) {
+                const unsigned char *row = plane + y * self->nx * word_size;
+                for (size_t x = 0; x < self->nx; x++) {
+                    const unsigned char *value = row + x * word_size;
+                    bool set = false;
+                    for (size_t b = 0; b < word_size; b++) set |= (value[b] != 0);
+                    if (!set) continue;
+                    
+                    const size_t x0 = x > grow ? x - grow : 0;
+                    const size_t y0 = y > grow ? y - grow : 0;
+                    const size_t x1 = x + grow < self->nx ? x + grow : self->nx - 1;
+                    const size_t y1 = y + grow < self->ny ? y + grow : self->ny - 1;
+                    DetectionMap_mark(hit, self, x0, x1, y0, y1);
+                    any = true;
+                }
+            }
+            
+            if (!any) continue;
+            
+            // ... and in the channels within 'grow' of it
+            const size_t z = (first + i) % self->nz;
+            const size_t z0 = z > grow ? z - grow : 0;
+            const size_t z1 = z + grow < self->nz ? z + grow : self->nz - 1;
+            for (size_t zz = z0; zz <= z1; zz++) {
+                unsigned char *keep = self->keep + zz * per_plane;
+                for (size_t c = 0; c < per_plane; c++) keep[c] |= hit[c];
+            }
+        }
+    }
+    
+    FitsFile_close(mask);
+    memory_free(buffer);
+    memory_free(hit);
+    
+    return;
+}
+
+// Whether the map applies to an image of this shape stored in these chunks
+bool DetectionMap_matches(const DetectionMap *self, const FitsFile *fits, const size_t chunk_nx, const size_t chunk_ny)
+{
+    check_null(self);
+    check_null(fits);
+    
+    return fits->nx == self->nx && fits->ny == self->ny && fits->nz == self->nz && fits->nw == self->nw
+        && chunk_nx == self->chunk_nx && chunk_ny == self->chunk_ny;
+}
+
+// Marks of the chunks of a plane (indexed over nz * nw), row by row
+const unsigned char *DetectionMap_plane(const DetectionMap *self, const size_t plane)
+{
+    check_null(self);
+    return self->keep + (plane % self->nz) * self->chunks_x * self->chunks_y;
+}
+
+// Number of marked chunks over all planes
+size_t DetectionMap_count(const DetectionMap *self)
+{
+    check_null(self);
+    
+    size_t count = 0;
+    for (size_t i = 0; i < self->nz * self->chunks_x * self->chunks_y; i++) count += self->keep[i];
+    
+    return count * self->nw;
+}
+
+// ----------------------------------------------------------------- //
+// Private methods                                                   //
+// ----------------------------------------------------------------- //
+
+// Mark the chunks of one plane that meet pixels x0..x1, y0..y1 (both included)
+void DetectionMap_mark(unsigned char *keep, const DetectionMap *self, const size_t x0, const size_t x1, const size_t y0, const size_t y1)
+{
+    for (size_t cy = y0 / self->chunk_ny; cy <= y1 / self->chunk_ny; cy++) {
+        for (size_t cx = x0 / self->chunk_nx; cx <= x1 / self->chunk_nx; cx++) keep[cy * self->chunks_x + cx] = 1;
+    }
+    return;
+}
@@ -0,0 +1,63 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (detections.h) - SoFiA to HDF5 Converter                  //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+/// @file   detections.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Chunks of an image that lie near the detections (header).
+
+#ifndef DETECTIONS_H
+#define DETECTIONS_H
+
+#include <stdbool.h>
+#include "common.h"
+#include "reader.h"
+
+// ----------------------------------------------------------------- //
+// Class 'DetectionMap'                                              //
+// ----------------------------------------------------------------- //
+// Marks, per plane, the chunks of a chunked image (chunk_nx by      //
+// chunk_ny pixels of one plane) that intersect a detection grown    //
+// by a margin: the bounding boxes of catalogue sources, or the      //
+// non-zero voxels of a mask. Only these chunks need to be stored    //
+// to keep every detection together with its surroundings.           //
+// Stokes planes share the marks of their channel.                   //
+// ----------------------------------------------------------------- //
+
+typedef CLASS DetectionMap {
+    size_t nx, ny, nz, nw;    // Shape of the image
+    size_t chunk_nx, chunk_ny;
+    size_t chunks_x, chunks_y;
+    unsigned char *keep;      // Per channel (nz) and chunk: near a detection
+} DetectionMap;
+
+// Constructor and destructor
+PUBLIC DetectionMap *DetectionMap_new(const FitsFile *fits, const size_t chunk_nx, const size_t chunk_ny);
+PUBLIC void DetectionMap_delete(DetectionMap *self);
+
+// Public methods
+PUBLIC void DetectionMap_add_box(DetectionMap *self, const double *lower, const double *upper);
+PUBLIC void DetectionMap_add_catalog(DetectionMap *self, const SofiaCatalog *catalog, const double margin);
+PUBLIC void DetectionMap_add_mask(DetectionMap *self, FitsFile *mask, const double margin, const size_t max_memory);
+PUBLIC bool DetectionMap_matches(const DetectionMap *self, const FitsFile *fits, const size_t chunk_nx, const size_t chunk_ny);
+PUBLIC const unsigned char *DetectionMap_plane(const DetectionMap *self, const size_t plane);
+PUBLIC size_t DetectionMap_count(const DetectionMap *self);
+
+#endif
@@ -0,0 +1,153 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (distributed.c) - SoFiA to HDF5 Converter                //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "distributed.h"
+
+#ifdef SOFIA2HDF5_MPI
+#include <mpi.h>
+
+#ifndef H5_HAVE_PARALLEL
+#error "make MPI=1 needs an HDF5 library built with parallel (MPI-IO) support."
+#endif
+#endif
+
+// ----------------------------------------------------------------- //
+// Public functions                                                  //
+// ----------------------------------------------------------------- //
+
+void distributed_init(int *argc, char ***argv)
+{
+#ifdef SOFIA2HDF5_MPI
+    MPI_Init(argc, argv);
+#else
+    (void)argc;
+    (void)argv;
+#endif
+    return;
+}
+
+void distributed_finalise(void)
+{
+#ifdef SOFIA2HDF5_MPI
+    MPI_Finalize();
+#endif
+    return;
+}
+
+int distributed_rank(void)
+{
+    int rank = 0;
+#ifdef SOFIA2HDF5_MPI
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#endif
+    return rank;
+}
+
+int distributed_size(void)
+{
+    int size = 1;
+#ifdef SOFIA2HDF5_MPI
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+#endif
+    return size;
+}
+
+void distributed_barrier(void)
+{
+#ifdef SOFIA2HDF5_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+#endif
+    return;
+}
+
+// Contiguous, balanced ranges in rank order
+void distributed_range(const size_t count, size_t *first, size_t *last)
+{
+    const size_t rank = (size_t)distributed_rank();
+    const size_t size = (size_t)distributed_size();
+    
+    *first = rank * count / size;
+    *last = (rank + 1) * count / size;
+    return;
+}
+
+bool distributed_any(const bool flag)
+{
+#ifdef SOFIA2HDF5_MPI
+    int local = flag ? 1 : 0;
+    int global = 0;
+    MPI_Allreduce(&local, &global, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+    return global != 0;
+#else
+    return flag;
+#endif
+}
+
+void distributed_gather(void *array, const size_t item_size, const size_t count)
+{
+#ifdef SOFIA2HDF5_MPI
+    const int size = distributed_size();
+    if (size == 1 || count == 0) return;
+    
+    if (count > (size_t)2147483647) error_exit("Too many items to gather across MPI ranks.");
+    
+    int *counts = memory_alloc(size * sizeof(int));
+    int *offsets = memory_alloc(size * sizeof(int));
+    for (int r = 0; r < size; r++) {
+        offsets[r] = (int)((size_t)r * count / size);
+        counts[r] = (int)((size_t)(r + 1) * count / size) - offsets[r];
+    }
+    
+    MPI_Datatype item;
+    MPI_Type_contiguous((int)item_size, MPI_BYTE, &item);
+    MPI_Type_commit(&item);
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, array, counts, offsets, item, MPI_COMM_WORLD);
+    MPI_Type_free(&item);
+    
+    memory_free(counts);
+    memory_free(offsets);
+#else
+    (void)array;
+    (void)item_size;
+    (void)count;
+#endif
+    return;
+}
+
+void distributed_sum(int64_t *array, const size_t count)
+{
+#ifdef SOFIA2HDF5_MPI
+    if (distributed_size() == 1 || count == 0) return;
+    
+    if (count > (size_t)2147483647) error_exit("Too many items to add up across MPI ranks.");
+    MPI_Allreduce(MPI_IN_PLACE, array, (int)count, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+#else
+    (void)array;
+    (void)count;
+#endif
+    return;
+}
+
+hid_t distributed_file_access(void)
+{
+    hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+#ifdef SOFIA2HDF5_MPI
+    H5Pset_fapl_mpio(fapl, MPI_COMM_WORLD, MPI_INFO_NULL);
+    
+    // Metadata are written once, by rank 0, instead of by every rank
+    H5Pset_coll_metadata_write(fapl, true);
+#endif
+    return fapl;
+}
+
+hid_t distributed_transfer(void)
+{
+    hid_t dxpl = H5Pcreate(H5P_DATASET_XFER);
+#ifdef SOFIA2HDF5_MPI
+    H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE);
+#endif
+    return dxpl;
+}
@@ -0,0 +1,68 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (distributed.h) - SoFiA to HDF5 Converter                //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+/// @file   distributed.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  MPI helpers for writing one HDF5 file from several ranks (header).
+
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hdf5.h>
+#include "common.h"
+
+// ----------------------------------------------------------------- //
+// Distributed writing                                               //
+// ----------------------------------------------------------------- //
+// Built with SOFIA2HDF5_MPI (make MPI=1), every rank of the job     //
+// converts its own range of planes and writes it to the shared      //
+// file through MPI-IO. All HDF5 calls that change the file layout   //
+// must then be made by all ranks with the same arguments. Without   //
+// MPI these functions describe a single rank that does all work,    //
+// so callers need no conditional code.                              //
+// ----------------------------------------------------------------- //
+
+PUBLIC void distributed_init(int *argc, char ***argv);
+PUBLIC void distributed_finalise(void);
+PUBLIC int distributed_rank(void);
+PUBLIC int distributed_size(void);
+PUBLIC void distributed_barrier(void);
+
+// Planes [first, last) of 'count' that belong to this rank
+PUBLIC void distributed_range(const size_t count, size_t *first, size_t *last);
+
+// Whether 'flag' is set on any rank
+PUBLIC bool distributed_any(const bool flag);
+
+// Fill in the items of an array of 'count' items, each 'item_size' bytes, that other
+// ranks computed for their distributed_range(); afterwards all ranks hold all items
+PUBLIC void distributed_gather(void *array, const size_t item_size, const size_t count);
+
+// Add up an array of 'count' counters over all ranks; afterwards all ranks hold the totals
+PUBLIC void distributed_sum(int64_t *array, const size_t count);
+
+// Property lists for opening files and for writing raw data (close after use)
+PUBLIC hid_t distributed_file_access(void);
+PUBLIC hid_t distributed_transfer(void);
+
+#endif
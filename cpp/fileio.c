@@ -0,0 +1,538 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (fileio.c) - SoFiA to HDF5 Converter                     //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+// Needed for O_DIRECT, pread() and posix_fadvise() with -std=c99
+#define _GNU_SOURCE
+
+#include "fileio.h"
+#include "parallel.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef SOFIA2HDF5_URING
+// The kernel interface is used directly, so that no liburing is needed
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+// One read request split into pieces for the threads
+typedef CLASS ReadTask {
+    FileReader *reader;
+    unsigned char *buffer;
+    size_t size;
+    size_t offset;
+    size_t block_size;    // Strided reads: bytes per block
+    size_t stride;        // Strided reads: distance between blocks in the file
+    size_t n_blocks;      // Strided reads: number of blocks
+    size_t group;         // Strided reads: blocks per piece
+    bool failed;          // Only ever set to true, so concurrent writes agree
+} ReadTask;
+
+#ifdef SOFIA2HDF5_URING
+// One read in flight on the ring
+typedef CLASS RingSlot {
+    unsigned char *target;   // Where the bytes go
+    size_t size;             // Bytes wanted
+    size_t lead;             // Bytes read before the wanted ones (direct I/O alignment)
+    size_t start;            // File offset the read starts at
+    size_t length;           // Bytes to read from 'start'
+    size_t done;             // Bytes read so far
+    unsigned char *bounce;   // Aligned buffer for direct I/O, else NULL
+    struct iovec iov;
+} RingSlot;
+
+// Submission and completion queues shared with the kernel
+typedef CLASS FileRing {
+    int fd;
+    unsigned int depth;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    size_t sqes_size;
+    RingSlot *slots;
+    unsigned int *free_slots;
+    unsigned int n_free;
+} FileRing;
+
+PRIVATE FileRing *FileRing_new(const bool direct);
+PRIVATE void FileRing_delete(FileRing *self);
+PRIVATE bool FileRing_read(FileRing *self, const FileReader *reader, unsigned char *buffer, const size_t block_size, const size_t n_blocks, const size_t offset, const size_t stride);
+PRIVATE void FileRing_queue(FileRing *self, const int fd, const unsigned int index);
+#endif
+
+// Private methods
+PRIVATE void FileReader_read_piece(const size_t index, void *context);
+PRIVATE void FileReader_read_block_piece(const size_t index, void *context);
+PRIVATE bool FileReader_read_range(const FileReader *self, void *buffer, const size_t size, const size_t offset, void *bounce);
+PRIVATE size_t pread_full(const int fd, void *buffer, const size_t size, const size_t offset);
+
+// ----------------------------------------------------------------- //
+// Constructor and destructor                                        //
+// ----------------------------------------------------------------- //
+
+FileReader *FileReader_open(const char *filename, const int n_threads, const bool direct)
+{
+    check_null(filename);
+    
+    FileReader *self = memory_alloc(sizeof(FileReader));
+    self->fd = -1;
+    self->n_threads = n_threads > 0 ? n_threads : 1;
+    self->direct = false;
+    self->drop_cache = false;
+    self->ring = NULL;
+    strncpy(self->filename, filename, MAX_PATH_LENGTH - 1);
+    self->filename[MAX_PATH_LENGTH - 1] = '\0';
+    
+    if (direct) {
+#if defined(O_DIRECT)
+        self->fd = open(filename, O_RDONLY | O_DIRECT);
+        self->direct = (self->fd >= 0);
+#elif defined(F_NOCACHE)
+        self->fd = open(filename, O_RDONLY);
+        self->direct = (self->fd >= 0 && fcntl(self->fd, F_NOCACHE, 1) != -1);
+#endif
+        if (!self->direct) {
+            if (self->fd >= 0) close(self->fd);
+            self->fd = -1;
+            self->drop_cache = true;
+            printf("Note: Direct I/O is not available for %s; cached pages are dropped after reading instead.\n", filename);
+        }
+    }
+    
+    if (self->fd < 0) self->fd = open(filename, O_RDONLY);
+    if (self->fd < 0) {
+        char error_msg[MAX_PATH_LENGTH + 100];
+        snprintf(error_msg, sizeof(error_msg), "Failed to open FITS file: %s", filename);
+        error_exit(error_msg);
+    }
+    
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (!self->direct) posix_fadvise(self->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    
+#ifdef SOFIA2HDF5_URING
+    // Disabled in many containers (seccomp, kernel.io_uring_disabled)
+    self->ring = FileRing_new(self->direct);
+    if (self->ring == NULL) printf("Note: io_uring is not available for %s; reading from %d thread(s) instead.\n", filename, self->n_threads);
+#endif
+    
+    return self;
+}
+
+void FileReader_close(FileReader *self)
+{
+    if (self != NULL) {
+#ifdef SOFIA2HDF5_URING
+        FileRing_delete(self->ring);
+#endif
+        if (self->fd >= 0) close(self->fd);
+        memory_free(self);
+    }
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Public methods                                                    //
+// ----------------------------------------------------------------- //
+
+// Read 'size' bytes at 'offset' into 'buffer'; the range must lie within the file
+void FileReader_read(FileReader *self, void *buffer, const size_t size, const size_t offset)
+{
+    check_null(self);
+    check_null(buffer);
+    
+    if (size == 0) return;
+    
+#ifdef SOFIA2HDF5_URING
+    if (self->ring != NULL) {
+        FileReader_read_blocks(self, buffer, size, 1, offset, size);
+        return;
+    }
+#endif
+    
+    ReadTask task;
+    task.reader = self;
+    task.buffer = buffer;
+    task.size = size;
+    task.offset = offset;
+    task.failed = false;
+    
+    const size_t n_pieces = (size + FILEIO_PIECE_SIZE - 1) / FILEIO_PIECE_SIZE;
+    parallel_for(n_pieces, self->n_threads, FileReader_read_piece, &task);
+    
+    if (task.failed) {
+        char error_msg[MAX_PATH_LENGTH + 100];
+        snprintf(error_msg, sizeof(error_msg), "Failed to read FITS data from %s.", self->filename);
+        error_exit(error_msg);
+    }
+    
+#ifdef POSIX_FADV_DONTNEED
+    if (self->drop_cache) posix_fadvise(self->fd, (off_t)offset, (off_t)size, POSIX_FADV_DONTNEED);
+#endif
+    
+    return;
+}
+
+// Read 'n_blocks' blocks of 'block_size' bytes, the first at 'offset' and each
+// following one 'stride' bytes further, packed one after the other into 'buffer',
+// e.g. the rows of a region of an image. The gaps between the blocks are not read.
+void FileReader_read_blocks(FileReader *self, void *buffer, const size_t block_size, const size_t n_blocks, const size_t offset, const size_t stride)
+{
+    check_null(self);
+    check_null(buffer);
+    
+    if (block_size == 0 || n_blocks == 0) return;
+    
+#ifdef SOFIA2HDF5_URING
+    if (self->ring != NULL) {
+        const bool contiguous = (n_blocks == 1 || stride == block_size);
+        if (!FileRing_read(self->ring, self, buffer, contiguous ? block_size * n_blocks : block_size, contiguous ? 1 : n_blocks, offset, stride)) {
+            char error_msg[MAX_PATH_LENGTH + 100];
+            snprintf(error_msg, sizeof(error_msg), "Failed to read FITS data from %s.", self->filename);
+            error_exit(error_msg);
+        }
+#ifdef POSIX_FADV_DONTNEED
+        if (self->drop_cache) posix_fadvise(self->fd, (off_t)offset, (off_t)((n_blocks - 1) * stride + block_size), POSIX_FADV_DONTNEED);
+#endif
+        return;
+    }
+#endif
+    
+    if (n_blocks == 1 || stride == block_size) {
+        FileReader_read(self, buffer, block_size * n_blocks, offset);
+        return;
+    }
+    
+    ReadTask task;
+    task.reader = self;
+    task.buffer = buffer;
+    task.size = block_size * n_blocks;
+    task.offset = offset;
+    task.block_size = block_size;
+    task.stride = stride;
+    task.n_blocks = n_blocks;
+    task.failed = false;
+    
+    // Pieces of up to FILEIO_PIECE_SIZE bytes, but enough of them to keep all threads busy
+    const size_t per_thread = (n_blocks + (size_t)self->n_threads - 1) / (size_t)self->n_threads;
+    task.group = FILEIO_PIECE_SIZE / block_size;
+    if (task.group > per_thread) task.group = per_thread;
+    if (task.group == 0) task.group = 1;
+    
+    const size_t n_pieces = (n_blocks + task.group - 1) / task.group;
+    parallel_for(n_pieces, self->n_threads, FileReader_read_block_piece, &task);
+    
+    if (task.failed) {
+        char error_msg[MAX_PATH_LENGTH + 100];
+        snprintf(error_msg, sizeof(error_msg), "Failed to read FITS data from %s.", self->filename);
+        error_exit(error_msg);
+    }
+    
+#ifdef POSIX_FADV_DONTNEED
+    if (self->drop_cache) posix_fadvise(self->fd, (off_t)offset, (off_t)((n_blocks - 1) * stride + block_size), POSIX_FADV_DONTNEED);
+#endif
+    
+    return;
+}
+
+// Ask the kernel to start reading a range that will be needed next
+void FileReader_prefetch(FileReader *self, const size_t size, const size_t offset)
+{
+    check_null(self);
+    
+#ifdef POSIX_FADV_WILLNEED
+    if (!self->direct && size > 0) posix_fadvise(self->fd, (off_t)offset, (off_t)size, POSIX_FADV_WILLNEED);
+#else
+    (void)size;
+    (void)offset;
+#endif
+    
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Private methods                                                   //
+// ----------------------------------------------------------------- //
+
+// Read one piece of a contiguous range
+void FileReader_read_piece(const size_t index, void *context)
+{
+    ReadTask *task = (ReadTask *)context;
+    const size_t start = index * FILEIO_PIECE_SIZE;
+    const size_t size = task->size - start < FILEIO_PIECE_SIZE ? task->size - start : FILEIO_PIECE_SIZE;
+    
+    void *bounce = NULL;
+    if (task->reader->direct && posix_memalign(&bounce, FILEIO_ALIGNMENT, size + 2 * FILEIO_ALIGNMENT) != 0) {
+        task->failed = true;
+        return;
+    }
+    
+    if (!FileReader_read_range(task->reader, task->buffer + start, size, task->offset + start, bounce)) task->failed = true;
+    
+    free(bounce);
+    return;
+}
+
+// Read one group of blocks of a strided read
+void FileReader_read_block_piece(const size_t index, void *context)
+{
+    ReadTask *task = (ReadTask *)context;
+    const size_t first = index * task->group;
+    const size_t last = first + task->group < task->n_blocks ? first + task->group : task->n_blocks;
+    
+    void *bounce = NULL;
+    if (task->reader->direct && posix_memalign(&bounce, FILEIO_ALIGNMENT, task->block_size + 2 * FILEIO_ALIGNMENT) != 0) {
+        task->failed = true;
+        return;
+    }
+    
+    for (size_t i = first; i < last && !task->failed; i++) {
+        if (!FileReader_read_range(task->reader, task->buffer + i * task->block_size, task->block_size, task->offset + i * task->stride, bounce)) {
+            task->failed = true;
+        }
+    }
+    
+    free(bounce);
+    return;
+}
+
+// Read one range. Direct I/O needs aligned offsets, sizes and memory, so the range
+// is widened to the alignment and read into 'bounce' (size + 2 * FILEIO_ALIGNMENT
+// bytes, aligned); 'bounce' is not used otherwise.
+bool FileReader_read_range(const FileReader *self, void *buffer, const size_t size, const size_t offset, void *bounce)
+{
+    if (!self->direct) return pread_full(self->fd, buffer, size, offset) == size;
+    
+    const size_t aligned_offset = offset / FILEIO_ALIGNMENT * FILEIO_ALIGNMENT;
+    const size_t aligned_end = (offset + size + FILEIO_ALIGNMENT - 1) / FILEIO_ALIGNMENT * FILEIO_ALIGNMENT;
+    const size_t lead = offset - aligned_offset;
+    
+    // The last block may end early at the end of the file
+    if (pread_full(self->fd, bounce, aligned_end - aligned_offset, aligned_offset) < lead + size) return false;
+    
+    memcpy(buffer, (unsigned char *)bounce + lead, size);
+    return true;
+}
+
+// pread() until 'size' bytes or the end of the file; returns the bytes read
+size_t pread_full(const int fd, void *buffer, const size_t size, const size_t offset)
+{
+    size_t done = 0;
+    
+    while (done < size) {
+        const ssize_t n = pread(fd, (unsigned char *)buffer + done, size - done, (off_t)(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    
+    return done;
+}
+
+#ifdef SOFIA2HDF5_URING
+
+// ----------------------------------------------------------------- //
+// io_uring reads (make URING=1)                                     //
+// ----------------------------------------------------------------- //
+// One thread keeps FILEIO_RING_DEPTH reads in flight: free slots    //
+// are filled with the next pieces, submitted with a single system   //
+// call, and each completion frees its slot for the next piece.      //
+// ----------------------------------------------------------------- //
+
+// Set up a ring with its slots; NULL if the kernel does not allow io_uring
+FileRing *FileRing_new(const bool direct)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    
+    const int fd = (int)syscall(__NR_io_uring_setup, FILEIO_RING_DEPTH, &params);
+    if (fd < 0) return NULL;
+    
+    FileRing *self = memory_alloc(sizeof(FileRing));
+    self->fd = fd;
+    self->depth = params.sq_entries;
+    self->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    self->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    self->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    
+    // Kernels since 5.4 map both rings at once
+    const bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_map && self->cq_map_size > self->sq_map_size) self->sq_map_size = self->cq_map_size;
+    
+    self->sq_map = mmap(NULL, self->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    self->cq_map = single_map ? self->sq_map : mmap(NULL, self->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    self->sqes = mmap(NULL, self->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    
+    if (self->sq_map == MAP_FAILED || self->cq_map == MAP_FAILED || self->sqes == MAP_FAILED) {
+        if (self->sqes != MAP_FAILED) munmap(self->sqes, self->sqes_size);
+        if (self->cq_map != MAP_FAILED && !single_map) munmap(self->cq_map, self->cq_map_size);
+        if (self->sq_map != MAP_FAILED) munmap(self->sq_map, self->sq_map_size);
+        close(fd);
+        memory_free(self);
+        return NULL;
+    }
+    
+    unsigned char *sq = self->sq_map;
+    unsigned char *cq = self->cq_map;
+    self->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    self->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    self->sq_array = (unsigned int *)(sq + params.sq_off.array);
+    self->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    self->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    self->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    self->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    
+    // One slot per submission queue entry, so the queue can never overflow
+    self->slots = memory_alloc(self->depth * sizeof(RingSlot));
+    self->free_slots = memory_alloc(self->depth * sizeof(unsigned int));
+    self->n_free = self->depth;
+    for (unsigned int i = 0; i < self->depth; i++) {
+        self->free_slots[i] = i;
+        self->slots[i].bounce = NULL;
+    }
+    
+    // Direct I/O reads aligned ranges into aligned buffers
+    for (unsigned int i = 0; direct && i < self->depth; i++) {
+        if (posix_memalign((void **)&self->slots[i].bounce, FILEIO_ALIGNMENT, FILEIO_RING_PIECE_SIZE + 2 * FILEIO_ALIGNMENT) != 0) {
+            self->slots[i].bounce = NULL;
+            FileRing_delete(self);
+            return NULL;
+        }
+    }
+    
+    return self;
+}
+
+void FileRing_delete(FileRing *self)
+{
+    if (self == NULL) return;
+    
+    for (unsigned int i = 0; i < self->depth; i++) free(self->slots[i].bounce);
+    memory_free(self->slots);
+    memory_free(self->free_slots);
+    munmap(self->sqes, self->sqes_size);
+    if (self->cq_map != self->sq_map) munmap(self->cq_map, self->cq_map_size);
+    munmap(self->sq_map, self->sq_map_size);
+    close(self->fd);
+    memory_free(self);
+    return;
+}
+
+// Read 'n_blocks' blocks as FileReader_read_blocks(), in pieces of at most
+// FILEIO_RING_PIECE_SIZE. Returns false if a read failed or ended early; all
+// reads have completed by then, so 'buffer' is no longer written to.
+bool FileRing_read(FileRing *self, const FileReader *reader, unsigned char *buffer, const size_t block_size, const size_t n_blocks, const size_t offset, const size_t stride)
+{
+    const size_t per_block = (block_size + FILEIO_RING_PIECE_SIZE - 1) / FILEIO_RING_PIECE_SIZE;
+    const size_t n_pieces = per_block * n_blocks;
+    size_t next = 0;
+    unsigned int in_flight = 0;
+    unsigned int to_submit = 0;
+    bool ok = true;
+    
+    while ((ok && next < n_pieces) || in_flight > 0) {
+        // Fill the free slots with the next pieces
+        while (ok && next < n_pieces && self->n_free > 0) {
+            const unsigned int index = self->free_slots[--self->n_free];
+            RingSlot *slot = &self->slots[index];
+            const size_t block = next / per_block;
+            const size_t start = (next % per_block) * FILEIO_RING_PIECE_SIZE;
+            const size_t piece_offset = offset + block * stride + start;
+            
+            slot->target = buffer + block * block_size + start;
+            slot->size = block_size - start < FILEIO_RING_PIECE_SIZE ? block_size - start : FILEIO_RING_PIECE_SIZE;
+            slot->start = reader->direct ? piece_offset / FILEIO_ALIGNMENT * FILEIO_ALIGNMENT : piece_offset;
+            slot->lead = piece_offset - slot->start;
+            slot->length = reader->direct ? (piece_offset + slot->size + FILEIO_ALIGNMENT - 1) / FILEIO_ALIGNMENT * FILEIO_ALIGNMENT - slot->start : slot->size;
+            slot->done = 0;
+            
+            FileRing_queue(self, reader->fd, index);
+            next++;
+            in_flight++;
+            to_submit++;
+        }
+        
+        // Submit and wait for at least one completion
+        const long submitted = syscall(__NR_io_uring_enter, self->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            error_exit("io_uring_enter() failed while reads were in flight.");
+        }
+        to_submit -= (unsigned int)submitted;
+        
+        // Collect the completions
+        unsigned int head = *self->cq_head;
+        const unsigned int tail = __atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE);
+        
+        while (head != tail) {
+            const struct io_uring_cqe *cqe = &self->cqes[head & *self->cq_mask];
+            const unsigned int index = (unsigned int)cqe->user_data;
+            const int result = cqe->res;
+            RingSlot *slot = &self->slots[index];
+            head++;
+            
+            // Interrupted or short reads continue where they stopped; with direct I/O
+            // the aligned range may run past the end of the file, which is fine
+            if (result == -EINTR || result == -EAGAIN || (result > 0 && slot->done + (size_t)result < slot->lead + slot->size)) {
+                if (result > 0) slot->done += (size_t)result;
+                FileRing_queue(self, reader->fd, index);
+                to_submit++;
+                continue;
+            }
+            
+            if (result > 0) slot->done += (size_t)result;
+            
+            if (result < 0 || slot->done < slot->lead + slot->size) ok = false;
+            else if (slot->bounce != NULL) memcpy(slot->target, slot->bounce + slot->lead, slot->size);
+            
+            self->free_slots[self->n_free++] = index;
+            in_flight--;
+        }
+        
+        __atomic_store_n(self->cq_head, head, __ATOMIC_RELEASE);
+    }
+    
+    return ok;
+}
+
+// Put the remainder of the read of slot 'index' on the submission queue
+void FileRing_queue(FileRing *self, const int fd, const unsigned int index)
+{
+    RingSlot *slot = &self->slots[index];
+    const unsigned int tail = *self->sq_tail;
+    const unsigned int position = tail & *self->sq_mask;
+    struct io_uring_sqe *sqe = &self->sqes[position];
+    
+    slot->iov.iov_base = (slot->bounce != NULL ? slot->bounce : slot->target) + slot->done;
+    slot->iov.iov_len = slot->length - slot->done;
+    
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->iov;
+    sqe->len = 1;
+    sqe->off = slot->start + slot->done;
+    sqe->user_data = index;
+    
+    self->sq_array[position] = position;
+    __atomic_store_n(self->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return;
+}
+
+#endif
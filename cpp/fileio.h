@@ -0,0 +1,69 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (fileio.h) - SoFiA to HDF5 Converter                     //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+/// @file   fileio.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Parallel positional reads of large files (header).
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <stdbool.h>
+#include "common.h"
+
+#define FILEIO_PIECE_SIZE (8 * 1024 * 1024)  ///< Bytes per read request.
+#define FILEIO_ALIGNMENT  4096               ///< Offset and size alignment for direct I/O.
+#define FILEIO_RING_DEPTH 32                 ///< Reads in flight with io_uring.
+#define FILEIO_RING_PIECE_SIZE (1024 * 1024) ///< Bytes per read request with io_uring.
+
+// ----------------------------------------------------------------- //
+// Class 'FileReader'                                                //
+// ----------------------------------------------------------------- //
+// Reads byte ranges of a file with pread(), split into pieces of    //
+// FILEIO_PIECE_SIZE that are issued from several threads at once,   //
+// so that fast storage sees many outstanding requests. Optionally   //
+// bypasses the page cache (O_DIRECT, F_NOCACHE on macOS) through    //
+// aligned bounce buffers, for inputs larger than memory; without    //
+// it, read-ahead of the next range is requested via fadvise.        //
+// A build with make URING=1 instead queues FILEIO_RING_DEPTH reads  //
+// of FILEIO_RING_PIECE_SIZE at a time on an io_uring from a single  //
+// thread, and falls back to the threads if the kernel refuses one.  //
+// ----------------------------------------------------------------- //
+
+typedef CLASS FileReader {
+    int fd;
+    int n_threads;        // Threads issuing reads
+    bool direct;          // Page cache is bypassed
+    bool drop_cache;      // Direct I/O was asked for but is unavailable: drop pages after reading
+    void *ring;           // io_uring queues (make URING=1), or NULL: reads are issued from threads
+    char filename[MAX_PATH_LENGTH];
+} FileReader;
+
+// Constructor and destructor
+PUBLIC FileReader *FileReader_open(const char *filename, const int n_threads, const bool direct);
+PUBLIC void FileReader_close(FileReader *self);
+
+// Public methods
+PUBLIC void FileReader_read(FileReader *self, void *buffer, const size_t size, const size_t offset);
+PUBLIC void FileReader_read_blocks(FileReader *self, void *buffer, const size_t block_size, const size_t n_blocks, const size_t offset, const size_t stride);
+PUBLIC void FileReader_prefetch(FileReader *self, const size_t size, const size_t offset);
+
+#endif
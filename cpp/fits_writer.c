@@ -0,0 +1,812 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (fits_writer.c) - SoFiA to HDF5 Converter                //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "fits_writer.h"
+#include "hdf5_writer.h"
+#include "compress.h"
+#include "reader.h"
+#include "utils.h"
+#include <stdlib.h>
+
+// Catalogue columns in the order of a SoFiA ASCII catalogue
+typedef CLASS CatalogColumn {
+    const char *name;
+    bool integer;
+} CatalogColumn;
+
+static const CatalogColumn catalog_columns[] = {
+    {"id", true}, {"x", false}, {"y", false}, {"z", false},
+    {"x_min", false}, {"x_max", false}, {"y_min", false}, {"y_max", false}, {"z_min", false}, {"z_max", false},
+    {"n_pix", true}, {"f_sum", false}, {"err_f_sum", false}, {"rms", false}, {"w50", false}, {"kin_pa", false},
+    {"err_x", false}, {"err_y", false}, {"err_z", false}, {"ra", false}, {"dec", false}, {"v_app", false}
+};
+#define CATALOG_COLUMN_COUNT (sizeof(catalog_columns) / sizeof(catalog_columns[0]))
+
+// Header cards collected while iterating over the attributes of a group
+typedef CLASS CardList {
+    char *cards;
+    size_t size;
+    size_t capacity;
+} CardList;
+
+PRIVATE char *CardList_add(CardList *self);
+PRIVATE void fits_format_card(char *card, const char *key, const char *value, const bool quoted);
+PRIVATE void fits_add_string_cards(CardList *list, const char *key, const char *value);
+PRIVATE herr_t fits_attribute_card(hid_t group_id, const char *name, const H5A_info_t *info, void *data);
+PRIVATE void fits_mandatory_card(CardList *list, const FitsHeader *shared, const char *raw, const size_t *offset, const char *key, const char *value, const bool quoted);
+PRIVATE bool fits_is_structural(const char *key);
+PRIVATE double fits_attribute_number(hid_t group_id, const char *name, const double fallback);
+PRIVATE bool fits_attribute_matches(hid_t group_id, const FitsCard *card);
+PRIVATE herr_t fits_added_card(hid_t group_id, const char *name, const H5A_info_t *info, void *data);
+PRIVATE herr_t fits_collect_hdu(hid_t group_id, const char *name, const H5L_info_t *info, void *data);
+PRIVATE size_t bounded_length(const char *str, const size_t max_length);
+PRIVATE int compare_int(const void *a, const void *b);
+PRIVATE void SofiaFITS_write_hdu(SofiaFITS *self, FILE *stream, hid_t group_id, const bool primary);
+PRIVATE char *SofiaFITS_build_header(hid_t group_id, hid_t dataset_id, const bool primary, size_t *n_cards);
+PRIVATE void SofiaFITS_write_data(SofiaFITS *self, FILE *stream, hid_t dataset_id, const int data_type);
+PRIVATE int fits_bitpix(hid_t datatype);
+PRIVATE void fits_write_padding(FILE *stream, const size_t size, const char fill);
+
+// ----------------------------------------------------------------- //
+// Constructor and destructor                                        //
+// ----------------------------------------------------------------- //
+
+SofiaFITS *SofiaFITS_new(const char *hdf5name, const char *directory)
+{
+    check_null(hdf5name);
+    check_null(directory);
+    
+    SofiaFITS *self = memory_alloc(sizeof(SofiaFITS));
+    
+    strncpy(self->hdf5name, hdf5name, MAX_PATH_LENGTH - 1);
+    self->hdf5name[MAX_PATH_LENGTH - 1] = '\0';
+    strncpy(self->directory, directory, MAX_PATH_LENGTH - 1);
+    self->directory[MAX_PATH_LENGTH - 1] = '\0';
+    self->max_memory = 1024 * (size_t)MEGABYTE;
+    compress_register_zstd();
+    
+    // Output files are named after the HDF5 file, as SoFiA names its products
+    const char *slash = strrchr(hdf5name, '/');
+    strncpy(self->name, slash != NULL ? slash + 1 : hdf5name, MAX_STRING_LENGTH - 1);
+    self->name[MAX_STRING_LENGTH - 1] = '\0';
+    char *dot = strrchr(self->name, '.');
+    if (dot != NULL && dot != self->name) *dot = '\0';
+    
+    self->file_id = H5Fopen(hdf5name, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (self->file_id < 0) {
+        char error_msg[MAX_PATH_LENGTH + 100];
+        snprintf(error_msg, sizeof(error_msg), "Cannot open HDF5 file: %s", hdf5name);
+        error_exit(error_msg);
+    }
+    
+    self->group_id = H5Gopen2(self->file_id, "/SoFiA", H5P_DEFAULT);
+    if (self->group_id < 0) {
+        error_exit("No SoFiA group found in HDF5 file");
+    }
+    
+    return self;
+}
+
+void SofiaFITS_delete(SofiaFITS *self)
+{
+    if (self != NULL) {
+        if (self->group_id >= 0) H5Gclose(self->group_id);
+        if (self->file_id >= 0) H5Fclose(self->file_id);
+        memory_free(self);
+    }
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Public methods                                                    //
+// ----------------------------------------------------------------- //
+
+void SofiaFITS_set_max_memory(SofiaFITS *self, const size_t max_memory)
+{
+    check_null(self);
+    
+    self->max_memory = max_memory;
+    return;
+}
+
+bool SofiaFITS_has_mask(const SofiaFITS *self)
+{
+    check_null(self);
+    
+    return H5Lexists(self->group_id, "Mask", H5P_DEFAULT) > 0;
+}
+
+bool SofiaFITS_has_catalog(const SofiaFITS *self)
+{
+    check_null(self);
+    
+    return H5Lexists(self->group_id, "Catalogue", H5P_DEFAULT) > 0;
+}
+
+// Write <name>.fits: the SoFiA group as primary HDU, HDU<n> groups as extensions
+void SofiaFITS_write_cube(SofiaFITS *self)
+{
+    check_null(self);
+    
+    char filename[MAX_STRING_LENGTH + 8];
+    snprintf(filename, sizeof(filename), "%s.fits", self->name);
+    char *path = format_path(self->directory, filename);
+    
+    FILE *stream = fopen(path, "wb");
+    if (stream == NULL) {
+        char error_msg[MAX_PATH_LENGTH + 100];
+        snprintf(error_msg, sizeof(error_msg), "Cannot create FITS file: %s", path);
+        error_exit(error_msg);
+    }
+    
+    printf("Writing FITS file '%s'.\n", path);
+    SofiaFITS_write_hdu(self, stream, self->group_id, true);
+    
+    // Extensions in their original order (link names sort HDU10 before HDU2)
+    int hdus[256];
+    size_t n_hdus = 0;
+    void *collect[2] = {hdus, &n_hdus};
+    H5Literate(self->group_id, H5_INDEX_NAME, H5_ITER_INC, NULL, fits_collect_hdu, collect);
+    qsort(hdus, n_hdus, sizeof(int), compare_int);
+    
+    for (size_t i = 0; i < n_hdus; i++) {
+        char group_name[32];
+        snprintf(group_name, sizeof(group_name), "HDU%d", hdus[i]);
+        hid_t hdu_group = H5Gopen2(self->group_id, group_name, H5P_DEFAULT);
+        SofiaFITS_write_hdu(self, stream, hdu_group, false);
+        H5Gclose(hdu_group);
+    }
+    
+    fclose(stream);
+    memory_free(path);
+    
+    return;
+}
+
+// Write <name>_mask.fits from the Mask group
+void SofiaFITS_write_mask(SofiaFITS *self)
+{
+    check_null(self);
+    
+    if (!SofiaFITS_has_mask(self)) return;
+    
+    char filename[MAX_STRING_LENGTH + 16];
+    snprintf(filename, sizeof(filename), "%s_mask.fits", self->name);
+    char *path = format_path(self->directory, filename);
+    
+    FILE *stream = fopen(path, "wb");
+    if (stream == NULL) {
+        char error_msg[MAX_PATH_LENGTH + 100];
+        snprintf(error_msg, sizeof(error_msg), "Cannot create FITS file: %s", path);
+        error_exit(error_msg);
+    }
+    
+    printf("Writing FITS file '%s'.\n", path);
+    hid_t mask_group = H5Gopen2(self->group_id, "Mask", H5P_DEFAULT);
+    SofiaFITS_write_hdu(self, stream, mask_group, true);
+    H5Gclose(mask_group);
+    
+    fclose(stream);
+    memory_free(path);
+    
+    return;
+}
+
+// Write <name>_cat.txt in the SoFiA ASCII format read by read_sofia_catalogue()
+void SofiaFITS_write_catalog(SofiaFITS *self)
+{
+    check_null(self);
+    
+    if (!SofiaFITS_has_catalog(self)) return;
+    
+    hid_t catalog_group = H5Gopen2(self->group_id, "Catalogue", H5P_DEFAULT);
+    
+    hid_t name_set = H5Dopen2(catalog_group, "name", H5P_DEFAULT);
+    if (name_set < 0) {
+        error_exit("Catalogue without source names in HDF5 file");
+    }
+    
+    hid_t name_space = H5Dget_space(name_set);
+    const size_t size = (size_t)H5Sget_simple_extent_npoints(name_space);
+    H5Sclose(name_space);
+    
+    hid_t name_type = H5Dget_type(name_set);
+    const size_t name_length = H5Tget_size(name_type);
+    char *names = memory_alloc(size * name_length + 1);
+    H5Dread(name_set, name_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, names);
+    H5Tclose(name_type);
+    H5Dclose(name_set);
+    
+    // Read the columns present in the group as double; only those are written
+    double *values = memory_alloc(size * CATALOG_COLUMN_COUNT * sizeof(double) + 1);
+    bool present[CATALOG_COLUMN_COUNT];
+    
+    for (size_t c = 0; c < CATALOG_COLUMN_COUNT; c++) {
+        present[c] = H5Lexists(catalog_group, catalog_columns[c].name, H5P_DEFAULT) > 0;
+        if (!present[c]) continue;
+        hid_t dataset_id = H5Dopen2(catalog_group, catalog_columns[c].name, H5P_DEFAULT);
+        H5Dread(dataset_id, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, values + c * size);
+        H5Dclose(dataset_id);
+    }
+    H5Gclose(catalog_group);
+    
+    // Names are quoted and padded to the longest one
+    size_t name_width = 4;
+    for (size_t i = 0; i < size; i++) {
+        const size_t length = bounded_length(names + i * name_length, name_length) + 2;
+        if (length > name_width) name_width = length;
+    }
+    
+    char filename[MAX_STRING_LENGTH + 16];
+    snprintf(filename, sizeof(filename), "%s_cat.txt", self->name);
+    char *path = format_path(self->directory, filename);
+    
+    FILE *stream = fopen(path, "w");
+    if (stream == NULL) {
+        char error_msg[MAX_PATH_LENGTH + 100];
+        snprintf(error_msg, sizeof(error_msg), "Cannot create catalogue file: %s", path);
+        error_exit(error_msg);
+    }
+    
+    printf("Writing catalogue '%s'.\n", path);
+    fprintf(stream, "# SoFiA source catalogue\n");
+    fprintf(stream, "# Regenerated from %s\n", self->hdf5name);
+    fprintf(stream, "#\n");
+    
+    fprintf(stream, "#%*s", (int)name_width, "name");
+    for (size_t c = 0; c < CATALOG_COLUMN_COUNT; c++) {
+        if (present[c]) fprintf(stream, " %24s", catalog_columns[c].name);
+    }
+    fprintf(stream, "\n");
+    
+    for (size_t i = 0; i < size; i++) {
+        char quoted[MAX_STRING_LENGTH + 3];
+        snprintf(quoted, sizeof(quoted), "\"%.*s\"", (int)bounded_length(names + i * name_length, name_length), names + i * name_length);
+        fprintf(stream, " %-*s", (int)name_width, quoted);
+        
+        for (size_t c = 0; c < CATALOG_COLUMN_COUNT; c++) {
+            if (!present[c]) continue;
+            const double value = values[c * size + i];
+            if (catalog_columns[c].integer) fprintf(stream, " %24lld", (long long)value);
+            else fprintf(stream, " %24.16g", value);
+        }
+        fprintf(stream, "\n");
+    }
+    
+    fclose(stream);
+    memory_free(path);
+    memory_free(names);
+    memory_free(values);
+    
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Private methods                                                   //
+// ----------------------------------------------------------------- //
+
+// Write one HDU: header from the raw HEADER cards (or the attributes), then DATA
+void SofiaFITS_write_hdu(SofiaFITS *self, FILE *stream, hid_t group_id, const bool primary)
+{
+    hid_t dataset_id = H5Dopen2(group_id, "DATA", H5P_DEFAULT);
+    if (dataset_id < 0) {
+        error_exit("No DATA set found in HDF5 group");
+    }
+    
+    hid_t datatype = H5Dget_type(dataset_id);
+    const int data_type = fits_bitpix(datatype);
+    H5Tclose(datatype);
+    
+    size_t n_cards = 0;
+    char *cards = (H5Lexists(group_id, "HEADER", H5P_DEFAULT) > 0)
+                ? SofiaFITS_read_header(group_id, dataset_id, primary, &n_cards)
+                : SofiaFITS_build_header(group_id, dataset_id, primary, &n_cards);
+    
+    fwrite(cards, FITS_HEADER_LINE_SIZE, n_cards, stream);
+    fits_write_padding(stream, n_cards * FITS_HEADER_LINE_SIZE, ' ');
+    memory_free(cards);
+    
+    SofiaFITS_write_data(self, stream, dataset_id, data_type);
+    H5Dclose(dataset_id);
+    
+    return;
+}
+
+// The header of a group: the raw cards of /SoFiA/HEADER, which every group links to,
+// with the values of the group's own attributes. Cards whose value is unchanged are
+// copied with their comments, changed ones are formatted anew, cards of keywords the
+// group lacks are dropped and keywords only the group has are added before END.
+// The mandatory cards come first; a former image extension that becomes the primary
+// HDU gets SIMPLE instead of XTENSION. Commentary cards are those of the cube.
+char *SofiaFITS_read_header(hid_t group_id, hid_t dataset_id, const bool primary, size_t *n_cards)
+{
+    hid_t header_set = H5Dopen2(group_id, "HEADER", H5P_DEFAULT);
+    hid_t space_id = H5Dget_space(header_set);
+    const size_t size = (size_t)H5Sget_simple_extent_npoints(space_id);
+    H5Sclose(space_id);
+    
+    hid_t str_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(str_type, FITS_HEADER_LINE_SIZE);
+    H5Tset_strpad(str_type, H5T_STR_SPACEPAD);
+    
+    char *raw = memory_alloc(size * FITS_HEADER_LINE_SIZE);
+    H5Dread(header_set, str_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, raw);
+    H5Tclose(str_type);
+    H5Dclose(header_set);
+    
+    FitsHeader *shared = FitsHeader_new(NULL);
+    FitsHeader_parse(shared, raw, size * FITS_HEADER_LINE_SIZE);
+    const size_t n_shared = FitsHeader_get_size(shared);
+    
+    // First raw card of every logical card
+    size_t *offset = memory_alloc((n_shared + 1) * sizeof(size_t));
+    offset[0] = 0;
+    for (size_t i = 0; i < n_shared; i++) offset[i + 1] = offset[i] + FitsHeader_get_card(shared, i)->lines;
+    
+    // Mandatory cards: BITPIX from the DATA set, the axes as in the header of the group
+    CardList list = {NULL, 0, 0};
+    char value[FITS_HEADER_LINE_SIZE];
+    
+    hid_t datatype = H5Dget_type(dataset_id);
+    snprintf(value, sizeof(value), "%d", fits_bitpix(datatype));
+    H5Tclose(datatype);
+    
+    hid_t data_space = H5Dget_space(dataset_id);
+    hsize_t dims[H5S_MAX_RANK];
+    const int rank = H5Sget_simple_extent_dims(data_space, dims, NULL);
+    H5Sclose(data_space);
+    
+    if (primary) fits_mandatory_card(&list, shared, raw, offset, "SIMPLE", "T", false);
+    else fits_mandatory_card(&list, shared, raw, offset, "XTENSION", "IMAGE", true);
+    fits_mandatory_card(&list, shared, raw, offset, "BITPIX", value, false);
+    
+    const int naxis = (int)fits_attribute_number(group_id, "NAXIS", (double)rank);
+    snprintf(value, sizeof(value), "%d", naxis);
+    fits_mandatory_card(&list, shared, raw, offset, "NAXIS", value, false);
+    
+    for (int i = 1; i <= naxis; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "NAXIS%d", i);
+        const double length = fits_attribute_number(group_id, key, i <= rank ? (double)dims[rank - i] : 1.0);
+        snprintf(value, sizeof(value), "%.0f", length);
+        fits_mandatory_card(&list, shared, raw, offset, key, value, false);
+    }
+    
+    if (!primary) {
+        fits_mandatory_card(&list, shared, raw, offset, "PCOUNT", "0", false);
+        fits_mandatory_card(&list, shared, raw, offset, "GCOUNT", "1", false);
+    }
+    
+    // The other cards in the order of the shared header
+    for (size_t i = 0; i < n_shared; i++) {
+        const FitsCard *card = FitsHeader_get_card(shared, i);
+        const size_t lines = card->lines;
+        
+        if (card->type == FITS_VALUE_NONE) {
+            // Commentary
+        }
+        else if (fits_is_structural(card->key) || H5Aexists(group_id, card->key) <= 0) {
+            continue;
+        }
+        else if (!fits_attribute_matches(group_id, card)) {
+            fits_attribute_card(group_id, card->key, NULL, &list);
+            continue;
+        }
+        
+        for (size_t j = 0; j < lines; j++) {
+            memcpy(CardList_add(&list), raw + (offset[i] + j) * FITS_HEADER_LINE_SIZE, FITS_HEADER_LINE_SIZE);
+        }
+    }
+    
+    // Keywords of the group only
+    void *added[2] = {&list, shared};
+    H5Aiterate2(group_id, H5_INDEX_NAME, H5_ITER_INC, NULL, fits_added_card, added);
+    
+    char *end = CardList_add(&list);
+    memset(end, ' ', FITS_HEADER_LINE_SIZE);
+    memcpy(end, "END", 3);
+    
+    memory_free(offset);
+    memory_free(raw);
+    FitsHeader_delete(shared);
+    
+    *n_cards = list.size;
+    return list.cards;
+}
+
+// Fallback for files without raw header: mandatory cards from the DATA set, then one
+// card per attribute. Attribute order is not tracked, so cards come sorted by name,
+// and long string values are split over CONTINUE cards.
+char *SofiaFITS_build_header(hid_t group_id, hid_t dataset_id, const bool primary, size_t *n_cards)
+{
+    CardList list = {NULL, 0, 0};
+    char value[FITS_HEADER_LINE_SIZE];
+    
+    hid_t datatype = H5Dget_type(dataset_id);
+    snprintf(value, sizeof(value), "%d", fits_bitpix(datatype));
+    H5Tclose(datatype);
+    
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[H5S_MAX_RANK];
+    const int rank = H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    
+    if (primary) fits_format_card(CardList_add(&list), "SIMPLE", "T", false);
+    else fits_format_card(CardList_add(&list), "XTENSION", "IMAGE", true);
+    fits_format_card(CardList_add(&list), "BITPIX", value, false);
+    snprintf(value, sizeof(value), "%d", rank);
+    fits_format_card(CardList_add(&list), "NAXIS", value, false);
+    
+    for (int i = 0; i < rank; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "NAXIS%d", i + 1);
+        snprintf(value, sizeof(value), "%llu", (unsigned long long)dims[rank - 1 - i]);
+        fits_format_card(CardList_add(&list), key, value, false);
+    }
+    
+    if (!primary) {
+        fits_format_card(CardList_add(&list), "PCOUNT", "0", false);
+        fits_format_card(CardList_add(&list), "GCOUNT", "1", false);
+    }
+    
+    H5Aiterate2(group_id, H5_INDEX_NAME, H5_ITER_INC, NULL, fits_attribute_card, &list);
+    
+    char *end = CardList_add(&list);
+    memset(end, ' ', FITS_HEADER_LINE_SIZE);
+    memcpy(end, "END", 3);
+    
+    *n_cards = list.size;
+    return list.cards;
+}
+
+// Stream DATA to the file in big-endian slabs of whole planes within max_memory
+void SofiaFITS_write_data(SofiaFITS *self, FILE *stream, hid_t dataset_id, const int data_type)
+{
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[H5S_MAX_RANK];
+    const int rank = H5Sget_simple_extent_dims(space_id, dims, NULL);
+    
+    if (rank < 1 || rank > 4) {
+        error_exit("Unsupported rank of DATA set for FITS output");
+    }
+    
+    const size_t word_size = (size_t)abs(data_type) / 8;
+    const size_t nx = dims[rank - 1];
+    const size_t ny = rank > 1 ? dims[rank - 2] : 1;
+    const size_t nz = rank > 2 ? dims[rank - 3] : 1;
+    const size_t nw = rank > 3 ? dims[0] : 1;
+    const size_t plane_bytes = nx * ny * word_size;
+    
+    size_t slab_planes = self->max_memory / plane_bytes;
+    if (slab_planes < 1) slab_planes = 1;
+    if (slab_planes > nz) slab_planes = nz;
+    
+    void *buffer = memory_alloc(slab_planes * plane_bytes);
+    const hid_t mem_type = h5_native_type(data_type);
+    const bool swap = is_little_endian_system() && word_size > 1;
+    size_t written = 0;
+    
+    for (size_t w = 0; w < nw; w++) {
+        for (size_t z = 0; z < nz; z += slab_planes) {
+            const size_t count = (nz - z < slab_planes) ? nz - z : slab_planes;
+            
+            hsize_t start[4];
+            hsize_t block[4];
+            for (int i = 0; i < rank; i++) {
+                start[i] = 0;
+                block[i] = dims[i];
+            }
+            if (rank > 3) {
+                start[0] = w;
+                block[0] = 1;
+            }
+            if (rank > 2) {
+                start[rank - 3] = z;
+                block[rank - 3] = count;
+            }
+            
+            hid_t mem_space = H5Screate_simple(rank, block, NULL);
+            H5Sselect_hyperslab(space_id, H5S_SELECT_SET, start, NULL, block, NULL);
+            if (H5Dread(dataset_id, mem_type, mem_space, space_id, H5P_DEFAULT, buffer) < 0) {
+                error_exit("Failed to read data from HDF5 file");
+            }
+            H5Sclose(mem_space);
+            
+            if (swap) swap_fits_byte_order(buffer, word_size, count * nx * ny);
+            
+            if (fwrite(buffer, plane_bytes, count, stream) != count) {
+                error_exit("Failed to write data to FITS file");
+            }
+            written += count * plane_bytes;
+        }
+    }
+    
+    fits_write_padding(stream, written, '\0');
+    
+    memory_free(buffer);
+    H5Sclose(space_id);
+    
+    return;
+}
+
+// BITPIX matching an HDF5 data type
+int fits_bitpix(hid_t datatype)
+{
+    const size_t size = H5Tget_size(datatype);
+    
+    switch (H5Tget_class(datatype)) {
+        case H5T_FLOAT:
+            if (size == 2 || size == 4) return -32;  // FITS has no half precision
+            if (size == 8) return -64;
+            break;
+        case H5T_INTEGER:
+            if (size == 1 || size == 2 || size == 4 || size == 8) return 8 * (int)size;
+            break;
+        default:
+            break;
+    }
+    
+    error_exit("Unsupported data type for FITS output");
+    return 0;
+}
+
+// Fill up the last block of a header (spaces) or data unit (zeros)
+void fits_write_padding(FILE *stream, const size_t size, const char fill)
+{
+    const size_t remainder = size % FITS_HEADER_BLOCK_SIZE;
+    if (remainder == 0) return;
+    
+    char block[FITS_HEADER_BLOCK_SIZE];
+    memset(block, fill, sizeof(block));
+    fwrite(block, 1, FITS_HEADER_BLOCK_SIZE - remainder, stream);
+    
+    return;
+}
+
+// Next free card of the list, growing it as needed
+char *CardList_add(CardList *self)
+{
+    if (self->size >= self->capacity) {
+        self->capacity = self->capacity > 0 ? 2 * self->capacity : 64;
+        self->cards = memory_realloc(self->cards, self->capacity * FITS_HEADER_LINE_SIZE);
+    }
+    
+    return self->cards + FITS_HEADER_LINE_SIZE * self->size++;
+}
+
+// Fixed-format card: strings are quoted (with quotes doubled, at least 8 characters),
+// other values right-aligned to column 30; keys over 8 characters use HIERARCH.
+void fits_format_card(char *card, const char *key, const char *value, const bool quoted)
+{
+    char text[2 * FITS_HEADER_LINE_SIZE + 3];
+    
+    if (quoted) {
+        size_t n = 0;
+        text[n++] = '\'';
+        for (const char *c = value; *c != '\0' && n < 2 * FITS_HEADER_LINE_SIZE; c++) {
+            if (*c == '\'') text[n++] = '\'';
+            text[n++] = *c;
+        }
+        while (n < 9) text[n++] = ' ';
+        text[n++] = '\'';
+        text[n] = '\0';
+    } else {
+        snprintf(text, sizeof(text), "%20s", value);
+    }
+    
+    char line[4 * FITS_HEADER_LINE_SIZE];
+    if (strlen(key) > 8) snprintf(line, sizeof(line), "HIERARCH %s = %s", key, quoted ? text : value);
+    else snprintf(line, sizeof(line), "%-8s= %s", key, text);
+    
+    const size_t length = strlen(line);
+    memset(card, ' ', FITS_HEADER_LINE_SIZE);
+    memcpy(card, line, length < FITS_HEADER_LINE_SIZE ? length : FITS_HEADER_LINE_SIZE);
+    
+    return;
+}
+
+// String value card, continued on CONTINUE cards (long-string convention) if it
+// does not fit; each piece but the last ends in '&'. HIERARCH values are truncated.
+void fits_add_string_cards(CardList *list, const char *key, const char *value)
+{
+    const size_t max_piece = 66;  // 68 characters between the quotes of a card, less '&' and a doubled quote
+    const char *position = value;
+    bool first = true;
+    
+    do {
+        // Take as many characters as fit once quotes are doubled
+        char piece[FITS_HEADER_LINE_SIZE];
+        size_t length = 0;
+        size_t escaped = 0;
+        while (position[length] != '\0' && escaped + (position[length] == '\'' ? 2 : 1) <= max_piece) {
+            escaped += (position[length] == '\'' ? 2 : 1);
+            length++;
+        }
+        
+        memcpy(piece, position, length);
+        position += length;
+        if (*position != '\0' && strlen(key) <= 8) piece[length++] = '&';
+        piece[length] = '\0';
+        
+        char *card = CardList_add(list);
+        if (first) {
+            fits_format_card(card, key, piece, true);
+            if (strlen(key) > 8) return;
+        } else {
+            // CONTINUE has no value indicator: the quoted text starts in column 11
+            char line[2 * FITS_HEADER_LINE_SIZE];
+            fits_format_card(line, "CONTINUE", piece, true);
+            memcpy(card, "CONTINUE  ", 10);
+            memcpy(card + 10, line + 10, FITS_HEADER_LINE_SIZE - 10);
+        }
+        first = false;
+    } while (*position != '\0');
+    
+    return;
+}
+
+// Mandatory card: copied from the shared header if it has the same value there
+void fits_mandatory_card(CardList *list, const FitsHeader *shared, const char *raw, const size_t *offset, const char *key, const char *value, const bool quoted)
+{
+    const FitsCard *card = FitsHeader_find(shared, key);
+    
+    if (card != NULL && strcmp(card->value, value) == 0) {
+        const size_t index = (size_t)(card - FitsHeader_get_card(shared, 0));
+        memcpy(CardList_add(list), raw + offset[index] * FITS_HEADER_LINE_SIZE, FITS_HEADER_LINE_SIZE);
+    } else {
+        fits_format_card(CardList_add(list), key, value, quoted);
+    }
+    
+    return;
+}
+
+// Whether the keyword is one of the mandatory cards, which follow the DATA set
+bool fits_is_structural(const char *key)
+{
+    static const char *structural[] = {"SIMPLE", "XTENSION", "BITPIX", "NAXIS", "PCOUNT", "GCOUNT", "END"};
+    for (size_t i = 0; i < sizeof(structural) / sizeof(structural[0]); i++) {
+        if (strcmp(key, structural[i]) == 0) return true;
+    }
+    
+    return string_starts_with(key, "NAXIS");
+}
+
+// Numeric attribute of a group, or 'fallback' if there is none
+double fits_attribute_number(hid_t group_id, const char *name, const double fallback)
+{
+    if (H5Aexists(group_id, name) <= 0) return fallback;
+    
+    double number = fallback;
+    hid_t attr_id = H5Aopen(group_id, name, H5P_DEFAULT);
+    hid_t attr_type = H5Aget_type(attr_id);
+    if (H5Tget_class(attr_type) == H5T_FLOAT) H5Aread(attr_id, H5T_NATIVE_DOUBLE, &number);
+    H5Tclose(attr_type);
+    H5Aclose(attr_id);
+    
+    return number;
+}
+
+// Whether the attribute of a group holds the value of a card of the shared header
+bool fits_attribute_matches(hid_t group_id, const FitsCard *card)
+{
+    hid_t attr_id = H5Aopen(group_id, card->key, H5P_DEFAULT);
+    hid_t attr_type = H5Aget_type(attr_id);
+    bool matches = false;
+    
+    if (H5Tget_class(attr_type) == H5T_STRING && !H5Tis_variable_str(attr_type)) {
+        const size_t size = H5Tget_size(attr_type);
+        char *text = memory_alloc(size + 1);
+        H5Aread(attr_id, attr_type, text);
+        text[size] = '\0';
+        matches = card->type != FITS_VALUE_BOOL && card->type != FITS_VALUE_INT && card->type != FITS_VALUE_FLOAT
+                  && strcmp(text, card->value) == 0;
+        memory_free(text);
+    }
+    else if (H5Tget_class(attr_type) == H5T_INTEGER) {
+        uint8_t flag = 0;
+        H5Aread(attr_id, H5T_NATIVE_UINT8, &flag);
+        matches = card->type == FITS_VALUE_BOOL && card->bool_value == (flag != 0);
+    }
+    else if (H5Tget_class(attr_type) == H5T_FLOAT) {
+        double number = 0.0;
+        H5Aread(attr_id, H5T_NATIVE_DOUBLE, &number);
+        matches = (card->type == FITS_VALUE_INT || card->type == FITS_VALUE_FLOAT) && card->flt_value == number;
+    }
+    
+    H5Tclose(attr_type);
+    H5Aclose(attr_id);
+    
+    return matches;
+}
+
+// H5Aiterate2 callback: one card per attribute whose keyword the shared header lacks
+herr_t fits_added_card(hid_t group_id, const char *name, const H5A_info_t *info, void *data)
+{
+    void **added = (void **)data;
+    const FitsHeader *shared = (const FitsHeader *)added[1];
+    
+    if (FitsHeader_find(shared, name) == NULL) fits_attribute_card(group_id, name, info, added[0]);
+    
+    return 0;
+}
+
+// H5Aiterate2 callback: one card per header attribute
+herr_t fits_attribute_card(hid_t group_id, const char *name, const H5A_info_t *info, void *data)
+{
+    (void)info;
+    CardList *list = (CardList *)data;
+    
+    // Structural keywords are derived from the DATA set
+    if (fits_is_structural(name)) return 0;
+    
+    hid_t attr_id = H5Aopen(group_id, name, H5P_DEFAULT);
+    hid_t attr_type = H5Aget_type(attr_id);
+    char value[2 * FITS_HEADER_LINE_SIZE];
+    
+    if (H5Tget_class(attr_type) == H5T_STRING && !H5Tis_variable_str(attr_type)) {
+        const size_t size = H5Tget_size(attr_type);
+        char *text = memory_alloc(size + 1);
+        H5Aread(attr_id, attr_type, text);
+        text[size] = '\0';
+        
+        // Complex values are kept in their literal form, e.g. (1.0, 2.0)
+        const size_t length = strlen(text);
+        const bool complex = length > 2 && text[0] == '(' && text[length - 1] == ')' && strchr(text, ',') != NULL;
+        if (complex) fits_format_card(CardList_add(list), name, text, false);
+        else fits_add_string_cards(list, name, text);
+        memory_free(text);
+    }
+    else if (H5Tget_class(attr_type) == H5T_INTEGER) {
+        uint8_t flag = 0;
+        H5Aread(attr_id, H5T_NATIVE_UINT8, &flag);
+        fits_format_card(CardList_add(list), name, flag ? "T" : "F", false);
+    }
+    else if (H5Tget_class(attr_type) == H5T_FLOAT) {
+        double number = 0.0;
+        H5Aread(attr_id, H5T_NATIVE_DOUBLE, &number);
+        if (number == (double)(long long)number && number > -1e15 && number < 1e15) {
+            snprintf(value, sizeof(value), "%lld", (long long)number);
+        } else {
+            snprintf(value, sizeof(value), "%.16G", number);
+        }
+        fits_format_card(CardList_add(list), name, value, false);
+    }
+    
+    H5Tclose(attr_type);
+    H5Aclose(attr_id);
+    
+    return 0;
+}
+
+// H5Literate callback: collect the numbers of HDU<n> groups
+herr_t fits_collect_hdu(hid_t group_id, const char *name, const H5L_info_t *info, void *data)
+{
+    (void)group_id;
+    (void)info;
+    void **collect = (void **)data;
+    int *hdus = (int *)collect[0];
+    size_t *n_hdus = (size_t *)collect[1];
+    
+    if (string_starts_with(name, "HDU") && name[3] >= '0' && name[3] <= '9' && *n_hdus < 256) {
+        hdus[(*n_hdus)++] = atoi(name + 3);
+    }
+    
+    return 0;
+}
+
+// Length of a fixed-size string that need not be terminated
+size_t bounded_length(const char *str, const size_t max_length)
+{
+    const char *end = memchr(str, '\0', max_length);
+    return end != NULL ? (size_t)(end - str) : max_length;
+}
+
+int compare_int(const void *a, const void *b)
+{
+    const int x = *(const int *)a;
+    const int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
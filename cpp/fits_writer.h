@@ -0,0 +1,68 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (fits_writer.h) - SoFiA to HDF5 Converter                //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+
+/// @file   fits_writer.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Regeneration of SoFiA FITS products from HDF5 (header).
+
+#ifndef FITS_WRITER_H
+#define FITS_WRITER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <hdf5.h>
+#include "common.h"
+
+// ----------------------------------------------------------------- //
+// Class 'SofiaFITS'                                                 //
+// ----------------------------------------------------------------- //
+// Reverse converter: reads an HDF5 file in the layout written by    //
+// SofiaHDF5 and rebuilds the FITS cube (with any further image      //
+// HDUs), the mask and the ASCII catalogue. Image data are streamed  //
+// in slabs of whole planes within the memory budget.                //
+// ----------------------------------------------------------------- //
+
+typedef CLASS SofiaFITS {
+    char hdf5name[MAX_PATH_LENGTH];
+    char directory[MAX_PATH_LENGTH];
+    char name[MAX_STRING_LENGTH];    // Base name of the output files
+    size_t max_memory;               // Upper limit for image data held in memory (bytes)
+    hid_t file_id;
+    hid_t group_id;
+} SofiaFITS;
+
+// Constructor and destructor
+PUBLIC SofiaFITS *SofiaFITS_new(const char *hdf5name, const char *directory);
+PUBLIC void SofiaFITS_delete(SofiaFITS *self);
+
+// Public methods
+PUBLIC void SofiaFITS_set_max_memory(SofiaFITS *self, const size_t max_memory);
+PUBLIC bool SofiaFITS_has_mask(const SofiaFITS *self);
+PUBLIC bool SofiaFITS_has_catalog(const SofiaFITS *self);
+PUBLIC void SofiaFITS_write_cube(SofiaFITS *self);
+PUBLIC void SofiaFITS_write_mask(SofiaFITS *self);
+PUBLIC void SofiaFITS_write_catalog(SofiaFITS *self);
+
+// Header of an image group, also used for the mask of a mosaic
+PUBLIC char *SofiaFITS_read_header(hid_t group_id, hid_t dataset_id, const bool primary, size_t *n_cards);
+
+#endif
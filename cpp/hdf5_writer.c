@@ -4,9 +4,66 @@
 // Copyright (C) 2025 Peter Kamphuis                                    //
 // ____________________________________________________________________ //
 
+// Needed for realpath() with -std=c99
+#define _XOPEN_SOURCE 700
+
 #include "hdf5_writer.h"
+#include "checksum.h"
+#include "compress.h"
+#include "distributed.h"
+#include "parallel.h"
+#include "quantise.h"
+#include "transpose.h"
 #include "utils.h"
+#include <sys/stat.h>
 #include <unistd.h>
+#include <math.h>
+
+PRIVATE void SofiaHDF5_write_products(SofiaHDF5 *self);
+PRIVATE void SofiaHDF5_abandon_file(SofiaHDF5 *self);
+PRIVATE void SofiaHDF5_write_header(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits_data);
+PRIVATE void SofiaHDF5_write_data(SofiaHDF5 *self, hid_t group_id, FitsFile *fits, const bool products);
+PRIVATE hid_t *SofiaHDF5_create_mipmaps(SofiaHDF5 *self, hid_t group_id, const MipMaps *mipmaps, const int rank, const hsize_t *dims);
+PRIVATE bool SofiaHDF5_reopen(SofiaHDF5 *self);
+PRIVATE hid_t SofiaHDF5_open_group(SofiaHDF5 *self, hid_t parent_id, const char *name, const FitsFile *fits);
+PRIVATE hid_t SofiaHDF5_open_data(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits, const bool products,
+                                  const int rank, const hsize_t *dims, hsize_t *chunk, size_t *done);
+PRIVATE void SofiaHDF5_set_progress(const SofiaHDF5 *self, hid_t dataset_id, const size_t planes);
+PRIVATE herr_t h5_count_attribute(hid_t location_id, const char *name, const H5A_info_t *info, void *data);
+PRIVATE bool SofiaHDF5_manifest_unchanged(SofiaHDF5 *self, const char *product, const char *filename, const char *group_path, FitsFile *fits);
+PRIVATE void SofiaHDF5_manifest_record(SofiaHDF5 *self, const char *product, const char *filename, const bool hash);
+PRIVATE void SofiaHDF5_remove_product(SofiaHDF5 *self, hid_t sofia_group, const char *name);
+PRIVATE void SofiaHDF5_fits_content_hash(SofiaHDF5 *self, FitsFile *fits, char *value);
+PRIVATE bool file_content_hash(const char *filename, char *value);
+PRIVATE void format_content_hash(const uint64_t *digest, const size_t n_digests, char *value);
+PRIVATE void h5_read_string_attribute(hid_t location_id, const char *name, char *value, const size_t size);
+PRIVATE void h5_write_string_attribute(hid_t location_id, const char *name, const char *value);
+PRIVATE void h5_read_scalar_attribute(hid_t location_id, const char *name, hid_t mem_type, void *value);
+PRIVATE void h5_write_scalar_attribute(hid_t location_id, const char *name, hid_t file_type, hid_t mem_type, const void *value);
+PRIVATE hid_t SofiaHDF5_data_create_plist(const SofiaHDF5 *self, const FitsFile *fits, const int rank, const hsize_t *dims, hsize_t *chunk);
+PRIVATE bool SofiaHDF5_is_lossy(const SofiaHDF5 *self, const FitsFile *fits, const bool products);
+PRIVATE hid_t h5_float16_type(void);
+PRIVATE void SofiaHDF5_write_quantisation(SofiaHDF5 *self, hid_t group_id, const double *steps, const int64_t *clipped, const size_t n_planes);
+PRIVATE void SofiaHDF5_verify_checksums(const FitsFile *fits, const uint32_t datasum);
+PRIVATE void SofiaHDF5_gather_statistics(Statistics *stats);
+PRIVATE void SofiaHDF5_write_content_hash(hid_t dataset_id, const uint64_t *digest, const size_t n_planes);
+PRIVATE void SofiaHDF5_write_external(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits);
+PRIVATE void SofiaHDF5_write_virtual(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits);
+PRIVATE void SofiaHDF5_write_swizzled(SofiaHDF5 *self, hid_t group_id, hid_t dataset_id, const FitsFile *fits, const int rank, const hsize_t *dims);
+PRIVATE void SofiaHDF5_write_statistics(SofiaHDF5 *self, hid_t group_id, const Statistics *stats, const int data_type);
+PRIVATE void h5_write_array(hid_t group_id, const char *name, const int rank, const hsize_t *dims,
+                            hid_t file_type, hid_t mem_type, const void *data);
+PRIVATE int SofiaHDF5_data_shape(const FitsFile *fits, hsize_t *dims);
+PRIVATE hid_t h5_fits_type(const int data_type);
+PRIVATE void SofiaHDF5_write_raw_header(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits_data);
+PRIVATE hid_t SofiaHDF5_group_create_plist(const SofiaHDF5 *self);
+PRIVATE hsize_t SofiaHDF5_fs_page_size(const SofiaHDF5 *self);
+PRIVATE hid_t SofiaHDF5_file_create_plist(const SofiaHDF5 *self);
+PRIVATE hid_t SofiaHDF5_file_access_plist(const SofiaHDF5 *self, const bool paged, const bool collective);
+PRIVATE hid_t SofiaHDF5_open_file(const SofiaHDF5 *self, const bool collective);
+PRIVATE void SofiaHDF5_close_file(SofiaHDF5 *self);
+PRIVATE size_t SofiaHDF5_estimate_size(const SofiaHDF5 *self);
+PRIVATE DetectionMap *SofiaHDF5_detection_map(SofiaHDF5 *self, const FitsFile *fits, const size_t chunk_nx, const size_t chunk_ny);
 
 // ----------------------------------------------------------------- //
 // Constructor and destructor                                        //
@@ -22,14 +79,25 @@ SofiaHDF5 *SofiaHDF5_new(const char *filename, const char *basename)
     strcpy(self->hdf5name, filename);
     strcpy(self->name, basename);
     self->overwrite = true;
+    Hdf5Options_set_defaults(&self->options);
+    self->max_memory = 1024 * (size_t)MEGABYTE;
+    self->n_threads = 1;
     
     self->cube_data = NULL;
     self->mask_data = NULL;
     self->catalog = NULL;
     
+    self->virtual_sources = NULL;
+    self->n_virtual = 0;
+    self->detections = NULL;
+    self->in_memory = 0;
+    
     self->file_id = -1;
     self->group_id = -1;
     
+    // Zstd-compressed data sets of an earlier run may be read back
+    compress_register_zstd();
+    
     return self;
 }
 
@@ -40,6 +108,8 @@ void SofiaHDF5_delete(SofiaHDF5 *self)
         if (self->group_id >= 0) H5Gclose(self->group_id);
         if (self->file_id >= 0) H5Fclose(self->file_id);
         
+        memory_free(self->virtual_sources);
+        DetectionMap_delete(self->detections);
         memory_free(self);
     }
     return;
@@ -49,6 +119,90 @@ void SofiaHDF5_delete(SofiaHDF5 *self)
 // Public methods                                                    //
 // ----------------------------------------------------------------- //
 
+void SofiaHDF5_set_options(SofiaHDF5 *self, const Hdf5Options *options)
+{
+    check_null(self);
+    check_null(options);
+    
+    self->options = *options;
+    
+    // Features that rewrite or reread the file as a whole need a single writer
+    if (distributed_size() > 1) {
+        if (self->options.resume || self->options.incremental || self->options.sparse || self->options.detections || self->options.external
+            || self->options.swizzle != SWIZZLE_NONE || self->options.compression != COMPRESSION_NONE || self->options.in_memory > 0) {
+            printf("Note: Resuming, incremental updates, sparse, detection-only and external data, swizzling, compression and in-memory files are not available with several MPI ranks.\n");
+        }
+        self->options.resume = false;
+        self->options.incremental = false;
+        self->options.sparse = false;
+        self->options.detections = false;
+        self->options.external = false;
+        self->options.swizzle = SWIZZLE_NONE;
+        self->options.compression = COMPRESSION_NONE;
+        self->options.in_memory = 0;
+    }
+    
+    // A file built in memory leaves nothing on disk to resume from after a crash
+    if (self->options.in_memory > 0 && self->options.resume) {
+        printf("Note: hdf5.in_memory is not used with hdf5.resume.\n");
+        self->options.in_memory = 0;
+    }
+    
+    // Only the chunks near the detections are allocated; copies of the whole cube
+    // would be larger than what is kept of it
+    if (self->options.detections) {
+        if (self->options.external || self->options.swizzle != SWIZZLE_NONE) {
+            printf("Note: External and swizzled data are not available with hdf5.detections.\n");
+        }
+        self->options.sparse = true;
+        self->options.external = false;
+        self->options.swizzle = SWIZZLE_NONE;
+        self->options.mipmaps = false;
+    }
+    
+    // Planes read back from a lossy DATA no longer match the FITS file
+    if (self->options.quantise != QUANTISE_NONE && (self->options.resume || self->options.incremental)) {
+        printf("Note: Resuming and incremental updates are not available with hdf5.quantise.\n");
+        self->options.resume = false;
+        self->options.incremental = false;
+    }
+    
+    // Reduced precision only saves space once the data are compressed
+    if (self->options.quantise != QUANTISE_NONE && self->options.compression == COMPRESSION_NONE && distributed_size() == 1) {
+        self->options.compression = COMPRESSION_DEFLATE;
+    }
+    
+    if (self->options.compression == COMPRESSION_ZSTD && !compress_zstd_available()) {
+        error_exit("hdf5.compression=zstd needs sofia2hdf5 built with make ZSTD=1.");
+    }
+    
+    if (self->options.compression_level < 0) {
+        self->options.compression_level = (self->options.compression == COMPRESSION_ZSTD) ? COMPRESS_ZSTD_LEVEL : COMPRESS_DEFLATE_LEVEL;
+    }
+    if (self->options.compression == COMPRESSION_DEFLATE && self->options.compression_level > 9) {
+        printf("Note: Deflate levels end at 9.\n");
+        self->options.compression_level = 9;
+    }
+    
+    return;
+}
+
+void SofiaHDF5_set_max_memory(SofiaHDF5 *self, const size_t max_memory)
+{
+    check_null(self);
+    
+    self->max_memory = max_memory;
+    return;
+}
+
+void SofiaHDF5_set_threads(SofiaHDF5 *self, const int n_threads)
+{
+    check_null(self);
+    
+    self->n_threads = n_threads > 0 ? n_threads : 1;
+    return;
+}
+
 void SofiaHDF5_add_cube(SofiaHDF5 *self, FitsFile *cube)
 {
     check_null(self);
@@ -76,79 +230,147 @@ void SofiaHDF5_add_mask(SofiaHDF5 *self, FitsFile *mask)
     return;
 }
 
-void SofiaHDF5_write_cube(SofiaHDF5 *self)
+// Map a box of another file into DATA; once any is added, DATA of the cube and the
+// mask become virtual data sets that refer to the same boxes of those files
+void SofiaHDF5_add_virtual_source(SofiaHDF5 *self, const VirtualSource *source)
+{
+    check_null(self);
+    check_null(source);
+    
+    self->virtual_sources = memory_realloc(self->virtual_sources, (self->n_virtual + 1) * sizeof(VirtualSource));
+    self->virtual_sources[self->n_virtual++] = *source;
+    return;
+}
+
+// Write everything that was added: cube, then mask and catalogue if present.
+// With several MPI ranks, cube and mask are written by all of them together and
+// the catalogue by rank 0 alone, once the others have closed the file. Returns
+// ERR_SUCCESS, or the code of the first error after closing the output file.
+int SofiaHDF5_write(SofiaHDF5 *self)
 {
     check_null(self);
-    check_null(self->cube_data);
     
-    // Remove existing file if overwrite is enabled
-    if (self->overwrite && file_exists(self->hdf5name)) {
-        printf("Removing existing file: %s\n", self->hdf5name);
-        unlink(self->hdf5name);
+    jmp_buf trap;
+    jmp_buf *outer = error_trap(&trap);
+    const int status = setjmp(trap);
+    
+    if (status != ERR_SUCCESS) {
+        error_trap(outer);
+        SofiaHDF5_abandon_file(self);
+        return status;
     }
     
-    // Create HDF5 file
-    self->file_id = H5Fcreate(self->hdf5name, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
-    if (self->file_id < 0) {
-        char error_msg[MAX_PATH_LENGTH + 100];
-        snprintf(error_msg, sizeof(error_msg), "Cannot create HDF5 file: %s", self->hdf5name);
-        error_exit(error_msg);
+    SofiaHDF5_write_products(self);
+    error_trap(outer);
+    
+    return ERR_SUCCESS;
+}
+
+// Apply one option in the form of the command line, e.g. "hdf5.compression=deflate".
+// Returns ERR_SUCCESS, ERR_USER_INPUT for an unknown option or the code of an invalid value.
+int SofiaHDF5_set_option(SofiaHDF5 *self, const char *setting)
+{
+    check_null(self);
+    check_null(setting);
+    
+    Hdf5Options options = self->options;
+    
+    jmp_buf trap;
+    jmp_buf *outer = error_trap(&trap);
+    const int status = setjmp(trap);
+    
+    if (status != ERR_SUCCESS) {
+        error_trap(outer);
+        return status;
     }
     
-    // Create main SoFiA group
-    self->group_id = H5Gcreate2(self->file_id, "/SoFiA", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-    if (self->group_id < 0) {
-        error_exit("Cannot create SoFiA group in HDF5 file");
+    const bool known = Hdf5Options_parse(&options, setting);
+    error_trap(outer);
+    
+    if (!known) {
+        fprintf(stderr, "Error: Unknown option: %s\n", setting);
+        return ERR_USER_INPUT;
+    }
+    
+    SofiaHDF5_set_options(self, &options);
+    return ERR_SUCCESS;
+}
+
+void SofiaHDF5_write_cube(SofiaHDF5 *self)
+{
+    check_null(self);
+    check_null(self->cube_data);
+    
+    // Small outputs are built in memory and written when the file is closed
+    if (self->options.in_memory > 0) {
+        const size_t estimate = SofiaHDF5_estimate_size(self);
+        if (estimate <= self->options.in_memory * (size_t)MEGABYTE) {
+            printf("Building %s in memory (%.1f MB estimated).\n", self->hdf5name, (double)estimate / MEGABYTE);
+            self->in_memory = estimate;
+        } else {
+            printf("Note: Output estimated at %.1f MB is larger than hdf5.in_memory; writing it directly.\n", (double)estimate / MEGABYTE);
+            self->in_memory = 0;
+        }
     }
     
-    // Write header attributes
-    SofiaHDF5_write_header(self, self->group_id, self->cube_data);
+    // Continue an earlier, interrupted conversion of the same cube, or update one in place
+    bool reopened = (self->options.resume || self->options.incremental) && file_exists(self->hdf5name) && SofiaHDF5_reopen(self);
     
-    // Create and write data dataset
-    if (self->cube_data->data && self->cube_data->nx > 0 && 
-        self->cube_data->ny > 0 && self->cube_data->nz > 0) {
-        
-        // Define dimensions (note: HDF5 uses C ordering, which is opposite of FITS)
-        hsize_t dims[3] = {self->cube_data->nz, self->cube_data->ny, self->cube_data->nx};
-        hid_t space_id = H5Screate_simple(3, dims, NULL);
-        
-        // Determine HDF5 data type based on FITS BITPIX
-        hid_t h5_datatype;
-        switch (self->cube_data->data_type) {
-            case 8:   h5_datatype = H5T_NATIVE_INT8; break;
-            case 16:  h5_datatype = H5T_NATIVE_INT16; break;
-            case 32:  h5_datatype = H5T_NATIVE_INT32; break;
-            case 64:  h5_datatype = H5T_NATIVE_INT64; break;
-            case -32: h5_datatype = H5T_NATIVE_FLOAT; break;
-            case -64: h5_datatype = H5T_NATIVE_DOUBLE; break;
-            default:  h5_datatype = H5T_NATIVE_FLOAT; break;
+    if (reopened && self->options.incremental && !SofiaHDF5_manifest_unchanged(self, "Cube", self->cube_data->filename, "/SoFiA", self->cube_data)) {
+        printf("Cube has changed since the last conversion; starting over.\n");
+        H5Fclose(self->file_id);
+        reopened = false;
+    }
+    
+    if (!reopened) {
+        // Remove existing file if overwrite is enabled
+        if (self->overwrite && file_exists(self->hdf5name) && distributed_rank() == 0) {
+            printf("Removing existing file: %s\n", self->hdf5name);
+            unlink(self->hdf5name);
         }
+        distributed_barrier();
         
-        // Create dataset
-        hid_t dataset_id = H5Dcreate2(self->group_id, "DATA", h5_datatype, space_id,
-                                      H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-        
-        if (dataset_id >= 0) {
-            // Write data
-            herr_t status = H5Dwrite(dataset_id, h5_datatype, H5S_ALL, H5S_ALL,
-                                     H5P_DEFAULT, self->cube_data->data);
-            
-            if (status < 0) {
-                fprintf(stderr, "Warning: Failed to write cube data to HDF5 file\n");
-            }
-            
-            H5Dclose(dataset_id);
+        // Create HDF5 file, laid out for the file system with a file-space profile
+        hid_t fcpl = SofiaHDF5_file_create_plist(self);
+        hid_t fapl = SofiaHDF5_file_access_plist(self, true, true);
+        self->file_id = H5Fcreate(self->hdf5name, H5F_ACC_TRUNC, fcpl, fapl);
+        H5Pclose(fapl);
+        H5Pclose(fcpl);
+        if (self->file_id < 0) {
+            char error_msg[MAX_PATH_LENGTH + 100];
+            snprintf(error_msg, sizeof(error_msg), "Cannot create HDF5 file: %s", self->hdf5name);
+            error_exit(error_msg);
         }
+    }
+    
+    // Main SoFiA group with header attributes and the raw header
+    self->group_id = SofiaHDF5_open_group(self, self->file_id, "SoFiA", self->cube_data);
+    SofiaHDF5_manifest_record(self, "Cube", self->cube_data->filename, false);
+    
+    // Products no longer produced by SoFiA must not survive an update
+    if (reopened && self->options.incremental) {
+        if (self->mask_data == NULL) SofiaHDF5_remove_product(self, self->group_id, "Mask");
+        if (self->catalog == NULL || self->catalog->size == 0) SofiaHDF5_remove_product(self, self->group_id, "Catalogue");
+    }
+    
+    // Stream the data cube into the DATA dataset
+    SofiaHDF5_write_data(self, self->group_id, self->cube_data, true);
+    
+    // Further image HDUs of the same file go into their own groups
+    for (FitsFile *extension = self->cube_data->next; extension != NULL; extension = extension->next) {
+        char group_name[32];
+        snprintf(group_name, sizeof(group_name), "HDU%d", extension->hdu);
         
-        H5Sclose(space_id);
+        hid_t hdu_group = SofiaHDF5_open_group(self, self->group_id, group_name, extension);
+        SofiaHDF5_write_data(self, hdu_group, extension, false);
+        
+        H5Gclose(hdu_group);
     }
     
     // Close groups and file
     H5Gclose(self->group_id);
-    H5Fclose(self->file_id);
-    
     self->group_id = -1;
-    self->file_id = -1;
+    SofiaHDF5_close_file(self);
     
     return;
 }
@@ -161,8 +383,8 @@ void SofiaHDF5_write_mask(SofiaHDF5 *self)
         return;  // No mask to write
     }
     
-    // Open existing file for writing
-    self->file_id = H5Fopen(self->hdf5name, H5F_ACC_RDWR, H5P_DEFAULT);
+    // Open existing file for writing, by all ranks
+    self->file_id = SofiaHDF5_open_file(self, true);
     if (self->file_id < 0) {
         char error_msg[MAX_PATH_LENGTH + 100];
         snprintf(error_msg, sizeof(error_msg), "Cannot open HDF5 file for mask writing: %s", self->hdf5name);
@@ -175,51 +397,23 @@ void SofiaHDF5_write_mask(SofiaHDF5 *self)
         error_exit("Cannot open SoFiA group for mask writing");
     }
     
-    // Create Mask group
-    hid_t mask_group = H5Gcreate2(sofia_group, "Mask", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-    if (mask_group < 0) {
-        error_exit("Cannot create Mask group");
+    // A mask that differs from the one converted before is written from scratch
+    if (self->options.incremental && H5Lexists(sofia_group, "Mask", H5P_DEFAULT) > 0
+        && !SofiaHDF5_manifest_unchanged(self, "Mask", self->mask_data->filename, "/SoFiA/Mask", self->mask_data)) {
+        printf("Mask has changed; rewriting it.\n");
+        SofiaHDF5_remove_product(self, sofia_group, "Mask");
     }
+    SofiaHDF5_manifest_record(self, "Mask", self->mask_data->filename, false);
     
-    // Write mask header
-    SofiaHDF5_write_header(self, mask_group, self->mask_data);
+    // Mask group with the mask header
+    hid_t mask_group = SofiaHDF5_open_group(self, sofia_group, "Mask", self->mask_data);
     
     // Write mask data
-    if (self->mask_data->data && self->mask_data->nx > 0 && 
-        self->mask_data->ny > 0 && self->mask_data->nz > 0) {
-        
-        hsize_t dims[3] = {self->mask_data->nz, self->mask_data->ny, self->mask_data->nx};
-        hid_t space_id = H5Screate_simple(3, dims, NULL);
-        
-        // Determine HDF5 data type based on FITS BITPIX
-        hid_t h5_datatype;
-        switch (self->mask_data->data_type) {
-            case 8:   h5_datatype = H5T_NATIVE_INT8; break;
-            case 16:  h5_datatype = H5T_NATIVE_INT16; break;
-            case 32:  h5_datatype = H5T_NATIVE_INT32; break;
-            case 64:  h5_datatype = H5T_NATIVE_INT64; break;
-            case -32: h5_datatype = H5T_NATIVE_FLOAT; break;
-            case -64: h5_datatype = H5T_NATIVE_DOUBLE; break;
-            default:  h5_datatype = H5T_NATIVE_FLOAT; break;
-        }
-        
-        hid_t dataset_id = H5Dcreate2(mask_group, "DATA", h5_datatype, space_id,
-                                      H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-        
-        if (dataset_id >= 0) {
-            H5Dwrite(dataset_id, h5_datatype, H5S_ALL, H5S_ALL,
-                     H5P_DEFAULT, self->mask_data->data);
-            H5Dclose(dataset_id);
-        }
-        
-        H5Sclose(space_id);
-    }
+    SofiaHDF5_write_data(self, mask_group, self->mask_data, false);
     
     H5Gclose(mask_group);
     H5Gclose(sofia_group);
-    H5Fclose(self->file_id);
-    
-    self->file_id = -1;
+    SofiaHDF5_close_file(self);
     
     return;
 }
@@ -232,8 +426,8 @@ void SofiaHDF5_write_catalog(SofiaHDF5 *self)
         return;  // No catalog to write
     }
     
-    // Open existing file for writing
-    self->file_id = H5Fopen(self->hdf5name, H5F_ACC_RDWR, H5P_DEFAULT);
+    // Open existing file for writing, by rank 0 alone once the others have closed it
+    self->file_id = SofiaHDF5_open_file(self, false);
     if (self->file_id < 0) {
         char error_msg[MAX_PATH_LENGTH + 100];
         snprintf(error_msg, sizeof(error_msg), "Cannot open HDF5 file for catalog writing: %s", self->hdf5name);
@@ -246,6 +440,17 @@ void SofiaHDF5_write_catalog(SofiaHDF5 *self)
         error_exit("Cannot open SoFiA group for catalog writing");
     }
     
+    // An unchanged catalogue is kept; one left by an interrupted run is written again
+    if (H5Lexists(sofia_group, "Catalogue", H5P_DEFAULT) > 0) {
+        if (self->options.incremental && SofiaHDF5_manifest_unchanged(self, "Catalogue", self->catalog->filename, NULL, NULL)) {
+            printf("Catalogue is unchanged.\n");
+            H5Gclose(sofia_group);
+            SofiaHDF5_close_file(self);
+            return;
+        }
+        SofiaHDF5_remove_product(self, sofia_group, "Catalogue");
+    }
+    
     // Create Catalogue group (note: British spelling as in original)
     hid_t catalog_group = H5Gcreate2(sofia_group, "Catalogue", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
     if (catalog_group < 0) {
@@ -342,14 +547,14 @@ void SofiaHDF5_write_catalog(SofiaHDF5 *self)
         // Name dataset (requires special string handling)
         hid_t str_space = H5Screate_simple(1, dims, NULL);
         hid_t str_dtype = H5Tcopy(H5T_C_S1);
-        H5Tset_size(str_dtype, MAX_STRING_LENGTH);
+        H5Tset_size(str_dtype, SOFIA2HDF5_NAME_LENGTH);
         
         hid_t name_dataset = H5Dcreate2(catalog_group, "name", str_dtype, str_space,
                                         H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
         if (name_dataset >= 0) {
-            char *names = memory_alloc(self->catalog->size * MAX_STRING_LENGTH);
+            char *names = memory_alloc(self->catalog->size * SOFIA2HDF5_NAME_LENGTH);
             for (size_t i = 0; i < self->catalog->size; i++) {
-                strcpy(names + i * MAX_STRING_LENGTH, self->catalog->sources[i].name);
+                strcpy(names + i * SOFIA2HDF5_NAME_LENGTH, self->catalog->sources[i].name);
             }
             H5Dwrite(name_dataset, str_dtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, names);
             memory_free(names);
@@ -364,11 +569,12 @@ void SofiaHDF5_write_catalog(SofiaHDF5 *self)
         #undef WRITE_INT_DATASET
     }
     
+    // Recorded last, as the group is only complete now
+    SofiaHDF5_manifest_record(self, "Catalogue", self->catalog->filename, true);
+    
     H5Gclose(catalog_group);
     H5Gclose(sofia_group);
-    H5Fclose(self->file_id);
-    
-    self->file_id = -1;
+    SofiaHDF5_close_file(self);
     
     return;
 }
@@ -377,63 +583,116 @@ void SofiaHDF5_write_catalog(SofiaHDF5 *self)
 // Private methods                                                   //
 // ----------------------------------------------------------------- //
 
+void SofiaHDF5_write_products(SofiaHDF5 *self)
+{
+    SofiaHDF5_write_cube(self);
+    if (self->mask_data != NULL) SofiaHDF5_write_mask(self);
+    if (self->catalog != NULL && distributed_rank() == 0) SofiaHDF5_write_catalog(self);
+    
+    // A file built in memory goes to disk now, in one sequential write
+    if (self->file_id >= 0) {
+        printf("Writing %s from memory.\n", self->hdf5name);
+        H5Fclose(self->file_id);
+        self->file_id = -1;
+    }
+    distributed_barrier();
+    
+    return;
+}
+
+// Close the output file after an error, including every object still open in it,
+// so that the library can be used again. The partial file is left on disk.
+void SofiaHDF5_abandon_file(SofiaHDF5 *self)
+{
+    const ssize_t n_files = H5Fget_obj_count(H5F_OBJ_ALL, H5F_OBJ_FILE);
+    if (n_files > 0) {
+        hid_t *files = memory_alloc((size_t)n_files * sizeof(hid_t));
+        H5Fget_obj_ids(H5F_OBJ_ALL, H5F_OBJ_FILE, (size_t)n_files, files);
+        
+        for (ssize_t i = 0; i < n_files; i++) {
+            char name[MAX_PATH_LENGTH];
+            if (H5Fget_name(files[i], name, sizeof(name)) < 0 || strcmp(name, self->hdf5name) != 0) continue;
+            
+            const unsigned int types[] = {H5F_OBJ_DATASET | H5F_OBJ_GROUP | H5F_OBJ_DATATYPE, H5F_OBJ_ATTR};
+            for (size_t t = 0; t < 2; t++) {
+                const ssize_t n_objects = H5Fget_obj_count(files[i], types[t]);
+                if (n_objects <= 0) continue;
+                
+                hid_t *objects = memory_alloc((size_t)n_objects * sizeof(hid_t));
+                H5Fget_obj_ids(files[i], types[t], (size_t)n_objects, objects);
+                for (ssize_t k = 0; k < n_objects; k++) {
+                    if (t == 0) H5Oclose(objects[k]);
+                    else H5Aclose(objects[k]);
+                }
+                memory_free(objects);
+            }
+            
+            H5Fclose(files[i]);
+        }
+        memory_free(files);
+    }
+    
+    self->file_id = -1;
+    self->group_id = -1;
+    return;
+}
+
 void SofiaHDF5_write_header(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits_data)
 {
     check_null(self);
     check_null(fits_data);
     
-    if (!fits_data->header_parsed || fits_data->header_count == 0) {
+    if (!fits_data->header_parsed || FitsHeader_get_size(fits_data->keywords) == 0) {
         return;  // No header to write
     }
     
-    // Create string datatype for attributes
+    // Strings are fixed at 256 characters as in the Python version; only longer
+    // values (joined from CONTINUE cards) get the length they need
     hid_t str_type = H5Tcopy(H5T_C_S1);
-    H5Tset_size(str_type, 256);  // 256 characters as in Python version
+    char text[256];
     
     hid_t attr_space = H5Screate(H5S_SCALAR);
     
-    for (size_t i = 0; i < fits_data->header_count; i++) {
-        const char *key = fits_data->header_keys[i];
-        const char *value = fits_data->header_values[i];
+    for (size_t i = 0; i < FitsHeader_get_size(fits_data->keywords); i++) {
+        const FitsCard *card = FitsHeader_get_card(fits_data->keywords, i);
         
-        // Skip HISTORY and COMMENT as in Python version
-        if (strcmp(key, "HISTORY") == 0 || strcmp(key, "COMMENT") == 0) {
+        // Skip HISTORY, COMMENT and other commentary cards as in Python version
+        if (card->type == FITS_VALUE_NONE || card->key[0] == '\0') {
             continue;
         }
         
-        // Check if value is a boolean
-        bool is_bool = (strcmp(value, "T") == 0 || strcmp(value, "F") == 0);
-        
-        if (is_bool) {
+        if (card->type == FITS_VALUE_BOOL) {
             // Write as uint8
-            hid_t attr_id = H5Acreate2(group_id, key, H5T_NATIVE_UINT8, attr_space,
+            hid_t attr_id = H5Acreate2(group_id, card->key, H5T_NATIVE_UINT8, attr_space,
                                        H5P_DEFAULT, H5P_DEFAULT);
             if (attr_id >= 0) {
-                uint8_t bool_val = (strcmp(value, "T") == 0) ? 1 : 0;
+                uint8_t bool_val = card->bool_value ? 1 : 0;
                 H5Awrite(attr_id, H5T_NATIVE_UINT8, &bool_val);
                 H5Aclose(attr_id);
             }
+        } else if (card->type == FITS_VALUE_INT || card->type == FITS_VALUE_FLOAT) {
+            // It's a number
+            hid_t attr_id = H5Acreate2(group_id, card->key, H5T_NATIVE_DOUBLE, attr_space,
+                                       H5P_DEFAULT, H5P_DEFAULT);
+            if (attr_id >= 0) {
+                double numeric_val = card->flt_value;
+                H5Awrite(attr_id, H5T_NATIVE_DOUBLE, &numeric_val);
+                H5Aclose(attr_id);
+            }
         } else {
-            // Check if value is numeric
-            char *endptr;
-            double numeric_val = strtod(value, &endptr);
-            
-            if (*endptr == '\0' && endptr != value) {
-                // It's a number
-                hid_t attr_id = H5Acreate2(group_id, key, H5T_NATIVE_DOUBLE, attr_space,
-                                           H5P_DEFAULT, H5P_DEFAULT);
-                if (attr_id >= 0) {
-                    H5Awrite(attr_id, H5T_NATIVE_DOUBLE, &numeric_val);
-                    H5Aclose(attr_id);
-                }
-            } else {
-                // It's a string
-                hid_t attr_id = H5Acreate2(group_id, key, str_type, attr_space,
-                                           H5P_DEFAULT, H5P_DEFAULT);
-                if (attr_id >= 0) {
-                    H5Awrite(attr_id, str_type, value);
-                    H5Aclose(attr_id);
-                }
+            // It's a string (complex values are kept in their literal form)
+            const size_t length = strlen(card->value);
+            const bool fits = length < sizeof(text);
+            if (fits) {
+                memset(text, 0, sizeof(text));
+                memcpy(text, card->value, length);
+            }
+            H5Tset_size(str_type, fits ? sizeof(text) : length + 1);
+            hid_t attr_id = H5Acreate2(group_id, card->key, str_type, attr_space,
+                                       H5P_DEFAULT, H5P_DEFAULT);
+            if (attr_id >= 0) {
+                H5Awrite(attr_id, str_type, fits ? text : card->value);
+                H5Aclose(attr_id);
             }
         }
     }
@@ -442,4 +701,1976 @@ void SofiaHDF5_write_header(SofiaHDF5 *self, hid_t group_id, const FitsFile *fit
     H5Tclose(str_type);
     
     return;
+}
+
+// HDF5 memory type matching a FITS BITPIX value
+hid_t h5_native_type(const int data_type)
+{
+    switch (data_type) {
+        case 8:   return H5T_NATIVE_UINT8;
+        case 16:  return H5T_NATIVE_INT16;
+        case 32:  return H5T_NATIVE_INT32;
+        case 64:  return H5T_NATIVE_INT64;
+        case -32: return H5T_NATIVE_FLOAT;
+        case -64: return H5T_NATIVE_DOUBLE;
+        default:  return H5T_NATIVE_FLOAT;
+    }
+}
+
+// HDF5 file type matching a FITS BITPIX value as stored in the FITS file (big-endian)
+hid_t h5_fits_type(const int data_type)
+{
+    switch (data_type) {
+        case 8:   return H5T_STD_U8BE;
+        case 16:  return H5T_STD_I16BE;
+        case 32:  return H5T_STD_I32BE;
+        case 64:  return H5T_STD_I64BE;
+        case -32: return H5T_IEEE_F32BE;
+        case -64: return H5T_IEEE_F64BE;
+        default:  return H5T_IEEE_F32BE;
+    }
+}
+
+// Dataset shape in C order. A Stokes axis keeps the data 4-D, even when the
+// spectral axis is degenerate, so that axis 0 is never mistaken for frequency;
+// only a degenerate fourth axis is squeezed.
+int SofiaHDF5_data_shape(const FitsFile *fits, hsize_t *dims)
+{
+    if (fits->nw > 1) {
+        dims[0] = fits->nw;
+        dims[1] = fits->nz;
+        dims[2] = fits->ny;
+        dims[3] = fits->nx;
+        return 4;
+    }
+    
+    dims[0] = fits->nz * fits->nw;
+    dims[1] = fits->ny;
+    dims[2] = fits->nx;
+    return 3;
+}
+
+// ----------------------------------------------------------------- //
+// Per-plane processing of a slab                                    //
+// ----------------------------------------------------------------- //
+// Every plane of a slab is byte-swapped and passed through the      //
+// enabled consumers (checksums, statistics, mipmaps, empty chunk    //
+// detection) by one thread while it is still hot in cache, before   //
+// the slab is handed to HDF5.                                       //
+// ----------------------------------------------------------------- //
+
+typedef CLASS SlabPass {
+    const FitsFile *fits;
+    unsigned char *slab;      // Planes of the current slab
+    size_t first;             // Index of the first plane of the slab
+    size_t plane_size;        // Elements per plane
+    bool swap;                // Slab is still big-endian
+    Statistics *statistics;   // NULL if disabled
+    MipMaps *mipmaps;         // NULL if disabled
+    unsigned char *empty;     // Per plane and chunk: only fill value; NULL if disabled
+    const DetectionMap *detections; // Chunks near the detections; NULL if all are stored
+    size_t chunk_nx, chunk_ny;
+    size_t chunks_x, chunks_y;
+    uint32_t *datasum;        // Per plane: FITS checksum of the big-endian data; NULL if disabled
+    uint64_t *digest;         // Per plane: XXH64 of the data as stored in DATA; NULL if disabled
+    double *steps;            // Per plane: rounding step of hdf5.quantise=round; NULL if disabled
+    int quantise_bits;
+    uint16_t *half;           // Slab in half precision for hdf5.quantise=float16; NULL if disabled
+    int64_t *clipped;         // Per plane: values clipped to the half-precision range; NULL if disabled
+} SlabPass;
+
+PRIVATE void SofiaHDF5_write_sparse(const SlabPass *pass, hid_t dataset_id, hid_t mem_type, hid_t mem_space, hid_t file_space,
+                                    const int rank, const hsize_t *start, const size_t count, const void *slab);
+
+// Kernels testing whether a rectangle of a plane holds only the fill value. The
+// inner loops accumulate without branching so that they vectorise; the test
+// stops at the end of the first row containing data.
+
+#define FILL_TEST_KERNEL(NAME, TYPE, ACC, INIT, STEP, DONE) \
+PRIVATE bool NAME(const TYPE *plane, const size_t nx, const size_t x0, const size_t x1, const size_t y0, const size_t y1) \
+{ \
+    for (size_t y = y0; y < y1; y++) { \
+        const TYPE *row = plane + y * nx; \
+        ACC acc = INIT; \
+        for (size_t x = x0; x < x1; x++) STEP; \
+        if (DONE) return false; \
+    } \
+    return true; \
+}
+
+FILL_TEST_KERNEL(is_nan_flt, float, int, 1, acc &= (row[x] != row[x]), !acc)
+FILL_TEST_KERNEL(is_nan_dbl, double, int, 1, acc &= (row[x] != row[x]), !acc)
+FILL_TEST_KERNEL(is_zero_byte, unsigned char, unsigned char, 0, acc |= row[x], acc)
+
+#undef FILL_TEST_KERNEL
+
+PRIVATE bool SlabPass_chunk_is_fill(const SlabPass *pass, const unsigned char *plane, const size_t cx, const size_t cy)
+{
+    const size_t nx = pass->fits->nx;
+    const size_t x0 = cx * pass->chunk_nx;
+    const size_t y0 = cy * pass->chunk_ny;
+    const size_t x1 = (x0 + pass->chunk_nx < nx) ? x0 + pass->chunk_nx : nx;
+    const size_t y1 = (y0 + pass->chunk_ny < pass->fits->ny) ? y0 + pass->chunk_ny : pass->fits->ny;
+    const size_t word_size = pass->fits->word_size;
+    
+    if (pass->fits->data_type == -32) return is_nan_flt((const float *)plane, nx, x0, x1, y0, y1);
+    if (pass->fits->data_type == -64) return is_nan_dbl((const double *)plane, nx, x0, x1, y0, y1);
+    return is_zero_byte(plane, nx * word_size, x0 * word_size, x1 * word_size, y0, y1);
+}
+
+// Set the chunks of a plane away from the detections to the fill value
+PRIVATE void SlabPass_blank_chunks(const SlabPass *pass, unsigned char *plane, const unsigned char *keep)
+{
+    const size_t nx = pass->fits->nx;
+    const size_t word_size = pass->fits->word_size;
+    
+    for (size_t c = 0; c < pass->chunks_x * pass->chunks_y; c++) {
+        if (keep[c]) continue;
+        
+        const size_t x0 = (c % pass->chunks_x) * pass->chunk_nx;
+        const size_t y0 = (c / pass->chunks_x) * pass->chunk_ny;
+        const size_t width = (x0 + pass->chunk_nx < nx) ? pass->chunk_nx : nx - x0;
+        const size_t y1 = (y0 + pass->chunk_ny < pass->fits->ny) ? y0 + pass->chunk_ny : pass->fits->ny;
+        
+        for (size_t y = y0; y < y1; y++) {
+            unsigned char *row = plane + (y * nx + x0) * word_size;
+            if (pass->fits->data_type == -32) {
+                for (size_t x = 0; x < width; x++) ((float *)row)[x] = NAN;
+            } else if (pass->fits->data_type == -64) {
+                for (size_t x = 0; x < width; x++) ((double *)row)[x] = NAN;
+            } else {
+                memset(row, 0, width * word_size);
+            }
+        }
+    }
+    
+    return;
+}
+
+PRIVATE void SlabPass_process_plane(const size_t index, void *context)
+{
+    SlabPass *pass = (SlabPass *)context;
+    const size_t plane_bytes = pass->plane_size * pass->fits->word_size;
+    unsigned char *plane = pass->slab + index * plane_bytes;
+    
+    if (pass->datasum != NULL) {
+        pass->datasum[pass->first + index] = checksum_fits(plane, plane_bytes, (pass->first + index) * plane_bytes);
+    }
+    
+    if (pass->swap) swap_fits_byte_order(plane, pass->fits->word_size, pass->plane_size);
+    
+    if (pass->steps != NULL) {
+        const double step = quantise_step(plane, pass->fits->data_type, pass->plane_size, pass->quantise_bits);
+        quantise_plane(plane, pass->fits->data_type, pass->plane_size, step);
+        pass->steps[pass->first + index] = step;
+    }
+    
+    // Only the chunks near the detections are kept, so everything below describes
+    // DATA as stored; the rounding step above still follows the noise of the plane
+    const unsigned char *keep = pass->detections != NULL ? DetectionMap_plane(pass->detections, pass->first + index) : NULL;
+    if (keep != NULL) SlabPass_blank_chunks(pass, plane, keep);
+    
+    if (pass->half != NULL) {
+        pass->clipped[pass->first + index] = (int64_t)quantise_float16(plane, pass->fits->data_type, pass->plane_size, pass->half + index * pass->plane_size);
+    }
+    
+    if (pass->digest != NULL) {
+        pass->digest[pass->first + index] = checksum_xxh64(plane, plane_bytes, 0);
+    }
+    
+    if (pass->statistics != NULL) {
+        Statistics_add_plane(pass->statistics, pass->first + index, index, plane, pass->fits->data_type, pass->plane_size);
+    }
+    
+    if (pass->mipmaps != NULL) {
+        MipMaps_add_plane(pass->mipmaps, index, plane);
+    }
+    
+    if (pass->empty != NULL) {
+        unsigned char *empty = pass->empty + index * pass->chunks_x * pass->chunks_y;
+        for (size_t cy = 0; cy < pass->chunks_y; cy++) {
+            for (size_t cx = 0; cx < pass->chunks_x; cx++) {
+                const size_t c = cy * pass->chunks_x + cx;
+                empty[c] = (keep != NULL && !keep[c]) || SlabPass_chunk_is_fill(pass, plane, cx, cy);
+            }
+        }
+    }
+    
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Chunk compression on all threads                                  //
+// ----------------------------------------------------------------- //
+// HDF5 runs its filters one chunk after another on the calling      //
+// thread. If the filters of DATA are ones the converter applies     //
+// itself (shuffle, deflate or Zstd, fletcher32, as written for      //
+// hdf5.compression), the chunks of a slab are compressed on all     //
+// threads and handed to H5Dwrite_chunk, which stores them as they   //
+// are.                                                              //
+// The filters are read from DATA, so a resumed data set is always   //
+// written the way it was created.                                   //
+// ----------------------------------------------------------------- //
+
+typedef CLASS ChunkCodec {
+    bool direct;              // Chunks are compressed here and written directly
+    bool shuffle;
+    bool zstd;                // Zstd instead of deflate
+    int level;                // Deflate or Zstd level
+    bool fletcher32;
+    size_t word_size;         // Bytes per element as stored
+    unsigned char fill[8];    // Fill value as stored, for the part of edge chunks outside DATA
+} ChunkCodec;
+
+typedef CLASS ChunkPass {
+    const SlabPass *pass;
+    const ChunkCodec *codec;
+    const unsigned char *data; // Planes of the slab as stored
+    size_t n_chunks;          // Chunks of the slab
+    size_t n_workers;
+    size_t bound;             // Room for each compressed chunk
+    unsigned char *compressed; // Per chunk: compressed bytes
+    size_t *sizes;            // Per chunk: number of compressed bytes; 0 if not written
+} ChunkPass;
+
+PRIVATE void SofiaHDF5_chunk_codec(const SofiaHDF5 *self, hid_t dataset_id, const int rank, hsize_t *chunk, ChunkCodec *codec);
+PRIVATE void SofiaHDF5_write_chunks(const ChunkPass *chunks, hid_t dataset_id, const int rank, const hsize_t *start,
+                                   size_t *data_bytes, size_t *compressed_bytes);
+
+// Worker 'index' compresses every n_workers-th chunk of the slab
+PRIVATE void ChunkPass_compress(const size_t index, void *context)
+{
+    ChunkPass *self = (ChunkPass *)context;
+    const SlabPass *pass = self->pass;
+    const size_t word_size = self->codec->word_size;
+    const size_t nx = pass->fits->nx;
+    const size_t ny = pass->fits->ny;
+    const size_t per_plane = pass->chunks_x * pass->chunks_y;
+    const size_t chunk_bytes = pass->chunk_nx * pass->chunk_ny * word_size;
+    
+    unsigned char *chunk = memory_alloc(chunk_bytes);
+    unsigned char *scratch = memory_alloc(chunk_bytes);
+    
+    for (size_t c = index; c < self->n_chunks; c += self->n_workers) {
+        const size_t plane = c / per_plane;
+        if (pass->empty != NULL && pass->empty[c]) {
+            self->sizes[c] = 0;
+            continue;
+        }
+        
+        const size_t x0 = (c % per_plane % pass->chunks_x) * pass->chunk_nx;
+        const size_t y0 = (c % per_plane / pass->chunks_x) * pass->chunk_ny;
+        const size_t width = (x0 + pass->chunk_nx < nx) ? pass->chunk_nx : nx - x0;
+        const size_t height = (y0 + pass->chunk_ny < ny) ? pass->chunk_ny : ny - y0;
+        const unsigned char *source = self->data + (plane * nx * ny + y0 * nx + x0) * word_size;
+        
+        // Edge chunks are padded with the fill value to their full size
+        for (size_t y = 0; y < pass->chunk_ny; y++) {
+            unsigned char *row = chunk + y * pass->chunk_nx * word_size;
+            const size_t copied = (y < height) ? width : 0;
+            if (copied > 0) memcpy(row, source + y * nx * word_size, copied * word_size);
+            for (size_t x = copied; x < pass->chunk_nx; x++) memcpy(row + x * word_size, self->codec->fill, word_size);
+        }
+        
+        self->sizes[c] = compress_chunk(chunk, chunk_bytes, word_size, self->codec->shuffle, self->codec->zstd, self->codec->level,
+                                        self->codec->fletcher32, scratch, self->compressed + c * self->bound);
+    }
+    
+    memory_free(chunk);
+    memory_free(scratch);
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Streaming DATA                                                    //
+// ----------------------------------------------------------------- //
+// SofiaHDF5_write_data() walks the planes of an image in slabs. The //
+// state shared by its stages is held in a DataWriter: opening DATA  //
+// and its products, reading a slab, the per-plane pass, storing     //
+// the slab, its mipmaps, and completing the data set at the end.    //
+// ----------------------------------------------------------------- //
+
+typedef CLASS DataWriter {
+    FitsFile *fits;
+    bool products;
+    int rank;
+    hsize_t dims[4];
+    hsize_t chunk[4];
+    size_t done;              // Planes in DATA from an interrupted conversion
+    hid_t dataset_id;
+    hid_t space_id;
+    hid_t h5_datatype;        // Native type of the planes
+    hid_t write_type;         // Memory type of the planes as handed to HDF5
+    hid_t dxpl;
+    size_t n_planes;
+    size_t plane_bytes;
+    size_t slab_planes;       // Planes per slab
+    bool lossy;
+    bool in_place;            // Planes are rounded or blanked in place
+    bool replay;              // Planes already in DATA are read back for the per-plane products
+    void *buffer;             // Slab read from the FITS file or DATA; NULL if not needed
+    const DetectionMap *detections; // Chunks near the detections; NULL if all are stored
+    ChunkCodec codec;
+    SlabPass pass;
+    ChunkPass chunks;
+    hid_t *mipmap_sets;       // One per mipmap level; NULL if disabled
+    size_t chunks_total, chunks_skipped;
+    size_t data_bytes, compressed_bytes;
+} DataWriter;
+
+PRIVATE bool SofiaHDF5_begin_data(SofiaHDF5 *self, DataWriter *writer, hid_t group_id, FitsFile *fits, const bool products);
+PRIVATE const void *SofiaHDF5_read_slab(const DataWriter *writer, const size_t first, const size_t count, const bool written, hid_t mem_space);
+PRIVATE void SofiaHDF5_process_slab(const SofiaHDF5 *self, const DataWriter *writer, const void *slab, const size_t first, const size_t count, const bool written);
+PRIVATE void SofiaHDF5_store_slab(const SofiaHDF5 *self, DataWriter *writer, const void *slab, const hsize_t *start, const size_t count, hid_t mem_space);
+PRIVATE void SofiaHDF5_write_mipmap_slab(const DataWriter *writer, const hsize_t *start, hsize_t *block, const size_t count);
+PRIVATE void SofiaHDF5_finish_data(SofiaHDF5 *self, DataWriter *writer, hid_t group_id);
+
+// Create the DATA dataset of a group and stream the image into it in slabs of whole
+// planes, so that at most max_memory bytes of image data are held at any time.
+// With 'products' set, statistics and mipmaps are made on the way and written next to DATA.
+void SofiaHDF5_write_data(SofiaHDF5 *self, hid_t group_id, FitsFile *fits, const bool products)
+{
+    check_null(self);
+    check_null(fits);
+    
+    if (fits->data_size == 0) return;
+    
+    if (self->n_virtual > 0) {
+        SofiaHDF5_write_virtual(self, group_id, fits);
+        return;
+    }
+    
+    if (self->options.external && fits->data == NULL && !fits->sequential && !FitsFile_has_region(fits)) {
+        SofiaHDF5_write_external(self, group_id, fits);
+        return;
+    }
+    
+    if (self->options.external && fits->sequential) {
+        printf("Note: Streamed input cannot be referred to externally; copying the data instead.\n");
+    }
+    
+    if (self->options.external && FitsFile_has_region(fits)) {
+        printf("Note: A region of the input cannot be referred to externally; copying the data instead.\n");
+    }
+    
+    if (fits->sequential && distributed_size() > 1) {
+        error_exit("Streamed input cannot be shared between several MPI ranks.");
+    }
+    
+    DataWriter writer;
+    if (!SofiaHDF5_begin_data(self, &writer, group_id, fits, products)) return;
+    
+    const int rank = writer.rank;
+    
+    // With several MPI ranks, each one converts its own range of planes. Collective I/O
+    // needs all of them in every write, so ranks that are done join with empty selections.
+    size_t range_first, range_last;
+    distributed_range(writer.n_planes, &range_first, &range_last);
+    
+    for (size_t first = range_first; distributed_any(first < range_last); ) {
+        size_t count = range_last - first < writer.slab_planes ? range_last - first : writer.slab_planes;
+        
+        // A 4-D slab must not run across the boundary between two Stokes planes
+        if (rank == 4 && first % fits->nz + count > fits->nz) count = fits->nz - first % fits->nz;
+        
+        // Nor across the point where an interrupted conversion stopped
+        const bool written = (first < writer.done);
+        if (written && first + count > writer.done) count = writer.done - first;
+        
+        if (written && !writer.replay) {
+            first += count;
+            continue;
+        }
+        
+        hsize_t start[4] = {0, 0, 0, 0};
+        hsize_t block[4];
+        for (int i = 0; i < rank; i++) block[i] = writer.dims[i];
+        if (rank == 4) {
+            start[0] = first / fits->nz;
+            start[1] = first % fits->nz;
+            block[0] = 1;
+            block[1] = count;
+        } else {
+            start[0] = first;
+            block[0] = count;
+        }
+        
+        hid_t mem_space = H5Screate_simple(rank, block, NULL);
+        if (count > 0) {
+            H5Sselect_hyperslab(writer.space_id, H5S_SELECT_SET, start, NULL, block, NULL);
+        } else {
+            H5Sselect_none(writer.space_id);
+            H5Sselect_none(mem_space);
+        }
+        
+        const void *slab = SofiaHDF5_read_slab(&writer, first, count, written, mem_space);
+        SofiaHDF5_process_slab(self, &writer, slab, first, count, written);
+        
+        // Planes read back from DATA need not be written again
+        if (!written) SofiaHDF5_store_slab(self, &writer, slab, start, count, mem_space);
+        H5Sclose(mem_space);
+        
+        SofiaHDF5_write_mipmap_slab(&writer, start, block, count);
+        
+        // Checkpoint: everything up to here is on disk (no single point with several ranks)
+        if (!written && self->options.resume && distributed_size() == 1) SofiaHDF5_set_progress(self, writer.dataset_id, first + count);
+        
+        first += count;
+    }
+    
+    SofiaHDF5_finish_data(self, &writer, group_id);
+    return;
+}
+
+// Open or create DATA and set up the slab buffers and the per-plane products. Returns
+// false if DATA is complete already or could not be created.
+bool SofiaHDF5_begin_data(SofiaHDF5 *self, DataWriter *writer, hid_t group_id, FitsFile *fits, const bool products)
+{
+    writer->fits = fits;
+    writer->products = products;
+    writer->rank = SofiaHDF5_data_shape(fits, writer->dims);
+    writer->h5_datatype = h5_native_type(fits->data_type);
+    writer->done = 0;
+    writer->dataset_id = SofiaHDF5_open_data(self, group_id, fits, products, writer->rank, writer->dims, writer->chunk, &writer->done);
+    if (writer->dataset_id < 0) return false;
+    
+    const int rank = writer->rank;
+    const hsize_t *chunk = writer->chunk;
+    ChunkCodec *codec = &writer->codec;
+    SlabPass *pass = &writer->pass;
+    ChunkPass *chunks = &writer->chunks;
+    
+    SofiaHDF5_chunk_codec(self, writer->dataset_id, rank, writer->chunk, codec);
+    
+    writer->space_id = H5Dget_space(writer->dataset_id);
+    writer->n_planes = FitsFile_get_plane_count(fits);
+    writer->plane_bytes = FitsFile_get_plane_bytes(fits);
+    
+    // The chunks near the detections are found for the first DATA and apply to
+    // every image of its shape
+    writer->detections = NULL;
+    if (self->options.detections) {
+        if (self->detections == NULL) self->detections = SofiaHDF5_detection_map(self, fits, chunk[rank - 1], chunk[rank - 2]);
+        if (self->detections != NULL && DetectionMap_matches(self->detections, fits, chunk[rank - 1], chunk[rank - 2])) {
+            writer->detections = self->detections;
+        } else if (self->detections != NULL) {
+            printf("Note: HDU %d differs in shape from the cube; all its chunks holding data are stored.\n", fits->hdu);
+        }
+    }
+    
+    // Compressed chunks are held next to the slab
+    writer->slab_planes = self->max_memory / (codec->direct ? 2 * writer->plane_bytes : writer->plane_bytes);
+    if (writer->slab_planes < 1) writer->slab_planes = 1;
+    if (writer->slab_planes > writer->n_planes) writer->slab_planes = writer->n_planes;
+    const size_t slab_planes = writer->slab_planes;
+    
+    // Rounding and blanking happen in place, so data held in memory by the caller are copied first
+    writer->lossy = SofiaHDF5_is_lossy(self, fits, products);
+    const bool rounding = writer->lossy && self->options.quantise == QUANTISE_ROUND;
+    writer->in_place = rounding || writer->detections != NULL;
+    writer->buffer = (fits->data == NULL || writer->done > 0 || writer->in_place) ? memory_alloc(slab_planes * writer->plane_bytes) : NULL;
+    
+    pass->fits = fits;
+    pass->plane_size = fits->nx * fits->ny;
+    pass->swap = (fits->data == NULL && is_little_endian_system() && fits->word_size > 1);
+    pass->statistics = NULL;
+    pass->empty = NULL;
+    pass->detections = writer->detections;
+    pass->datasum = NULL;
+    pass->digest = NULL;
+    pass->steps = rounding ? memory_alloc(writer->n_planes * sizeof(double)) : NULL;
+    pass->quantise_bits = self->options.quantise_bits;
+    pass->half = (writer->lossy && self->options.quantise == QUANTISE_FLOAT16) ? memory_alloc(slab_planes * pass->plane_size * sizeof(uint16_t)) : NULL;
+    pass->clipped = pass->half != NULL ? memory_alloc(writer->n_planes * sizeof(int64_t)) : NULL;
+    writer->write_type = pass->half != NULL ? h5_float16_type() : H5Tcopy(writer->h5_datatype);
+    writer->chunks_total = 0;
+    writer->chunks_skipped = 0;
+    
+    if (self->options.sparse || codec->direct) {
+        pass->chunk_nx = chunk[rank - 1];
+        pass->chunk_ny = chunk[rank - 2];
+        pass->chunks_x = (fits->nx + pass->chunk_nx - 1) / pass->chunk_nx;
+        pass->chunks_y = (fits->ny + pass->chunk_ny - 1) / pass->chunk_ny;
+    }
+    
+    if (self->options.sparse) pass->empty = memory_alloc(slab_planes * pass->chunks_x * pass->chunks_y);
+    
+    chunks->pass = pass;
+    chunks->codec = codec;
+    chunks->compressed = NULL;
+    chunks->sizes = NULL;
+    writer->data_bytes = 0;
+    writer->compressed_bytes = 0;
+    
+    if (codec->direct) {
+        chunks->bound = compress_bound(pass->chunk_nx * pass->chunk_ny * codec->word_size);
+        chunks->compressed = memory_alloc(slab_planes * pass->chunks_x * pass->chunks_y * chunks->bound);
+        chunks->sizes = memory_alloc(slab_planes * pass->chunks_x * pass->chunks_y * sizeof(size_t));
+    }
+    
+    if (self->options.checksums) {
+        pass->digest = memory_alloc(writer->n_planes * sizeof(uint64_t));
+        
+        // The FITS checksums can only be verified on the bytes as they are in the file
+        if (fits->data == NULL && (get_fits_header_value(fits, "DATASUM") != NULL || get_fits_header_value(fits, "CHECKSUM") != NULL)) {
+            pass->datasum = memory_alloc(writer->n_planes * sizeof(uint32_t));
+        }
+    }
+    
+    // The checksums cover raw FITS bytes, which are not read again for planes already in DATA
+    if (writer->done > 0 && pass->datasum != NULL) {
+        printf("Note: FITS checksums are not verified when resuming a conversion.\n");
+        memory_free(pass->datasum);
+        pass->datasum = NULL;
+    }
+    
+    if (products && self->options.statistics && Statistics_supports_type(fits->data_type)) {
+        const hsize_t *dims = writer->dims;
+        pass->statistics = Statistics_new(rank == 4 ? dims[0] : 1, rank == 4 ? dims[1] : dims[0], pass->plane_size, slab_planes);
+    }
+    
+    pass->mipmaps = NULL;
+    writer->mipmap_sets = NULL;
+    
+    if (products && self->options.mipmaps && MipMaps_supports_type(fits->data_type)) {
+        pass->mipmaps = MipMaps_new(fits->nx, fits->ny, fits->data_type, slab_planes);
+        if (pass->mipmaps->n_levels > 0) {
+            writer->mipmap_sets = SofiaHDF5_create_mipmaps(self, group_id, pass->mipmaps, rank, writer->dims);
+        } else {
+            MipMaps_delete(pass->mipmaps);
+            pass->mipmaps = NULL;
+        }
+    }
+    
+    // Planes written before an interruption are read back from DATA rather than the
+    // FITS file, but only if per-plane products have to be made from them
+    writer->replay = (pass->statistics != NULL || pass->mipmaps != NULL || pass->digest != NULL);
+    writer->dxpl = distributed_transfer();
+    
+    return true;
+}
+
+// The planes [first, first + count) from DATA if they were written before an
+// interruption, else from the FITS file or the image held in memory
+const void *SofiaHDF5_read_slab(const DataWriter *writer, const size_t first, const size_t count, const bool written, hid_t mem_space)
+{
+    FitsFile *fits = writer->fits;
+    
+    if (count == 0) return fits->data != NULL ? fits->data : writer->buffer;
+    
+    if (written) {
+        if (H5Dread(writer->dataset_id, writer->h5_datatype, mem_space, writer->space_id, H5P_DEFAULT, writer->buffer) < 0) {
+            error_exit("Failed to read back data for resuming");
+        }
+        return writer->buffer;
+    }
+    
+    if (fits->data != NULL && writer->in_place) {
+        memcpy(writer->buffer, FitsFile_get_planes(fits, first, count, NULL), count * writer->plane_bytes);
+        return writer->buffer;
+    }
+    
+    if (fits->data != NULL) return FitsFile_get_planes(fits, first, count, NULL);
+    
+    FitsFile_read_planes_raw(fits, first, count, writer->buffer);
+    return writer->buffer;
+}
+
+// Byte swap and per-plane products in one parallel sweep; in-memory data are only read.
+// Planes read back from DATA are native already and only feed the products.
+void SofiaHDF5_process_slab(const SofiaHDF5 *self, const DataWriter *writer, const void *slab, const size_t first, const size_t count, const bool written)
+{
+    SlabPass slab_pass = writer->pass;
+    slab_pass.slab = (unsigned char *)slab;
+    slab_pass.first = first;
+    if (written) {
+        slab_pass.swap = false;
+        slab_pass.empty = NULL;
+        slab_pass.detections = NULL;
+        slab_pass.datasum = NULL;
+        slab_pass.steps = NULL;
+        slab_pass.half = NULL;
+    }
+    if (slab_pass.swap || writer->replay || slab_pass.empty != NULL || slab_pass.steps != NULL || slab_pass.half != NULL) {
+        parallel_for(count, self->n_threads, SlabPass_process_plane, &slab_pass);
+        if (slab_pass.statistics != NULL) Statistics_merge(slab_pass.statistics, first, count);
+    }
+    
+    return;
+}
+
+// Write a processed slab to the selection of DATA: as compressed chunks, skipping
+// the chunks holding only the fill value, or in one H5Dwrite
+void SofiaHDF5_store_slab(const SofiaHDF5 *self, DataWriter *writer, const void *slab, const hsize_t *start, const size_t count, hid_t mem_space)
+{
+    const SlabPass *pass = &writer->pass;
+    const void *stored = pass->half != NULL ? (const void *)pass->half : slab;
+    
+    size_t empty_count = 0;
+    for (size_t i = 0; pass->empty != NULL && i < count * pass->chunks_x * pass->chunks_y; i++) empty_count += pass->empty[i];
+    
+    if (writer->codec.direct && count > 0) {
+        ChunkPass *chunks = &writer->chunks;
+        chunks->data = (const unsigned char *)stored;
+        chunks->n_chunks = count * pass->chunks_x * pass->chunks_y;
+        chunks->n_workers = (size_t)self->n_threads < chunks->n_chunks ? (size_t)self->n_threads : chunks->n_chunks;
+        parallel_for(chunks->n_workers, self->n_threads, ChunkPass_compress, chunks);
+        
+        SofiaHDF5_write_chunks(chunks, writer->dataset_id, writer->rank, start, &writer->data_bytes, &writer->compressed_bytes);
+    } else if (empty_count == 0) {
+        if (H5Dwrite(writer->dataset_id, writer->write_type, mem_space, writer->space_id, writer->dxpl, stored) < 0) {
+            fprintf(stderr, "Warning: Failed to write data to HDF5 file\n");
+        }
+    } else {
+        SofiaHDF5_write_sparse(pass, writer->dataset_id, writer->write_type, mem_space, writer->space_id, writer->rank, start, count, stored);
+    }
+    
+    if (pass->empty != NULL) {
+        writer->chunks_total += count * pass->chunks_x * pass->chunks_y;
+        writer->chunks_skipped += empty_count;
+    }
+    
+    return;
+}
+
+// Downsampled planes go to the same planes of each mipmap level
+void SofiaHDF5_write_mipmap_slab(const DataWriter *writer, const hsize_t *start, hsize_t *block, const size_t count)
+{
+    const MipMaps *mipmaps = writer->pass.mipmaps;
+    const int rank = writer->rank;
+    
+    for (size_t level = 0; mipmaps != NULL && level < mipmaps->n_levels; level++) {
+        block[rank - 2] = mipmaps->height[level];
+        block[rank - 1] = mipmaps->width[level];
+        
+        hid_t level_space = H5Dget_space(writer->mipmap_sets[level]);
+        hid_t level_mem = H5Screate_simple(rank, block, NULL);
+        if (count > 0) {
+            H5Sselect_hyperslab(level_space, H5S_SELECT_SET, start, NULL, block, NULL);
+        } else {
+            H5Sselect_none(level_space);
+            H5Sselect_none(level_mem);
+        }
+        H5Dwrite(writer->mipmap_sets[level], writer->h5_datatype, level_mem, level_space, writer->dxpl, mipmaps->levels[level]);
+        H5Sclose(level_mem);
+        H5Sclose(level_space);
+    }
+    
+    return;
+}
+
+// Combine the per-plane results of all ranks, write the attributes and products of
+// the complete DATA set and release the writer
+void SofiaHDF5_finish_data(SofiaHDF5 *self, DataWriter *writer, hid_t group_id)
+{
+    FitsFile *fits = writer->fits;
+    SlabPass *pass = &writer->pass;
+    const size_t n_planes = writer->n_planes;
+    
+    H5Pclose(writer->dxpl);
+    H5Tclose(writer->write_type);
+    FitsFile_close(fits);
+    memory_free(writer->buffer);
+    memory_free(pass->half);
+    memory_free(pass->empty);
+    memory_free(writer->chunks.compressed);
+    memory_free(writer->chunks.sizes);
+    
+    // Per-plane results of the other ranks, so that all ranks write the same attributes
+    if (pass->datasum != NULL) distributed_gather(pass->datasum, sizeof(uint32_t), n_planes);
+    if (pass->digest != NULL) distributed_gather(pass->digest, sizeof(uint64_t), n_planes);
+    if (pass->statistics != NULL) {
+        SofiaHDF5_gather_statistics(pass->statistics);
+        Statistics_finalise(pass->statistics);
+        distributed_sum(pass->statistics->cube_histogram, pass->statistics->n_stokes * pass->statistics->n_bins);
+    }
+    if (pass->steps != NULL) distributed_gather(pass->steps, sizeof(double), n_planes);
+    if (pass->clipped != NULL) distributed_gather(pass->clipped, sizeof(int64_t), n_planes);
+    
+    if (pass->datasum != NULL) {
+        uint32_t datasum = 0;
+        for (size_t i = 0; i < n_planes; i++) datasum = checksum_fits_add(datasum, pass->datasum[i]);
+        SofiaHDF5_verify_checksums(fits, datasum);
+        memory_free(pass->datasum);
+    }
+    
+    if (pass->digest != NULL) {
+        SofiaHDF5_write_content_hash(writer->dataset_id, pass->digest, n_planes);
+        memory_free(pass->digest);
+    }
+    
+    if (writer->chunks_total > 0) {
+        const size_t chunk_bytes = pass->chunk_nx * pass->chunk_ny * fits->word_size;
+        printf("Skipped %zu of %zu chunks %s (up to %.1f MB not written).\n", writer->chunks_skipped, writer->chunks_total,
+               writer->detections != NULL ? "away from the detections or holding only the fill value" : "holding only the fill value",
+               (double)(writer->chunks_skipped * chunk_bytes) / MEGABYTE);
+    }
+    
+    if (writer->compressed_bytes > 0) {
+        printf("Compressed %.1f MB of data to %.1f MB (ratio %.2f) on %d thread(s).\n", (double)writer->data_bytes / MEGABYTE,
+               (double)writer->compressed_bytes / MEGABYTE, (double)writer->data_bytes / (double)writer->compressed_bytes, self->n_threads);
+    }
+    
+    if (writer->products && self->options.swizzle != SWIZZLE_NONE && fits->nz > 1) {
+        SofiaHDF5_write_swizzled(self, group_id, writer->dataset_id, fits, writer->rank, writer->dims);
+    }
+    
+    H5Dclose(writer->dataset_id);
+    H5Sclose(writer->space_id);
+    
+    if (pass->mipmaps != NULL) {
+        for (size_t level = 0; level < pass->mipmaps->n_levels; level++) H5Dclose(writer->mipmap_sets[level]);
+        memory_free(writer->mipmap_sets);
+        MipMaps_delete(pass->mipmaps);
+    }
+    
+    if (pass->statistics != NULL) {
+        SofiaHDF5_write_statistics(self, group_id, pass->statistics, fits->data_type);
+    }
+    
+    if (writer->lossy) SofiaHDF5_write_quantisation(self, group_id, pass->steps, pass->clipped, n_planes);
+    memory_free(pass->steps);
+    memory_free(pass->clipped);
+    Statistics_delete(pass->statistics);
+    
+    // DATA and its products are complete
+    H5Adelete_by_name(group_id, "DATA", "PROGRESS", H5P_DEFAULT);
+    if (self->options.resume && self->in_memory == 0) H5Fflush(group_id, H5F_SCOPE_GLOBAL);
+    
+    return;
+}
+
+// Complete the channel statistics with those of the planes converted by other MPI ranks
+void SofiaHDF5_gather_statistics(Statistics *stats)
+{
+    const size_t n_planes = stats->n_stokes * stats->n_channels;
+    
+    distributed_gather(stats->min, sizeof(double), n_planes);
+    distributed_gather(stats->max, sizeof(double), n_planes);
+    distributed_gather(stats->sum, sizeof(double), n_planes);
+    distributed_gather(stats->sum_sq, sizeof(double), n_planes);
+    distributed_gather(stats->nan_count, sizeof(int64_t), n_planes);
+    distributed_gather(stats->histogram, stats->n_bins * sizeof(int64_t), n_planes);
+    
+    return;
+}
+
+// Combine per-plane (or per-block) digests into "xxh64:<hex>"
+void format_content_hash(const uint64_t *digest, const size_t n_digests, char *value)
+{
+    unsigned char *bytes = memory_alloc(n_digests * sizeof(uint64_t) + 1);
+    for (size_t i = 0; i < n_digests; i++) {
+        for (int b = 0; b < 8; b++) bytes[8 * i + b] = (unsigned char)(digest[i] >> (8 * b));
+    }
+    
+    snprintf(value, 32, "xxh64:%016llx", (unsigned long long)checksum_xxh64(bytes, n_digests * sizeof(uint64_t), 0));
+    memory_free(bytes);
+    
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Resuming                                                          //
+// ----------------------------------------------------------------- //
+// DATA is created with a PROGRESS attribute of 0, which is removed  //
+// once DATA and all its products are complete. With hdf5.resume,    //
+// PROGRESS is updated to the number of planes on disk and the file  //
+// is flushed after every slab; otherwise an interrupted DATA set    //
+// is converted again from its first plane.                          //
+// ----------------------------------------------------------------- //
+
+// Reopen the file of an interrupted run; it is only used if it belongs to the same cube
+bool SofiaHDF5_reopen(SofiaHDF5 *self)
+{
+    hid_t file_id;
+    H5E_BEGIN_TRY {
+        file_id = SofiaHDF5_open_file(self, true);
+    } H5E_END_TRY;
+    
+    bool valid = (file_id >= 0 && H5Lexists(file_id, "SoFiA", H5P_DEFAULT) > 0);
+    
+    // The raw header must be the one of the cube being converted
+    if (valid && H5Lexists(file_id, "/SoFiA/HEADER", H5P_DEFAULT) > 0) {
+        hid_t header_set = H5Dopen2(file_id, "/SoFiA/HEADER", H5P_DEFAULT);
+        hid_t space_id = H5Dget_space(header_set);
+        const size_t n_cards = (size_t)H5Sget_simple_extent_npoints(space_id);
+        H5Sclose(space_id);
+        
+        valid = (n_cards * FITS_HEADER_LINE_SIZE <= self->cube_data->header_size);
+        if (valid) {
+            hid_t str_type = H5Tcopy(H5T_C_S1);
+            H5Tset_size(str_type, FITS_HEADER_LINE_SIZE);
+            H5Tset_strpad(str_type, H5T_STR_SPACEPAD);
+            char *cards = memory_alloc(n_cards * FITS_HEADER_LINE_SIZE);
+            H5Dread(header_set, str_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, cards);
+            valid = (memcmp(cards, self->cube_data->header, n_cards * FITS_HEADER_LINE_SIZE) == 0);
+            memory_free(cards);
+            H5Tclose(str_type);
+        }
+        H5Dclose(header_set);
+    }
+    
+    if (!valid) {
+        printf("Existing file %s cannot be resumed; starting over.\n", self->hdf5name);
+        if (file_id >= 0) H5Fclose(file_id);
+        return false;
+    }
+    
+    printf("Continuing in existing file %s.\n", self->hdf5name);
+    self->file_id = file_id;
+    return true;
+}
+
+// Open a group written by an interrupted run, or create it. Its header is (re)written
+// unless DATA exists already, which means the header was complete.
+hid_t SofiaHDF5_open_group(SofiaHDF5 *self, hid_t parent_id, const char *name, const FitsFile *fits)
+{
+    hid_t group_id;
+    
+    if (H5Lexists(parent_id, name, H5P_DEFAULT) > 0) {
+        group_id = H5Gopen2(parent_id, name, H5P_DEFAULT);
+        if (H5Lexists(group_id, "DATA", H5P_DEFAULT) > 0) return group_id;
+        
+        // Clear attributes that may be incomplete; HEADER was checked on reopening
+        hsize_t n_attrs = 0;
+        H5Aiterate2(group_id, H5_INDEX_NAME, H5_ITER_INC, NULL, h5_count_attribute, &n_attrs);
+        for (hsize_t i = 0; i < n_attrs; i++) H5Adelete_by_idx(group_id, ".", H5_INDEX_NAME, H5_ITER_DEC, 0, H5P_DEFAULT);
+    } else {
+        hid_t gcpl = SofiaHDF5_group_create_plist(self);
+        group_id = H5Gcreate2(parent_id, name, H5P_DEFAULT, gcpl, H5P_DEFAULT);
+        H5Pclose(gcpl);
+    }
+    
+    if (group_id < 0) {
+        char error_msg[MAX_STRING_LENGTH + 100];
+        snprintf(error_msg, sizeof(error_msg), "Cannot create %s group in HDF5 file", name);
+        error_exit(error_msg);
+    }
+    
+    SofiaHDF5_write_header(self, group_id, fits);
+    SofiaHDF5_write_raw_header(self, group_id, fits);
+    
+    return group_id;
+}
+
+// Open the DATA set of a group for writing. A complete one from an earlier run is
+// skipped (returns -1); for an incomplete one, 'done' is set to the planes on disk
+// and products that are made along with DATA are removed to be made again.
+hid_t SofiaHDF5_open_data(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits, const bool products,
+                          const int rank, const hsize_t *dims, hsize_t *chunk, size_t *done)
+{
+    const bool lossy = SofiaHDF5_is_lossy(self, fits, products);
+    const hid_t h5_datatype = (lossy && self->options.quantise == QUANTISE_FLOAT16) ? h5_float16_type() : H5Tcopy(h5_native_type(fits->data_type));
+    *done = 0;
+    
+    // Chunk shape is needed either way
+    const bool chunked = self->options.sparse || self->options.compression != COMPRESSION_NONE;
+    hid_t dcpl = chunked ? SofiaHDF5_data_create_plist(self, fits, rank, dims, chunk) : H5P_DEFAULT;
+    
+    if (H5Lexists(group_id, "DATA", H5P_DEFAULT) > 0) {
+        hid_t dataset_id = H5Dopen2(group_id, "DATA", H5P_DEFAULT);
+        if (dcpl != H5P_DEFAULT) H5Pclose(dcpl);
+        H5Tclose(h5_datatype);
+        
+        if (H5Aexists(dataset_id, "PROGRESS") <= 0) {
+            printf("DATA is complete already.\n");
+            H5Dclose(dataset_id);
+            return -1;
+        }
+        
+        unsigned long long progress = 0;
+        hid_t attr_id = H5Aopen(dataset_id, "PROGRESS", H5P_DEFAULT);
+        H5Aread(attr_id, H5T_NATIVE_ULLONG, &progress);
+        H5Aclose(attr_id);
+        *done = (size_t)progress;
+        
+        printf("Resuming DATA at plane %zu of %zu.\n", *done, FitsFile_get_plane_count(fits));
+        
+        static const char *product_groups[] = {"Statistics", "MipMaps", "SwizzledData"};
+        for (size_t i = 0; products && i < sizeof(product_groups) / sizeof(product_groups[0]); i++) {
+            if (H5Lexists(group_id, product_groups[i], H5P_DEFAULT) > 0) H5Ldelete(group_id, product_groups[i], H5P_DEFAULT);
+        }
+        
+        return dataset_id;
+    }
+    
+    hid_t space_id = H5Screate_simple(rank, dims, NULL);
+    hid_t dataset_id = H5Dcreate2(group_id, "DATA", h5_datatype, space_id, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    H5Sclose(space_id);
+    H5Tclose(h5_datatype);
+    if (dcpl != H5P_DEFAULT) H5Pclose(dcpl);
+    
+    if (dataset_id < 0) {
+        fprintf(stderr, "Warning: Failed to create data set in HDF5 file\n");
+        return -1;
+    }
+    
+    SofiaHDF5_set_progress(self, dataset_id, 0);
+    return dataset_id;
+}
+
+// Record the number of planes written and, with hdf5.resume, flush the file (a
+// file built in memory has nothing on disk to checkpoint until it is closed)
+void SofiaHDF5_set_progress(const SofiaHDF5 *self, hid_t dataset_id, const size_t planes)
+{
+    const unsigned long long progress = planes;
+    
+    hid_t attr_id;
+    if (H5Aexists(dataset_id, "PROGRESS") > 0) {
+        attr_id = H5Aopen(dataset_id, "PROGRESS", H5P_DEFAULT);
+    } else {
+        hid_t attr_space = H5Screate(H5S_SCALAR);
+        attr_id = H5Acreate2(dataset_id, "PROGRESS", H5T_STD_U64LE, attr_space, H5P_DEFAULT, H5P_DEFAULT);
+        H5Sclose(attr_space);
+    }
+    
+    H5Awrite(attr_id, H5T_NATIVE_ULLONG, &progress);
+    H5Aclose(attr_id);
+    if (self->options.resume && self->in_memory == 0) H5Fflush(dataset_id, H5F_SCOPE_GLOBAL);
+    
+    return;
+}
+
+// H5Aiterate2 callback counting attributes
+herr_t h5_count_attribute(hid_t location_id, const char *name, const H5A_info_t *info, void *data)
+{
+    (void)location_id;
+    (void)name;
+    (void)info;
+    (*(hsize_t *)data)++;
+    return 0;
+}
+
+// ----------------------------------------------------------------- //
+// Manifest                                                          //
+// ----------------------------------------------------------------- //
+// /Manifest/<product> records FILE, SIZE and MTIME of the input a   //
+// product was made from. An input counts as unchanged if all three  //
+// match. If only the time differs, the content decides: FITS data   //
+// are hashed as for CONTENT_HASH and compared with DATA, other      //
+// files are compared with the HASH kept in the manifest.            //
+// ----------------------------------------------------------------- //
+
+// Whether the input of a product is the one recorded in the manifest. For FITS
+// input, 'fits' is the image (with extensions) behind the DATA sets in 'group_path'.
+bool SofiaHDF5_manifest_unchanged(SofiaHDF5 *self, const char *product, const char *filename, const char *group_path, FitsFile *fits)
+{
+    char path[MAX_STRING_LENGTH];
+    snprintf(path, sizeof(path), "/Manifest/%s", product);
+    
+    struct stat info;
+    if (stat(filename, &info) != 0 || !S_ISREG(info.st_mode)) return false;
+    if (H5Lexists(self->file_id, "Manifest", H5P_DEFAULT) <= 0 || H5Lexists(self->file_id, path, H5P_DEFAULT) <= 0) return false;
+    
+    char recorded_file[MAX_PATH_LENGTH];
+    char recorded_hash[32];
+    unsigned long long recorded_size = 0;
+    long long recorded_mtime = 0;
+    
+    hid_t entry = H5Gopen2(self->file_id, path, H5P_DEFAULT);
+    h5_read_string_attribute(entry, "FILE", recorded_file, sizeof(recorded_file));
+    h5_read_string_attribute(entry, "HASH", recorded_hash, sizeof(recorded_hash));
+    h5_read_scalar_attribute(entry, "SIZE", H5T_NATIVE_ULLONG, &recorded_size);
+    h5_read_scalar_attribute(entry, "MTIME", H5T_NATIVE_LLONG, &recorded_mtime);
+    H5Gclose(entry);
+    
+    if (strcmp(recorded_file, filename) != 0 || recorded_size != (unsigned long long)info.st_size) return false;
+    if (recorded_mtime == (long long)info.st_mtime) return true;
+    
+    // Touched but possibly identical, as when SoFiA is run again with the same settings
+    printf("%s input %s was modified; comparing its content.\n", product, filename);
+    
+    char hash[32];
+    
+    if (fits == NULL) {
+        return recorded_hash[0] != '\0' && file_content_hash(filename, hash) && strcmp(hash, recorded_hash) == 0;
+    }
+    
+    for (FitsFile *hdu = fits; hdu != NULL; hdu = hdu->next) {
+        if (hdu->data_size == 0) continue;
+    
+        char data_path[MAX_STRING_LENGTH];
+        if (hdu == fits) snprintf(data_path, sizeof(data_path), "%s/DATA", group_path);
+        else snprintf(data_path, sizeof(data_path), "%s/HDU%d", group_path, hdu->hdu);
+    
+        if (H5Lexists(self->file_id, data_path, H5P_DEFAULT) <= 0) return false;
+        if (hdu != fits) {
+            strcat(data_path, "/DATA");
+            if (H5Lexists(self->file_id, data_path, H5P_DEFAULT) <= 0) return false;
+        }
+    
+        char stored[32];
+        hid_t dataset_id = H5Dopen2(self->file_id, data_path, H5P_DEFAULT);
+        h5_read_string_attribute(dataset_id, "CONTENT_HASH", stored, sizeof(stored));
+        H5Dclose(dataset_id);
+    
+        if (stored[0] == '\0') return false;
+        SofiaHDF5_fits_content_hash(self, hdu, hash);
+        if (strcmp(hash, stored) != 0) return false;
+    }
+    
+    return true;
+}
+
+// Record the input of a product; with 'hash' set, its content hash is kept as well
+void SofiaHDF5_manifest_record(SofiaHDF5 *self, const char *product, const char *filename, const bool hash)
+{
+    struct stat info;
+    if (stat(filename, &info) != 0 || !S_ISREG(info.st_mode)) return;
+    
+    hid_t manifest = H5Lexists(self->file_id, "Manifest", H5P_DEFAULT) > 0
+                   ? H5Gopen2(self->file_id, "Manifest", H5P_DEFAULT)
+                   : H5Gcreate2(self->file_id, "Manifest", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (manifest < 0) {
+        fprintf(stderr, "Warning: Failed to create manifest in HDF5 file\n");
+        return;
+    }
+    
+    if (H5Lexists(manifest, product, H5P_DEFAULT) > 0) H5Ldelete(manifest, product, H5P_DEFAULT);
+    hid_t entry = H5Gcreate2(manifest, product, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    
+    const unsigned long long size = (unsigned long long)info.st_size;
+    const long long mtime = (long long)info.st_mtime;
+    
+    h5_write_string_attribute(entry, "FILE", filename);
+    h5_write_scalar_attribute(entry, "SIZE", H5T_STD_U64LE, H5T_NATIVE_ULLONG, &size);
+    h5_write_scalar_attribute(entry, "MTIME", H5T_STD_I64LE, H5T_NATIVE_LLONG, &mtime);
+    
+    char value[32];
+    if (hash && file_content_hash(filename, value)) h5_write_string_attribute(entry, "HASH", value);
+    
+    H5Gclose(entry);
+    H5Gclose(manifest);
+    
+    return;
+}
+
+// Remove a product group together with its manifest entry
+void SofiaHDF5_remove_product(SofiaHDF5 *self, hid_t sofia_group, const char *name)
+{
+    if (H5Lexists(sofia_group, name, H5P_DEFAULT) > 0) {
+        printf("Removing %s from %s.\n", name, self->hdf5name);
+        H5Ldelete(sofia_group, name, H5P_DEFAULT);
+    }
+    
+    char path[MAX_STRING_LENGTH];
+    snprintf(path, sizeof(path), "/Manifest/%s", name);
+    if (H5Lexists(self->file_id, "Manifest", H5P_DEFAULT) > 0 && H5Lexists(self->file_id, path, H5P_DEFAULT) > 0) {
+        H5Ldelete(self->file_id, path, H5P_DEFAULT);
+    }
+    
+    return;
+}
+
+// CONTENT_HASH that DATA would get from this image, computed from the FITS file
+void SofiaHDF5_fits_content_hash(SofiaHDF5 *self, FitsFile *fits, char *value)
+{
+    const size_t n_planes = FitsFile_get_plane_count(fits);
+    const size_t plane_bytes = FitsFile_get_plane_bytes(fits);
+    size_t slab_planes = self->max_memory / plane_bytes;
+    if (slab_planes < 1) slab_planes = 1;
+    if (slab_planes > n_planes) slab_planes = n_planes;
+    
+    void *buffer = (fits->data == NULL) ? memory_alloc(slab_planes * plane_bytes) : NULL;
+    
+    SlabPass pass;
+    memset(&pass, 0, sizeof(SlabPass));
+    pass.fits = fits;
+    pass.plane_size = fits->nx * fits->ny;
+    pass.swap = (fits->data == NULL && is_little_endian_system() && fits->word_size > 1);
+    pass.digest = memory_alloc(n_planes * sizeof(uint64_t));
+    
+    for (size_t first = 0; first < n_planes; first += slab_planes) {
+        const size_t count = n_planes - first < slab_planes ? n_planes - first : slab_planes;
+    
+        if (fits->data != NULL) {
+            pass.slab = (unsigned char *)FitsFile_get_planes(fits, first, count, NULL);
+        } else {
+            FitsFile_read_planes_raw(fits, first, count, buffer);
+            pass.slab = buffer;
+        }
+        pass.first = first;
+        parallel_for(count, self->n_threads, SlabPass_process_plane, &pass);
+    }
+    
+    FitsFile_close(fits);
+    format_content_hash(pass.digest, n_planes, value);
+    memory_free(pass.digest);
+    memory_free(buffer);
+    
+    return;
+}
+
+// Content hash of any file: XXH64 over the digests of its 1 MB blocks
+bool file_content_hash(const char *filename, char *value)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return false;
+    
+    unsigned char *block = memory_alloc(MEGABYTE);
+    size_t n_blocks = 0;
+    size_t capacity = 64;
+    uint64_t *digest = memory_alloc(capacity * sizeof(uint64_t));
+    
+    size_t n_read;
+    while ((n_read = fread(block, 1, MEGABYTE, file)) > 0) {
+        if (n_blocks == capacity) {
+            capacity *= 2;
+            digest = memory_realloc(digest, capacity * sizeof(uint64_t));
+        }
+        digest[n_blocks++] = checksum_xxh64(block, n_read, 0);
+    }
+    
+    const bool success = !ferror(file);
+    fclose(file);
+    
+    if (success) format_content_hash(digest, n_blocks, value);
+    memory_free(digest);
+    memory_free(block);
+    
+    return success;
+}
+
+// Read a string attribute into 'value' (empty if it does not exist)
+void h5_read_string_attribute(hid_t location_id, const char *name, char *value, const size_t size)
+{
+    value[0] = '\0';
+    if (H5Aexists(location_id, name) <= 0) return;
+    
+    hid_t attr_id = H5Aopen(location_id, name, H5P_DEFAULT);
+    hid_t str_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(str_type, size);
+    H5Tset_strpad(str_type, H5T_STR_NULLTERM);
+    if (H5Aread(attr_id, str_type, value) < 0) value[0] = '\0';
+    value[size - 1] = '\0';
+    H5Tclose(str_type);
+    H5Aclose(attr_id);
+    
+    return;
+}
+
+// Write a string attribute sized to its value
+void h5_write_string_attribute(hid_t location_id, const char *name, const char *value)
+{
+    const size_t length = strlen(value);
+    hid_t str_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(str_type, length > 0 ? length : 1);
+    hid_t attr_space = H5Screate(H5S_SCALAR);
+    hid_t attr_id = H5Acreate2(location_id, name, str_type, attr_space, H5P_DEFAULT, H5P_DEFAULT);
+    if (attr_id >= 0) {
+        H5Awrite(attr_id, str_type, length > 0 ? value : " ");
+        H5Aclose(attr_id);
+    }
+    H5Sclose(attr_space);
+    H5Tclose(str_type);
+    
+    return;
+}
+
+// Read a scalar numeric attribute (left unchanged if it does not exist)
+void h5_read_scalar_attribute(hid_t location_id, const char *name, hid_t mem_type, void *value)
+{
+    if (H5Aexists(location_id, name) <= 0) return;
+    
+    hid_t attr_id = H5Aopen(location_id, name, H5P_DEFAULT);
+    H5Aread(attr_id, mem_type, value);
+    H5Aclose(attr_id);
+    
+    return;
+}
+
+// Write a scalar numeric attribute
+void h5_write_scalar_attribute(hid_t location_id, const char *name, hid_t file_type, hid_t mem_type, const void *value)
+{
+    hid_t attr_space = H5Screate(H5S_SCALAR);
+    hid_t attr_id = H5Acreate2(location_id, name, file_type, attr_space, H5P_DEFAULT, H5P_DEFAULT);
+    if (attr_id >= 0) {
+        H5Awrite(attr_id, mem_type, value);
+        H5Aclose(attr_id);
+    }
+    H5Sclose(attr_space);
+    
+    return;
+}
+
+// Creation properties of a chunked DATA set: chunks of at most one plane of
+// SPARSE_CHUNK_SIZE x SPARSE_CHUNK_SIZE pixels and a fill value (NaN for floating-point
+// data, 0 otherwise). Sparse data sets only allocate chunks when written. Compressed
+// ones are shuffled, then deflated or compressed with Zstd (filter 32015). With
+// checksums enabled, every chunk carries a Fletcher32 checksum, as the last filter.
+hid_t SofiaHDF5_data_create_plist(const SofiaHDF5 *self, const FitsFile *fits, const int rank, const hsize_t *dims, hsize_t *chunk)
+{
+    for (int i = 0; i < rank - 2; i++) chunk[i] = 1;
+    chunk[rank - 2] = dims[rank - 2] < SPARSE_CHUNK_SIZE ? dims[rank - 2] : SPARSE_CHUNK_SIZE;
+    chunk[rank - 1] = dims[rank - 1] < SPARSE_CHUNK_SIZE ? dims[rank - 1] : SPARSE_CHUNK_SIZE;
+    
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl, rank, chunk);
+    if (self->options.sparse) {
+        H5Pset_alloc_time(dcpl, H5D_ALLOC_TIME_INCR);
+        H5Pset_fill_time(dcpl, H5D_FILL_TIME_IFSET);
+    }
+    if (self->options.compression == COMPRESSION_DEFLATE) {
+        H5Pset_shuffle(dcpl);
+        H5Pset_deflate(dcpl, (unsigned int)self->options.compression_level);
+    } else if (self->options.compression == COMPRESSION_ZSTD) {
+        const unsigned int values[1] = {(unsigned int)self->options.compression_level};
+        H5Pset_shuffle(dcpl);
+        H5Pset_filter(dcpl, COMPRESS_FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, values);
+    }
+    if (self->options.checksums) H5Pset_fletcher32(dcpl);
+    
+    const float nan_flt = NAN;
+    const double nan_dbl = NAN;
+    const long long zero = 0;
+    const void *fill = (fits->data_type == -32) ? (const void *)&nan_flt
+                     : (fits->data_type == -64) ? (const void *)&nan_dbl : (const void *)&zero;
+    H5Pset_fill_value(dcpl, h5_native_type(fits->data_type), fill);
+    
+    return dcpl;
+}
+
+// Chunks of DATA near the detections: the source bounding boxes of the catalogue if there
+// is one, else the non-zero voxels of the mask. Without either, hdf5.detections falls
+// back to hdf5.sparse and NULL is returned.
+DetectionMap *SofiaHDF5_detection_map(SofiaHDF5 *self, const FitsFile *fits, const size_t chunk_nx, const size_t chunk_ny)
+{
+    const FitsFile *cube = self->cube_data != NULL ? self->cube_data : fits;
+    const FitsFile *mask = self->mask_data;
+    const bool mask_fits = mask != NULL && mask->nx == cube->nx && mask->ny == cube->ny && mask->nz == cube->nz;
+    
+    if (self->catalog == NULL && !mask_fits) {
+        printf("Note: hdf5.detections needs a catalogue or a mask of the cube's shape; storing all chunks that hold data.\n");
+        self->options.detections = false;
+        return NULL;
+    }
+    
+    DetectionMap *map = DetectionMap_new(cube, chunk_nx, chunk_ny);
+    if (self->catalog != NULL) DetectionMap_add_catalog(map, self->catalog, self->options.detection_margin);
+    else DetectionMap_add_mask(map, self->mask_data, self->options.detection_margin, self->max_memory);
+    
+    const size_t total = map->nz * map->nw * map->chunks_x * map->chunks_y;
+    const size_t kept = DetectionMap_count(map);
+    printf("Detections (%s, margin %g pixels) meet %zu of %zu chunks (%.1f%%).\n", self->catalog != NULL ? "catalogue" : "mask",
+           self->options.detection_margin, kept, total, total > 0 ? 100.0 * (double)kept / (double)total : 0.0);
+    
+    return map;
+}
+
+// Whether DATA of an image is stored with reduced precision (cube only, floating point)
+bool SofiaHDF5_is_lossy(const SofiaHDF5 *self, const FitsFile *fits, const bool products)
+{
+    return products && self->options.quantise != QUANTISE_NONE && quantise_supports_type(fits->data_type);
+}
+
+// IEEE 754 half precision as a file type (HDF5 1.10 predefines none); the caller closes it
+hid_t h5_float16_type(void)
+{
+    hid_t type = H5Tcopy(H5T_IEEE_F32LE);
+    H5Tset_fields(type, 15, 10, 5, 0, 10);
+    H5Tset_offset(type, 0);
+    H5Tset_precision(type, 16);
+    H5Tset_size(type, 2);
+    H5Tset_ebias(type, 15);
+    return type;
+}
+
+// Record how DATA was reduced in precision and the resulting error bound: for
+// rounding the absolute bound of every channel (QUANTISATION_STEP / 2, in Statistics
+// layout) and of the cube, for half precision the relative bound, which does not
+// hold for the QUANTISATION_CLIPPED values that were clipped to the largest half.
+void SofiaHDF5_write_quantisation(SofiaHDF5 *self, hid_t group_id, const double *steps, const int64_t *clipped, const size_t n_planes)
+{
+    hid_t dataset_id = H5Dopen2(group_id, "DATA", H5P_DEFAULT);
+    if (dataset_id < 0) return;
+    
+    if (self->options.quantise == QUANTISE_ROUND && steps != NULL) {
+        const int bits = self->options.quantise_bits;
+        double max_step = 0.0;
+        for (size_t i = 0; i < n_planes; i++) if (steps[i] > max_step) max_step = steps[i];
+        const double max_error = max_step / 2.0;
+        
+        h5_write_string_attribute(dataset_id, "QUANTISATION", "round");
+        h5_write_scalar_attribute(dataset_id, "QUANTISATION_BITS", H5T_STD_I32LE, H5T_NATIVE_INT, &bits);
+        h5_write_scalar_attribute(dataset_id, "QUANTISATION_ERROR", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &max_error);
+        
+        hsize_t dims[1] = {n_planes};
+        h5_write_array(group_id, "QUANTISATION_STEP", 1, dims, H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, steps);
+        
+        printf("Rounded DATA to %d bits below the channel RMS (error at most %.3g).\n", bits, max_error);
+    } else if (self->options.quantise == QUANTISE_FLOAT16) {
+        const double relative_error = QUANTISE_FLOAT16_RELATIVE_ERROR;
+        h5_write_string_attribute(dataset_id, "QUANTISATION", "float16");
+        h5_write_scalar_attribute(dataset_id, "QUANTISATION_RELATIVE_ERROR", H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, &relative_error);
+        
+        int64_t n_clipped = 0;
+        for (size_t i = 0; clipped != NULL && i < n_planes; i++) n_clipped += clipped[i];
+        h5_write_scalar_attribute(dataset_id, "QUANTISATION_CLIPPED", H5T_STD_I64LE, H5T_NATIVE_INT64, &n_clipped);
+        if (n_clipped > 0) {
+            printf("Warning: %lld values beyond %g do not fit half precision and were clipped.\n", (long long)n_clipped, QUANTISE_FLOAT16_MAX);
+        }
+        printf("Stored DATA in half precision (relative error at most %.3g).\n", relative_error);
+    }
+    
+    H5Dclose(dataset_id);
+    return;
+}
+
+// Filters of DATA, and whether the converter can apply them itself: shuffle (optional)
+// and deflate or Zstd, then fletcher32 (optional). 'chunk' is set to the chunk shape of DATA.
+void SofiaHDF5_chunk_codec(const SofiaHDF5 *self, hid_t dataset_id, const int rank, hsize_t *chunk, ChunkCodec *codec)
+{
+    memset(codec, 0, sizeof(ChunkCodec));
+    if (self->options.compression == COMPRESSION_NONE) return;
+    
+    hid_t dcpl = H5Dget_create_plist(dataset_id);
+    hid_t type_id = H5Dget_type(dataset_id);
+    codec->word_size = H5Tget_size(type_id);
+    
+    if (H5Pget_layout(dcpl) == H5D_CHUNKED && H5Pget_chunk(dcpl, rank, chunk) == rank && codec->word_size <= sizeof(codec->fill)) {
+        const int n_filters = H5Pget_nfilters(dcpl);
+        bool compressor = false;
+        bool known = true;
+        
+        for (int i = 0; i < n_filters; i++) {
+            unsigned int flags;
+            unsigned int values[1] = {0};
+            size_t n_values = 1;
+            const H5Z_filter_t filter = H5Pget_filter2(dcpl, (unsigned int)i, &flags, &n_values, values, 0, NULL, NULL);
+            
+            if (filter == H5Z_FILTER_SHUFFLE && i == 0) {
+                codec->shuffle = true;
+            } else if ((filter == H5Z_FILTER_DEFLATE || (filter == COMPRESS_FILTER_ZSTD && compress_zstd_available())) && !compressor) {
+                compressor = true;
+                codec->zstd = (filter == COMPRESS_FILTER_ZSTD);
+                codec->level = (int)values[0];
+            } else if (filter == H5Z_FILTER_FLETCHER32 && compressor && i == n_filters - 1) {
+                codec->fletcher32 = true;
+            } else {
+                known = false;
+            }
+        }
+        
+        codec->direct = compressor && known;
+        
+        H5D_fill_value_t fill_status;
+        if (codec->direct && H5Pfill_value_defined(dcpl, &fill_status) >= 0 && fill_status != H5D_FILL_VALUE_UNDEFINED) {
+            H5Pget_fill_value(dcpl, type_id, codec->fill);
+        }
+    }
+    
+    H5Tclose(type_id);
+    H5Pclose(dcpl);
+    return;
+}
+
+// Store the compressed chunks of a slab as they are, adding the bytes of data they
+// hold and their compressed size to the totals
+void SofiaHDF5_write_chunks(const ChunkPass *chunks, hid_t dataset_id, const int rank, const hsize_t *start,
+                            size_t *data_bytes, size_t *compressed_bytes)
+{
+    const SlabPass *pass = chunks->pass;
+    const size_t per_plane = pass->chunks_x * pass->chunks_y;
+    
+    for (size_t c = 0; c < chunks->n_chunks; c++) {
+        if (chunks->sizes[c] == 0) continue;
+        
+        hsize_t offset[4];
+        for (int i = 0; i < rank; i++) offset[i] = start[i];
+        offset[rank - 3] += c / per_plane;
+        offset[rank - 2] = (c % per_plane / pass->chunks_x) * pass->chunk_ny;
+        offset[rank - 1] = (c % per_plane % pass->chunks_x) * pass->chunk_nx;
+        
+        if (H5Dwrite_chunk(dataset_id, H5P_DEFAULT, 0, offset, chunks->sizes[c], chunks->compressed + c * chunks->bound) < 0) {
+            fprintf(stderr, "Warning: Failed to write a chunk to HDF5 file\n");
+        }
+        
+        const size_t width = (offset[rank - 1] + pass->chunk_nx < pass->fits->nx) ? pass->chunk_nx : pass->fits->nx - offset[rank - 1];
+        const size_t height = (offset[rank - 2] + pass->chunk_ny < pass->fits->ny) ? pass->chunk_ny : pass->fits->ny - offset[rank - 2];
+        *data_bytes += width * height * chunks->codec->word_size;
+        *compressed_bytes += chunks->sizes[c];
+    }
+    
+    return;
+}
+
+// Write the chunks of a slab that hold data one by one; all other chunks are
+// left unallocated and read back as the fill value.
+void SofiaHDF5_write_sparse(const SlabPass *pass, hid_t dataset_id, hid_t mem_type, hid_t mem_space, hid_t file_space,
+                            const int rank, const hsize_t *start, const size_t count, const void *slab)
+{
+    const size_t chunks = pass->chunks_x * pass->chunks_y;
+    
+    for (size_t plane = 0; plane < count; plane++) {
+        for (size_t c = 0; c < chunks; c++) {
+            if (pass->empty[plane * chunks + c]) continue;
+            
+            const size_t x0 = (c % pass->chunks_x) * pass->chunk_nx;
+            const size_t y0 = (c / pass->chunks_x) * pass->chunk_ny;
+            
+            hsize_t mem_start[4] = {0, 0, 0, 0};
+            hsize_t file_start[4];
+            hsize_t block[4] = {1, 1, 1, 1};
+            for (int i = 0; i < rank; i++) file_start[i] = start[i];
+            mem_start[rank - 3] = plane;
+            file_start[rank - 3] += plane;
+            mem_start[rank - 2] = file_start[rank - 2] = y0;
+            mem_start[rank - 1] = file_start[rank - 1] = x0;
+            block[rank - 2] = (y0 + pass->chunk_ny < pass->fits->ny) ? pass->chunk_ny : pass->fits->ny - y0;
+            block[rank - 1] = (x0 + pass->chunk_nx < pass->fits->nx) ? pass->chunk_nx : pass->fits->nx - x0;
+            
+            H5Sselect_hyperslab(mem_space, H5S_SELECT_SET, mem_start, NULL, block, NULL);
+            H5Sselect_hyperslab(file_space, H5S_SELECT_SET, file_start, NULL, block, NULL);
+            if (H5Dwrite(dataset_id, mem_type, mem_space, file_space, H5P_DEFAULT, slab) < 0) {
+                fprintf(stderr, "Warning: Failed to write data to HDF5 file\n");
+            }
+        }
+    }
+    
+    return;
+}
+
+// Compare the checksum of the data unit with the DATASUM card and, together with the
+// header, with the CHECKSUM card; the whole HDU must sum to -0 (all bits set).
+void SofiaHDF5_verify_checksums(const FitsFile *fits, const uint32_t datasum)
+{
+    check_null(fits);
+    
+    const char *expected = get_fits_header_value(fits, "DATASUM");
+    if (expected != NULL && strlen(expected) > 0) {
+        if (strtoul(expected, NULL, 10) == datasum) {
+            printf("DATASUM of HDU %d verified.\n", fits->hdu);
+        } else {
+            fprintf(stderr, "Warning: DATASUM mismatch in HDU %d of %s (header %s, data %u); the data may be corrupted.\n",
+                    fits->hdu, fits->filename, expected, datasum);
+        }
+    }
+    
+    if (get_fits_header_value(fits, "CHECKSUM") != NULL && fits->header != NULL) {
+        const uint32_t sum = checksum_fits_add(checksum_fits(fits->header, fits->header_size, 0), datasum);
+        if (sum == 0xFFFFFFFF) {
+            printf("CHECKSUM of HDU %d verified.\n", fits->hdu);
+        } else {
+            fprintf(stderr, "Warning: CHECKSUM mismatch in HDU %d of %s; the header or data may be corrupted.\n",
+                    fits->hdu, fits->filename);
+        }
+    }
+    
+    return;
+}
+
+// Attach CONTENT_HASH to DATA: the XXH64 of the per-plane XXH64 digests (in plane order,
+// as little-endian 64-bit words), where each plane digest covers the plane's bytes as
+// stored in DATA. Recomputing it needs just one read of the data set.
+void SofiaHDF5_write_content_hash(hid_t dataset_id, const uint64_t *digest, const size_t n_planes)
+{
+    char value[32];
+    format_content_hash(digest, n_planes, value);
+    
+    if (H5Aexists(dataset_id, "CONTENT_HASH") > 0) H5Adelete(dataset_id, "CONTENT_HASH");
+    
+    hid_t str_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(str_type, strlen(value));
+    hid_t attr_space = H5Screate(H5S_SCALAR);
+    hid_t attr_id = H5Acreate2(dataset_id, "CONTENT_HASH", str_type, attr_space, H5P_DEFAULT, H5P_DEFAULT);
+    if (attr_id >= 0) {
+        H5Awrite(attr_id, str_type, value);
+        H5Aclose(attr_id);
+    }
+    H5Sclose(attr_space);
+    H5Tclose(str_type);
+    
+    return;
+}
+
+// Create DATA as an external dataset that refers to the data unit inside the FITS
+// file itself, so no image data are copied. The file type is the big-endian FITS
+// type; HDF5 converts on read. The FITS file must stay where it is.
+void SofiaHDF5_write_external(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits)
+{
+    check_null(self);
+    check_null(fits);
+    
+    hsize_t dims[4];
+    const int rank = SofiaHDF5_data_shape(fits, dims);
+    const hsize_t data_bytes = (hsize_t)fits->data_size * fits->word_size;
+    
+    // Absolute path, as HDF5 resolves relative ones against the working directory of the reader
+    char *path = realpath(fits->filename, NULL);
+    if (path == NULL) {
+        error_exit("Cannot resolve path of FITS file for external storage");
+    }
+    
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    if (H5Pset_external(dcpl, path, (off_t)fits->data_offset, data_bytes) < 0) {
+        error_exit("Failed to set external storage for data set");
+    }
+    free(path);
+    
+    hid_t space_id = H5Screate_simple(rank, dims, NULL);
+    hid_t dataset_id = H5Dcreate2(group_id, "DATA", h5_fits_type(fits->data_type), space_id,
+                                  H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    if (dataset_id < 0) {
+        fprintf(stderr, "Warning: Failed to create external data set in HDF5 file\n");
+    } else {
+        H5Dclose(dataset_id);
+    }
+    
+    H5Sclose(space_id);
+    H5Pclose(dcpl);
+    
+    return;
+}
+
+// Create DATA as a virtual data set assembled from the same data set (by path) in the
+// files of the virtual sources. Pixels not covered by any source read as blank.
+void SofiaHDF5_write_virtual(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits)
+{
+    check_null(self);
+    check_null(fits);
+    
+    hsize_t dims[4];
+    const int rank = SofiaHDF5_data_shape(fits, dims);
+    const hid_t h5_datatype = h5_native_type(fits->data_type);
+    
+    char path[MAX_STRING_LENGTH];
+    const ssize_t length = H5Iget_name(group_id, path, sizeof(path) - 6);
+    if (length <= 0) error_exit("Cannot determine the path of a virtual data set");
+    strcat(path, "/DATA");
+    
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    const double nan_value = NAN;
+    const float nan_float = NAN;
+    if (fits->data_type == -64) H5Pset_fill_value(dcpl, H5T_NATIVE_DOUBLE, &nan_value);
+    else if (fits->data_type == -32) H5Pset_fill_value(dcpl, H5T_NATIVE_FLOAT, &nan_float);
+    
+    hid_t space_id = H5Screate_simple(rank, dims, NULL);
+    
+    for (size_t i = 0; i < self->n_virtual; i++) {
+        const VirtualSource *source = &self->virtual_sources[i];
+        if (source->rank != rank) error_exit("Virtual source does not match the shape of the data set");
+        
+        hid_t source_space = H5Screate_simple(rank, source->dims, NULL);
+        H5Sselect_hyperslab(source_space, H5S_SELECT_SET, source->source, NULL, source->count, NULL);
+        H5Sselect_hyperslab(space_id, H5S_SELECT_SET, source->target, NULL, source->count, NULL);
+        
+        if (H5Pset_virtual(dcpl, space_id, source->filename, path, source_space) < 0) {
+            error_exit("Failed to map a virtual source");
+        }
+        H5Sclose(source_space);
+    }
+    
+    H5Sselect_all(space_id);
+    hid_t dataset_id = H5Dcreate2(group_id, "DATA", h5_datatype, space_id, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    if (dataset_id < 0) {
+        fprintf(stderr, "Warning: Failed to create virtual data set in HDF5 file\n");
+    } else {
+        printf("Mapped %zu virtual sources into %s.\n", self->n_virtual, path);
+        H5Dclose(dataset_id);
+    }
+    
+    H5Sclose(space_id);
+    H5Pclose(dcpl);
+    
+    return;
+}
+
+// Write SwizzledData/ZYX (or ZXY), a copy of DATA with the spectral axis last, so a
+// spectrum is one contiguous read. The copy is made out of core from the DATA just
+// written: tiles of whole rows of all channels are read back, transposed in memory
+// and written out, two tiles (source and target) fitting into max_memory.
+void SofiaHDF5_write_swizzled(SofiaHDF5 *self, hid_t group_id, hid_t dataset_id, const FitsFile *fits, const int rank, const hsize_t *dims)
+{
+    check_null(self);
+    check_null(fits);
+    
+    const bool x_major = (self->options.swizzle == SWIZZLE_ZYX);
+    const size_t nx = fits->nx;
+    const size_t ny = fits->ny;
+    const size_t nz = fits->nz;
+    const size_t n_stokes = (rank == 4) ? dims[0] : 1;
+    const hid_t h5_datatype = h5_native_type(fits->data_type);
+    
+    // CARTA names the axes fastest first; a trailing W marks the Stokes axis
+    char name[8];
+    snprintf(name, sizeof(name), "%s%s", x_major ? "ZYX" : "ZXY", rank == 4 ? "W" : "");
+    
+    hsize_t swizzled_dims[4];
+    const int axis = rank - 3;
+    if (rank == 4) swizzled_dims[0] = dims[0];
+    swizzled_dims[axis] = x_major ? nx : ny;
+    swizzled_dims[axis + 1] = x_major ? ny : nx;
+    swizzled_dims[axis + 2] = nz;
+    
+    hid_t swizzled_group = H5Gcreate2(group_id, "SwizzledData", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t swizzled_space = H5Screate_simple(rank, swizzled_dims, NULL);
+    hid_t swizzled_id = H5Dcreate2(swizzled_group, name, h5_datatype, swizzled_space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (swizzled_group < 0 || swizzled_id < 0) {
+        error_exit("Cannot create swizzled data set in HDF5 file");
+    }
+    
+    const size_t row_bytes = nx * nz * fits->word_size;
+    size_t tile_rows = self->max_memory / (2 * row_bytes);
+    if (tile_rows < 1) tile_rows = 1;
+    if (tile_rows > ny) tile_rows = ny;
+    
+    void *source = memory_alloc(tile_rows * row_bytes);
+    void *target = memory_alloc(tile_rows * row_bytes);
+    hid_t data_space = H5Dget_space(dataset_id);
+    
+    for (size_t w = 0; w < n_stokes; w++) {
+        for (size_t y = 0; y < ny; y += tile_rows) {
+            const size_t rows = (ny - y < tile_rows) ? ny - y : tile_rows;
+            
+            // Source tile: all channels of rows y .. y + rows - 1
+            hsize_t start[4] = {0, 0, 0, 0};
+            hsize_t block[4];
+            if (rank == 4) {
+                start[0] = w;
+                block[0] = 1;
+            }
+            start[axis + 1] = y;
+            block[axis] = nz;
+            block[axis + 1] = rows;
+            block[axis + 2] = nx;
+            
+            hid_t mem_space = H5Screate_simple(rank, block, NULL);
+            H5Sselect_hyperslab(data_space, H5S_SELECT_SET, start, NULL, block, NULL);
+            if (H5Dread(dataset_id, h5_datatype, mem_space, data_space, H5P_DEFAULT, source) < 0) {
+                error_exit("Failed to read back data for swizzling");
+            }
+            H5Sclose(mem_space);
+            
+            transpose_to_spectra(source, target, nz, rows, nx, fits->word_size, x_major, self->n_threads);
+            
+            // Target tile: the same rows, spectral axis last
+            start[axis] = x_major ? 0 : y;
+            start[axis + 1] = x_major ? y : 0;
+            start[axis + 2] = 0;
+            block[axis] = x_major ? nx : rows;
+            block[axis + 1] = x_major ? rows : nx;
+            block[axis + 2] = nz;
+            
+            mem_space = H5Screate_simple(rank, block, NULL);
+            H5Sselect_hyperslab(swizzled_space, H5S_SELECT_SET, start, NULL, block, NULL);
+            if (H5Dwrite(swizzled_id, h5_datatype, mem_space, swizzled_space, H5P_DEFAULT, target) < 0) {
+                fprintf(stderr, "Warning: Failed to write swizzled data to HDF5 file\n");
+            }
+            H5Sclose(mem_space);
+        }
+    }
+    
+    memory_free(source);
+    memory_free(target);
+    H5Sclose(data_space);
+    H5Dclose(swizzled_id);
+    H5Sclose(swizzled_space);
+    H5Gclose(swizzled_group);
+    
+    return;
+}
+
+// Create the MipMaps/DATA/DATA_XY_<factor> datasets of the CARTA (IDIA) schema;
+// they share the leading (channel and Stokes) axes of the full-resolution data.
+hid_t *SofiaHDF5_create_mipmaps(SofiaHDF5 *self, hid_t group_id, const MipMaps *mipmaps, const int rank, const hsize_t *dims)
+{
+    check_null(self);
+    check_null(mipmaps);
+    
+    hid_t mipmap_group = H5Gcreate2(group_id, "MipMaps", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t data_group = H5Gcreate2(mipmap_group, "DATA", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (mipmap_group < 0 || data_group < 0) {
+        error_exit("Cannot create MipMaps group in HDF5 file");
+    }
+    
+    hid_t *datasets = memory_alloc(mipmaps->n_levels * sizeof(hid_t));
+    const hid_t h5_datatype = h5_native_type(mipmaps->data_type);
+    
+    for (size_t level = 0; level < mipmaps->n_levels; level++) {
+        hsize_t level_dims[4];
+        for (int i = 0; i < rank; i++) level_dims[i] = dims[i];
+        level_dims[rank - 2] = mipmaps->height[level];
+        level_dims[rank - 1] = mipmaps->width[level];
+        
+        char name[32];
+        snprintf(name, sizeof(name), "DATA_XY_%zu", mipmaps->factor[level]);
+        
+        hid_t space_id = H5Screate_simple(rank, level_dims, NULL);
+        datasets[level] = H5Dcreate2(data_group, name, h5_datatype, space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        H5Sclose(space_id);
+        
+        if (datasets[level] < 0) {
+            error_exit("Cannot create mipmap data set in HDF5 file");
+        }
+    }
+    
+    H5Gclose(data_group);
+    H5Gclose(mipmap_group);
+    
+    return datasets;
+}
+
+// Write a small dataset of the given shape in one go
+void h5_write_array(hid_t group_id, const char *name, const int rank, const hsize_t *dims,
+                    hid_t file_type, hid_t mem_type, const void *data)
+{
+    hid_t space_id = rank > 0 ? H5Screate_simple(rank, dims, NULL) : H5Screate(H5S_SCALAR);
+    hid_t dataset_id = H5Dcreate2(group_id, name, file_type, space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    
+    if (dataset_id >= 0) {
+        H5Dwrite(dataset_id, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+        H5Dclose(dataset_id);
+    } else {
+        fprintf(stderr, "Warning: Failed to create data set '%s' in HDF5 file\n", name);
+    }
+    
+    H5Sclose(space_id);
+    return;
+}
+
+// Statistics group in the layout of the CARTA (IDIA) schema: XY holds one entry per
+// channel ([stokes][channel] for 4-D data), XYZ one entry per cube (Stokes plane).
+void SofiaHDF5_write_statistics(SofiaHDF5 *self, hid_t group_id, const Statistics *stats, const int data_type)
+{
+    check_null(self);
+    check_null(stats);
+    
+    hid_t stats_group = H5Gcreate2(group_id, "Statistics", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (stats_group < 0) {
+        fprintf(stderr, "Warning: Failed to create Statistics group in HDF5 file\n");
+        return;
+    }
+    
+    // Minimum and maximum are stored in the precision of the data, like in CARTA
+    const hid_t value_type = data_type == -64 ? H5T_IEEE_F64LE : H5T_IEEE_F32LE;
+    
+    for (int xyz = 0; xyz <= 1; xyz++) {
+        hid_t sub_group = H5Gcreate2(stats_group, xyz ? "XYZ" : "XY", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if (sub_group < 0) continue;
+        
+        // Leading dimensions: [stokes][channel] for XY, [stokes] for XYZ; unit axes are dropped
+        hsize_t dims[3];
+        int rank = 0;
+        if (stats->n_stokes > 1) dims[rank++] = stats->n_stokes;
+        if (!xyz) dims[rank++] = stats->n_channels;
+        
+        const double *min = xyz ? stats->cube_min : stats->min;
+        const double *max = xyz ? stats->cube_max : stats->max;
+        const double *sum = xyz ? stats->cube_sum : stats->sum;
+        const double *sum_sq = xyz ? stats->cube_sum_sq : stats->sum_sq;
+        const int64_t *nan_count = xyz ? stats->cube_nan_count : stats->nan_count;
+        const int64_t *histogram = xyz ? stats->cube_histogram : stats->histogram;
+        
+        h5_write_array(sub_group, "MIN", rank, dims, value_type, H5T_NATIVE_DOUBLE, min);
+        h5_write_array(sub_group, "MAX", rank, dims, value_type, H5T_NATIVE_DOUBLE, max);
+        h5_write_array(sub_group, "SUM", rank, dims, H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, sum);
+        h5_write_array(sub_group, "SUM_SQ", rank, dims, H5T_IEEE_F64LE, H5T_NATIVE_DOUBLE, sum_sq);
+        h5_write_array(sub_group, "NAN_COUNT", rank, dims, H5T_STD_I64LE, H5T_NATIVE_INT64, nan_count);
+        
+        dims[rank] = stats->n_bins;
+        h5_write_array(sub_group, "HISTOGRAM", rank + 1, dims, H5T_STD_I64LE, H5T_NATIVE_INT64, histogram);
+        
+        H5Gclose(sub_group);
+    }
+    
+    H5Gclose(stats_group);
+    return;
+}
+
+// Store the raw header cards of the cube once, as /SoFiA/HEADER; every other group
+// links to it and differs from it by its attributes only (see SofiaFITS_read_header)
+void SofiaHDF5_write_raw_header(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits_data)
+{
+    check_null(self);
+    check_null(fits_data);
+    
+    if (fits_data->header == NULL || fits_data->header_size == 0) {
+        return;  // No header to write
+    }
+    
+    if (H5Lexists(group_id, "HEADER", H5P_DEFAULT) > 0) {
+        return;  // Kept from an interrupted run
+    }
+    
+    if (fits_data != self->cube_data && H5Lexists(self->file_id, "/SoFiA/HEADER", H5P_DEFAULT) > 0) {
+        H5Lcreate_hard(self->file_id, "/SoFiA/HEADER", group_id, "HEADER", H5P_DEFAULT, H5P_DEFAULT);
+        return;
+    }
+    
+    // Count cards up to and including END
+    size_t n_cards = 0;
+    while (n_cards * FITS_HEADER_LINE_SIZE < fits_data->header_size) {
+        const char *line = fits_data->header + n_cards * FITS_HEADER_LINE_SIZE;
+        n_cards++;
+        if (strncmp(line, "END", 3) == 0 && line[3] == ' ') break;
+    }
+    
+    hid_t str_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(str_type, FITS_HEADER_LINE_SIZE);
+    H5Tset_strpad(str_type, H5T_STR_SPACEPAD);
+    
+    hsize_t dims[1] = {n_cards};
+    hid_t space_id = H5Screate_simple(1, dims, NULL);
+    
+    // Small headers fit into the object header itself, saving a separate data block
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    if (n_cards * FITS_HEADER_LINE_SIZE < 60000) H5Pset_layout(dcpl, H5D_COMPACT);
+    
+    hid_t dataset_id = H5Dcreate2(group_id, "HEADER", str_type, space_id, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+    if (dataset_id >= 0) {
+        H5Dwrite(dataset_id, str_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, fits_data->header);
+        H5Dclose(dataset_id);
+    } else {
+        fprintf(stderr, "Warning: Failed to write raw FITS header to HDF5 file\n");
+    }
+    
+    H5Pclose(dcpl);
+    H5Sclose(space_id);
+    H5Tclose(str_type);
+    
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// File-space profiles                                               //
+// ----------------------------------------------------------------- //
+// Many small data sets and attributes make HDF5 issue many small    //
+// metadata writes all over the file, which parallel file systems    //
+// handle badly. With a profile, free space is managed in pages of   //
+// one stripe (Lustre) or block (GPFS): metadata and small raw data  //
+// are gathered into their own pages, a page buffer turns their      //
+// writes into whole-page writes, and objects of at least a page     //
+// start on a page boundary. Needs the latest file format, and       //
+// readers with HDF5 1.10.1 or later.                                //
+// ----------------------------------------------------------------- //
+
+// Page size of the file-space profile; 0 for HDF5's default layout
+hsize_t SofiaHDF5_fs_page_size(const SofiaHDF5 *self)
+{
+    switch (self->options.fs_profile) {
+        case FS_PROFILE_LOCAL:  return FS_PAGE_SIZE_LOCAL;
+        case FS_PROFILE_LUSTRE: return FS_PAGE_SIZE_LUSTRE;
+        case FS_PROFILE_GPFS:   return FS_PAGE_SIZE_GPFS;
+        default:                return 0;
+    }
+}
+
+// File creation property list: paged file-space management with a profile
+hid_t SofiaHDF5_file_create_plist(const SofiaHDF5 *self)
+{
+    check_null(self);
+    
+    hid_t fcpl = H5Pcreate(H5P_FILE_CREATE);
+    const hsize_t page = SofiaHDF5_fs_page_size(self);
+    
+    if (page > 0) {
+        H5Pset_file_space_strategy(fcpl, H5F_FSPACE_STRATEGY_PAGE, false, 1);
+        H5Pset_file_space_page_size(fcpl, page);
+    }
+    
+    return fcpl;
+}
+
+// File access property list. A 'collective' file is opened by all ranks together
+// (MPI-IO with several ranks), any other one by the calling rank alone. With a profile
+// and 'paged' set (the file is paged), a page buffer is added; HDF5 does not support
+// it with MPI-IO.
+hid_t SofiaHDF5_file_access_plist(const SofiaHDF5 *self, const bool paged, const bool collective)
+{
+    check_null(self);
+    
+    const bool mpio = collective && distributed_size() > 1;
+    hid_t fapl = collective ? distributed_file_access() : H5Pcreate(H5P_FILE_ACCESS);
+    const hsize_t page = SofiaHDF5_fs_page_size(self);
+    
+    if (page > 0) {
+        H5Pset_libver_bounds(fapl, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+        H5Pset_alignment(fapl, page, page);
+        H5Pset_meta_block_size(fapl, page);
+        if (paged && !mpio && self->in_memory == 0) H5Pset_page_buffer_size(fapl, FS_PAGE_BUFFER_PAGES * page, 0, 0);
+    }
+    else if (self->options.dense_attributes) {
+        // Dense attribute storage needs the 1.8 file format
+        H5Pset_libver_bounds(fapl, H5F_LIBVER_V18, H5F_LIBVER_LATEST);
+    }
+    
+    // Core driver: the file image is allocated at its estimated size and written
+    // to disk as a whole when the file is closed
+    if (self->in_memory > 0) H5Pset_fapl_core(fapl, self->in_memory, true);
+    
+    return fapl;
+}
+
+// Open the output file for writing, by all ranks together if 'collective', else by
+// the calling rank alone. A file written without a profile (e.g. by an earlier run)
+// has no pages, so it is opened without the page buffer. A file built in memory
+// stays open from the cube to the catalogue.
+hid_t SofiaHDF5_open_file(const SofiaHDF5 *self, const bool collective)
+{
+    if (self->file_id >= 0) return self->file_id;
+    
+    hid_t fapl = SofiaHDF5_file_access_plist(self, true, collective);
+    hid_t file_id;
+    H5E_BEGIN_TRY {
+        file_id = H5Fopen(self->hdf5name, H5F_ACC_RDWR, fapl);
+    } H5E_END_TRY;
+    H5Pclose(fapl);
+    
+    if (file_id < 0 && SofiaHDF5_fs_page_size(self) > 0) {
+        fapl = SofiaHDF5_file_access_plist(self, false, collective);
+        file_id = H5Fopen(self->hdf5name, H5F_ACC_RDWR, fapl);
+        H5Pclose(fapl);
+    }
+    
+    return file_id;
+}
+
+// Close the output file, unless it is built in memory: that one is written to disk
+// once, when SofiaHDF5_write (or SofiaHDF5_delete) closes it
+void SofiaHDF5_close_file(SofiaHDF5 *self)
+{
+    if (self->in_memory > 0) return;
+    
+    H5Fclose(self->file_id);
+    self->file_id = -1;
+    
+    return;
+}
+
+// Generous estimate of the output size (bytes) for hdf5.in_memory: the image data of
+// every HDU and of the mask with their swizzled copies and mipmaps, the headers as
+// attributes and raw cards, the catalogue and 1 MB of further metadata. Compression
+// and blank chunks left out only make the file smaller.
+size_t SofiaHDF5_estimate_size(const SofiaHDF5 *self)
+{
+    size_t size = MEGABYTE;
+    const FitsFile *images[2] = {self->cube_data, self->mask_data};
+    
+    for (int i = 0; i < 2; ++i) {
+        for (const FitsFile *fits = images[i]; fits != NULL; fits = (i == 0) ? fits->next : NULL) {
+            size_t data_bytes = fits->data_size * fits->word_size;
+            if (self->options.swizzle != SWIZZLE_NONE) data_bytes *= 2;
+            if (self->options.mipmaps) data_bytes += data_bytes / 3;
+            size += data_bytes + 4 * fits->header_size;
+        }
+    }
+    
+    if (self->catalog != NULL) size += self->catalog->size * sizeof(CatalogSource);
+    
+    return size;
+}
+
+// Group creation property list; optionally switches attributes straight to dense storage
+hid_t SofiaHDF5_group_create_plist(const SofiaHDF5 *self)
+{
+    check_null(self);
+    
+    hid_t gcpl = H5Pcreate(H5P_GROUP_CREATE);
+    
+    if (self->options.dense_attributes) {
+        // Zero compact attributes: no compact-to-dense conversion half-way through the header
+        H5Pset_attr_phase_change(gcpl, 0, 0);
+    }
+    
+    return gcpl;
 }
\ No newline at end of file
@@ -27,9 +27,38 @@
 #define HDF5_WRITER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <hdf5.h>
 #include "common.h"
+#include "config.h"
 #include "reader.h"
+#include "statistics.h"
+#include "mipmap.h"
+#include "detections.h"
+
+#define SPARSE_CHUNK_SIZE 512  ///< Largest chunk edge (pixels) of sparse data sets.
+
+#define FS_PAGE_SIZE_LOCAL   (64 * 1024)        ///< File-space page of --fs-profile=local (bytes).
+#define FS_PAGE_SIZE_LUSTRE  (1024 * 1024)      ///< File-space page of --fs-profile=lustre: default stripe size (bytes).
+#define FS_PAGE_SIZE_GPFS    (4 * 1024 * 1024)  ///< File-space page of --fs-profile=gpfs: default block size (bytes).
+#define FS_PAGE_BUFFER_PAGES 16                 ///< Pages held by the page buffer of a file-space profile.
+
+// ----------------------------------------------------------------- //
+// Class 'VirtualSource'                                             //
+// ----------------------------------------------------------------- //
+// A box of the DATA set in another HDF5 file written by this        //
+// converter that makes up part of a virtual DATA set (mosaic).      //
+// Shapes and offsets are given in the axis order of DATA.           //
+// ----------------------------------------------------------------- //
+
+typedef CLASS VirtualSource {
+    char filename[MAX_PATH_LENGTH]; // Relative to the directory of the output file, or absolute
+    int rank;
+    hsize_t dims[4];      // Shape of DATA in that file
+    hsize_t source[4];    // First pixel of the box in that file
+    hsize_t target[4];    // First pixel of the box in the output
+    hsize_t count[4];     // Size of the box
+} VirtualSource;
 
 // ----------------------------------------------------------------- //
 // Class 'SofiaHDF5'                                                 //
@@ -37,35 +66,45 @@
 // Structure to handle HDF5 file creation and writing               //
 // ----------------------------------------------------------------- //
 
-typedef CLASS SofiaHDF5 {
+CLASS SofiaHDF5 {
     char hdf5name[MAX_PATH_LENGTH];
     char name[MAX_STRING_LENGTH];
     bool overwrite;
+    Hdf5Options options;
+    size_t max_memory;    // Upper limit for image data held in memory (bytes)
+    int n_threads;        // Threads used for per-plane processing
     
     // Data containers
     FitsFile *cube_data;
     FitsFile *mask_data;
     SofiaCatalog *catalog;
     
+    // Boxes of other files that DATA (and Mask/DATA) map to instead of holding data
+    VirtualSource *virtual_sources;
+    size_t n_virtual;
+    
+    // Chunks near the detections (hdf5.detections), made for the first DATA written
+    DetectionMap *detections;
+    
+    // Estimated size of a file built in memory (hdf5.in_memory), 0 when written directly
+    size_t in_memory;
+    
     // HDF5 file handle
     hid_t file_id;
     hid_t group_id;
-} SofiaHDF5;
+};
 
-// Constructor and destructor
-PUBLIC SofiaHDF5 *SofiaHDF5_new(const char *filename, const char *basename);
-PUBLIC void SofiaHDF5_delete(SofiaHDF5 *self);
+// Constructor, destructor, options, inputs and SofiaHDF5_write() are declared in sofia2hdf5.h
 
 // Public methods
-PUBLIC void SofiaHDF5_add_cube(SofiaHDF5 *self, FitsFile *cube);
-PUBLIC void SofiaHDF5_add_catalog(SofiaHDF5 *self, SofiaCatalog *catalog);
-PUBLIC void SofiaHDF5_add_mask(SofiaHDF5 *self, FitsFile *mask);
+PUBLIC void SofiaHDF5_set_options(SofiaHDF5 *self, const Hdf5Options *options);
+PUBLIC void SofiaHDF5_add_virtual_source(SofiaHDF5 *self, const VirtualSource *source);
 
 PUBLIC void SofiaHDF5_write_cube(SofiaHDF5 *self);
 PUBLIC void SofiaHDF5_write_mask(SofiaHDF5 *self);
 PUBLIC void SofiaHDF5_write_catalog(SofiaHDF5 *self);
 
-// Private methods
-PRIVATE void SofiaHDF5_write_header(SofiaHDF5 *self, hid_t group_id, const FitsFile *fits_data);
+// Helper functions
+PUBLIC hid_t h5_native_type(const int data_type);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,430 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (header.c) - SoFiA to HDF5 Converter                     //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "header.h"
+#include "reader.h"
+#include <ctype.h>
+#include <math.h>
+
+#define HEADER_ARENA_BLOCK_SIZE 32768
+
+// Private methods
+PRIVATE void FitsHeader_append(FitsHeader *self, const FitsCard *card);
+PRIVATE void FitsHeader_rehash(FitsHeader *self, const size_t table_size);
+PRIVATE void FitsHeader_insert_hash(FitsHeader *self, const size_t index);
+PRIVATE void FitsHeader_parse_value(FitsHeader *self, FitsCard *card, const char *text, const size_t len);
+PRIVATE const char *FitsHeader_parse_string(FitsHeader *self, const char *text, const char *end, const char **next);
+PRIVATE const char *FitsHeader_trimmed_copy(FitsHeader *self, const char *start, const char *end);
+PRIVATE size_t hash_key(const char *key);
+
+// ----------------------------------------------------------------- //
+// Constructor and destructor                                        //
+// ----------------------------------------------------------------- //
+
+// Strings go to 'arena' if given (e.g. the one of the FitsFile), else to an arena of its own
+FitsHeader *FitsHeader_new(Arena *arena)
+{
+    FitsHeader *self = memory_alloc(sizeof(FitsHeader));
+    self->cards = NULL;
+    self->size = 0;
+    self->capacity = 0;
+    self->table = NULL;
+    self->table_size = 0;
+    self->arena = arena != NULL ? arena : Arena_new(HEADER_ARENA_BLOCK_SIZE);
+    self->owns_arena = (arena == NULL);
+    return self;
+}
+
+void FitsHeader_delete(FitsHeader *self)
+{
+    if (self != NULL) {
+        memory_free(self->cards);
+        memory_free(self->table);
+        if (self->owns_arena) Arena_delete(self->arena);
+        memory_free(self);
+    }
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Public methods                                                    //
+// ----------------------------------------------------------------- //
+
+void FitsHeader_parse(FitsHeader *self, const char *raw, const size_t size)
+{
+    check_null(self);
+    check_null(raw);
+
+    // Every card is parsed exactly once; reserve room for all of them up front
+    const size_t max_cards = size / FITS_HEADER_LINE_SIZE;
+    if (self->size + max_cards > self->capacity) {
+        self->capacity = self->size + max_cards;
+        self->cards = memory_realloc(self->cards, self->capacity * sizeof(FitsCard));
+    }
+    FitsHeader_rehash(self, 2 * self->capacity);
+
+    for (size_t pos = 0; pos + FITS_HEADER_LINE_SIZE <= size; pos += FITS_HEADER_LINE_SIZE) {
+        const char *line = raw + pos;
+        const char *line_end = line + FITS_HEADER_LINE_SIZE;
+
+        if (strncmp(line, "END", 3) == 0 && (line[3] == ' ' || line[3] == '\0')) break;
+
+        FitsCard card = {"", "", "", FITS_VALUE_NONE, false, false, 0, NAN, 0.0, 1};
+
+        if (strncmp(line, "CONTINUE", 8) == 0 && line[8] != '=' && self->size > 0) {
+            // Long string continuation: append to the preceding string card
+            FitsCard *prev = &self->cards[self->size - 1];
+            size_t prev_len = strlen(prev->value);
+
+            if (prev->type == FITS_VALUE_STRING && prev_len > 0 && prev->value[prev_len - 1] == '&') {
+                FitsCard part = card;
+                FitsHeader_parse_value(self, &part, line + 8, FITS_HEADER_LINE_SIZE - 8);
+
+                if (part.type == FITS_VALUE_STRING) {
+                    const size_t part_len = strlen(part.value);
+                    char *merged = Arena_alloc(self->arena, prev_len + part_len);
+                    memcpy(merged, prev->value, prev_len - 1);
+                    memcpy(merged + prev_len - 1, part.value, part_len + 1);
+                    prev->value = merged;
+                    prev->lines++;
+
+                    if (part.comment[0] != '\0') {
+                        const size_t comment_len = strlen(prev->comment);
+                        char *comment = Arena_alloc(self->arena, comment_len + strlen(part.comment) + 2);
+                        sprintf(comment, comment_len > 0 ? "%s %s" : "%s%s", prev->comment, part.comment);
+                        prev->comment = comment;
+                    }
+                    continue;
+                }
+            }
+        }
+
+        if (strncmp(line, "HIERARCH ", 9) == 0 && memchr(line, '=', FITS_HEADER_LINE_SIZE) != NULL) {
+            // ESO HIERARCH convention: keyword of arbitrary length up to the '='
+            const char *equals = memchr(line, '=', FITS_HEADER_LINE_SIZE);
+            card.key = FitsHeader_trimmed_copy(self, line + 9, equals);
+            card.hierarch = true;
+            FitsHeader_parse_value(self, &card, equals + 1, line_end - equals - 1);
+        } else {
+            card.key = FitsHeader_trimmed_copy(self, line, line + FITS_HEADER_KEYWORD_SIZE);
+
+            if (line[8] == '=' && line[9] == ' ') {
+                FitsHeader_parse_value(self, &card, line + 10, FITS_HEADER_VALUE_SIZE);
+            } else {
+                // Commentary card; everything after the keyword is free text
+                card.comment = FitsHeader_trimmed_copy(self, line + FITS_HEADER_KEYWORD_SIZE, line_end);
+            }
+        }
+
+        FitsHeader_append(self, &card);
+    }
+
+    return;
+}
+
+size_t FitsHeader_get_size(const FitsHeader *self)
+{
+    check_null(self);
+    return self->size;
+}
+
+const FitsCard *FitsHeader_get_card(const FitsHeader *self, const size_t index)
+{
+    check_null(self);
+    if (index >= self->size) return NULL;
+    return &self->cards[index];
+}
+
+const FitsCard *FitsHeader_find(const FitsHeader *self, const char *key)
+{
+    check_null(self);
+    check_null(key);
+
+    if (self->table_size == 0) return NULL;
+
+    const size_t mask = self->table_size - 1;
+    for (size_t slot = hash_key(key) & mask; self->table[slot] != 0; slot = (slot + 1) & mask) {
+        const FitsCard *card = &self->cards[self->table[slot] - 1];
+        if (strcmp(card->key, key) == 0) return card;
+    }
+
+    return NULL;
+}
+
+const char *FitsHeader_get_str(const FitsHeader *self, const char *key)
+{
+    const FitsCard *card = FitsHeader_find(self, key);
+    return card == NULL ? NULL : card->value;
+}
+
+long int FitsHeader_get_int(const FitsHeader *self, const char *key)
+{
+    const FitsCard *card = FitsHeader_find(self, key);
+    if (card == NULL) return 0;
+
+    switch (card->type) {
+        case FITS_VALUE_INT:   return (long int)card->int_value;
+        case FITS_VALUE_FLOAT: return (long int)card->flt_value;
+        case FITS_VALUE_BOOL:  return card->bool_value ? 1 : 0;
+        default:               return strtol(card->value, NULL, 10);
+    }
+}
+
+double FitsHeader_get_flt(const FitsHeader *self, const char *key)
+{
+    const FitsCard *card = FitsHeader_find(self, key);
+    if (card == NULL) return NAN;
+
+    switch (card->type) {
+        case FITS_VALUE_INT:     return (double)card->int_value;
+        case FITS_VALUE_FLOAT:   return card->flt_value;
+        case FITS_VALUE_COMPLEX: return card->flt_value;
+        case FITS_VALUE_STRING:  return strtod(card->value, NULL);
+        default:                 return NAN;
+    }
+}
+
+bool FitsHeader_get_bool(const FitsHeader *self, const char *key)
+{
+    const FitsCard *card = FitsHeader_find(self, key);
+    if (card == NULL) return false;
+    if (card->type == FITS_VALUE_BOOL) return card->bool_value;
+
+    return (strcmp(card->value, "T") == 0 || strcmp(card->value, "true") == 0 || strcmp(card->value, "True") == 0);
+}
+
+// ----------------------------------------------------------------- //
+// Raw header cards                                                  //
+// ----------------------------------------------------------------- //
+// Editing of the 80-character cards of a header as read from the    //
+// file (up to END and its padding, or without END), e.g. to         //
+// describe a cut-out or a mosaic. Values are written in fixed       //
+// format, right-aligned in columns 11 to 30; comments are kept.     //
+// ----------------------------------------------------------------- //
+
+// Set the value of a card, or insert the card before END if it is missing. The
+// header grows by a block if there is no room; returns the (moved) header.
+char *fits_header_set_card(char *cards, size_t *header_size, const char *key, const char *value)
+{
+    check_null(cards);
+    check_null(header_size);
+
+    char name[FITS_HEADER_KEYWORD_SIZE + 1];
+    snprintf(name, sizeof(name), "%-8s", key);
+
+    char field[21];
+    snprintf(field, sizeof(field), "%20s", value);
+
+    size_t end = *header_size;
+    for (size_t pos = 0; pos + FITS_HEADER_LINE_SIZE <= *header_size; pos += FITS_HEADER_LINE_SIZE) {
+        char *card = cards + pos;
+        if (strncmp(card, "END", 3) == 0 && (card[3] == ' ' || card[3] == '\0')) {
+            end = pos;
+            break;
+        }
+        if (strncmp(card, name, FITS_HEADER_KEYWORD_SIZE) == 0 && card[8] == '=') {
+            memcpy(card + 10, field, 20);
+            return cards;
+        }
+    }
+
+    if (end == *header_size) {
+        // Cards without END: append
+        cards = memory_realloc(cards, *header_size + FITS_HEADER_LINE_SIZE);
+        *header_size += FITS_HEADER_LINE_SIZE;
+    }
+    else {
+        // END moves down by one card
+        if (end + 2 * FITS_HEADER_LINE_SIZE > *header_size) {
+            cards = memory_realloc(cards, *header_size + FITS_HEADER_BLOCK_SIZE);
+            memset(cards + *header_size, ' ', FITS_HEADER_BLOCK_SIZE);
+            *header_size += FITS_HEADER_BLOCK_SIZE;
+        }
+        memmove(cards + end + FITS_HEADER_LINE_SIZE, cards + end, FITS_HEADER_LINE_SIZE);
+    }
+
+    char card[FITS_HEADER_LINE_SIZE + 1];
+    snprintf(card, sizeof(card), "%-8s= %s%-50s", key, field, "");
+    memcpy(cards + end, card, FITS_HEADER_LINE_SIZE);
+
+    return cards;
+}
+
+// Remove a card; returns the new header size
+size_t fits_header_drop_card(char *cards, const size_t header_size, const char *key)
+{
+    check_null(cards);
+
+    char name[FITS_HEADER_KEYWORD_SIZE + 1];
+    snprintf(name, sizeof(name), "%-8s", key);
+
+    for (size_t pos = 0; pos + FITS_HEADER_LINE_SIZE <= header_size; pos += FITS_HEADER_LINE_SIZE) {
+        if (strncmp(cards + pos, name, FITS_HEADER_KEYWORD_SIZE) == 0) {
+            memmove(cards + pos, cards + pos + FITS_HEADER_LINE_SIZE, header_size - pos - FITS_HEADER_LINE_SIZE);
+            return header_size - FITS_HEADER_LINE_SIZE;
+        }
+    }
+
+    return header_size;
+}
+
+// ----------------------------------------------------------------- //
+// Private methods                                                   //
+// ----------------------------------------------------------------- //
+
+void FitsHeader_append(FitsHeader *self, const FitsCard *card)
+{
+    if (self->size >= self->capacity) {
+        self->capacity = self->capacity > 0 ? 2 * self->capacity : 64;
+        self->cards = memory_realloc(self->cards, self->capacity * sizeof(FitsCard));
+    }
+
+    self->cards[self->size] = *card;
+    self->size++;
+
+    // Keep the load factor at or below 1/2
+    if (2 * self->size > self->table_size) FitsHeader_rehash(self, 2 * self->capacity);
+    else FitsHeader_insert_hash(self, self->size - 1);
+
+    return;
+}
+
+void FitsHeader_rehash(FitsHeader *self, const size_t table_size)
+{
+    size_t new_size = 16;
+    while (new_size < table_size) new_size *= 2;
+    if (new_size <= self->table_size) return;
+
+    memory_free(self->table);
+    self->table = memory_alloc(new_size * sizeof(size_t));
+    memset(self->table, 0, new_size * sizeof(size_t));
+    self->table_size = new_size;
+
+    for (size_t i = 0; i < self->size; i++) FitsHeader_insert_hash(self, i);
+
+    return;
+}
+
+void FitsHeader_insert_hash(FitsHeader *self, const size_t index)
+{
+    const FitsCard *card = &self->cards[index];
+
+    // Commentary cards may repeat and are never looked up by keyword
+    if (card->type == FITS_VALUE_NONE || card->key[0] == '\0') return;
+
+    const size_t mask = self->table_size - 1;
+    size_t slot = hash_key(card->key) & mask;
+
+    while (self->table[slot] != 0) {
+        // First occurrence of a duplicated keyword wins
+        if (strcmp(self->cards[self->table[slot] - 1].key, card->key) == 0) return;
+        slot = (slot + 1) & mask;
+    }
+
+    self->table[slot] = index + 1;
+    return;
+}
+
+// Parse the value field of a card (everything after the value indicator)
+void FitsHeader_parse_value(FitsHeader *self, FitsCard *card, const char *text, const size_t len)
+{
+    const char *ptr = text;
+    const char *end = text + len;
+
+    while (ptr < end && *ptr == ' ') ptr++;
+
+    if (ptr < end && *ptr == '\'') {
+        card->type = FITS_VALUE_STRING;
+        card->value = FitsHeader_parse_string(self, ptr + 1, end, &ptr);
+    } else {
+        const char *slash = memchr(ptr, '/', end - ptr);
+        const char *value_end = slash != NULL ? slash : end;
+        card->value = FitsHeader_trimmed_copy(self, ptr, value_end);
+        ptr = value_end;
+
+        const char *value = card->value;
+        char *endptr;
+
+        if (value[0] == '\0') {
+            card->type = FITS_VALUE_UNDEFINED;
+        } else if ((value[0] == 'T' || value[0] == 'F') && value[1] == '\0') {
+            card->type = FITS_VALUE_BOOL;
+            card->bool_value = (value[0] == 'T');
+        } else if (value[0] == '(') {
+            card->type = FITS_VALUE_COMPLEX;
+            card->flt_value = strtod(value + 1, &endptr);
+            while (*endptr == ' ' || *endptr == ',') endptr++;
+            card->imag_value = strtod(endptr, NULL);
+        } else {
+            card->int_value = strtoll(value, &endptr, 10);
+
+            if (*endptr == '\0') {
+                card->type = FITS_VALUE_INT;
+                card->flt_value = (double)card->int_value;
+            } else {
+                // FITS allows 'D' as exponent character for double precision
+                char number[FITS_HEADER_VALUE_SIZE + 1];
+                strncpy(number, value, FITS_HEADER_VALUE_SIZE);
+                number[FITS_HEADER_VALUE_SIZE] = '\0';
+                for (char *c = number; *c; c++) if (*c == 'D' || *c == 'd') *c = 'E';
+
+                card->flt_value = strtod(number, &endptr);
+                card->type = (*endptr == '\0') ? FITS_VALUE_FLOAT : FITS_VALUE_STRING;
+            }
+        }
+    }
+
+    // Remainder of the card after an optional '/' is the comment
+    while (ptr < end && *ptr != '/') ptr++;
+    if (ptr < end) card->comment = FitsHeader_trimmed_copy(self, ptr + 1, end);
+
+    return;
+}
+
+// Decode a quoted FITS string starting after the opening quote; '' denotes a literal quote
+const char *FitsHeader_parse_string(FitsHeader *self, const char *text, const char *end, const char **next)
+{
+    char buffer[FITS_HEADER_LINE_SIZE + 1];
+    size_t len = 0;
+    const char *ptr = text;
+
+    while (ptr < end) {
+        if (*ptr == '\'') {
+            if (ptr + 1 < end && ptr[1] == '\'') {
+                buffer[len++] = '\'';
+                ptr += 2;
+                continue;
+            }
+            ptr++;
+            break;
+        }
+        buffer[len++] = *ptr++;
+    }
+
+    // Trailing blanks are not significant in FITS strings
+    while (len > 0 && buffer[len - 1] == ' ') len--;
+
+    *next = ptr;
+    return Arena_string_ncopy(self->arena, buffer, len);
+}
+
+const char *FitsHeader_trimmed_copy(FitsHeader *self, const char *start, const char *end)
+{
+    while (start < end && *start == ' ') start++;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\0')) end--;
+    return Arena_string_ncopy(self->arena, start, end - start);
+}
+
+// FNV-1a hash of a keyword
+size_t hash_key(const char *key)
+{
+    size_t hash = (size_t)2166136261u;
+    for (const unsigned char *c = (const unsigned char *)key; *c; c++) {
+        hash ^= *c;
+        hash *= (size_t)16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,98 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (header.h) - SoFiA to HDF5 Converter                     //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+/// @file   header.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Typed FITS header model with hashed keyword lookup (header).
+
+#ifndef HEADER_H
+#define HEADER_H
+
+#include <stdbool.h>
+#include "common.h"
+
+// ----------------------------------------------------------------- //
+// Class 'FitsCard'                                                  //
+// ----------------------------------------------------------------- //
+// A single (logical) FITS header card. Long strings spread over     //
+// CONTINUE cards are merged into one card; HIERARCH keywords are    //
+// stored without the HIERARCH prefix.                               //
+// ----------------------------------------------------------------- //
+
+typedef enum FitsValueType {
+    FITS_VALUE_NONE,       // Commentary card (COMMENT, HISTORY, blank, ...)
+    FITS_VALUE_UNDEFINED,  // Value indicator present but value empty
+    FITS_VALUE_BOOL,
+    FITS_VALUE_INT,
+    FITS_VALUE_FLOAT,
+    FITS_VALUE_STRING,
+    FITS_VALUE_COMPLEX
+} FitsValueType;
+
+typedef CLASS FitsCard {
+    const char *key;      // Keyword
+    const char *value;    // Unquoted string or literal value text ("" if none)
+    const char *comment;  // Card comment or commentary text ("" if none)
+    FitsValueType type;   // Type of the parsed value
+    bool hierarch;        // Keyword was given with the HIERARCH convention
+    bool bool_value;
+    long long int int_value;
+    double flt_value;     // Also holds the real part of complex values
+    double imag_value;    // Imaginary part of complex values
+    size_t lines;         // Number of raw cards, CONTINUE cards included
+} FitsCard;
+
+// ----------------------------------------------------------------- //
+// Class 'FitsHeader'                                                //
+// ----------------------------------------------------------------- //
+// Ordered list of cards with an open-addressing hash table for      //
+// O(1) keyword lookup. All strings live in a single arena.          //
+// ----------------------------------------------------------------- //
+
+typedef CLASS FitsHeader {
+    FitsCard *cards;      // Cards in header order
+    size_t size;          // Number of cards
+    size_t capacity;      // Allocated number of cards
+    size_t *table;        // Hash table of card index + 1 (0 = empty slot)
+    size_t table_size;    // Number of slots, always a power of 2
+    Arena *arena;         // Storage for keys, values and comments
+    bool owns_arena;      // Whether the arena is deleted with the header
+} FitsHeader;
+
+// Constructor and destructor
+PUBLIC FitsHeader *FitsHeader_new(Arena *arena);
+PUBLIC void FitsHeader_delete(FitsHeader *self);
+
+// Public methods
+PUBLIC void FitsHeader_parse(FitsHeader *self, const char *raw, const size_t size);
+PUBLIC size_t FitsHeader_get_size(const FitsHeader *self);
+PUBLIC const FitsCard *FitsHeader_get_card(const FitsHeader *self, const size_t index);
+PUBLIC const FitsCard *FitsHeader_find(const FitsHeader *self, const char *key);
+PUBLIC const char *FitsHeader_get_str(const FitsHeader *self, const char *key);
+PUBLIC long int FitsHeader_get_int(const FitsHeader *self, const char *key);
+PUBLIC double FitsHeader_get_flt(const FitsHeader *self, const char *key);
+PUBLIC bool FitsHeader_get_bool(const FitsHeader *self, const char *key);
+
+// Editing of raw header cards
+PUBLIC char *fits_header_set_card(char *cards, size_t *header_size, const char *key, const char *value);
+PUBLIC size_t fits_header_drop_card(char *cards, const size_t header_size, const char *key);
+
+#endif
@@ -23,11 +23,19 @@
 /// @date   29/09/2025
 /// @brief  Main program for sofia2hdf5 converter.
 
+// Needed for fork() and waitpid() with -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/wait.h>
+#include <unistd.h>
 #include "common.h"
 #include "config.h"
+#include "distributed.h"
 #include "parameter.h"
 #include "reader.h"
 #include "hdf5_writer.h"
+#include "fits_writer.h"
+#include "mosaic.h"
 #include "utils.h"
 
 // ----------------------------------------------------------------- //
@@ -35,6 +43,8 @@
 // ----------------------------------------------------------------- //
 
 int convert(Config *cfg);
+int convert_back(Config *cfg);
+int convert_mosaic(Config *cfg);
 
 // ----------------------------------------------------------------- //
 // Main function                                                     //
@@ -42,18 +52,33 @@ int convert(Config *cfg);
 
 int main(int argc, char **argv)
 {
+    distributed_init(&argc, &argv);
+    
+    // With several MPI ranks only rank 0 reports progress
+    if (distributed_rank() > 0 && freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Warning: Cannot silence the output of MPI rank %d\n", distributed_rank());
+    }
+    
     // Setup configuration from command line arguments
     Config *cfg = setup_config(argc, argv);
     if (cfg == NULL) {
+        distributed_finalise();
         return ERR_SUCCESS;  // Help or version was printed
     }
     
-    // Perform the conversion
-    int result = convert(cfg);
+    // Perform the conversion (or the reverse one, which rank 0 does alone)
+    int result = ERR_SUCCESS;
+    if (cfg->mosaic != NULL) result = convert_mosaic(cfg);
+    else if (strlen(cfg->hdf5_input) == 0) result = convert(cfg);
+    else if (distributed_rank() == 0) result = convert_back(cfg);
     
     // Cleanup
+    const bool verbose = cfg->general.verbose;
     Config_delete(cfg);
     
+    if (verbose) memory_print_statistics();
+    
+    distributed_finalise();
     return result;
 }
 
@@ -74,6 +99,7 @@ int convert(Config *cfg)
     // Read the parameter file
     Parameter *input_parameters = Parameter_new();
     Parameter_load(input_parameters, cfg->sofia_input);
+    if (strlen(cfg->input_data) > 0) Parameter_set(input_parameters, "input.data", cfg->input_data);
     
     // Get working directory and base name
     char *working_directory = get_working_directory(cfg->general.directory, input_parameters);
@@ -89,6 +115,9 @@ int convert(Config *cfg)
     snprintf(hdf5_filename, sizeof(hdf5_filename), "%s%s.hdf5", working_directory, base_name);
     
     SofiaHDF5 *our_hdf5 = SofiaHDF5_new(hdf5_filename, base_name);
+    SofiaHDF5_set_options(our_hdf5, &cfg->hdf5);
+    SofiaHDF5_set_max_memory(our_hdf5, cfg->general.max_memory * (size_t)MEGABYTE);
+    SofiaHDF5_set_threads(our_hdf5, cfg->general.multiprocessing ? cfg->general.ncpu : 1);
     
     // Read the FITS data cube
     if (cfg->general.verbose) {
@@ -97,7 +126,9 @@ int convert(Config *cfg)
         printf("Adding data to HDF5 file: %s\n", hdf5_filename);
     }
     
+    const int io_threads = cfg->general.multiprocessing ? cfg->general.ncpu : 1;
     FitsFile *fits_data = get_fitsfile(cfg->general.directory, input_parameters);
+    FitsFile_set_io(fits_data, io_threads, cfg->general.direct_io);
     SofiaHDF5_add_cube(our_hdf5, fits_data);
     
     // Check for catalog
@@ -123,13 +154,46 @@ int convert(Config *cfg)
         }
         
         if (file_exists(mask_to_add.filename)) {
-            FitsFile *mask = get_fitsfile("", input_parameters);  // Placeholder - would need proper mask reading
+            FitsFile *mask = read_fits_file(mask_to_add.filename);
+            FitsFile_set_io(mask, io_threads, cfg->general.direct_io);
             SofiaHDF5_add_mask(our_hdf5, mask);
         } else {
             printf("Warning: Mask file not found: %s\n", mask_to_add.filename);
         }
     }
     
+    // Convert only part of the cube: the same region of the cube, its extensions of
+    // the same shape and the mask, with the catalogue moved along
+    if (strlen(cfg->region) > 0) {
+        Region region;
+        if (strcmp(cfg->region, "catalog") == 0 || strcmp(cfg->region, "catalogue") == 0) {
+            Region_from_catalog(&region, our_hdf5->catalog, cfg->region_margin);
+        } else {
+            Region_parse(&region, cfg->region);
+        }
+        
+        for (FitsFile *hdu = fits_data; hdu != NULL; hdu = hdu->next) {
+            if (hdu->file_nx == fits_data->file_nx && hdu->file_ny == fits_data->file_ny && hdu->file_nz == fits_data->file_nz) {
+                FitsFile_set_region(hdu, &region);
+            } else {
+                printf("Warning: HDU %d differs in shape from the cube and is converted in full.\n", hdu->hdu);
+            }
+        }
+        
+        FitsFile *mask = our_hdf5->mask_data;
+        if (mask != NULL) {
+            if (mask->file_nx == fits_data->file_nx && mask->file_ny == fits_data->file_ny && mask->file_nz == fits_data->file_nz) {
+                FitsFile_set_region(mask, &region);
+            } else {
+                printf("Warning: The mask differs in shape from the cube and is left out.\n");
+                FitsFile_delete(mask);
+                our_hdf5->mask_data = NULL;
+            }
+        }
+        
+        if (our_hdf5->catalog != NULL) SofiaCatalog_set_region(our_hdf5->catalog, fits_data);
+    }
+    
     // Check for Karma annotations warning
     if (Parameter_get_bool(input_parameters, "output.writekarma")) {
         printf("Warning: You have produced Karma annotations but Karma does not read HDF5, "
@@ -141,17 +205,9 @@ int convert(Config *cfg)
         printf("Writing data to HDF5 file...\n");
     }
     
-    SofiaHDF5_write_cube(our_hdf5);
-    
-    if (our_hdf5->mask_data) {
-        SofiaHDF5_write_mask(our_hdf5);
-    }
-    
-    if (our_hdf5->catalog) {
-        SofiaHDF5_write_catalog(our_hdf5);
-    }
+    const int result = SofiaHDF5_write(our_hdf5);
     
-    if (cfg->general.verbose) {
+    if (result == ERR_SUCCESS && cfg->general.verbose) {
         printf("Conversion completed successfully!\n");
         printf("Output file: %s\n", hdf5_filename);
     }
@@ -159,10 +215,163 @@ int convert(Config *cfg)
     // Cleanup
     Parameter_delete(input_parameters);
     if (our_hdf5->catalog) SofiaCatalog_delete(our_hdf5->catalog);
+    if (our_hdf5->mask_data) FitsFile_delete(our_hdf5->mask_data);
     SofiaHDF5_delete(our_hdf5);
     FitsFile_delete(fits_data);
     memory_free(working_directory);
     memory_free(base_name);
     
+    return result;
+}
+
+// ----------------------------------------------------------------- //
+// Reverse conversion function                                       //
+// ----------------------------------------------------------------- //
+
+int convert_back(Config *cfg)
+{
+    check_null(cfg);
+    
+    if (cfg->general.verbose) {
+        printf("Starting HDF5 to SoFiA conversion...\n");
+        printf("HDF5 input file: %s\n", cfg->hdf5_input);
+        printf("Output directory: %s\n", cfg->general.directory);
+    }
+    
+    ensure_directory_exists(cfg->general.directory);
+    
+    SofiaFITS *our_fits = SofiaFITS_new(cfg->hdf5_input, cfg->general.directory);
+    SofiaFITS_set_max_memory(our_fits, cfg->general.max_memory * (size_t)MEGABYTE);
+    
+    SofiaFITS_write_cube(our_fits);
+    
+    if (SofiaFITS_has_mask(our_fits)) {
+        SofiaFITS_write_mask(our_fits);
+    }
+    
+    if (SofiaFITS_has_catalog(our_fits)) {
+        SofiaFITS_write_catalog(our_fits);
+    }
+    
+    if (cfg->general.verbose) {
+        printf("Conversion completed successfully!\n");
+    }
+    
+    SofiaFITS_delete(our_fits);
+    
     return ERR_SUCCESS;
-}
\ No newline at end of file
+}
+
+// ----------------------------------------------------------------- //
+// Mosaic of tile runs                                               //
+// ----------------------------------------------------------------- //
+
+// Convert the SoFiA run of every tile into its own HDF5 file and join them in
+// mosaic.output through virtual data sets. The HDF5 library is not thread-safe,
+// so tiles are converted by child processes, as many at once as there are CPUs.
+int convert_mosaic(Config *cfg)
+{
+    check_null(cfg);
+    
+    if (distributed_size() > 1) error_exit("A mosaic is assembled by a single process; run it without mpirun.");
+    
+    // Parameter files of the tiles
+    size_t n_tiles = 0;
+    char **tile_inputs = NULL;
+    char *list = string_copy(cfg->mosaic);
+    for (char *token = strtok(list, ","); token != NULL; token = strtok(NULL, ",")) {
+        token = string_trim(token);
+        if (strlen(token) == 0) continue;
+        tile_inputs = memory_realloc(tile_inputs, (n_tiles + 1) * sizeof(char *));
+        tile_inputs[n_tiles++] = string_copy(token);
+    }
+    memory_free(list);
+    
+    if (n_tiles == 0) error_exit("mosaic= lists no parameter files.");
+    
+    // Convert the tiles
+    const int n_cpu = cfg->general.multiprocessing ? cfg->general.ncpu : 1;
+    const size_t n_jobs = (size_t)n_cpu < n_tiles ? (size_t)n_cpu : n_tiles;
+    size_t next = 0;
+    size_t running = 0;
+    bool failed = false;
+    
+    if (cfg->general.verbose) printf("Converting %zu tiles, %zu at a time...\n", n_tiles, n_jobs);
+    
+    while (next < n_tiles || running > 0) {
+        if (next < n_tiles && running < n_jobs && !failed) {
+            fflush(NULL);
+            const pid_t pid = fork();
+            if (pid < 0) error_exit("Cannot start the conversion of a tile.");
+            if (pid == 0) {
+                strncpy(cfg->sofia_input, tile_inputs[next], MAX_PATH_LENGTH - 1);
+                cfg->sofia_input[MAX_PATH_LENGTH - 1] = '\0';
+                cfg->general.ncpu = n_cpu / (int)n_jobs > 0 ? n_cpu / (int)n_jobs : 1;
+                const int result = convert(cfg);
+                fflush(NULL);
+                _exit(result);
+            }
+            next++;
+            running++;
+            continue;
+        }
+        
+        int status = 0;
+        if (wait(&status) < 0) break;
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != ERR_SUCCESS) failed = true;
+    }
+    
+    if (failed) error_exit("The conversion of at least one tile failed.");
+    
+    // Assemble the mosaic from the HDF5 files of the tiles
+    SofiaMosaic *mosaic = SofiaMosaic_new();
+    for (size_t i = 0; i < n_tiles; i++) {
+        Parameter *input_parameters = Parameter_new();
+        Parameter_load(input_parameters, tile_inputs[i]);
+        char *working_directory = get_working_directory(cfg->general.directory, input_parameters);
+        char *base_name = get_basename(input_parameters);
+        
+        char hdf5_filename[MAX_PATH_LENGTH];
+        snprintf(hdf5_filename, sizeof(hdf5_filename), "%s%s.hdf5", working_directory, base_name);
+        SofiaMosaic_add_tile(mosaic, hdf5_filename);
+        
+        CatalogInfo catalog_to_add = check_catalogs(working_directory, input_parameters);
+        if (catalog_to_add.add && file_exists(catalog_to_add.filename)) {
+            SofiaMosaic_add_catalog(mosaic, read_catalog(catalog_to_add.filename));
+        }
+        
+        Parameter_delete(input_parameters);
+        memory_free(working_directory);
+        memory_free(base_name);
+    }
+    SofiaMosaic_arrange(mosaic);
+    SofiaMosaic_merge_catalogs(mosaic, cfg->mosaic_match_radius, cfg->mosaic_match_channels);
+    
+    // Base name of the mosaic from its file name
+    char base_name[MAX_PATH_LENGTH];
+    const char *slash = strrchr(cfg->mosaic_output, '/');
+    strncpy(base_name, slash != NULL ? slash + 1 : cfg->mosaic_output, MAX_PATH_LENGTH - 1);
+    base_name[MAX_PATH_LENGTH - 1] = '\0';
+    char *dot = strrchr(base_name, '.');
+    if (dot != NULL && dot != base_name) *dot = '\0';
+    
+    SofiaHDF5 *our_hdf5 = SofiaHDF5_new(cfg->mosaic_output, base_name);
+    SofiaHDF5_set_options(our_hdf5, &cfg->hdf5);
+    SofiaMosaic_setup(mosaic, our_hdf5);
+    const int result = SofiaHDF5_write(our_hdf5);
+    if (result == ERR_SUCCESS) SofiaMosaic_write_labels(mosaic, cfg->mosaic_output);
+    
+    if (result == ERR_SUCCESS && cfg->general.verbose) {
+        printf("Mosaic completed successfully!\n");
+        printf("Output file: %s\n", cfg->mosaic_output);
+    }
+    
+    // Cleanup
+    SofiaHDF5_delete(our_hdf5);
+    SofiaMosaic_delete(mosaic);
+    for (size_t i = 0; i < n_tiles; i++) memory_free(tile_inputs[i]);
+    memory_free(tile_inputs);
+    
+    return result;
+}
@@ -0,0 +1,251 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (merge.c) - SoFiA to HDF5 Converter                       //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "merge.h"
+#include <math.h>
+#include <stdint.h>
+
+// One source of any part, in the merged pixel grid
+typedef CLASS MergeEntry {
+    double position[3];
+    size_t part;
+    size_t index;         // Index in the catalogue of the part
+    size_t match;         // Entry this one duplicates, or SPATIAL_HASH_NONE
+    int merged_id;        // ID in the merged catalogue (of the match if dropped)
+    bool valid;           // Position is known
+    bool owned;           // Position lies in the region of its own part
+} MergeEntry;
+
+PRIVATE bool takes_precedence(const MergeEntry *entry, const MergeEntry *other);
+PRIVATE size_t SpatialHash_bucket(const SpatialHash *self, const long long cx, const long long cy, const long long cz);
+
+// ----------------------------------------------------------------- //
+// Constructor and destructor                                        //
+// ----------------------------------------------------------------- //
+
+SpatialHash *SpatialHash_new(const size_t capacity, const double cell_x, const double cell_y, const double cell_z)
+{
+    if (!(cell_x > 0.0 && cell_y > 0.0 && cell_z > 0.0)) error_exit("Cells of a spatial hash must have a positive size.");
+    
+    SpatialHash *self = memory_alloc(sizeof(SpatialHash));
+    self->cell[0] = cell_x;
+    self->cell[1] = cell_y;
+    self->cell[2] = cell_z;
+    self->capacity = capacity > 0 ? capacity : 1;
+    
+    self->n_buckets = 1;
+    while (self->n_buckets < 2 * self->capacity) self->n_buckets *= 2;
+    
+    self->heads = memory_alloc(self->n_buckets * sizeof(size_t));
+    self->next = memory_alloc(self->capacity * sizeof(size_t));
+    for (size_t i = 0; i < self->n_buckets; i++) self->heads[i] = SPATIAL_HASH_NONE;
+    
+    return self;
+}
+
+void SpatialHash_delete(SpatialHash *self)
+{
+    if (self != NULL) {
+        memory_free(self->heads);
+        memory_free(self->next);
+        memory_free(self);
+    }
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Public methods                                                    //
+// ----------------------------------------------------------------- //
+
+// Insert point 'index' (below the capacity) at 'position'
+void SpatialHash_insert(SpatialHash *self, const size_t index, const double *position)
+{
+    check_null(self);
+    if (index >= self->capacity) error_exit("Spatial hash is full.");
+    
+    long long cell[3];
+    SpatialHash_cell(self, position, cell);
+    
+    const size_t bucket = SpatialHash_bucket(self, cell[0], cell[1], cell[2]);
+    self->next[index] = self->heads[bucket];
+    self->heads[bucket] = index;
+    
+    return;
+}
+
+// Grid cell of a position
+void SpatialHash_cell(const SpatialHash *self, const double *position, long long *cell)
+{
+    check_null(self);
+    for (int axis = 0; axis < 3; axis++) cell[axis] = (long long)floor(position[axis] / self->cell[axis]);
+    return;
+}
+
+// First point in the bucket of a cell; continue with self->next[] until SPATIAL_HASH_NONE
+size_t SpatialHash_first(const SpatialHash *self, const long long cx, const long long cy, const long long cz)
+{
+    check_null(self);
+    return self->heads[SpatialHash_bucket(self, cx, cy, cz)];
+}
+
+// Merge the catalogues of overlapping tiles. A source in the region of its own tile
+// takes precedence over one outside, and otherwise the tile listed first decides.
+// Every source is dropped for the nearest source of another tile that takes
+// precedence over it and lies within 'radius' pixels and 'channels' channels, and its
+// mask label maps to the one kept. Precedence only increases along such links, so
+// they end at a kept source. Kept sources are numbered from 1 in the order of the
+// parts and have their positions moved into the merged grid. 'labels' receives one
+// entry per input source, and the caller frees it.
+SofiaCatalog *catalog_merge(const CatalogPart *parts, const size_t n_parts, const double radius, const double channels, LabelMap **labels, size_t *n_labels)
+{
+    check_null(parts);
+    check_null(labels);
+    check_null(n_labels);
+    
+    if (!(radius > 0.0) || !(channels >= 0.0)) error_exit("Catalogue match radius must be positive and channel tolerance not negative.");
+    
+    size_t n_entries = 0;
+    for (size_t p = 0; p < n_parts; p++) {
+        if (parts[p].catalog != NULL) n_entries += parts[p].catalog->size;
+    }
+    
+    MergeEntry *entries = memory_alloc((n_entries > 0 ? n_entries : 1) * sizeof(MergeEntry));
+    SpatialHash *hash = SpatialHash_new(n_entries, radius, radius, channels > 0.0 ? channels : 1.0);
+    
+    // Positions in the merged grid; pixel i covers [i - 0.5, i + 0.5)
+    size_t n = 0;
+    for (size_t p = 0; p < n_parts; p++) {
+        if (parts[p].catalog == NULL) continue;
+        
+        for (size_t i = 0; i < parts[p].catalog->size; i++, n++) {
+            const CatalogSource *source = &parts[p].catalog->sources[i];
+            MergeEntry *entry = &entries[n];
+            entry->position[0] = source->x + parts[p].offset[0];
+            entry->position[1] = source->y + parts[p].offset[1];
+            entry->position[2] = source->z + parts[p].offset[2];
+            entry->part = p;
+            entry->index = i;
+            entry->match = SPATIAL_HASH_NONE;
+            entry->merged_id = 0;
+            entry->valid = !isnan(entry->position[0]) && !isnan(entry->position[1]) && !isnan(entry->position[2]);
+            entry->owned = true;
+            
+            if (entry->valid) {
+                for (int axis = 0; axis < 3; axis++) {
+                    if (entry->position[axis] < parts[p].first[axis] - 0.5 || entry->position[axis] >= parts[p].last[axis] - 0.5) entry->owned = false;
+                }
+                SpatialHash_insert(hash, n, entry->position);
+            }
+        }
+    }
+    
+    // Nearest source of another tile that takes precedence
+    const double radius_sq = radius * radius;
+    size_t n_dropped = 0;
+    
+    for (size_t i = 0; i < n_entries; i++) {
+        MergeEntry *entry = &entries[i];
+        if (!entry->valid) continue;
+        
+        long long cell[3];
+        SpatialHash_cell(hash, entry->position, cell);
+        double best = INFINITY;
+        
+        for (long long dz = -1; dz <= 1; dz++) {
+            for (long long dy = -1; dy <= 1; dy++) {
+                for (long long dx = -1; dx <= 1; dx++) {
+                    for (size_t j = SpatialHash_first(hash, cell[0] + dx, cell[1] + dy, cell[2] + dz); j != SPATIAL_HASH_NONE; j = hash->next[j]) {
+                        const MergeEntry *other = &entries[j];
+                        if (other->part == entry->part || !takes_precedence(other, entry)) continue;
+                        
+                        const double ddx = other->position[0] - entry->position[0];
+                        const double ddy = other->position[1] - entry->position[1];
+                        const double ddz = other->position[2] - entry->position[2];
+                        const double distance = ddx * ddx + ddy * ddy;
+                        if (distance > radius_sq || fabs(ddz) > channels) continue;
+                        
+                        const double score = distance / radius_sq + (channels > 0.0 ? (ddz * ddz) / (channels * channels) : 0.0);
+                        if (score < best || (score == best && j < entry->match)) {
+                            best = score;
+                            entry->match = j;
+                        }
+                    }
+                }
+            }
+        }
+        
+        if (entry->match != SPATIAL_HASH_NONE) n_dropped++;
+    }
+    
+    SpatialHash_delete(hash);
+    
+    // Merged catalogue
+    SofiaCatalog *merged = SofiaCatalog_new();
+    for (size_t p = 0; p < n_parts; p++) {
+        if (parts[p].catalog != NULL) {
+            strcpy(merged->type, parts[p].catalog->type);
+            break;
+        }
+    }
+    
+    int next_id = 1;
+    for (size_t i = 0; i < n_entries; i++) {
+        MergeEntry *entry = &entries[i];
+        if (entry->match != SPATIAL_HASH_NONE) continue;
+        
+        const CatalogPart *part = &parts[entry->part];
+        CatalogSource source = part->catalog->sources[entry->index];
+        source.x += part->offset[0];
+        source.x_min += part->offset[0];
+        source.x_max += part->offset[0];
+        source.y += part->offset[1];
+        source.y_min += part->offset[1];
+        source.y_max += part->offset[1];
+        source.z += part->offset[2];
+        source.z_min += part->offset[2];
+        source.z_max += part->offset[2];
+        source.id = next_id;
+        
+        entry->merged_id = next_id++;
+        SofiaCatalog_add_source(merged, &source);
+    }
+    
+    // Labels of dropped sources go to the kept source at the end of their links
+    *n_labels = n_entries;
+    *labels = memory_alloc((n_entries > 0 ? n_entries : 1) * sizeof(LabelMap));
+    for (size_t i = 0; i < n_entries; i++) {
+        const MergeEntry *entry = &entries[i];
+        LabelMap *label = &(*labels)[i];
+        label->part = (int)entry->part;
+        label->id = parts[entry->part].catalog->sources[entry->index].id;
+        size_t kept = i;
+        while (entries[kept].match != SPATIAL_HASH_NONE) kept = entries[kept].match;
+        label->merged_id = entries[kept].merged_id;
+    }
+    
+    printf("Merged %zu sources of %zu catalogues into %zu (%zu duplicates removed).\n", n_entries, n_parts, merged->size, n_dropped);
+    
+    memory_free(entries);
+    return merged;
+}
+
+// ----------------------------------------------------------------- //
+// Private methods                                                   //
+// ----------------------------------------------------------------- //
+
+// Bucket of a cell: large-prime mixing of the cell indices, then a Fibonacci hash
+size_t SpatialHash_bucket(const SpatialHash *self, const long long cx, const long long cy, const long long cz)
+{
+    const uint64_t key = ((uint64_t)cx * UINT64_C(73856093)) ^ ((uint64_t)cy * UINT64_C(19349663)) ^ ((uint64_t)cz * UINT64_C(83492791));
+    return (size_t)((key * UINT64_C(11400714819323198485)) >> 32) & (self->n_buckets - 1);
+}
+
+// Source in its own region before one outside, then the earlier tile
+bool takes_precedence(const MergeEntry *entry, const MergeEntry *other)
+{
+    if (entry->owned != other->owned) return entry->owned;
+    return entry->part < other->part;
+}
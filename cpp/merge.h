@@ -0,0 +1,92 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (merge.h) - SoFiA to HDF5 Converter                       //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+
+/// @file   merge.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Merging of tile catalogues with a spatial hash (header).
+
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stdbool.h>
+#include "common.h"
+#include "reader.h"
+
+#define SPATIAL_HASH_NONE ((size_t)-1)  ///< End of a bucket list.
+
+// ----------------------------------------------------------------- //
+// Class 'SpatialHash'                                               //
+// ----------------------------------------------------------------- //
+// Buckets of points by the cell of a regular 3-D grid they fall     //
+// into, so that all points within one cell size of a position are   //
+// found by walking the 27 surrounding cells. Cells are hashed into  //
+// a table of twice as many buckets as points, keeping insertion     //
+// and lookup O(1) for any extent of the grid. Different cells can   //
+// share a bucket, so candidates must still be checked.              //
+// ----------------------------------------------------------------- //
+
+typedef CLASS SpatialHash {
+    double cell[3];       // Cell size along each axis
+    size_t n_buckets;     // Power of two
+    size_t capacity;      // Points that can be inserted
+    size_t *heads;        // First point of every bucket
+    size_t *next;         // Next point in the bucket of every point
+} SpatialHash;
+
+// ----------------------------------------------------------------- //
+// Class 'CatalogPart'                                               //
+// ----------------------------------------------------------------- //
+// Catalogue of one tile with its place in the merged pixel grid:    //
+// the offset added to its pixel positions and the region of the     //
+// merged grid it is responsible for, [first, last) along x, y, z.   //
+// ----------------------------------------------------------------- //
+
+typedef CLASS CatalogPart {
+    const SofiaCatalog *catalog;
+    double offset[3];
+    double first[3];
+    double last[3];
+} CatalogPart;
+
+// ----------------------------------------------------------------- //
+// Class 'LabelMap'                                                  //
+// ----------------------------------------------------------------- //
+// Source ID of a tile and the ID it has in the merged catalogue.    //
+// ----------------------------------------------------------------- //
+
+typedef CLASS LabelMap {
+    int part;
+    int id;
+    int merged_id;
+} LabelMap;
+
+// Constructor and destructor
+PUBLIC SpatialHash *SpatialHash_new(const size_t capacity, const double cell_x, const double cell_y, const double cell_z);
+PUBLIC void SpatialHash_delete(SpatialHash *self);
+
+// Public methods
+PUBLIC void SpatialHash_insert(SpatialHash *self, const size_t index, const double *position);
+PUBLIC void SpatialHash_cell(const SpatialHash *self, const double *position, long long *cell);
+PUBLIC size_t SpatialHash_first(const SpatialHash *self, const long long cx, const long long cy, const long long cz);
+PUBLIC SofiaCatalog *catalog_merge(const CatalogPart *parts, const size_t n_parts, const double radius, const double channels, LabelMap **labels, size_t *n_labels);
+
+#endif
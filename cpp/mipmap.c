@@ -0,0 +1,178 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (mipmap.c) - SoFiA to HDF5 Converter                     //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "mipmap.h"
+#include <math.h>
+
+// Private methods
+PRIVATE void MipMaps_complete_row(MipMaps *self, const size_t slot, const size_t level, const size_t y,
+                                  double *sum, uint64_t *count);
+
+// ----------------------------------------------------------------- //
+// First-level kernels                                               //
+// ----------------------------------------------------------------- //
+// Add the finite values of one full-resolution row, pair by pair,   //
+// to the sums and counts of the row of 2x2 blocks it falls in; an   //
+// odd last pixel forms an incomplete block. Blanks are masked       //
+// with finite_mask() instead of branched around, so the pairs are   //
+// added with vector instructions.                                   //
+// ----------------------------------------------------------------- //
+
+#define MIPMAP_FIRST_LEVEL_KERNEL(NAME, TYPE) \
+PRIVATE void NAME(const TYPE *row, const size_t nx, double *sum, uint64_t *count) \
+{ \
+    const size_t pairs = nx / 2; \
+    \
+    _Pragma("omp simd") \
+    for (size_t x = 0; x < pairs; x++) { \
+        const double left = (double)row[2 * x]; \
+        const double right = (double)row[2 * x + 1]; \
+        const uint64_t keep_left = finite_mask(left); \
+        const uint64_t keep_right = finite_mask(right); \
+        sum[x] += select_value(keep_left, left, 0.0) + select_value(keep_right, right, 0.0); \
+        count[x] += (keep_left & 1) + (keep_right & 1); \
+    } \
+    \
+    if (nx % 2 != 0) { \
+        const double value = (double)row[nx - 1]; \
+        const uint64_t keep = finite_mask(value); \
+        sum[pairs] += select_value(keep, value, 0.0); \
+        count[pairs] += keep & 1; \
+    } \
+}
+
+MIPMAP_FIRST_LEVEL_KERNEL(MipMaps_first_level_flt, float)
+MIPMAP_FIRST_LEVEL_KERNEL(MipMaps_first_level_dbl, double)
+
+#undef MIPMAP_FIRST_LEVEL_KERNEL
+
+// ----------------------------------------------------------------- //
+// Constructor and destructor                                        //
+// ----------------------------------------------------------------- //
+
+MipMaps *MipMaps_new(const size_t nx, const size_t ny, const int data_type, const size_t slab_planes)
+{
+    MipMaps *self = memory_alloc(sizeof(MipMaps));
+    self->nx = nx;
+    self->ny = ny;
+    self->data_type = data_type;
+    self->slab_planes = slab_planes;
+
+    // Count levels: keep halving while either axis is still above the minimum size
+    self->n_levels = 0;
+    for (size_t f = 2; (nx + f / 2 - 1) / (f / 2) > MIPMAP_MIN_SIZE || (ny + f / 2 - 1) / (f / 2) > MIPMAP_MIN_SIZE; f *= 2) {
+        self->n_levels++;
+    }
+
+    self->factor = memory_alloc((self->n_levels + 1) * sizeof(size_t));
+    self->width = memory_alloc((self->n_levels + 1) * sizeof(size_t));
+    self->height = memory_alloc((self->n_levels + 1) * sizeof(size_t));
+    self->levels = memory_alloc((self->n_levels + 1) * sizeof(void *));
+
+    const size_t word_size = data_type == -64 ? sizeof(double) : sizeof(float);
+
+    for (size_t level = 0; level < self->n_levels; level++) {
+        self->factor[level] = (size_t)2 << level;
+        self->width[level] = (nx + self->factor[level] - 1) / self->factor[level];
+        self->height[level] = (ny + self->factor[level] - 1) / self->factor[level];
+        self->levels[level] = memory_alloc(slab_planes * self->width[level] * self->height[level] * word_size);
+    }
+
+    self->row_cells = 0;
+    for (size_t level = 0; level < self->n_levels; level++) self->row_cells += self->width[level];
+    self->row_sum = memory_alloc(slab_planes * self->row_cells * sizeof(double));
+    self->row_count = memory_alloc(slab_planes * self->row_cells * sizeof(uint64_t));
+
+    return self;
+}
+
+void MipMaps_delete(MipMaps *self)
+{
+    if (self != NULL) {
+        for (size_t level = 0; level < self->n_levels; level++) memory_free(self->levels[level]);
+        memory_free(self->levels);
+        memory_free(self->factor);
+        memory_free(self->width);
+        memory_free(self->height);
+        memory_free(self->row_sum);
+        memory_free(self->row_count);
+        memory_free(self);
+    }
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Public methods                                                    //
+// ----------------------------------------------------------------- //
+
+bool MipMaps_supports_type(const int data_type)
+{
+    return data_type == -32 || data_type == -64;
+}
+
+// Downsample one native-endian plane into position 'slot' of the level buffers.
+// Different slots may be filled from different threads at the same time.
+void MipMaps_add_plane(MipMaps *self, const size_t slot, const void *data)
+{
+    check_null(self);
+    check_null(data);
+
+    if (self->n_levels == 0) return;
+    if (slot >= self->slab_planes) error_exit("Mipmap slot out of range.");
+
+    // Rows under construction, one per level, one level after the other
+    double *sum = self->row_sum + slot * self->row_cells;
+    uint64_t *count = self->row_count + slot * self->row_cells;
+    memset(sum, 0, self->row_cells * sizeof(double));
+    memset(count, 0, self->row_cells * sizeof(uint64_t));
+
+    for (size_t y = 0; y < self->ny; y++) {
+        if (self->data_type == -64) MipMaps_first_level_dbl((const double *)data + y * self->nx, self->nx, sum, count);
+        else MipMaps_first_level_flt((const float *)data + y * self->nx, self->nx, sum, count);
+
+        if (y % 2 == 1 || y + 1 == self->ny) MipMaps_complete_row(self, slot, 0, y / 2, sum, count);
+    }
+
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Private methods                                                   //
+// ----------------------------------------------------------------- //
+
+// Row y of a level has all its blocks: store it as means (NaN for fully blanked
+// blocks), add it to the row of the next level, which follows it in the scratch,
+// complete that one as well if this was its last row, and clear it for reuse
+void MipMaps_complete_row(MipMaps *self, const size_t slot, const size_t level, const size_t y,
+                          double *sum, uint64_t *count)
+{
+    const size_t width = self->width[level];
+    const size_t offset = (slot * self->height[level] + y) * width;
+
+    if (self->data_type == -64) {
+        double *out = (double *)self->levels[level] + offset;
+        for (size_t x = 0; x < width; x++) out[x] = count[x] > 0 ? sum[x] / count[x] : NAN;
+    } else {
+        float *out = (float *)self->levels[level] + offset;
+        for (size_t x = 0; x < width; x++) out[x] = count[x] > 0 ? (float)(sum[x] / count[x]) : NAN;
+    }
+
+    if (level + 1 < self->n_levels) {
+        double *next_sum = sum + width;
+        uint64_t *next_count = count + width;
+        for (size_t x = 0; x < width; x++) {
+            next_sum[x / 2] += sum[x];
+            next_count[x / 2] += count[x];
+        }
+        if (y % 2 == 1 || y + 1 == self->height[level]) {
+            MipMaps_complete_row(self, slot, level + 1, y / 2, next_sum, next_count);
+        }
+    }
+
+    memset(sum, 0, width * sizeof(double));
+    memset(count, 0, width * sizeof(uint64_t));
+    return;
+}
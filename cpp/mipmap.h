@@ -0,0 +1,70 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (mipmap.h) - SoFiA to HDF5 Converter                     //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+/// @file   mipmap.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Spatially downsampled copies of image planes (header).
+
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "common.h"
+
+#define MIPMAP_MIN_SIZE 128  ///< No further levels once both axes are at or below this size.
+
+// ----------------------------------------------------------------- //
+// Class 'MipMaps'                                                   //
+// ----------------------------------------------------------------- //
+// Mean-binned 2x, 4x, 8x, ... downsampled planes (NaN-aware) for    //
+// one slab of planes at a time, as in the CARTA (IDIA) schema.      //
+// Each level is computed from the sums and counts of the previous   //
+// one, so every level is an exact mean over its full-resolution     //
+// block. A plane is swept row by row: each level only keeps the     //
+// sums and counts of the row it is building, in scratch that is     //
+// allocated once per slot. Planes of a slab may be added from       //
+// several threads, each into its own slot.                          //
+// ----------------------------------------------------------------- //
+
+typedef CLASS MipMaps {
+    size_t nx, ny;        // Size of the full-resolution plane
+    int data_type;        // BITPIX of the data (-32 or -64)
+    size_t n_levels;      // Number of downsampled levels
+    size_t *factor;       // Downsampling factor per level (2, 4, 8, ...)
+    size_t *width;        // Plane width per level
+    size_t *height;       // Plane height per level
+    size_t slab_planes;   // Capacity of the level buffers in planes
+    void **levels;        // Per level: slab_planes downsampled planes in data precision
+    size_t row_cells;     // Sum of the level widths: row scratch per slot
+    double *row_sum;      // Per slot: the rows being built, level after level
+    uint64_t *row_count;
+} MipMaps;
+
+// Constructor and destructor
+PUBLIC MipMaps *MipMaps_new(const size_t nx, const size_t ny, const int data_type, const size_t slab_planes);
+PUBLIC void MipMaps_delete(MipMaps *self);
+
+// Public methods
+PUBLIC bool MipMaps_supports_type(const int data_type);
+PUBLIC void MipMaps_add_plane(MipMaps *self, const size_t slot, const void *data);
+
+#endif
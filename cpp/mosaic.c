@@ -0,0 +1,534 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (mosaic.c) - SoFiA to HDF5 Converter                     //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+// Needed for realpath() with -std=c99
+#define _XOPEN_SOURCE 700
+
+#include "mosaic.h"
+#include "header.h"
+#include "fits_writer.h"
+#include <math.h>
+
+// Tolerances for tiles to count as cut from the same pixel grid
+#define MOSAIC_PIXEL_TOLERANCE 1.0e-3  ///< Largest deviation of CRPIX offsets from whole pixels.
+#define MOSAIC_WCS_TOLERANCE   1.0e-6  ///< Largest relative deviation of CRVAL and CDELT.
+
+// Interval of a tile along one axis and the part of it that the tile supplies
+typedef CLASS MosaicSpan {
+    long long start;
+    long long end;
+    long long first;
+    long long last;
+} MosaicSpan;
+
+PRIVATE int compare_span(const void *a, const void *b);
+PRIVATE char *mosaic_read_cards(hid_t file_id, const char *path, size_t *header_size);
+PRIVATE char *mosaic_header(const SofiaMosaic *self, const char *cards, const size_t header_size, size_t *mosaic_size);
+PRIVATE void mosaic_relative_path(const char *directory, const char *filename, char *path);
+
+// ----------------------------------------------------------------- //
+// Constructor and destructor                                        //
+// ----------------------------------------------------------------- //
+
+SofiaMosaic *SofiaMosaic_new(void)
+{
+    SofiaMosaic *self = memory_alloc(sizeof(SofiaMosaic));
+    self->tiles = NULL;
+    self->n_tiles = 0;
+    self->size[0] = self->size[1] = self->size[2] = 0;
+    self->header = NULL;
+    self->header_size = 0;
+    self->mask_header = NULL;
+    self->mask_header_size = 0;
+    self->cube = NULL;
+    self->mask = NULL;
+    self->catalog = NULL;
+    self->labels = NULL;
+    self->n_labels = 0;
+    return self;
+}
+
+void SofiaMosaic_delete(SofiaMosaic *self)
+{
+    if (self != NULL) {
+        for (size_t i = 0; i < self->n_tiles; i++) SofiaCatalog_delete(self->tiles[i].catalog);
+        memory_free(self->tiles);
+        memory_free(self->header);
+        memory_free(self->mask_header);
+        FitsFile_delete(self->cube);
+        FitsFile_delete(self->mask);
+        SofiaCatalog_delete(self->catalog);
+        memory_free(self->labels);
+        memory_free(self);
+    }
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Public methods                                                    //
+// ----------------------------------------------------------------- //
+
+// Add the HDF5 file of one tile; it must share the pixel grid of the first tile
+void SofiaMosaic_add_tile(SofiaMosaic *self, const char *filename)
+{
+    check_null(self);
+    check_null(filename);
+    
+    char error_msg[MAX_PATH_LENGTH + 200];
+    
+    hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0 || H5Lexists(file_id, "/SoFiA", H5P_DEFAULT) <= 0 || H5Lexists(file_id, "/SoFiA/DATA", H5P_DEFAULT) <= 0) {
+        snprintf(error_msg, sizeof(error_msg), "Tile %s is not an HDF5 file written by sofia2hdf5.", filename);
+        error_exit(error_msg);
+    }
+    
+    self->tiles = memory_realloc(self->tiles, (self->n_tiles + 1) * sizeof(MosaicTile));
+    MosaicTile *tile = &self->tiles[self->n_tiles];
+    memset(tile, 0, sizeof(MosaicTile));
+    strncpy(tile->filename, filename, MAX_PATH_LENGTH - 1);
+    
+    hid_t dataset_id = H5Dopen2(file_id, "/SoFiA/DATA", H5P_DEFAULT);
+    hid_t space_id = H5Dget_space(dataset_id);
+    tile->rank = H5Sget_simple_extent_dims(space_id, tile->dims, NULL);
+    H5Sclose(space_id);
+    H5Dclose(dataset_id);
+    
+    if (tile->rank < 3 || tile->rank > 4) {
+        snprintf(error_msg, sizeof(error_msg), "DATA of tile %s has an unexpected shape.", filename);
+        error_exit(error_msg);
+    }
+    
+    size_t header_size = 0;
+    char *cards = mosaic_read_cards(file_id, "/SoFiA/HEADER", &header_size);
+    if (cards == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Tile %s has no raw FITS header.", filename);
+        error_exit(error_msg);
+    }
+    
+    FitsHeader *header = FitsHeader_new(NULL);
+    FitsHeader_parse(header, cards, header_size);
+    
+    // The spectral axis is only tiled if it is the third axis of DATA (not squeezed Stokes)
+    const bool has_z = FitsHeader_get_int(header, "NAXIS") >= 3 && (hsize_t)FitsHeader_get_int(header, "NAXIS3") == tile->dims[tile->rank - 3];
+    
+    for (int axis = 0; axis < 3; axis++) {
+        char key[16];
+        snprintf(key, sizeof(key), "CRPIX%d", axis + 1);
+        tile->size[axis] = tile->dims[tile->rank - 1 - axis];
+        tile->crpix[axis] = (axis < 2 || has_z) ? FitsHeader_get_flt(header, key) : 1.0;
+        if (isnan(tile->crpix[axis])) {
+            if (axis < 2) {
+                snprintf(error_msg, sizeof(error_msg), "Tile %s lacks %s.", filename, key);
+                error_exit(error_msg);
+            }
+            tile->crpix[axis] = 1.0;
+        }
+    }
+    
+    if (self->n_tiles == 0) {
+        self->header = cards;
+        self->header_size = header_size;
+    } else {
+        // Same pixel grid as the first tile
+        FitsHeader *reference = FitsHeader_new(NULL);
+        FitsHeader_parse(reference, self->header, self->header_size);
+        
+        for (int axis = 1; axis <= 4; axis++) {
+            char key[16];
+            snprintf(key, sizeof(key), "CTYPE%d", axis);
+            const char *ctype = FitsHeader_get_str(header, key);
+            const char *ref_ctype = FitsHeader_get_str(reference, key);
+            
+            snprintf(key, sizeof(key), "CDELT%d", axis);
+            const double cdelt = FitsHeader_get_flt(header, key);
+            const double ref_cdelt = FitsHeader_get_flt(reference, key);
+            
+            snprintf(key, sizeof(key), "CRVAL%d", axis);
+            const double crval = FitsHeader_get_flt(header, key);
+            const double ref_crval = FitsHeader_get_flt(reference, key);
+            
+            const bool same_type = (ctype == NULL && ref_ctype == NULL) || (ctype != NULL && ref_ctype != NULL && strcmp(ctype, ref_ctype) == 0);
+            const double scale = fabs(ref_cdelt) > 0.0 ? fabs(ref_cdelt) : 1.0;
+            const bool same_cdelt = (isnan(cdelt) && isnan(ref_cdelt)) || fabs(cdelt - ref_cdelt) <= MOSAIC_WCS_TOLERANCE * scale;
+            const bool same_crval = (isnan(crval) && isnan(ref_crval)) || fabs(crval - ref_crval) <= MOSAIC_WCS_TOLERANCE * scale;
+            
+            if (!same_type || !same_cdelt || !same_crval) {
+                snprintf(error_msg, sizeof(error_msg), "Tile %s does not share the pixel grid of %s (axis %d).", filename, self->tiles[0].filename, axis);
+                error_exit(error_msg);
+            }
+        }
+        
+        FitsHeader_delete(reference);
+        memory_free(cards);
+    }
+    
+    FitsHeader_delete(header);
+    
+    // The mask is only included if every tile has one of the shape of DATA
+    if (H5Lexists(file_id, "/SoFiA/Mask", H5P_DEFAULT) > 0 && H5Lexists(file_id, "/SoFiA/Mask/DATA", H5P_DEFAULT) > 0) {
+        hsize_t mask_dims[4];
+        hid_t mask_id = H5Dopen2(file_id, "/SoFiA/Mask/DATA", H5P_DEFAULT);
+        hid_t mask_space = H5Dget_space(mask_id);
+        const int mask_rank = H5Sget_simple_extent_dims(mask_space, mask_dims, NULL);
+        H5Sclose(mask_space);
+        H5Dclose(mask_id);
+        
+        tile->has_mask = (mask_rank == tile->rank && memcmp(mask_dims, tile->dims, tile->rank * sizeof(hsize_t)) == 0);
+        
+        if (tile->has_mask && self->n_tiles == 0 && H5Lexists(file_id, "/SoFiA/Mask/HEADER", H5P_DEFAULT) > 0) {
+            // The mask links to the cube header and keeps its own values as attributes
+            size_t n_cards = 0;
+            hid_t mask_group = H5Gopen2(file_id, "/SoFiA/Mask", H5P_DEFAULT);
+            hid_t mask_data = H5Dopen2(mask_group, "DATA", H5P_DEFAULT);
+            self->mask_header = SofiaFITS_read_header(mask_group, mask_data, true, &n_cards);
+            self->mask_header_size = n_cards * FITS_HEADER_LINE_SIZE;
+            H5Dclose(mask_data);
+            H5Gclose(mask_group);
+        }
+    }
+    
+    H5Fclose(file_id);
+    self->n_tiles++;
+    
+    return;
+}
+
+// Hand over the catalogue of the tile added last; the mosaic deletes it
+void SofiaMosaic_add_catalog(SofiaMosaic *self, SofiaCatalog *catalog)
+{
+    check_null(self);
+    check_null(catalog);
+    if (self->n_tiles == 0) error_exit("A catalogue can only be added to a tile.");
+    
+    SofiaCatalog_delete(self->tiles[self->n_tiles - 1].catalog);
+    self->tiles[self->n_tiles - 1].catalog = catalog;
+    return;
+}
+
+// Place the tiles by their reference pixels and decide which tile supplies which part of
+// the mosaic. Along each axis the distinct tile intervals must follow each other, and
+// every combination of them must be one tile (a regular grid, possibly overlapping).
+void SofiaMosaic_arrange(SofiaMosaic *self)
+{
+    check_null(self);
+    
+    if (self->n_tiles == 0) error_exit("A mosaic needs at least one tile.");
+    
+    for (size_t i = 1; i < self->n_tiles; i++) {
+        if (self->tiles[i].rank != self->tiles[0].rank || (self->tiles[0].rank == 4 && self->tiles[i].dims[0] != self->tiles[0].dims[0])) {
+            error_exit("Tiles of a mosaic must have the same axes and Stokes parameters.");
+        }
+    }
+    
+    bool all_masks = (self->mask_header != NULL);
+    for (size_t i = 0; i < self->n_tiles; i++) all_masks = all_masks && self->tiles[i].has_mask;
+    if (!all_masks && self->mask_header != NULL) {
+        printf("Note: Not all tiles have a mask; the mosaic is written without one.\n");
+        memory_free(self->mask_header);
+        self->mask_header = NULL;
+    }
+    
+    MosaicSpan *spans = memory_alloc(self->n_tiles * sizeof(MosaicSpan));
+    size_t n_combinations = 1;
+    
+    for (int axis = 0; axis < 3; axis++) {
+        // Whole-pixel offsets relative to the first tile
+        long long min_offset = 0;
+        for (size_t i = 0; i < self->n_tiles; i++) {
+            const double offset = self->tiles[0].crpix[axis] - self->tiles[i].crpix[axis];
+            if (fabs(offset - round(offset)) > MOSAIC_PIXEL_TOLERANCE) {
+                char error_msg[MAX_PATH_LENGTH + 100];
+                snprintf(error_msg, sizeof(error_msg), "Tile %s is not offset by whole pixels.", self->tiles[i].filename);
+                error_exit(error_msg);
+            }
+            self->tiles[i].origin[axis] = llround(offset);
+            if (self->tiles[i].origin[axis] < min_offset) min_offset = self->tiles[i].origin[axis];
+        }
+        
+        // Distinct intervals along this axis, in order
+        size_t n_spans = 0;
+        self->size[axis] = 0;
+        for (size_t i = 0; i < self->n_tiles; i++) {
+            MosaicTile *tile = &self->tiles[i];
+            tile->origin[axis] -= min_offset;
+            
+            const long long end = tile->origin[axis] + (long long)tile->size[axis];
+            if ((size_t)end > self->size[axis]) self->size[axis] = (size_t)end;
+            
+            size_t s = 0;
+            while (s < n_spans && !(spans[s].start == tile->origin[axis] && spans[s].end == end)) s++;
+            if (s == n_spans) {
+                spans[n_spans].start = tile->origin[axis];
+                spans[n_spans].end = end;
+                n_spans++;
+            }
+        }
+        
+        qsort(spans, n_spans, sizeof(MosaicSpan), compare_span);
+        n_combinations *= n_spans;
+        
+        // Overlaps are split in the middle
+        spans[0].first = spans[0].start;
+        for (size_t s = 1; s < n_spans; s++) {
+            if (spans[s].start <= spans[s - 1].start || spans[s].end <= spans[s - 1].end) {
+                error_exit("Tiles of the mosaic do not form a regular grid.");
+            }
+            const long long cut = spans[s].start < spans[s - 1].end ? (spans[s].start + spans[s - 1].end) / 2 : spans[s].start;
+            spans[s - 1].last = spans[s].start < spans[s - 1].end ? cut : spans[s - 1].end;
+            spans[s].first = cut;
+        }
+        spans[n_spans - 1].last = spans[n_spans - 1].end;
+        
+        for (size_t i = 0; i < self->n_tiles; i++) {
+            MosaicTile *tile = &self->tiles[i];
+            for (size_t s = 0; s < n_spans; s++) {
+                if (spans[s].start == tile->origin[axis] && spans[s].end == tile->origin[axis] + (long long)tile->size[axis]) {
+                    tile->first[axis] = (size_t)spans[s].first;
+                    tile->last[axis] = (size_t)spans[s].last;
+                }
+            }
+        }
+    }
+    
+    memory_free(spans);
+    
+    // Every grid cell exactly once
+    for (size_t i = 0; i < self->n_tiles; i++) {
+        for (size_t j = i + 1; j < self->n_tiles; j++) {
+            if (memcmp(self->tiles[i].first, self->tiles[j].first, sizeof(self->tiles[i].first)) == 0) {
+                char error_msg[2 * MAX_PATH_LENGTH + 100];
+                snprintf(error_msg, sizeof(error_msg), "Tiles %s and %s cover the same region.", self->tiles[i].filename, self->tiles[j].filename);
+                error_exit(error_msg);
+            }
+        }
+    }
+    if (n_combinations != self->n_tiles) {
+        error_exit("Tiles of the mosaic do not form a regular grid.");
+    }
+    
+    printf("Mosaic of %zu tiles: %zu x %zu x %zu pixels.\n", self->n_tiles, self->size[0], self->size[1], self->size[2]);
+    
+    return;
+}
+
+// Merge the tile catalogues once the tiles are arranged. Every tile is responsible for
+// the sources in the part of the mosaic it supplies; see catalog_merge().
+void SofiaMosaic_merge_catalogs(SofiaMosaic *self, const double radius, const double channels)
+{
+    check_null(self);
+    
+    bool any = false;
+    for (size_t i = 0; i < self->n_tiles; i++) any = any || self->tiles[i].catalog != NULL;
+    if (!any) return;
+    
+    CatalogPart *parts = memory_alloc(self->n_tiles * sizeof(CatalogPart));
+    for (size_t i = 0; i < self->n_tiles; i++) {
+        parts[i].catalog = self->tiles[i].catalog;
+        for (int axis = 0; axis < 3; axis++) {
+            parts[i].offset[axis] = (double)self->tiles[i].origin[axis];
+            parts[i].first[axis] = (double)self->tiles[i].first[axis];
+            parts[i].last[axis] = (double)self->tiles[i].last[axis];
+        }
+    }
+    
+    SofiaCatalog_delete(self->catalog);
+    memory_free(self->labels);
+    self->catalog = catalog_merge(parts, self->n_tiles, radius, channels, &self->labels, &self->n_labels);
+    
+    memory_free(parts);
+    return;
+}
+
+// Hand the mosaic to an HDF5 writer: header-only cube and mask, and one virtual
+// source per tile, named relative to the output file where possible
+void SofiaMosaic_setup(SofiaMosaic *self, SofiaHDF5 *out)
+{
+    check_null(self);
+    check_null(out);
+    
+    size_t size = 0;
+    char *cards = mosaic_header(self, self->header, self->header_size, &size);
+    self->cube = FitsFile_new_from_header(cards, size);
+    memory_free(cards);
+    SofiaHDF5_add_cube(out, self->cube);
+    
+    if (self->mask_header != NULL) {
+        cards = mosaic_header(self, self->mask_header, self->mask_header_size, &size);
+        self->mask = FitsFile_new_from_header(cards, size);
+        memory_free(cards);
+        SofiaHDF5_add_mask(out, self->mask);
+    }
+    
+    if (self->catalog != NULL) SofiaHDF5_add_catalog(out, self->catalog);
+    
+    // Directory of the output file
+    char directory[MAX_PATH_LENGTH];
+    strncpy(directory, out->hdf5name, MAX_PATH_LENGTH - 1);
+    directory[MAX_PATH_LENGTH - 1] = '\0';
+    char *slash = strrchr(directory, '/');
+    if (slash == NULL) strcpy(directory, ".");
+    else if (slash == directory) slash[1] = '\0';
+    else *slash = '\0';
+    
+    for (size_t i = 0; i < self->n_tiles; i++) {
+        const MosaicTile *tile = &self->tiles[i];
+        
+        VirtualSource source;
+        memset(&source, 0, sizeof(VirtualSource));
+        mosaic_relative_path(directory, tile->filename, source.filename);
+        source.rank = tile->rank;
+        memcpy(source.dims, tile->dims, sizeof(source.dims));
+        
+        // Stokes axis in full
+        if (tile->rank == 4) source.count[0] = tile->dims[0];
+        
+        for (int axis = 0; axis < 3; axis++) {
+            const int index = tile->rank - 1 - axis;
+            source.source[index] = tile->first[axis] - (size_t)tile->origin[axis];
+            source.target[index] = tile->first[axis];
+            source.count[index] = tile->last[axis] - tile->first[axis];
+        }
+        
+        SofiaHDF5_add_virtual_source(out, &source);
+    }
+    
+    return;
+}
+
+// Record in Mask/Labels which mosaic source every label of a tile mask belongs to:
+// columns 'tile' (index of the virtual source of DATA), 'id' and 'mosaic_id'. The
+// virtual mask keeps the labels of the tiles, so these are needed to look them up.
+void SofiaMosaic_write_labels(const SofiaMosaic *self, const char *filename)
+{
+    check_null(self);
+    check_null(filename);
+    
+    if (self->n_labels == 0 || self->mask == NULL) return;
+    
+    hid_t file_id = H5Fopen(filename, H5F_ACC_RDWR, H5P_DEFAULT);
+    if (file_id < 0 || H5Lexists(file_id, "/SoFiA/Mask", H5P_DEFAULT) <= 0) {
+        fprintf(stderr, "Warning: Cannot add mask labels to %s\n", filename);
+        if (file_id >= 0) H5Fclose(file_id);
+        return;
+    }
+    
+    hid_t group_id = H5Gcreate2(file_id, "/SoFiA/Mask/Labels", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hsize_t dims[1] = {self->n_labels};
+    hid_t space_id = H5Screate_simple(1, dims, NULL);
+    int *column = memory_alloc(self->n_labels * sizeof(int));
+    
+    const char *names[3] = {"tile", "id", "mosaic_id"};
+    for (int c = 0; c < 3; c++) {
+        for (size_t i = 0; i < self->n_labels; i++) {
+            column[i] = c == 0 ? self->labels[i].part : (c == 1 ? self->labels[i].id : self->labels[i].merged_id);
+        }
+        hid_t dataset = H5Dcreate2(group_id, names[c], H5T_NATIVE_INT, space_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        if (dataset >= 0) {
+            H5Dwrite(dataset, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, column);
+            H5Dclose(dataset);
+        }
+    }
+    
+    memory_free(column);
+    H5Sclose(space_id);
+    H5Gclose(group_id);
+    H5Fclose(file_id);
+    
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Private methods                                                   //
+// ----------------------------------------------------------------- //
+
+// Raw header cards stored by the converter (HEADER data set), or NULL
+char *mosaic_read_cards(hid_t file_id, const char *path, size_t *header_size)
+{
+    *header_size = 0;
+    if (H5Lexists(file_id, path, H5P_DEFAULT) <= 0) return NULL;
+    
+    hid_t dataset_id = H5Dopen2(file_id, path, H5P_DEFAULT);
+    hid_t space_id = H5Dget_space(dataset_id);
+    const size_t n_cards = (size_t)H5Sget_simple_extent_npoints(space_id);
+    H5Sclose(space_id);
+    
+    hid_t str_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(str_type, FITS_HEADER_LINE_SIZE);
+    H5Tset_strpad(str_type, H5T_STR_SPACEPAD);
+    
+    char *cards = memory_alloc(n_cards * FITS_HEADER_LINE_SIZE);
+    const herr_t status = H5Dread(dataset_id, str_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, cards);
+    H5Tclose(str_type);
+    H5Dclose(dataset_id);
+    
+    if (status < 0 || n_cards == 0) {
+        memory_free(cards);
+        return NULL;
+    }
+    
+    *header_size = n_cards * FITS_HEADER_LINE_SIZE;
+    return cards;
+}
+
+// Header of the first tile with the axis lengths and reference pixels of the mosaic.
+// Checksums of the tile no longer apply and are dropped.
+char *mosaic_header(const SofiaMosaic *self, const char *cards, const size_t header_size, size_t *mosaic_size)
+{
+    size_t size = header_size;
+    char *header = memory_alloc(size);
+    memcpy(header, cards, size);
+    
+    const MosaicTile *first = &self->tiles[0];
+    
+    for (int axis = 0; axis < 3; axis++) {
+        if (first->size[axis] == self->size[axis] && first->origin[axis] == 0) continue;
+        
+        char key[16];
+        char value[32];
+        
+        snprintf(key, sizeof(key), "NAXIS%d", axis + 1);
+        snprintf(value, sizeof(value), "%zu", self->size[axis]);
+        header = fits_header_set_card(header, &size, key, value);
+        
+        snprintf(key, sizeof(key), "CRPIX%d", axis + 1);
+        snprintf(value, sizeof(value), "%.12G", first->crpix[axis] + (double)first->origin[axis]);
+        if (strpbrk(value, ".E") == NULL) strcat(value, ".0");
+        header = fits_header_set_card(header, &size, key, value);
+    }
+    
+    size = fits_header_drop_card(header, size, "CHECKSUM");
+    size = fits_header_drop_card(header, size, "DATASUM");
+    
+    *mosaic_size = size;
+    return header;
+}
+
+// 'filename' relative to 'directory' if it lies below it, else its absolute path
+void mosaic_relative_path(const char *directory, const char *filename, char *path)
+{
+    char *dir = realpath(directory, NULL);
+    char *file = realpath(filename, NULL);
+    
+    if (file == NULL) {
+        snprintf(path, MAX_PATH_LENGTH, "%s", filename);
+    } else if (dir != NULL && strncmp(file, dir, strlen(dir)) == 0 && file[strlen(dir)] == '/') {
+        snprintf(path, MAX_PATH_LENGTH, "%s", file + strlen(dir) + 1);
+    } else {
+        snprintf(path, MAX_PATH_LENGTH, "%s", file);
+    }
+    
+    free(dir);
+    free(file);
+    return;
+}
+
+int compare_span(const void *a, const void *b)
+{
+    const MosaicSpan *span_a = (const MosaicSpan *)a;
+    const MosaicSpan *span_b = (const MosaicSpan *)b;
+    if (span_a->start != span_b->start) return span_a->start < span_b->start ? -1 : 1;
+    return span_a->end < span_b->end ? -1 : (span_a->end > span_b->end ? 1 : 0);
+}
@@ -0,0 +1,96 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (mosaic.h) - SoFiA to HDF5 Converter                     //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+/// @file   mosaic.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Field-wide mosaic of converted SoFiA tiles (header).
+
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+#include <stdbool.h>
+#include <hdf5.h>
+#include "common.h"
+#include "reader.h"
+#include "hdf5_writer.h"
+#include "merge.h"
+
+// ----------------------------------------------------------------- //
+// Class 'MosaicTile'                                                //
+// ----------------------------------------------------------------- //
+// One converted tile and its place in the mosaic. Axes are in FITS  //
+// order (x, y, z).                                                  //
+// ----------------------------------------------------------------- //
+
+typedef CLASS MosaicTile {
+    char filename[MAX_PATH_LENGTH];
+    int rank;             // Rank of DATA
+    hsize_t dims[4];      // Shape of DATA
+    size_t size[3];       // Pixels along x, y and z
+    double crpix[3];      // Reference pixels along x, y and z
+    long long origin[3];  // Mosaic pixel of the first tile pixel
+    size_t first[3];      // First mosaic pixel taken from this tile
+    size_t last[3];       // One past the last mosaic pixel taken from this tile
+    bool has_mask;        // Tile has Mask/DATA of the same shape as DATA
+    SofiaCatalog *catalog;  // Catalogue of the tile run, or NULL (owned)
+} MosaicTile;
+
+// ----------------------------------------------------------------- //
+// Class 'SofiaMosaic'                                               //
+// ----------------------------------------------------------------- //
+// Combines the HDF5 files of SoFiA runs on sub-cubes of one field   //
+// into a single file whose DATA (and Mask/DATA) are virtual data    //
+// sets referring to the tiles, so no pixel is copied. Tiles must    //
+// share the pixel grid (CTYPE, CRVAL, CDELT) and differ by whole    //
+// pixels in CRPIX, as SoFiA writes them for input.region. Where     //
+// tiles overlap, each takes the half of the overlap next to it.     //
+// Tile catalogues are merged into one without the duplicates        //
+// found in the overlaps.                                            //
+// ----------------------------------------------------------------- //
+
+typedef CLASS SofiaMosaic {
+    MosaicTile *tiles;
+    size_t n_tiles;
+    size_t size[3];       // Mosaic pixels along x, y and z
+    char *header;         // Raw cards of the first tile, up to END
+    size_t header_size;
+    char *mask_header;    // Raw mask cards of the first tile; NULL if not all tiles have a mask
+    size_t mask_header_size;
+    FitsFile *cube;       // Header-only images of the mosaic (owned)
+    FitsFile *mask;
+    SofiaCatalog *catalog;  // Merged catalogue of the tiles, or NULL
+    LabelMap *labels;     // Mask label of every tile source in the mosaic
+    size_t n_labels;
+} SofiaMosaic;
+
+// Constructor and destructor
+PUBLIC SofiaMosaic *SofiaMosaic_new(void);
+PUBLIC void SofiaMosaic_delete(SofiaMosaic *self);
+
+// Public methods
+PUBLIC void SofiaMosaic_add_tile(SofiaMosaic *self, const char *filename);
+PUBLIC void SofiaMosaic_add_catalog(SofiaMosaic *self, SofiaCatalog *catalog);
+PUBLIC void SofiaMosaic_arrange(SofiaMosaic *self);
+PUBLIC void SofiaMosaic_merge_catalogs(SofiaMosaic *self, const double radius, const double channels);
+PUBLIC void SofiaMosaic_setup(SofiaMosaic *self, SofiaHDF5 *out);
+PUBLIC void SofiaMosaic_write_labels(const SofiaMosaic *self, const char *filename);
+
+#endif
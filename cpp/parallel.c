@@ -0,0 +1,69 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (parallel.c) - SoFiA to HDF5 Converter                   //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "parallel.h"
+#include <pthread.h>
+
+typedef CLASS ParallelRange {
+    size_t first;
+    size_t last;
+    parallel_task task;
+    void *context;
+} ParallelRange;
+
+PRIVATE void *parallel_worker(void *arg);
+
+// ----------------------------------------------------------------- //
+// Public functions                                                  //
+// ----------------------------------------------------------------- //
+
+void parallel_for(const size_t count, const int n_threads, parallel_task task, void *context)
+{
+    if (count == 0) return;
+    
+    size_t threads = n_threads > 1 ? (size_t)n_threads : 1;
+    if (threads > count) threads = count;
+    
+    if (threads == 1) {
+        for (size_t i = 0; i < count; i++) task(i, context);
+        return;
+    }
+    
+    pthread_t *handles = memory_alloc(threads * sizeof(pthread_t));
+    ParallelRange *ranges = memory_alloc(threads * sizeof(ParallelRange));
+    
+    for (size_t t = 0; t < threads; t++) {
+        ranges[t].first = t * count / threads;
+        ranges[t].last = (t + 1) * count / threads;
+        ranges[t].task = task;
+        ranges[t].context = context;
+    }
+    
+    // The calling thread handles the first range itself
+    for (size_t t = 1; t < threads; t++) {
+        if (pthread_create(&handles[t], NULL, parallel_worker, &ranges[t]) != 0) {
+            error_exit("Failed to create worker thread.");
+        }
+    }
+    parallel_worker(&ranges[0]);
+    for (size_t t = 1; t < threads; t++) pthread_join(handles[t], NULL);
+    
+    memory_free(ranges);
+    memory_free(handles);
+    
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Private functions                                                 //
+// ----------------------------------------------------------------- //
+
+void *parallel_worker(void *arg)
+{
+    ParallelRange *range = (ParallelRange *)arg;
+    for (size_t i = range->first; i < range->last; i++) range->task(i, range->context);
+    return NULL;
+}
@@ -0,0 +1,38 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (parallel.h) - SoFiA to HDF5 Converter                   //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+/// @file   parallel.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Minimal thread helpers for sofia2hdf5 converter (header).
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "common.h"
+
+// Work function: process item 'index' using the shared context
+typedef void (*parallel_task)(const size_t index, void *context);
+
+// Run task(0 .. count - 1) on up to n_threads threads. Items are split into
+// contiguous ranges, one per thread; the call returns once all are done.
+PUBLIC void parallel_for(const size_t count, const int n_threads, parallel_task task, void *context);
+
+#endif
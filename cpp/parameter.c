@@ -9,6 +9,10 @@
 #include <ctype.h>
 
 #define PARAMETER_INITIAL_CAPACITY 50
+#define PARAMETER_ARENA_BLOCK_SIZE 8192
+
+PRIVATE void Parameter_expand_capacity(Parameter *self);
+PRIVATE size_t Parameter_find_index(const Parameter *self, const char *key);
 
 // ----------------------------------------------------------------- //
 // Constructor and destructor                                        //
@@ -21,16 +25,14 @@ Parameter *Parameter_new(void)
     self->values = memory_alloc(PARAMETER_INITIAL_CAPACITY * sizeof(char *));
     self->size = 0;
     self->capacity = PARAMETER_INITIAL_CAPACITY;
+    self->arena = Arena_new(PARAMETER_ARENA_BLOCK_SIZE);
     return self;
 }
 
 void Parameter_delete(Parameter *self)
 {
     if (self != NULL) {
-        for (size_t i = 0; i < self->size; i++) {
-            memory_free(self->keys[i]);
-            memory_free(self->values[i]);
-        }
+        Arena_delete(self->arena);
         memory_free(self->keys);
         memory_free(self->values);
         memory_free(self);
@@ -51,9 +53,8 @@ void Parameter_set(Parameter *self, const char *key, const char *value)
     // Check if key already exists
     size_t index = Parameter_find_index(self, key);
     if (index < self->size) {
-        // Update existing key
-        memory_free(self->values[index]);
-        self->values[index] = string_copy(value);
+        // Update existing key; the old value stays in the arena until deletion
+        self->values[index] = Arena_string_copy(self->arena, value);
         return;
     }
     
@@ -62,8 +63,8 @@ void Parameter_set(Parameter *self, const char *key, const char *value)
         Parameter_expand_capacity(self);
     }
     
-    self->keys[self->size] = string_copy(key);
-    self->values[self->size] = string_copy(value);
+    self->keys[self->size] = Arena_string_copy(self->arena, key);
+    self->values[self->size] = Arena_string_copy(self->arena, value);
     self->size++;
     
     return;
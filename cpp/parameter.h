@@ -42,6 +42,7 @@ typedef CLASS Parameter {
     char **values;
     size_t size;
     size_t capacity;
+    Arena *arena;         // Storage for keys and values
 } Parameter;
 
 // Constructor and destructor
@@ -56,8 +57,4 @@ PUBLIC bool Parameter_get_bool(const Parameter *self, const char *key);
 PUBLIC void Parameter_load(Parameter *self, const char *filename);
 PUBLIC void Parameter_set_defaults(Parameter *self);
 
-// Private methods
-PRIVATE void Parameter_expand_capacity(Parameter *self);
-PRIVATE size_t Parameter_find_index(const Parameter *self, const char *key);
-
 #endif
\ No newline at end of file
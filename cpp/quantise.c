@@ -0,0 +1,141 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (quantise.c) - SoFiA to HDF5 Converter                    //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "quantise.h"
+#include <math.h>
+
+PRIVATE uint16_t float_to_half(const float value);
+
+// Kernels for the sum of squares of the finite values and the rounding of a plane.
+// Blanks are masked with finite_mask() rather than branched around, rounding
+// multiplies by the inverse of a power of two, which is exact, and rint() passes
+// NaN through, so the loops have no branches and vectorise.
+
+#define QUANTISE_KERNELS(SUFFIX, TYPE, RINT) \
+PRIVATE void sum_squares_##SUFFIX(const TYPE *plane, const size_t size, double *sum_sq, size_t *count) \
+{ \
+    double sum = 0.0; \
+    uint64_t n = 0; \
+    _Pragma("omp simd reduction(+:sum,n)") \
+    for (size_t i = 0; i < size; i++) { \
+        const double value = plane[i]; \
+        const uint64_t finite = finite_mask(value); \
+        const double term = select_value(finite, value, 0.0); \
+        sum += term * term; \
+        n += finite & 1; \
+    } \
+    *sum_sq = sum; \
+    *count = (size_t)n; \
+    return; \
+} \
+\
+PRIVATE void round_plane_##SUFFIX(TYPE *plane, const size_t size, const TYPE step) \
+{ \
+    const TYPE inverse = (TYPE)1 / step; \
+    for (size_t i = 0; i < size; i++) plane[i] = RINT(plane[i] * inverse) * step; \
+    return; \
+}
+
+QUANTISE_KERNELS(flt, float, rintf)
+QUANTISE_KERNELS(dbl, double, rint)
+
+#undef QUANTISE_KERNELS
+
+bool quantise_supports_type(const int data_type)
+{
+    return data_type == -32 || data_type == -64;
+}
+
+// Rounding step of a plane: the largest power of two not above RMS * 2^-bits.
+// Returns 0 (no rounding) for planes without finite non-zero values.
+double quantise_step(const void *plane, const int data_type, const size_t size, const int bits)
+{
+    double sum_sq = 0.0;
+    size_t count = 0;
+    
+    if (data_type == -32) sum_squares_flt((const float *)plane, size, &sum_sq, &count);
+    else if (data_type == -64) sum_squares_dbl((const double *)plane, size, &sum_sq, &count);
+    
+    if (count == 0 || !(sum_sq > 0.0) || !isfinite(sum_sq)) return 0.0;
+    
+    const double rms = sqrt(sum_sq / (double)count);
+    double step = ldexp(1.0, (int)floor(log2(rms)) - bits);
+    
+    // Steps below the smallest normal value would lose the exactness of the rounding
+    const double smallest = (data_type == -32) ? 1.1754943508222875e-38 : 2.2250738585072014e-308;
+    if (step < smallest) return 0.0;
+    
+    return step;
+}
+
+// Round the values of a plane to multiples of 'step' (a power of two; 0 leaves it as it is)
+void quantise_plane(void *plane, const int data_type, const size_t size, const double step)
+{
+    if (!(step > 0.0)) return;
+    
+    if (data_type == -32) round_plane_flt((float *)plane, size, (float)step);
+    else if (data_type == -64) round_plane_dbl((double *)plane, size, step);
+    
+    return;
+}
+
+// Convert a plane to IEEE 754 half precision, rounding to nearest even. Returns
+// the number of finite values that would round beyond QUANTISE_FLOAT16_MAX and
+// are clipped to it instead.
+size_t quantise_float16(const void *plane, const int data_type, const size_t size, uint16_t *half)
+{
+    size_t clipped = 0;
+    
+    if (data_type == -32) {
+        const float *values = (const float *)plane;
+        for (size_t i = 0; i < size; i++) {
+            half[i] = float_to_half(values[i]);
+            clipped += fabsf(values[i]) >= QUANTISE_FLOAT16_LIMIT && isfinite(values[i]);
+        }
+    } else if (data_type == -64) {
+        const double *values = (const double *)plane;
+        for (size_t i = 0; i < size; i++) {
+            half[i] = float_to_half((float)values[i]);
+            clipped += fabs(values[i]) >= QUANTISE_FLOAT16_LIMIT && isfinite(values[i]);
+        }
+    }
+    return clipped;
+}
+
+// ----------------------------------------------------------------- //
+// Private methods                                                   //
+// ----------------------------------------------------------------- //
+
+uint16_t float_to_half(const float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    
+    const uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    const uint32_t magnitude = bits & 0x7FFFFFFF;
+    
+    if (magnitude > 0x7F800000) return sign | 0x7E00;        // NaN
+    if (magnitude == 0x7F800000) return sign | 0x7C00;       // Infinity
+    if (magnitude >= 0x477FF000) return sign | 0x7BFF;       // Would round beyond 65504: clip
+    
+    // Normal: rebias the exponent; a carry out of the mantissa raises the exponent
+    if (magnitude >= 0x38800000) {
+        uint32_t result = (magnitude >> 13) - (112 << 10);
+        const uint32_t rest = magnitude & 0x1FFF;
+        if (rest > 0x1000 || (rest == 0x1000 && (result & 1))) result++;
+        return sign | (uint16_t)result;
+    }
+    
+    // Subnormal, in units of 2^-24
+    if (magnitude < 0x33000000) return sign;
+    const uint32_t mantissa = (magnitude & 0x007FFFFF) | 0x00800000;
+    const uint32_t shift = 126 - (magnitude >> 23);
+    uint32_t result = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (result & 1))) result++;
+    return sign | (uint16_t)result;
+}
@@ -0,0 +1,57 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (quantise.h) - SoFiA to HDF5 Converter                    //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+
+/// @file   quantise.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Noise-relative precision reduction of image planes (header).
+
+#ifndef QUANTISE_H
+#define QUANTISE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "common.h"
+
+#define QUANTISE_FLOAT16_MAX            65504.0       ///< Largest finite half-precision value.
+#define QUANTISE_FLOAT16_LIMIT          65520.0       ///< Smallest magnitude rounding beyond QUANTISE_FLOAT16_MAX.
+#define QUANTISE_FLOAT16_RELATIVE_ERROR 4.8828125e-4  ///< Rounding error of half precision, 2^-11.
+
+// ----------------------------------------------------------------- //
+// Quantisation                                                      //
+// ----------------------------------------------------------------- //
+// Granular bit rounding: the values of a plane are rounded to a     //
+// multiple of a power of two no larger than 2^-bits times the RMS   //
+// of the plane. The low mantissa bits then hold zeros, which        //
+// shuffle and deflate compress well, and the error of every value   //
+// is at most half that step. Blanks (NaN) are left as they are.     //
+// Half precision is converted here rather than by HDF5, whose       //
+// conversion does not carry a rounded-up mantissa into the          //
+// exponent; finite values that would round beyond                   //
+// QUANTISE_FLOAT16_MAX are clipped to it and counted.               //
+// ----------------------------------------------------------------- //
+
+PUBLIC bool quantise_supports_type(const int data_type);
+PUBLIC double quantise_step(const void *plane, const int data_type, const size_t size, const int bits);
+PUBLIC void quantise_plane(void *plane, const int data_type, const size_t size, const double step);
+PUBLIC size_t quantise_float16(const void *plane, const int data_type, const size_t size, uint16_t *half);
+
+#endif
@@ -4,20 +4,31 @@
 // Copyright (C) 2025 Peter Kamphuis                                    //
 // ____________________________________________________________________ //
 
+// Needed for fseeko() with -std=c99
+#define _POSIX_C_SOURCE 200809L
+
 #include "reader.h"
 #include "utils.h"
 #include <ctype.h>
 #include <math.h>
+#include <sys/stat.h>
 
 // For strcasecmp on some systems
 #if defined(__APPLE__) || defined(__linux__)
 #include <strings.h>
 #endif
 
-// Memory size constants
-#define KILOBYTE       1024  ///< Size of a kilobyte (in bytes).
-#define MEGABYTE    1048576  ///< Size of a megabyte (in bytes).
-#define GIGABYTE 1073741824  ///< Size of a gigabyte (in bytes).
+#define FITS_ARENA_BLOCK_SIZE    32768  ///< Arena block size for header strings (in bytes).
+#define CATALOG_ARENA_BLOCK_SIZE  4096  ///< Arena block size for catalogue column names (in bytes).
+
+// Private functions
+PRIVATE char *read_fits_header_blocks(FILE *fp, size_t *header_size);
+PRIVATE size_t fits_data_unit_size(const FitsFile *self);
+PRIVATE void FitsFile_setup_image(FitsFile *self);
+PRIVATE bool skip_stream(FILE *fp, size_t size);
+PRIVATE void FitsFile_read_blocks(FitsFile *self, void *buffer, const size_t block_size, const size_t n_blocks, const size_t position, const size_t stride);
+PRIVATE size_t parse_region_bound(const char *text, const char *end);
+PRIVATE void FitsFile_load_header(FitsFile *self, const char *header, const size_t header_size);
 
 // ----------------------------------------------------------------- //
 // Constructor and destructor functions                              //
@@ -27,36 +38,89 @@ FitsFile *FitsFile_new(void)
 {
     FitsFile *self = memory_alloc(sizeof(FitsFile));
     self->data = NULL;
+    self->owns_data = true;
     self->nx = self->ny = self->nz = 0;
+    self->nw = 0;
+    self->naxis = 0;
     self->data_type = 0;
     self->word_size = 0;
     self->data_size = 0;
     self->header = NULL;
     self->header_size = 0;
     self->header_parsed = false;
-    self->header_keys = NULL;
-    self->header_values = NULL;
-    self->header_count = 0;
+    self->keywords = NULL;
+    self->arena = Arena_new(FITS_ARENA_BLOCK_SIZE);
+    strcpy(self->filename, "");
+    self->hdu = 0;
+    self->data_offset = 0;
+    self->reader = NULL;
+    self->io_threads = 1;
+    self->direct_io = false;
+    self->stream = NULL;
+    self->stream_pos = 0;
+    self->sequential = false;
+    self->next = NULL;
+    self->file_nx = self->file_ny = self->file_nz = 0;
+    self->origin[0] = self->origin[1] = self->origin[2] = 0;
     return self;
 }
 
 void FitsFile_delete(FitsFile *self)
 {
     if (self != NULL) {
-        if (self->data) memory_free(self->data);
+        if (self->data && self->owns_data) memory_free(self->data);
         if (self->header) memory_free(self->header);
-        
-        for (size_t i = 0; i < self->header_count; i++) {
-            memory_free(self->header_keys[i]);
-            memory_free(self->header_values[i]);
-        }
-        memory_free(self->header_keys);
-        memory_free(self->header_values);
+        FitsHeader_delete(self->keywords);
+        Arena_delete(self->arena);
+        FitsFile_close(self);
+        FitsFile_delete(self->next);
         memory_free(self);
     }
     return;
 }
 
+// Wrap an image held by the caller, e.g. a cube just processed by SoFiA. The header
+// (whole 80-character cards up to END) is copied; the data must be in native byte
+// order as described by that header and are used in place, not copied or freed.
+// Returns NULL if the header is invalid.
+FitsFile *FitsFile_new_from_memory(const char *header, const size_t header_size, void *data)
+{
+    if (header == NULL || data == NULL) {
+        fprintf(stderr, "Error: In-memory FITS image needs both a header and data.\n");
+        return NULL;
+    }
+    
+    FitsFile *self = FitsFile_new();
+    
+    jmp_buf trap;
+    jmp_buf *outer = error_trap(&trap);
+    if (setjmp(trap) != ERR_SUCCESS) {
+        error_trap(outer);
+        FitsFile_delete(self);
+        return NULL;
+    }
+    
+    FitsFile_load_header(self, header, header_size);
+    error_trap(outer);
+    
+    self->data = data;
+    self->owns_data = false;
+    
+    return self;
+}
+
+// An image described by a header alone, for data that are stored elsewhere (e.g. a
+// mosaic of virtual data sets). The header is copied.
+FitsFile *FitsFile_new_from_header(const char *header, const size_t header_size)
+{
+    check_null(header);
+    
+    FitsFile *self = FitsFile_new();
+    FitsFile_load_header(self, header, header_size);
+    
+    return self;
+}
+
 SofiaCatalog *SofiaCatalog_new(void)
 {
     SofiaCatalog *self = memory_alloc(sizeof(SofiaCatalog));
@@ -65,18 +129,36 @@ SofiaCatalog *SofiaCatalog_new(void)
     self->capacity = 0;
     strcpy(self->type, "");
     strcpy(self->filename, "");
+    self->arena = Arena_new(CATALOG_ARENA_BLOCK_SIZE);
     return self;
 }
 
 void SofiaCatalog_delete(SofiaCatalog *self)
 {
     if (self != NULL) {
+        Arena_delete(self->arena);
         memory_free(self->sources);
         memory_free(self);
     }
     return;
 }
 
+// Append a copy of a source, e.g. when a catalogue is built in memory
+void SofiaCatalog_add_source(SofiaCatalog *self, const CatalogSource *source)
+{
+    check_null(self);
+    check_null(source);
+    
+    if (self->size >= self->capacity) {
+        self->capacity = self->capacity > 0 ? 2 * self->capacity : 100;
+        self->sources = memory_realloc(self->sources, self->capacity * sizeof(CatalogSource));
+    }
+    
+    self->sources[self->size++] = *source;
+    
+    return;
+}
+
 // ----------------------------------------------------------------- //
 // Reading functions                                                 //
 // ----------------------------------------------------------------- //
@@ -89,231 +171,649 @@ FitsFile *read_fits_file(const char *filename)
 {
     check_null(filename);
     
-    if (!file_exists(filename)) {
+    const bool from_stdin = (strcmp(filename, "-") == 0);
+    
+    if (!from_stdin && !file_exists(filename)) {
         char error_msg[MAX_PATH_LENGTH + 100];
         snprintf(error_msg, sizeof(error_msg), "FITS file not found: %s", filename);
         error_exit(error_msg);
     }
     
-    printf("Opening FITS file '%s'.\n", filename);
+    printf("Opening FITS file '%s'.\n", from_stdin ? "(standard input)" : filename);
     
-    FILE *fp = fopen(filename, "rb");
+    FILE *fp = from_stdin ? stdin : fopen(filename, "rb");
     if (fp == NULL) {
         char error_msg[MAX_PATH_LENGTH + 100];
         snprintf(error_msg, sizeof(error_msg), "Failed to open FITS file: %s", filename);
         error_exit(error_msg);
     }
     
-    FitsFile *fits = FitsFile_new();
+    // Pipes and FIFOs cannot seek: only the first image HDU is used, and the stream
+    // is handed to it so that its data can be read once, front to back.
+    struct stat info;
+    const bool sequential = from_stdin || fstat(fileno(fp), &info) != 0 || !S_ISREG(info.st_mode);
+    
+    // Walk through all HDUs, reading only their headers and skipping the data units.
+    // The data themselves are streamed plane by plane later on.
+    FitsFile *first = NULL;
+    FitsFile *last = NULL;
+    size_t offset = 0;
     
-    // Read entire header into temporary array
+    for (int hdu = 0; ; hdu++) {
+        size_t header_size = 0;
+        char *header = read_fits_header_blocks(fp, &header_size);
+        
+        if (header == NULL) {
+            if (hdu == 0) {
+                fclose(fp);
+                error_exit("FITS file ended unexpectedly while reading header.");
+            }
+            break;  // Regular end of file
+        }
+        
+        // Check if valid FITS file or extension
+        if (hdu == 0 && strncmp(header, "SIMPLE", 6) != 0) {
+            memory_free(header);
+            fclose(fp);
+            error_exit("Missing 'SIMPLE' keyword; file does not appear to be a FITS file.");
+        }
+        if (hdu > 0 && strncmp(header, "XTENSION", 8) != 0) {
+            fprintf(stderr, "Warning: Ignoring trailing data after HDU %d.\n", hdu - 1);
+            memory_free(header);
+            break;
+        }
+        
+        FitsFile *fits = FitsFile_new();
+        fits->header = header;
+        fits->header_size = header_size;
+        fits->hdu = hdu;
+        fits->data_offset = offset + header_size;
+        strncpy(fits->filename, filename, MAX_PATH_LENGTH - 1);
+        fits->filename[MAX_PATH_LENGTH - 1] = '\0';
+        
+        // Parse header to extract crucial elements
+        parse_fits_header(fits);
+        
+        const size_t data_unit_size = fits_data_unit_size(fits);
+        offset += header_size + data_unit_size;
+        
+        const char *xtension = get_fits_header_value(fits, "XTENSION");
+        const bool is_image = (hdu == 0 || (xtension != NULL && strcmp(xtension, "IMAGE") == 0));
+        
+        if (is_image && get_fits_header_int(fits, "NAXIS") > 0) {
+            FitsFile_setup_image(fits);
+            
+            if (first == NULL) first = fits;
+            else last->next = fits;
+            last = fits;
+            
+            if (sequential) {
+                fits->stream = fp;
+                fits->stream_pos = fits->data_offset;
+                fits->sequential = true;
+                fp = NULL;
+                break;
+            }
+        } else {
+            if (hdu > 0) printf("Skipping HDU %d (%s).\n", hdu, xtension != NULL ? xtension : "no data");
+            FitsFile_delete(fits);
+        }
+        
+        // Skip over the data unit to the next header
+        if (sequential ? !skip_stream(fp, data_unit_size) : fseeko(fp, (off_t)offset, SEEK_SET) != 0) break;
+    }
+    
+    if (fp != NULL && fp != stdin) fclose(fp);
+    
+    if (first == NULL) {
+        error_exit("FITS file does not contain any image data.");
+    }
+    
+    // Print status information
+    for (FitsFile *fits = first; fits != NULL; fits = fits->next) {
+        const double data_bytes = (double)(fits->data_size * fits->word_size);
+        
+        printf("Found FITS data in HDU %d with the following specifications:\n", fits->hdu);
+        printf("  Data type:    %d\n", fits->data_type);
+        printf("  No. of axes:  %d\n", fits->naxis);
+        printf("  Axis sizes:   %zu, %zu, %zu, %zu\n", fits->nx, fits->ny, fits->nz, fits->nw);
+        
+        if (data_bytes >= GIGABYTE) {
+            printf("  Data size:    %.1f GB\n", data_bytes / GIGABYTE);
+        } else if (data_bytes >= MEGABYTE) {
+            printf("  Data size:    %.1f MB\n", data_bytes / MEGABYTE);
+        } else {
+            printf("  Data size:    %.1f kB\n", data_bytes / KILOBYTE);
+        }
+    }
+    
+    return first;
+}
+
+// Read all header blocks up to the END card; returns NULL at end of file
+char *read_fits_header_blocks(FILE *fp, size_t *header_size)
+{
     char *header = NULL;
-    size_t header_size = 0;
     bool end_reached = false;
+    *header_size = 0;
     
     while (!end_reached) {
         // (Re-)allocate memory as needed
-        header = memory_realloc(header, header_size + FITS_HEADER_BLOCK_SIZE);
+        header = memory_realloc(header, *header_size + FITS_HEADER_BLOCK_SIZE);
         
         // Read header block
-        size_t bytes_read = fread(header + header_size, 1, FITS_HEADER_BLOCK_SIZE, fp);
+        size_t bytes_read = fread(header + *header_size, 1, FITS_HEADER_BLOCK_SIZE, fp);
         if (bytes_read != FITS_HEADER_BLOCK_SIZE) {
             memory_free(header);
+            if (bytes_read == 0 && *header_size == 0) return NULL;
             fclose(fp);
-            FitsFile_delete(fits);
             error_exit("FITS file ended unexpectedly while reading header.");
         }
         
         // Check if we have reached the end of the header
-        char *ptr = header + header_size;
+        char *ptr = header + *header_size;
         
-        while (!end_reached && ptr < header + header_size + FITS_HEADER_BLOCK_SIZE) {
+        while (!end_reached && ptr < header + *header_size + FITS_HEADER_BLOCK_SIZE) {
             if (strncmp(ptr, "END", 3) == 0) end_reached = true;
             else ptr += FITS_HEADER_LINE_SIZE;
         }
         
-        header_size += FITS_HEADER_BLOCK_SIZE;
+        *header_size += FITS_HEADER_BLOCK_SIZE;
     }
     
-    // Check if valid FITS file
-    if (strncmp(header, "SIMPLE", 6) != 0) {
-        memory_free(header);
-        fclose(fp);
-        FitsFile_delete(fits);
-        error_exit("Missing 'SIMPLE' keyword; file does not appear to be a FITS file.");
+    return header;
+}
+
+// Size of the data unit following the header, including padding to full blocks
+size_t fits_data_unit_size(const FitsFile *self)
+{
+    const long int naxis = get_fits_header_int(self, "NAXIS");
+    if (naxis <= 0) return 0;
+    
+    size_t elements = 1;
+    for (int i = 1; i <= naxis; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "NAXIS%d", i);
+        elements *= (size_t)get_fits_header_int(self, key);
     }
     
-    // Store header in FitsFile object
-    fits->header = header;
-    fits->header_size = header_size;
+    // Random groups and tables may carry a heap (PCOUNT) and several groups (GCOUNT)
+    const long int pcount = get_fits_header_int(self, "PCOUNT");
+    const long int gcount = get_fits_header_value(self, "GCOUNT") != NULL ? get_fits_header_int(self, "GCOUNT") : 1;
+    const size_t bytes = labs(get_fits_header_int(self, "BITPIX")) / 8 * (size_t)gcount * ((size_t)pcount + elements);
     
-    // Parse header to extract crucial elements
-    parse_fits_header(fits);
+    return (bytes + FITS_HEADER_BLOCK_SIZE - 1) / FITS_HEADER_BLOCK_SIZE * FITS_HEADER_BLOCK_SIZE;
+}
+
+// Copy and parse a header given in memory
+void FitsFile_load_header(FitsFile *self, const char *header, const size_t header_size)
+{
+    if (header_size == 0 || header_size % FITS_HEADER_LINE_SIZE != 0) {
+        error_exit("In-memory FITS header must consist of whole 80-character cards.");
+    }
     
-    // Extract crucial header elements
-    fits->data_type = get_fits_header_int(fits, "BITPIX");
-    int dimension = get_fits_header_int(fits, "NAXIS");
-    fits->nx = get_fits_header_int(fits, "NAXIS1");
-    fits->ny = (dimension > 1) ? get_fits_header_int(fits, "NAXIS2") : 1;
-    fits->nz = (dimension > 2) ? get_fits_header_int(fits, "NAXIS3") : 1;
+    self->header = memory_alloc(header_size);
+    memcpy(self->header, header, header_size);
+    self->header_size = header_size;
     
-    fits->word_size = abs(fits->data_type) / 8;  // Assumes 8 bits per byte
-    fits->data_size = fits->nx * fits->ny * fits->nz;
+    parse_fits_header(self);
+    FitsFile_setup_image(self);
+    return;
+}
+
+// Extract and check the crucial header elements of an image HDU
+void FitsFile_setup_image(FitsFile *self)
+{
+    self->data_type = get_fits_header_int(self, "BITPIX");
+    self->naxis = get_fits_header_int(self, "NAXIS");
+    self->nx = get_fits_header_int(self, "NAXIS1");
+    self->ny = (self->naxis > 1) ? get_fits_header_int(self, "NAXIS2") : 1;
+    self->nz = (self->naxis > 2) ? get_fits_header_int(self, "NAXIS3") : 1;
+    self->nw = (self->naxis > 3) ? get_fits_header_int(self, "NAXIS4") : 1;
+    
+    self->word_size = abs(self->data_type) / 8;  // Assumes 8 bits per byte
+    self->data_size = self->nx * self->ny * self->nz * self->nw;
+    
+    // The whole image until a region is set
+    self->file_nx = self->nx;
+    self->file_ny = self->ny;
+    self->file_nz = self->nz;
+    self->origin[0] = self->origin[1] = self->origin[2] = 0;
     
     // Sanity checks
-    if (!(fits->data_type == -64 || fits->data_type == -32 || fits->data_type == 8 || 
-          fits->data_type == 16 || fits->data_type == 32 || fits->data_type == 64)) {
-        fclose(fp);
-        FitsFile_delete(fits);
+    if (!(self->data_type == -64 || self->data_type == -32 || self->data_type == 8 || 
+          self->data_type == 16 || self->data_type == 32 || self->data_type == 64)) {
         error_exit("Invalid BITPIX keyword encountered.");
     }
     
-    if (dimension <= 0 || dimension > 4) {
-        fclose(fp);
-        FitsFile_delete(fits);
+    if (self->naxis <= 0 || self->naxis > 4) {
         error_exit("Only FITS files with 1-4 dimensions are supported.");
     }
     
-    if (fits->data_size <= 0) {
-        fclose(fp);
-        FitsFile_delete(fits);
+    if (self->data_size == 0) {
         error_exit("Invalid NAXISn keyword encountered.");
     }
     
-    const double ram_needed = (double)(fits->data_size * fits->word_size);
+    // Handle BSCALE and BZERO if necessary
+    double bscale = get_fits_header_flt(self, "BSCALE");
+    double bzero = get_fits_header_flt(self, "BZERO");
     
-    // Print status information
-    printf("Reading FITS data with the following specifications:\n");
-    printf("  Data type:    %d\n", fits->data_type);
-    printf("  No. of axes:  %d\n", dimension);
-    printf("  Axis sizes:   %zu, %zu, %zu\n", fits->nx, fits->ny, fits->nz);
+    // Set defaults if not found
+    if (isnan(bscale)) bscale = 1.0;
+    if (isnan(bzero)) bzero = 0.0;
     
-    if (ram_needed >= GIGABYTE) {
-        printf("  Memory used:  %.1f GB\n", ram_needed / GIGABYTE);
-    } else if (ram_needed >= MEGABYTE) {
-        printf("  Memory used:  %.1f MB\n", ram_needed / MEGABYTE);
-    } else {
-        printf("  Memory used:  %.1f kB\n", ram_needed / KILOBYTE);
+    if (bscale != 1.0 || bzero != 0.0) {
+        // Apply scaling to data - simplified version for now
+        printf("Warning: BSCALE/BZERO scaling detected but not fully implemented.\n");
     }
     
-    // Allocate memory for data array
-    fits->data = memory_alloc(fits->data_size * fits->word_size);
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Plane-wise data access                                            //
+// ----------------------------------------------------------------- //
+
+size_t FitsFile_get_plane_count(const FitsFile *self)
+{
+    check_null(self);
+    return self->nz * self->nw;
+}
+
+size_t FitsFile_get_plane_bytes(const FitsFile *self)
+{
+    check_null(self);
+    return self->nx * self->ny * self->word_size;
+}
+
+// Return planes [first, first + count) in native byte order. Data already held in
+// memory are returned in place; otherwise the planes are read into the caller's buffer.
+const void *FitsFile_get_planes(FitsFile *self, const size_t first, const size_t count, void *buffer)
+{
+    check_null(self);
+    
+    if (first + count > FitsFile_get_plane_count(self)) {
+        error_exit("Requested planes exceed the size of the FITS data.");
+    }
     
-    // Read data
-    size_t elements_read = fread(fits->data, fits->word_size, fits->data_size, fp);
-    if (elements_read != fits->data_size) {
-        fclose(fp);
-        FitsFile_delete(fits);
-        error_exit("FITS file ended unexpectedly while reading data.");
+    if (self->data != NULL) {
+        return (const char *)self->data + first * FitsFile_get_plane_bytes(self);
     }
     
-    fclose(fp);
+    FitsFile_read_planes(self, first, count, buffer);
+    return buffer;
+}
+
+void FitsFile_read_planes(FitsFile *self, const size_t first, const size_t count, void *buffer)
+{
+    FitsFile_read_planes_raw(self, first, count, buffer);
     
     // Swap byte order if required (FITS is big-endian)
-    if (is_little_endian_system() && fits->word_size > 1) {
-        swap_fits_byte_order(fits->data, fits->word_size, fits->data_size);
+    if (is_little_endian_system() && self->word_size > 1) {
+        swap_fits_byte_order(buffer, self->word_size, count * self->nx * self->ny);
     }
     
-    // Handle BSCALE and BZERO if necessary
-    double bscale = get_fits_header_flt(fits, "BSCALE");
-    double bzero = get_fits_header_flt(fits, "BZERO");
+    return;
+}
+
+// Read planes exactly as stored in the file, i.e. big-endian
+void FitsFile_read_planes_raw(FitsFile *self, const size_t first, const size_t count, void *buffer)
+{
+    check_null(self);
+    check_null(buffer);
     
-    // Set defaults if not found
-    if (isnan(bscale)) bscale = 1.0;
-    if (isnan(bzero)) bzero = 0.0;
+    const size_t plane_bytes = FitsFile_get_plane_bytes(self);
     
-    if (bscale != 1.0 || bzero != 0.0) {
-        // Apply scaling to data - simplified version for now
-        printf("Warning: BSCALE/BZERO scaling detected but not fully implemented.\n");
+    if (FitsFile_has_region(self)) {
+        // Planes of the region, run by run along the fourth axis; only the rows
+        // inside the region are read, at their offsets within the data unit
+        const size_t row_bytes = self->nx * self->word_size;
+        const size_t file_row_bytes = self->file_nx * self->word_size;
+        const size_t file_plane_bytes = file_row_bytes * self->file_ny;
+        unsigned char *out = buffer;
+        
+        for (size_t p = first; p < first + count; ) {
+            const size_t w = p / self->nz;
+            const size_t run_end = (w + 1) * self->nz < first + count ? (w + 1) * self->nz : first + count;
+            const size_t run = run_end - p;
+            const size_t plane = w * self->file_nz + self->origin[2] + p % self->nz;
+            const size_t position = self->data_offset + plane * file_plane_bytes + self->origin[1] * file_row_bytes + self->origin[0] * self->word_size;
+            
+            if (self->nx == self->file_nx) {
+                // Full rows: the region of each plane is one contiguous block
+                FitsFile_read_blocks(self, out, plane_bytes, run, position, file_plane_bytes);
+            } else {
+                for (size_t i = 0; i < run; i++) {
+                    FitsFile_read_blocks(self, out + i * plane_bytes, row_bytes, self->ny, position + i * file_plane_bytes, file_row_bytes);
+                }
+            }
+            
+            out += run * plane_bytes;
+            p = run_end;
+        }
+        
+        return;
     }
     
-    return fits;
+    const size_t position = self->data_offset + first * plane_bytes;
+    FitsFile_read_blocks(self, buffer, count * plane_bytes, 1, position, count * plane_bytes);
+    
+    // Have the kernel fetch the next slab while this one is processed
+    if (!self->sequential) {
+        const size_t remaining = FitsFile_get_plane_count(self) - first - count;
+        FileReader_prefetch(self->reader, (remaining < count ? remaining : count) * plane_bytes, position + count * plane_bytes);
+    }
+    
+    return;
 }
 
-void parse_fits_header(FitsFile *self)
+// Read 'n_blocks' blocks of 'block_size' bytes, 'stride' bytes apart, starting at byte
+// 'position' of the file into consecutive memory
+void FitsFile_read_blocks(FitsFile *self, void *buffer, const size_t block_size, const size_t n_blocks, const size_t position, const size_t stride)
 {
-    check_null(self);
-    
-    if (self->header_parsed || self->header == NULL || self->header_size == 0) {
+    if (!self->sequential) {
+        if (self->reader == NULL) self->reader = FileReader_open(self->filename, self->io_threads, self->direct_io);
+        FileReader_read_blocks(self->reader, buffer, block_size, n_blocks, position, stride);
         return;
     }
     
-    // Count number of header lines
-    size_t line_count = 0;
-    for (size_t i = 0; i < self->header_size; i += FITS_HEADER_LINE_SIZE) {
-        if (i + 3 < self->header_size && strncmp(self->header + i, "END", 3) == 0) {
-            break;
+    if (self->stream == NULL) {
+        error_exit("Streamed FITS input cannot be read again.");
+    }
+    
+    for (size_t i = 0; i < n_blocks; i++) {
+        const size_t block_position = position + i * stride;
+        
+        // A stream can only skip ahead
+        if (block_position != self->stream_pos) {
+            if (block_position < self->stream_pos || !skip_stream(self->stream, block_position - self->stream_pos)) {
+                error_exit("Streamed FITS input cannot be read out of order.");
+            }
         }
-        line_count++;
+        
+        if (fread((unsigned char *)buffer + i * block_size, 1, block_size, self->stream) != block_size) {
+            error_exit("FITS file ended unexpectedly while reading data.");
+        }
+        self->stream_pos = block_position + block_size;
     }
     
-    // Allocate arrays for keys and values
-    self->header_keys = memory_alloc(line_count * sizeof(char *));
-    self->header_values = memory_alloc(line_count * sizeof(char *));
-    self->header_count = 0;
+    return;
+}
+
+void FitsFile_close(FitsFile *self)
+{
+    if (self != NULL && self->reader != NULL) {
+        FileReader_close(self->reader);
+        self->reader = NULL;
+    }
     
-    // Parse each header line
-    for (size_t i = 0; i < self->header_size && self->header_count < line_count; i += FITS_HEADER_LINE_SIZE) {
-        char line[FITS_HEADER_LINE_SIZE + 1];
+    if (self != NULL && self->stream != NULL) {
+        // Drain a stream so that the writing process does not fail on a broken pipe
+        if (self->sequential) {
+            const size_t data_bytes = self->file_nx * self->file_ny * self->file_nz * self->nw * self->word_size;
+            const size_t data_end = self->data_offset + (data_bytes + FITS_HEADER_BLOCK_SIZE - 1) / FITS_HEADER_BLOCK_SIZE * FITS_HEADER_BLOCK_SIZE;
+            if (self->stream_pos < data_end) skip_stream(self->stream, data_end - self->stream_pos);
+            
+            char block[FITS_HEADER_BLOCK_SIZE];
+            if (fread(block, 1, sizeof(block), self->stream) > 0) {
+                fprintf(stderr, "Warning: Ignoring further HDUs of streamed FITS input.\n");
+                while (fread(block, 1, sizeof(block), self->stream) > 0);
+            }
+        }
         
-        // Copy line and null-terminate
-        memcpy(line, self->header + i, FITS_HEADER_LINE_SIZE);
-        line[FITS_HEADER_LINE_SIZE] = '\0';
+        if (self->stream != stdin) fclose(self->stream);
+        self->stream = NULL;
+    }
+    return;
+}
+
+// Read the data of this image and its extensions with 'n_threads' threads, optionally
+// bypassing the page cache (useful for cubes larger than memory)
+void FitsFile_set_io(FitsFile *self, const int n_threads, const bool direct)
+{
+    for (FitsFile *hdu = self; hdu != NULL; hdu = hdu->next) {
+        hdu->io_threads = n_threads > 0 ? n_threads : 1;
+        hdu->direct_io = direct;
+    }
+    return;
+}
+
+// Read and discard 'size' bytes of a stream that cannot seek
+bool skip_stream(FILE *fp, size_t size)
+{
+    char block[FITS_HEADER_BLOCK_SIZE];
+    
+    while (size > 0) {
+        const size_t chunk = size < sizeof(block) ? size : sizeof(block);
+        if (fread(block, 1, chunk, fp) != chunk) return false;
+        size -= chunk;
+    }
+    
+    return true;
+}
+
+// ----------------------------------------------------------------- //
+// Regions                                                           //
+// ----------------------------------------------------------------- //
+
+// Parse "x0:x1,y0:y1,z0:z1" (pixels counted from 0, both ends included). Either
+// end of a range, a whole range or trailing axes may be left out to read the axis
+// from its start, to its end or in full; a single number selects one pixel.
+void Region_parse(Region *self, const char *text)
+{
+    check_null(self);
+    check_null(text);
+    
+    for (int axis = 0; axis < 3; axis++) self->first[axis] = self->last[axis] = REGION_OPEN;
+    
+    const char *ptr = text;
+    for (int axis = 0; axis < 3 && *ptr != '\0'; axis++) {
+        const char *end = strchr(ptr, ',');
+        if (end == NULL) end = ptr + strlen(ptr);
         
-        // Check for END keyword
-        if (strncmp(line, "END", 3) == 0) {
-            break;
+        const char *colon = memchr(ptr, ':', (size_t)(end - ptr));
+        if (colon == NULL) {
+            self->first[axis] = self->last[axis] = parse_region_bound(ptr, end);
+        } else {
+            self->first[axis] = parse_region_bound(ptr, colon);
+            self->last[axis] = parse_region_bound(colon + 1, end);
         }
         
-        // Skip comment lines
-        if (line[0] == ' ' || strncmp(line, "COMMENT", 7) == 0 || strncmp(line, "HISTORY", 7) == 0) {
-            continue;
+        if (self->first[axis] != REGION_OPEN && self->last[axis] != REGION_OPEN && self->first[axis] > self->last[axis]) {
+            error_exit("Invalid region; the first pixel of an axis lies beyond its last.");
         }
         
-        // Look for equals sign
-        char *equals = strchr(line, '=');
-        if (equals == NULL) {
-            continue;  // No equals sign, skip this line
-        }
+        ptr = (*end == ',') ? end + 1 : end;
+        if (axis == 2 && *ptr != '\0') error_exit("Invalid region; at most three axes can be given.");
+    }
+    
+    return;
+}
+
+// Union of the bounding boxes of all sources, widened by 'margin' pixels
+void Region_from_catalog(Region *self, const SofiaCatalog *catalog, const double margin)
+{
+    check_null(self);
+    
+    if (catalog == NULL || catalog->size == 0) {
+        error_exit("A region from the catalogue needs a catalogue with sources.");
+    }
+    
+    double lower[3] = {INFINITY, INFINITY, INFINITY};
+    double upper[3] = {-INFINITY, -INFINITY, -INFINITY};
+    
+    for (size_t i = 0; i < catalog->size; i++) {
+        const CatalogSource *source = &catalog->sources[i];
+        const double low[3] = {source->x_min, source->y_min, source->z_min};
+        const double high[3] = {source->x_max, source->y_max, source->z_max};
+        const double centre[3] = {source->x, source->y, source->z};
         
-        // Extract keyword
-        size_t key_len = equals - line;
-        while (key_len > 0 && line[key_len - 1] == ' ') key_len--;  // Trim trailing spaces
+        for (int axis = 0; axis < 3; axis++) {
+            // Fall back to the centroid where no bounding box is given
+            const double a = (high[axis] >= low[axis]) ? low[axis] : centre[axis];
+            const double b = (high[axis] >= low[axis]) ? high[axis] : centre[axis];
+            if (isnan(a) || isnan(b)) continue;
+            if (a < lower[axis]) lower[axis] = a;
+            if (b > upper[axis]) upper[axis] = b;
+        }
+    }
+    
+    for (int axis = 0; axis < 3; axis++) {
+        if (!(upper[axis] >= lower[axis])) error_exit("Catalogue sources have no pixel positions to take a region from.");
         
-        self->header_keys[self->header_count] = memory_alloc(key_len + 1);
-        strncpy(self->header_keys[self->header_count], line, key_len);
-        self->header_keys[self->header_count][key_len] = '\0';
+        const double first = floor(lower[axis] - margin);
+        const double last = ceil(upper[axis] + margin);
+        self->first[axis] = first > 0.0 ? (size_t)first : 0;
+        self->last[axis] = last > 0.0 ? (size_t)last : 0;
+    }
+    
+    return;
+}
+
+// Read only 'region' (clipped to the image) of the data unit from here on. The axis
+// lengths and reference pixels in the header are changed to describe the region,
+// and checksums of the file, which no longer apply, are dropped.
+void FitsFile_set_region(FitsFile *self, const Region *region)
+{
+    check_null(self);
+    check_null(region);
+    
+    if (self->data != NULL || self->filename[0] == '\0') {
+        error_exit("A region can only be read from a FITS file.");
+    }
+    
+    const size_t size[3] = {self->file_nx, self->file_ny, self->file_nz};
+    size_t first[3];
+    size_t last[3];
+    
+    for (int axis = 0; axis < 3; axis++) {
+        first[axis] = region->first[axis] == REGION_OPEN ? 0 : region->first[axis];
+        last[axis] = (region->last[axis] == REGION_OPEN || region->last[axis] >= size[axis]) ? size[axis] - 1 : region->last[axis];
+        if (first[axis] > last[axis]) error_exit("Region lies outside the image.");
+    }
+    
+    self->origin[0] = first[0];
+    self->origin[1] = first[1];
+    self->origin[2] = first[2];
+    self->nx = last[0] - first[0] + 1;
+    self->ny = last[1] - first[1] + 1;
+    self->nz = last[2] - first[2] + 1;
+    self->data_size = self->nx * self->ny * self->nz * self->nw;
+    
+    const double share = (double)self->data_size / (double)(self->file_nx * self->file_ny * self->file_nz * self->nw);
+    printf("Reading region %zu:%zu,%zu:%zu,%zu:%zu of HDU %d (%.1f%% of the data).\n",
+           first[0], last[0], first[1], last[1], first[2], last[2], self->hdu, 100.0 * share);
+    
+    if (!FitsFile_has_region(self)) return;
+    
+    // Header of the region
+    for (int axis = 0; axis < 3 && axis < self->naxis; axis++) {
+        char key[FITS_HEADER_KEYWORD_SIZE + 1];
+        char value[32];
         
-        // Extract value
-        char *value_start = equals + 1;
-        while (*value_start == ' ') value_start++;  // Skip leading spaces
+        snprintf(key, sizeof(key), "NAXIS%d", axis + 1);
+        snprintf(value, sizeof(value), "%zu", last[axis] - first[axis] + 1);
+        self->header = fits_header_set_card(self->header, &self->header_size, key, value);
         
-        // Find end of value (before comment if any)
-        char *value_end = strchr(value_start, '/');
-        if (value_end == NULL) {
-            value_end = line + FITS_HEADER_LINE_SIZE;
-        }
+        if (first[axis] == 0) continue;
         
-        // Trim trailing spaces
-        while (value_end > value_start && *(value_end - 1) == ' ') value_end--;
+        snprintf(key, sizeof(key), "CRPIX%d", axis + 1);
+        double crpix = get_fits_header_flt(self, key);
+        if (isnan(crpix)) crpix = 1.0;  // FITS default
+        snprintf(value, sizeof(value), "%.12G", crpix - (double)first[axis]);
+        if (strpbrk(value, ".E") == NULL) strcat(value, ".0");
+        self->header = fits_header_set_card(self->header, &self->header_size, key, value);
+    }
+    
+    self->header_size = fits_header_drop_card(self->header, self->header_size, "CHECKSUM");
+    self->header_size = fits_header_drop_card(self->header, self->header_size, "DATASUM");
+    
+    FitsHeader_delete(self->keywords);
+    self->keywords = NULL;
+    self->header_parsed = false;
+    parse_fits_header(self);
+    
+    return;
+}
+
+// Whether only a region of the data unit is read
+bool FitsFile_has_region(const FitsFile *self)
+{
+    check_null(self);
+    return self->nx != self->file_nx || self->ny != self->file_ny || self->nz != self->file_nz;
+}
+
+// Move the pixel positions of a catalogue into the region read from 'fits' and
+// drop the sources whose centroid lies outside it
+void SofiaCatalog_set_region(SofiaCatalog *self, const FitsFile *fits)
+{
+    check_null(self);
+    check_null(fits);
+    
+    const double origin[3] = {(double)fits->origin[0], (double)fits->origin[1], (double)fits->origin[2]};
+    const double size[3] = {(double)fits->nx, (double)fits->ny, (double)fits->nz};
+    size_t kept = 0;
+    
+    for (size_t i = 0; i < self->size; i++) {
+        CatalogSource source = self->sources[i];
+        source.x -= origin[0];
+        source.x_min -= origin[0];
+        source.x_max -= origin[0];
+        source.y -= origin[1];
+        source.y_min -= origin[1];
+        source.y_max -= origin[1];
+        source.z -= origin[2];
+        source.z_min -= origin[2];
+        source.z_max -= origin[2];
         
-        // Remove quotes if present
-        if (*value_start == '\'' && *(value_end - 1) == '\'') {
-            value_start++;
-            value_end--;
-            // Trim spaces again
-            while (*value_start == ' ') value_start++;
-            while (value_end > value_start && *(value_end - 1) == ' ') value_end--;
+        // Pixel i covers [i - 0.5, i + 0.5)
+        const double position[3] = {source.x, source.y, source.z};
+        bool inside = true;
+        for (int axis = 0; axis < 3; axis++) {
+            if (!(position[axis] >= -0.5 && position[axis] < size[axis] - 0.5)) inside = false;
         }
         
-        size_t value_len = value_end - value_start;
-        self->header_values[self->header_count] = memory_alloc(value_len + 1);
-        strncpy(self->header_values[self->header_count], value_start, value_len);
-        self->header_values[self->header_count][value_len] = '\0';
-        
-        self->header_count++;
+        if (inside) self->sources[kept++] = source;
+    }
+    
+    if (kept < self->size) printf("Keeping %zu of %zu catalogue sources inside the region.\n", kept, self->size);
+    self->size = kept;
+    
+    return;
+}
+
+// Pixel number in [text, end), or REGION_OPEN if empty
+size_t parse_region_bound(const char *text, const char *end)
+{
+    while (text < end && isspace((unsigned char)*text)) text++;
+    while (end > text && isspace((unsigned char)end[-1])) end--;
+    if (text == end) return REGION_OPEN;
+    
+    char number[32];
+    const size_t length = (size_t)(end - text);
+    if (length >= sizeof(number)) error_exit("Invalid region; pixel number too long.");
+    memcpy(number, text, length);
+    number[length] = '\0';
+    
+    char *stop = NULL;
+    const unsigned long long value = strtoull(number, &stop, 10);
+    if (*stop != '\0' || number[0] == '-') error_exit("Invalid region; expected x0:x1,y0:y1,z0:z1.");
+    
+    return (size_t)value;
+}
+
+void parse_fits_header(FitsFile *self)
+{
+    check_null(self);
+    
+    if (self->header_parsed || self->header == NULL || self->header_size == 0) {
+        return;
     }
     
+    // Parse every card once into typed values; lookups are hashed from here on
+    self->keywords = FitsHeader_new(self->arena);
+    FitsHeader_parse(self->keywords, self->header, self->header_size);
+    
     self->header_parsed = true;
 }
 
@@ -324,37 +824,31 @@ const char *get_fits_header_value(const FitsFile *self, const char *key)
     
     if (!self->header_parsed) return NULL;
     
-    for (size_t i = 0; i < self->header_count; i++) {
-        if (strcmp(self->header_keys[i], key) == 0) {
-            return self->header_values[i];
-        }
-    }
-    
-    return NULL;
+    return FitsHeader_get_str(self->keywords, key);
 }
 
 long int get_fits_header_int(const FitsFile *self, const char *key)
 {
-    const char *value = get_fits_header_value(self, key);
-    if (value == NULL) return 0;
+    check_null(self);
+    if (!self->header_parsed) return 0;
     
-    return strtol(value, NULL, 10);
+    return FitsHeader_get_int(self->keywords, key);
 }
 
 double get_fits_header_flt(const FitsFile *self, const char *key)
 {
-    const char *value = get_fits_header_value(self, key);
-    if (value == NULL) return NAN;
+    check_null(self);
+    if (!self->header_parsed) return NAN;
     
-    return strtod(value, NULL);
+    return FitsHeader_get_flt(self->keywords, key);
 }
 
 bool get_fits_header_bool(const FitsFile *self, const char *key)
 {
-    const char *value = get_fits_header_value(self, key);
-    if (value == NULL) return false;
+    check_null(self);
+    if (!self->header_parsed) return false;
     
-    return (strcmp(value, "T") == 0 || strcmp(value, "true") == 0 || strcmp(value, "True") == 0);
+    return FitsHeader_get_bool(self->keywords, key);
 }
 
 // ----------------------------------------------------------------- //
@@ -375,18 +869,50 @@ void swap_fits_byte_order(void *data, size_t word_size, size_t count)
 {
     if (word_size <= 1) return;  // No swapping needed for single bytes
     
-    char *bytes = (char *)data;
-    char temp;
+    unsigned char *bytes = (unsigned char *)data;
     
-    for (size_t i = 0; i < count; i++) {
-        char *word = bytes + i * word_size;
-        
-        // Swap bytes in this word
-        for (size_t j = 0; j < word_size / 2; j++) {
-            temp = word[j];
-            word[j] = word[word_size - 1 - j];
-            word[word_size - 1 - j] = temp;
-        }
+    // Fixed-size cases let the compiler emit bswap / vector shuffles
+    switch (word_size) {
+        case 2:
+            for (size_t i = 0; i < count; i++) {
+                uint16_t word;
+                memcpy(&word, bytes + 2 * i, 2);
+                word = (uint16_t)((word << 8) | (word >> 8));
+                memcpy(bytes + 2 * i, &word, 2);
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < count; i++) {
+                uint32_t word;
+                memcpy(&word, bytes + 4 * i, 4);
+                word = ((word & 0x000000ffu) << 24) | ((word & 0x0000ff00u) << 8) |
+                       ((word & 0x00ff0000u) >> 8)  | ((word & 0xff000000u) >> 24);
+                memcpy(bytes + 4 * i, &word, 4);
+            }
+            break;
+        case 8:
+            for (size_t i = 0; i < count; i++) {
+                uint64_t word;
+                memcpy(&word, bytes + 8 * i, 8);
+                word = ((word & 0x00000000000000ffull) << 56) | ((word & 0x000000000000ff00ull) << 40) |
+                       ((word & 0x0000000000ff0000ull) << 24) | ((word & 0x00000000ff000000ull) << 8)  |
+                       ((word & 0x000000ff00000000ull) >> 8)  | ((word & 0x0000ff0000000000ull) >> 24) |
+                       ((word & 0x00ff000000000000ull) >> 40) | ((word & 0xff00000000000000ull) >> 56);
+                memcpy(bytes + 8 * i, &word, 8);
+            }
+            break;
+        default:
+            for (size_t i = 0; i < count; i++) {
+                unsigned char *word = bytes + i * word_size;
+                
+                // Swap bytes in this word
+                for (size_t j = 0; j < word_size / 2; j++) {
+                    unsigned char temp = word[j];
+                    word[j] = word[word_size - 1 - j];
+                    word[word_size - 1 - j] = temp;
+                }
+            }
+            break;
     }
 }
 
@@ -404,7 +930,8 @@ FitsFile *get_fitsfile(const char *directory, const Parameter *input_parameters)
         error_exit("No input data file specified");
     }
     
-    char *filename = format_path(directory, input_data);
+    // "-" is standard input, which must not be prefixed with the directory
+    char *filename = strcmp(input_data, "-") == 0 ? string_copy(input_data) : format_path(directory, input_data);
     FitsFile *fits = read_fits_file(filename);
     memory_free(filename);
     
@@ -497,8 +1024,8 @@ SofiaCatalog *read_sofia_catalogue(const char *filename, bool xml)
                 }
                 
                 // Allocate arrays
-                input_columns = memory_alloc(col_count * sizeof(char *));
-                column_locations = memory_alloc(col_count * sizeof(int));
+                input_columns = Arena_alloc(catalog->arena, col_count * sizeof(char *));
+                column_locations = Arena_alloc(catalog->arena, col_count * sizeof(int));
                 
                 // Parse columns and find their positions
                 strcpy(temp_line, line);
@@ -507,7 +1034,7 @@ SofiaCatalog *read_sofia_catalogue(const char *filename, bool xml)
                 char *token;
                 
                 while ((token = strtok(pos, " \t")) && col_index < col_count) {
-                    input_columns[col_index] = string_copy(token);
+                    input_columns[col_index] = Arena_string_copy(catalog->arena, token);
                     
                     // Find position in original line
                     char *found = strstr(line, token);
@@ -655,12 +1182,8 @@ SofiaCatalog *read_sofia_catalogue(const char *filename, bool xml)
     
     fclose(file);
     
-    // Clean up
-    for (int i = 0; i < col_count; i++) {
-        memory_free(input_columns[i]);
-    }
-    memory_free(input_columns);
-    memory_free(column_locations);
+    // The column names are no longer needed
+    Arena_reset(catalog->arena);
     
     return catalog;
 }
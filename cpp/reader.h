@@ -28,8 +28,11 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include "sofia2hdf5.h"
 #include "common.h"
 #include "parameter.h"
+#include "header.h"
+#include "fileio.h"
 
 // FITS file constants (from SoFiA-2)
 #define FITS_HEADER_BLOCK_SIZE   2880  ///< Size of a single FITS header block (in bytes).
@@ -45,19 +48,52 @@
 // Structure to hold FITS file information                          //
 // ----------------------------------------------------------------- //
 
-typedef CLASS FitsFile {
-    void *data;           // Raw data pointer (can be float, double, int8, int16, int32, int64)
+CLASS FitsFile {
+    void *data;           // Raw data pointer (can be float, double, int8, int16, int32, int64); NULL if streamed
+    bool owns_data;       // Whether data are freed with the object (false for caller buffers)
     size_t nx, ny, nz;    // Dimensions
+    size_t nw;            // Size of the fourth (e.g. Stokes) axis
+    int naxis;            // Number of axes in the HDU
     int data_type;        // BITPIX value from FITS header
     size_t word_size;     // Size of each data element in bytes
     size_t data_size;     // Total number of data elements
     char *header;         // Raw FITS header
     size_t header_size;   // Size of header in bytes
-    bool header_parsed;   // Whether header has been parsed into key-value pairs
-    char **header_keys;   // Parsed header keys
-    char **header_values; // Parsed header values
-    size_t header_count;  // Number of header key-value pairs
-} FitsFile;
+    bool header_parsed;   // Whether header has been parsed into cards
+    FitsHeader *keywords; // Parsed, typed header cards with hashed lookup
+    Arena *arena;         // Storage for the header strings
+    
+    // Streamed access to the data unit
+    char filename[MAX_PATH_LENGTH]; // File the HDU was read from
+    int hdu;              // HDU number within the file (0 = primary)
+    size_t data_offset;   // Byte offset of the data unit within the file
+    FileReader *reader;   // Parallel positional reads of a regular file, NULL until first use
+    int io_threads;       // Threads issuing reads
+    bool direct_io;       // Bypass the page cache
+    FILE *stream;         // Pipe or FIFO the data are read from
+    size_t stream_pos;    // Current byte position of the stream
+    bool sequential;      // Stream can only be read once, front to back (pipe, FIFO)
+    FitsFile *next;       // Next image HDU of the same file (owned)
+    
+    // Region of the data unit that is read (nx, ny, nz above give its size)
+    size_t file_nx, file_ny, file_nz; // Dimensions of the image in the file
+    size_t origin[3];     // First pixel of the region in the file
+};
+
+// ----------------------------------------------------------------- //
+// Class 'Region'                                                    //
+// ----------------------------------------------------------------- //
+// Box of pixels to be read from an image: the first and last pixel  //
+// (inclusive, counted from 0) along the first three axes, as in     //
+// SoFiA's input.region. REGION_OPEN marks an axis read in full.     //
+// ----------------------------------------------------------------- //
+
+#define REGION_OPEN SIZE_MAX
+
+typedef CLASS Region {
+    size_t first[3];
+    size_t last[3];
+} Region;
 
 // ----------------------------------------------------------------- //
 // Class 'Catalog'                                                   //
@@ -65,27 +101,16 @@ typedef CLASS FitsFile {
 // Structure to hold catalog information                            //
 // ----------------------------------------------------------------- //
 
-typedef CLASS CatalogSource {
-    char name[MAX_STRING_LENGTH];
-    int id;
-    double x, y, z;
-    double x_min, x_max, y_min, y_max, z_min, z_max;
-    double ra, dec, v_app;
-    double f_sum, err_f_sum;
-    double err_x, err_y, err_z;
-    double kin_pa, w50;
-    double rms;
-    int n_pix;
-    double v_sofia;
-} CatalogSource;
-
-typedef CLASS SofiaCatalog {
+// CatalogSource is part of the public interface, see sofia2hdf5.h
+
+CLASS SofiaCatalog {
     CatalogSource *sources;
     size_t size;
     size_t capacity;
     char type[MAX_STRING_LENGTH];
     char filename[MAX_PATH_LENGTH];
-} SofiaCatalog;
+    Arena *arena;         // Storage for column names while reading
+};
 
 // ----------------------------------------------------------------- //
 // Class 'CatalogInfo'                                               //
@@ -111,13 +136,11 @@ typedef CLASS MaskInfo {
     char type[MAX_STRING_LENGTH];
 } MaskInfo;
 
-// Constructor and destructor functions
+// Constructor and destructor functions (the public ones are declared in sofia2hdf5.h)
 PUBLIC FitsFile *FitsFile_new(void);
-PUBLIC void FitsFile_delete(FitsFile *self);
-PUBLIC SofiaCatalog *SofiaCatalog_new(void);
-PUBLIC void SofiaCatalog_delete(SofiaCatalog *self);
+PUBLIC FitsFile *FitsFile_new_from_header(const char *header, const size_t header_size);
 
-// FITS file reading functions
+// FITS file reading functions ("-" reads from standard input)
 PUBLIC FitsFile *read_fits_file(const char *filename);
 PUBLIC void parse_fits_header(FitsFile *self);
 PUBLIC const char *get_fits_header_value(const FitsFile *self, const char *key);
@@ -125,6 +148,22 @@ PUBLIC long int get_fits_header_int(const FitsFile *self, const char *key);
 PUBLIC double get_fits_header_flt(const FitsFile *self, const char *key);
 PUBLIC bool get_fits_header_bool(const FitsFile *self, const char *key);
 
+// Plane-wise data access; a plane is nx * ny elements, indexed over nz * nw
+PUBLIC size_t FitsFile_get_plane_count(const FitsFile *self);
+PUBLIC size_t FitsFile_get_plane_bytes(const FitsFile *self);
+PUBLIC const void *FitsFile_get_planes(FitsFile *self, const size_t first, const size_t count, void *buffer);
+PUBLIC void FitsFile_read_planes(FitsFile *self, const size_t first, const size_t count, void *buffer);
+PUBLIC void FitsFile_read_planes_raw(FitsFile *self, const size_t first, const size_t count, void *buffer);
+PUBLIC void FitsFile_close(FitsFile *self);
+PUBLIC void FitsFile_set_io(FitsFile *self, const int n_threads, const bool direct);
+
+// Regions
+PUBLIC void Region_parse(Region *self, const char *text);
+PUBLIC void Region_from_catalog(Region *self, const SofiaCatalog *catalog, const double margin);
+PUBLIC void FitsFile_set_region(FitsFile *self, const Region *region);
+PUBLIC bool FitsFile_has_region(const FitsFile *self);
+PUBLIC void SofiaCatalog_set_region(SofiaCatalog *self, const FitsFile *fits);
+
 // Byte order functions
 PUBLIC bool is_little_endian_system(void);
 PUBLIC void swap_fits_byte_order(void *data, size_t word_size, size_t count);
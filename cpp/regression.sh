@@ -0,0 +1,812 @@
+#!/bin/bash
+
+# Regression tests for the sofia2hdf5 C implementation
+# Converts small generated cubes with the main options and compares what HDF5
+# reads back with the FITS input. Needs python3 with numpy and h5py.
+#
+# Usage: ./regression.sh [path/to/sofia2hdf5]
+#
+# With MPIRUN set to the MPI launcher, e.g. MPIRUN="mpirun --oversubscribe", and
+# a binary built with make MPI=1, the conversions are also run on 2 and 4 ranks
+# and every data set is compared with the one written by a single rank.
+
+echo "SoFiA2HDF5 Regression Tests"
+echo "==========================="
+
+BINARY=$(realpath "${1:-./sofia2hdf5}" 2>/dev/null)
+if [ ! -x "$BINARY" ]; then
+    echo "Error: sofia2hdf5 executable not found; build it with make first"
+    exit 1
+fi
+
+if ! python3 -c "import numpy, h5py" 2>/dev/null; then
+    echo "Error: python3 with numpy and h5py is needed to check the output"
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+CHECK="$WORK/check.py"
+PASSED=0
+FAILED=0
+
+# ----------------------------------------------------------------- #
+# Input generation and checks, in Python                            #
+# ----------------------------------------------------------------- #
+
+cat > "$CHECK" << 'EOF'
+import os, sys
+import numpy as np
+import h5py
+
+NX, NY, NZ = 600, 150, 16      # Two chunks along x, mipmaps, one blank channel
+BLANK_PLANE = 5
+SOURCES = [(40, 60, 20, 35, 2, 4), (530, 560, 100, 120, 9, 11)]  # x0 x1 y0 y1 z0 z1
+
+# Overlapping tiles of the cube (x0 x1 y0 y1) and the sources each one finds, in
+# the order of their labels; the last source lies in the overlap of all four
+TILE_SOURCES = SOURCES + [(290, 310, 72, 78, 13, 14)]
+TILES = {'t00': ((0, 320, 0, 80), [0, 2]), 't01': ((0, 320, 70, NY), [2]),
+         't10': ((280, NX, 0, 80), [2]), 't11': ((280, NX, 70, NY), [1, 2])}
+
+def card(key, value=None):
+    if value is None:
+        return key.ljust(80)
+    if isinstance(value, str) and value not in ('T', 'F'):
+        value = "'%-8s'" % value
+    return ('%-8s= %20s' % (key, value)).ljust(80)
+
+# Cards of the cube beyond the WCS: long string, HIERARCH, logical, integer, empty string
+LONG = 'A history of this cube that does not fit on one card, ' * 2
+CARDS = [("ORIGIN  = '%s&'" % LONG[:67]).ljust(80), ("CONTINUE  '%s'" % LONG[67:]).ljust(80),
+         'HIERARCH ESO DET CHIP TEMP = 153.25 / K'.ljust(80), card('SIMULATE', 'T'), card('NITER', 42),
+         "OBSERVER= ''".ljust(80), 'HISTORY made for the regression tests'.ljust(80)]
+HEADER_VALUES = {'ORIGIN': LONG.rstrip().encode(), 'ESO DET CHIP TEMP': 153.25, 'SIMULATE': 1, 'NITER': 42.0,
+                 'OBSERVER': b'', 'CTYPE3': b'FREQ', 'CRVAL3': 1.4e9}
+
+def hdu(data, bitpix, cards=(), xtension=None):
+    # Header and data unit; an extension for 'xtension', else the primary HDU
+    first = [card('XTENSION', xtension)] if xtension else [card('SIMPLE', 'T')]
+    header = first + [card('BITPIX', bitpix), card('NAXIS', data.ndim)]
+    header += [card('NAXIS%d' % (i + 1), n) for i, n in enumerate(data.shape[::-1])]
+    header += [card('PCOUNT', 0), card('GCOUNT', 1)] if xtension else []
+    header += list(cards) + [card('END')]
+    text = ''.join(header)
+    text += ' ' * (-len(text) % 2880)
+    dtype = {-32: '>f4', -64: '>f8', 8: 'u1', 16: '>i2', 32: '>i4'}[bitpix]
+    raw = data.astype(dtype).tobytes()
+    raw += b'\0' * (-len(raw) % 2880)
+    return text.encode() + raw
+
+def write_fits(name, data, bitpix, cards=()):
+    with open(name, 'wb') as f:
+        f.write(hdu(data, bitpix, cards))
+
+def read_hdus(name):
+    # (XTENSION, data) of every HDU; data is None for tables
+    with open(name, 'rb') as f:
+        raw = f.read()
+    hdus, offset = [], 0
+    while offset < len(raw):
+        keys = {}
+        while 'END' not in keys:
+            block = raw[offset:offset + 2880].decode('latin-1')
+            offset += 2880
+            for i in range(0, 2880, 80):
+                line = block[i:i + 80]
+                if line.startswith('END'):
+                    keys['END'] = ''
+                    break
+                if line[8:10] == '= ':
+                    keys[line[:8].strip()] = line[10:].split('/')[0].strip()
+        shape = [int(keys['NAXIS%d' % i]) for i in range(int(keys['NAXIS']), 0, -1)]
+        count = int(np.prod(shape)) if shape else 0
+        bitpix = int(keys['BITPIX'])
+        size = abs(bitpix) // 8 * int(keys.get('GCOUNT', 1)) * (int(keys.get('PCOUNT', 0)) + count)
+        xtension = keys.get('XTENSION', "'PRIMARY'").strip("' ")
+        if xtension in ('PRIMARY', 'IMAGE'):
+            dtype = {-32: '>f4', -64: '>f8', 8: 'u1', 16: '>i2', 32: '>i4'}[bitpix]
+            hdus.append((xtension, np.frombuffer(raw, dtype, count, offset).reshape(shape)))
+        else:
+            hdus.append((xtension, None))
+        offset += size + (-size % 2880)
+    return hdus
+
+def read_fits(name):
+    return read_hdus(name)[0][1]
+
+def squeeze(data):
+    # DATA drops a degenerate fourth axis only, and holds an image as a single plane
+    if data.ndim == 2:
+        return data[np.newaxis]
+    return data[0] if data.ndim == 4 and data.shape[0] == 1 else data
+
+def region(data, text):
+    if text == '-':
+        return data
+    (x0, x1), (y0, y1), (z0, z1) = [map(int, part.split(':')) for part in text.split(',')]
+    return data[..., z0:z1 + 1, y0:y1 + 1, x0:x1 + 1]
+
+def equal(a, b):
+    return a.shape == b.shape and np.array_equal(a, b, equal_nan=a.dtype.kind == 'f')
+
+def fail(message):
+    print(message)
+    sys.exit(1)
+
+def write_catalogue(name, sources, dx=0, dy=0):
+    # SoFiA ASCII catalogue of boxes, with IDs counting from 1 and pixels shifted by -dx, -dy
+    with open(name, 'w') as f:
+        f.write('# SoFiA 2.6.0 source catalogue\n#\n')
+        f.write('#    name  id  x  y  z  x_min  x_max  y_min  y_max  z_min  z_max  n_pix  f_sum  ra  dec  v_app  w50  kin_pa  err_x  err_y  err_z  err_f_sum  rms\n#\n')
+        for i, (x0, x1, y0, y1, z0, z1) in enumerate(sources):
+            x0, x1, y0, y1 = x0 - dx, x1 - dx, y0 - dy, y1 - dy
+            f.write(' "SoFiA J%06d"  %d  %.1f  %.1f  %.1f  %d  %d  %d  %d  %d  %d  100  1.5  150.0  2.0  1200.0  40.0  120.0  0.1  0.1  0.1  0.5  0.01\n'
+                    % (i, i + 1, (x0 + x1) / 2, (y0 + y1) / 2, (z0 + z1) / 2, x0, x1, y0, y1, z0, z1))
+
+def fits_sum(data):
+    # Ones' complement sum of the big-endian 32-bit words, as for DATASUM
+    total = int(np.frombuffer(data, '>u4').astype(np.uint64).sum())
+    while total >> 32:
+        total = (total & 0xffffffff) + (total >> 32)
+    return total
+
+def fits_encode(value):
+    # ASCII encoding of the complement of a checksum for CHECKSUM (FITS standard, appendix J)
+    value = ~value & 0xffffffff
+    excluded = b':;<=>?@[\\]^_`'
+    text = [0] * 16
+    for i in range(4):
+        byte = (value >> (24 - 8 * i)) & 0xff
+        chars = [byte // 4 + 0x30] * 4
+        chars[0] += byte % 4
+        while any(c in excluded for c in chars):
+            for j in (0, 2):
+                if chars[j] in excluded or chars[j + 1] in excluded:
+                    chars[j] += 1
+                    chars[j + 1] -= 1
+        for j in range(4):
+            text[4 * j + i] = chars[j]
+    return bytes(text[-1:] + text[:-1]).decode()
+
+def write_checksummed(name, data, bitpix, corrupt=False):
+    # FITS file with DATASUM and CHECKSUM; 'corrupt' flips one bit of the data afterwards
+    raw = hdu(data, bitpix)
+    header_size = raw.index(card('END').encode()) // 2880 * 2880 + 2880
+    datasum = fits_sum(raw[header_size:])
+    # The encoding assumes the value at its usual place, from column 12
+    checksum = lambda value: ("CHECKSUM= '%s'" % value).ljust(80)
+    raw = hdu(data, bitpix, [card('DATASUM', str(datasum)), checksum('0' * 16)])
+    total = fits_sum(raw[:header_size]) + datasum
+    total = (total & 0xffffffff) + (total >> 32)
+    raw = hdu(data, bitpix, [card('DATASUM', str(datasum)), checksum(fits_encode(total))])
+    if corrupt:
+        raw = bytearray(raw)
+        raw[header_size + 100] ^= 1
+    with open(name, 'wb') as f:
+        f.write(raw)
+
+def make(directory):
+    rng = np.random.default_rng(2026)
+    wcs = [card('CTYPE1', 'RA---SIN'), card('CRPIX1', 300.0), card('CRVAL1', 150.0), card('CDELT1', -0.001),
+           card('CTYPE2', 'DEC--SIN'), card('CRPIX2', 75.0), card('CRVAL2', 2.0), card('CDELT2', 0.001),
+           card('CTYPE3', 'FREQ'), card('CRPIX3', 1.0), card('CRVAL3', 1.4e9), card('CDELT3', 1.0e5),
+           card('BUNIT', 'Jy/beam')]
+    cube = rng.normal(0.0, 0.01, (NZ, NY, NX)).astype('f4')
+    mask = np.zeros(cube.shape, 'i4')
+    for i, (x0, x1, y0, y1, z0, z1) in enumerate(SOURCES):
+        cube[z0:z1 + 1, y0:y1 + 1, x0:x1 + 1] += 0.05
+        mask[z0:z1 + 1, y0:y1 + 1, x0:x1 + 1] = i + 1
+    cube[:, :4, :] = np.nan
+    cube[:, 11, 7::13] = np.nan  # Partly blanked 2x2 blocks
+    cube[BLANK_PLANE] = np.nan
+    os.makedirs(directory + '/out', exist_ok=True)
+    write_fits(directory + '/cube.fits', cube, -32, wcs + CARDS)
+    write_fits(directory + '/out/cube_mask.fits', mask, 32, wcs)
+    write_catalogue(directory + '/out/cube_cat.txt', SOURCES)
+
+    stokes = rng.normal(0.0, 1.0, (2, 6, 40, 50)).astype('f4')
+    write_fits(directory + '/stokes.fits', stokes, -32, wcs + [card('CTYPE4', 'STOKES')])
+    image = rng.normal(0.0, 1.0, (4, 1, 40, 50)).astype('f4')
+    write_fits(directory + '/image.fits', image, -32, wcs + [card('CTYPE4', 'STOKES')])
+    bright = rng.normal(0.0, 3.0e4, (4, 30, 40)).astype('f4')
+    write_fits(directory + '/bright.fits', bright, -32, wcs)
+    counts = rng.integers(-3000, 3000, (NZ, 60, 70)).astype('i2')
+    counts[BLANK_PLANE] = 0
+    write_fits(directory + '/counts.fits', counts, 16)
+
+    # Overlapping tiles of the cube with shifted CRPIX, as cut by SoFiA's input.region,
+    # each with the mask and catalogue of the sources it finds, labelled from 1
+    for name, ((x0, x1, y0, y1), found) in TILES.items():
+        tile = [c for c in wcs if not c.startswith('CRPIX1') and not c.startswith('CRPIX2')]
+        tile += [card('CRPIX1', 300.0 - x0), card('CRPIX2', 75.0 - y0)]
+        write_fits(directory + '/%s.fits' % name, cube[:, y0:y1, x0:x1], -32, tile)
+        labels = np.zeros((NZ, y1 - y0, x1 - x0), 'i4')
+        for label, i in enumerate(found):
+            sx0, sx1, sy0, sy1, sz0, sz1 = TILE_SOURCES[i]
+            labels[sz0:sz1 + 1, max(sy0 - y0, 0):sy1 + 1 - y0, max(sx0 - x0, 0):sx1 + 1 - x0] = label + 1
+        write_fits(directory + '/out/%s_mask.fits' % name, labels, 32, tile)
+        write_catalogue(directory + '/out/%s_cat.txt' % name, [TILE_SOURCES[i] for i in found], x0, y0)
+
+    # Further HDUs: a table, which is skipped, an image and one with a degenerate fourth axis
+    with open(directory + '/multi.fits', 'wb') as f:
+        f.write(hdu(cube[:3, :20, :30], -32, wcs))
+        f.write(hdu(np.zeros((5, 4), 'u1'), 8, [card('TFIELDS', 1), card('TFORM1', '4B')], 'BINTABLE'))
+        f.write(hdu(counts[0, :25, :35], 16, [], 'IMAGE'))
+        f.write(hdu(stokes[:1, :3, :20, :30], -32, [], 'IMAGE'))
+
+    write_checksummed(directory + '/sums.fits', counts[:4], 16)
+    write_checksummed(directory + '/corrupt.fits', counts[:4], 16, corrupt=True)
+
+    # Mipmap means worked out by hand in check_mipmap_means
+    blocks = np.zeros((2, 3, 257), 'f4')
+    blocks[0, :, :4] = [[1, 2, 0, 0], [3, np.nan, 0, 0], [10, np.nan, np.nan, np.nan]]
+    blocks[0, :, 256] = [5, 7, 9]
+    blocks[1] = np.nan
+    write_fits(directory + '/blocks.fits', blocks, -32)
+
+    for name in ('cube', 'stokes', 'image', 'counts', 'bright', 'multi', 'sums', 'corrupt', 'blocks') + tuple(TILES):
+        with open(directory + '/%s.par' % name, 'w') as f:
+            f.write('input.data = %s.fits\noutput.directory = %s/out\noutput.filename = %s\n' % (name, directory, name))
+            if name == 'cube' or name in TILES:
+                f.write('output.writeCatASCII = true\noutput.writeMask = true\n')
+
+def check_data(hdf5, fits, box='-', path='/SoFiA/DATA'):
+    data = h5py.File(hdf5, 'r')[path][...]
+    expected = squeeze(region(read_fits(fits), box))
+    if not equal(data, expected.astype(data.dtype)):
+        fail('%s of %s differs from %s' % (path, hdf5, fits))
+
+def check_lossy(hdf5, fits, mode):
+    f = h5py.File(hdf5, 'r')
+    data = f['/SoFiA/DATA'][...].astype('f8')
+    expected = read_fits(fits).astype('f8')
+    if not np.array_equal(np.isnan(data), np.isnan(expected)):
+        fail('Blanks of %s moved' % hdf5)
+    error = np.abs(np.nan_to_num(data - expected))
+    if mode == 'round':
+        limit = f['/SoFiA/QUANTISATION_STEP'][...].reshape(-1, 1, 1) / 2.0
+    else:
+        limit = np.abs(np.nan_to_num(expected)) * 2.0 ** -11 + 2.0 ** -24
+    if np.any(error > limit * (1.0 + 1e-6)):
+        fail('%s of %s exceeds the quantisation error' % (mode, hdf5))
+
+def check_clipped(hdf5, fits):
+    # Values that would round beyond the largest half are clipped to it and counted
+    data = h5py.File(hdf5, 'r')['/SoFiA/DATA']
+    expected = read_fits(fits).astype('f8')
+    beyond = np.abs(expected) >= 65520.0
+    if data.attrs['QUANTISATION_CLIPPED'] != np.count_nonzero(beyond):
+        fail('QUANTISATION_CLIPPED of %s is %d instead of %d' % (hdf5, data.attrs['QUANTISATION_CLIPPED'], np.count_nonzero(beyond)))
+    if not np.array_equal(data[...][beyond], np.sign(expected[beyond]) * 65504.0):
+        fail('Values beyond the half-precision range of %s are not clipped' % hdf5)
+
+def check_same(hdf5, reference):
+    a, b = h5py.File(hdf5, 'r'), h5py.File(reference, 'r')
+    names = []
+    b.visititems(lambda name, item: names.append(name) if isinstance(item, h5py.Dataset) else None)
+    for name in names:
+        if name.startswith('SoFiA/Manifest'):
+            continue
+        if name not in a or not equal(a[name][()], b[name][()]):
+            fail('%s differs between %s and %s' % (name, hdf5, reference))
+    if not names:
+        fail('%s holds no data sets' % reference)
+
+def check_filters(hdf5, *wanted):
+    plist = h5py.File(hdf5, 'r')['/SoFiA/DATA'].id.get_create_plist()
+    filters = [plist.get_filter(i)[0] for i in range(plist.get_nfilters())]
+    codes = {'shuffle': 2, 'deflate': 1, 'fletcher32': 3, 'zstd': 32015}
+    for name in wanted:
+        if codes[name] not in filters:
+            fail('DATA of %s has no %s filter (filters %s)' % (hdf5, name, filters))
+
+def check_frames(hdf5):
+    # Every stored chunk is one Zstd frame (and its Fletcher32 checksum)
+    data = h5py.File(hdf5, 'r')['/SoFiA/DATA']
+    for i in range(data.id.get_num_chunks()):
+        mask, raw = data.id.read_direct_chunk(data.id.get_chunk_info(i).chunk_offset)
+        if mask != 0 or raw[:4] != b'\x28\xb5\x2f\xfd':
+            fail('Chunk %d of %s is not a Zstd frame' % (i, hdf5))
+
+def check_sparse(hdf5):
+    data = h5py.File(hdf5, 'r')['/SoFiA/DATA']
+    chunks = data.id.get_num_chunks()
+    total = int(np.prod([-(-n // c) for n, c in zip(data.shape, data.chunks)]))
+    if chunks >= total:
+        fail('All %d chunks of %s are stored' % (total, hdf5))
+    stored = {data.id.get_chunk_info(i).chunk_offset[0] for i in range(chunks)}
+    if BLANK_PLANE in stored:
+        fail('Blank channel %d of %s is stored' % (BLANK_PLANE, hdf5))
+
+def check_detections(hdf5, fits):
+    data = h5py.File(hdf5, 'r')['/SoFiA/DATA'][...]
+    expected = read_fits(fits)
+    for x0, x1, y0, y1, z0, z1 in SOURCES:
+        box = (slice(z0, z1 + 1), slice(y0, y1 + 1), slice(x0, x1 + 1))
+        if not equal(data[box], expected[box]):
+            fail('Detection at x=%d..%d of %s differs' % (x0, x1, hdf5))
+    if not np.all(np.isnan(data[NZ - 1])):
+        fail('Channel %d of %s holds no detection but is stored' % (NZ - 1, hdf5))
+
+def check_swizzled(hdf5, fits):
+    data = h5py.File(hdf5, 'r')['/SoFiA/SwizzledData/ZYX'][...]
+    if not equal(data, np.ascontiguousarray(read_fits(fits).astype('f4').transpose(2, 1, 0))):
+        fail('SwizzledData/ZYX of %s is not the transposed cube' % hdf5)
+
+def check_statistics(hdf5, fits):
+    # Statistics/XY describes each channel and Statistics/XYZ each cube; the
+    # histograms count every finite value in sqrt(nx * ny) bins over the range
+    # of the channel or cube, as np.histogram does
+    data = squeeze(read_fits(fits)).astype('f8')
+    cubes = data if data.ndim == 4 else data[np.newaxis]
+    group = h5py.File(hdf5, 'r')['/SoFiA/Statistics']
+    n_bins = int(np.sqrt(data.shape[-1] * data.shape[-2]))
+    for name, parts in (('XYZ', [cube for cube in cubes]), ('XY', [plane for cube in cubes for plane in cube])):
+        stored = {key: group[name][key][...].reshape(len(parts), -1) for key in ('MIN', 'MAX', 'NAN_COUNT', 'HISTOGRAM')}
+        if stored['HISTOGRAM'].shape[1] != n_bins:
+            fail('%s/HISTOGRAM of %s has %d bins instead of %d' % (name, hdf5, stored['HISTOGRAM'].shape[1], n_bins))
+        for i, part in enumerate(parts):
+            values = part[np.isfinite(part)]
+            if stored['NAN_COUNT'][i, 0] != part.size - values.size:
+                fail('%s/NAN_COUNT %d of %s is wrong' % (name, i, hdf5))
+            if values.size == 0:
+                continue
+            if stored['MIN'][i, 0] != np.float32(values.min()) or stored['MAX'][i, 0] != np.float32(values.max()):
+                fail('%s/MIN or MAX %d of %s is wrong' % (name, i, hdf5))
+            expected, edges = np.histogram(values, n_bins, (values.min(), values.max()))
+            moved = np.abs(stored['HISTOGRAM'][i] - expected).sum()
+            if name == 'XYZ':
+                # Rebinned from the fine histograms: only values within 1/16 bin of an edge may move
+                inner = edges[1:-1]
+                k = np.clip(np.searchsorted(inner, values), 1, len(inner) - 1)
+                distance = np.minimum(np.abs(values - inner[k - 1]), np.abs(values - inner[k]))
+                near = distance < (edges[1] - edges[0]) / 16.0
+                allowed = 2 * np.count_nonzero(near)
+            else:
+                allowed = 0
+            if stored['HISTOGRAM'][i].sum() != values.size or moved > allowed:
+                fail('%s/HISTOGRAM %d of %s differs from np.histogram by %d counts'
+                     % (name, i, hdf5, moved))
+
+def check_mipmaps(hdf5, fits):
+    # Level f holds the mean of the finite values in every f x f block, NaN if
+    # there are none; edge blocks are cut off by the plane
+    data = read_fits(fits).astype('f8')
+    group = h5py.File(hdf5, 'r')['/SoFiA/MipMaps/DATA']
+    if 'DATA_XY_2' not in group:
+        fail('%s has no mipmaps' % hdf5)
+    for name in group:
+        f = int(name.split('_')[-1])
+        nz, ny, nx = data.shape
+        padded = np.full((nz, -(-ny // f) * f, -(-nx // f) * f), np.nan)
+        padded[:, :ny, :nx] = data
+        blocks = padded.reshape(nz, padded.shape[1] // f, f, padded.shape[2] // f, f)
+        count = np.isfinite(blocks).sum(axis=(2, 4))
+        total = np.nansum(blocks, axis=(2, 4))
+        with np.errstate(invalid='ignore'):
+            expected = np.where(count > 0, total / count, np.nan)
+        stored = group[name][...]
+        if stored.shape != expected.shape or not np.allclose(stored, expected, rtol=1e-6, atol=1e-9, equal_nan=True):
+            fail('MipMaps/DATA/%s of %s differs from the block means' % (name, hdf5))
+
+def check_catalogue(hdf5, rows):
+    group = h5py.File(hdf5, 'r')['/SoFiA/Catalogue']
+    if len(group['id']) != int(rows):
+        fail('Catalogue of %s has %d rows instead of %s' % (hdf5, len(group['id']), rows))
+
+def check_columns(catalogue, hdf5):
+    # The regenerated catalogue holds exactly the columns stored in the file
+    with open(catalogue) as f:
+        header = [line.split() for line in f if line.startswith('#') and 'name' in line.split()]
+    stored = set(h5py.File(hdf5, 'r')['/SoFiA/Catalogue'].keys()) - {'name'}
+    if not header or set(header[0][2:]) != stored:
+        fail('Columns of %s differ from those in %s' % (catalogue, hdf5))
+
+def drop(hdf5, *columns):
+    with h5py.File(hdf5, 'r+') as f:
+        for name in columns:
+            del f['/SoFiA/Catalogue'][name]
+
+def check_fits(fits, reference):
+    if not equal(read_fits(fits), read_fits(reference)):
+        fail('Data of %s differ from %s' % (fits, reference))
+
+def check_header(hdf5, storage):
+    # Typed header attributes, strings of 256 characters, one HEADER for all groups
+    f = h5py.File(hdf5, 'r')
+    attrs = f['/SoFiA'].attrs
+    for key, value in HEADER_VALUES.items():
+        if key not in attrs or attrs[key] != value:
+            fail('Attribute %s of %s is %r instead of %r' % (key, hdf5, attrs.get(key), value))
+    for group in ('/SoFiA', '/SoFiA/Mask'):
+        for key in f[group].attrs:
+            dtype = f[group].attrs.get_id(key).dtype
+            if dtype.kind == 'S' and dtype.itemsize != 256:
+                fail('Attribute %s of %s in %s is a string of %d characters' % (key, group, hdf5, dtype.itemsize))
+    shared = h5py.h5o.get_info(f['/SoFiA/HEADER'].id).addr
+    groups = []
+    f.visititems(lambda name, item: groups.append(name) if isinstance(item, h5py.Group) and 'HEADER' in item else None)
+    if any(h5py.h5o.get_info(f[name]['HEADER'].id).addr != shared for name in groups) or 'SoFiA/Mask' not in groups:
+        fail('Groups of %s do not share /SoFiA/HEADER' % hdf5)
+    dense = h5py.h5o.get_info(f['/SoFiA'].id).meta_size.attr.heap_size > 0
+    if dense != (storage == 'dense'):
+        fail('Header attributes of %s are not in %s storage' % (hdf5, storage))
+
+def check_cards(fits, reference, commentary='same'):
+    # The regenerated header matches the original card for card; the commentary
+    # cards of a mask are those of the cube
+    def cards(name):
+        with open(name, 'rb') as f:
+            raw = f.read(2880 * 4).decode('latin-1')
+        lines = [raw[i:i + 80] for i in range(0, raw.index('END' + ' ' * 77) + 80, 80)]
+        return [line for line in lines if commentary == 'same' or line[8:10] == '= ' or line.startswith('END')]
+    if cards(fits) != cards(reference):
+        fail('Header of %s differs from %s' % (fits, reference))
+
+def check_complete(hdf5):
+    # A finished conversion leaves no PROGRESS behind
+    left = []
+    h5py.File(hdf5, 'r').visititems(lambda name, item: left.append(name) if 'PROGRESS' in item.attrs else None)
+    if left:
+        fail('%s still carry PROGRESS in %s' % (', '.join(left), hdf5))
+
+def check_hdus(hdf5, fits):
+    # Every image extension of the FITS file is in HDU<n>, a degenerate fourth axis dropped
+    f = h5py.File(hdf5, 'r')
+    for index, (xtension, data) in enumerate(read_hdus(fits)):
+        name = '/SoFiA/DATA' if index == 0 else '/SoFiA/HDU%d/DATA' % index
+        if data is None:
+            if 'HDU%d' % index in f['/SoFiA']:
+                fail('Table HDU %d of %s was converted' % (index, fits))
+        elif name not in f or not equal(f[name][...], squeeze(data).astype(f[name].dtype)):
+            fail('%s of %s differs from HDU %d of %s' % (name, hdf5, index, fits))
+
+def check_images(fits, reference):
+    # The same image HDUs in the same order; tables are left out
+    images = [data for xtension, data in read_hdus(reference) if data is not None]
+    found = [data for xtension, data in read_hdus(fits)]
+    if len(found) != len(images) or not all(equal(squeeze(a), squeeze(b)) for a, b in zip(found, images)):
+        fail('Image HDUs of %s differ from those of %s' % (fits, reference))
+
+def check_log(log, *patterns):
+    # Each pattern must occur in the log, or must not if it starts with '!'
+    with open(log) as f:
+        text = f.read()
+    for pattern in patterns:
+        if (pattern[1:] in text) if pattern.startswith('!') else (pattern not in text):
+            fail('%s %s "%s"' % (log, 'holds' if pattern.startswith('!') else 'lacks', pattern.lstrip('!')))
+
+def check_attributes(hdf5, path, *pairs):
+    attrs = h5py.File(hdf5, 'r')[path].attrs
+    for key, value in zip(pairs[::2], pairs[1::2]):
+        if key not in attrs or not np.isclose(attrs[key], float(value)):
+            fail('Attribute %s of %s in %s is %s instead of %s' % (key, path, hdf5, attrs.get(key), value))
+
+def check_mipmap_means(hdf5):
+    # Level 4 is the mean of all finite pixels of its block, not of the level-2 means
+    # (which would give (2 + 0 + 10) / 3 = 4 for the first block)
+    group = h5py.File(hdf5, 'r')['/SoFiA/MipMaps/DATA']
+    if sorted(group) != ['DATA_XY_2', 'DATA_XY_4']:
+        fail('%s has mipmaps %s instead of levels 2 and 4' % (hdf5, sorted(group)))
+    levels = {f: group['DATA_XY_%d' % f][...] for f in (2, 4)}
+    expected = {(2, (0, 0, 0)): (1 + 2 + 3) / 3, (2, (0, 0, 1)): 0.0, (2, (0, 1, 0)): 10.0, (2, (0, 1, 1)): np.nan,
+                (2, (0, 0, 128)): (5 + 7) / 2, (2, (0, 1, 128)): 9.0,
+                (4, (0, 0, 0)): (1 + 2 + 3 + 10) / 8, (4, (0, 0, 64)): (5 + 7 + 9) / 3}
+    if levels[2].shape != (2, 2, 129) or levels[4].shape != (2, 1, 65):
+        fail('Mipmaps of %s have shapes %s and %s' % (hdf5, levels[2].shape, levels[4].shape))
+    for (f, index), value in expected.items():
+        if not np.allclose(levels[f][index], value, equal_nan=True):
+            fail('Level %d at %s of %s is %g instead of %g' % (f, index, hdf5, levels[f][index], value))
+    if not np.all(np.isnan(levels[2][1])) or not np.all(np.isnan(levels[4][1])):
+        fail('Mipmaps of the blank plane of %s are not blank' % hdf5)
+
+def check_labels(hdf5, *tiles):
+    # One catalogue row per source of the field; every tile label points at the
+    # row of the source it marks, so the copies in the overlaps share one ID
+    f = h5py.File(hdf5, 'r')
+    catalogue, labels = f['/SoFiA/Catalogue'], f['/SoFiA/Mask/Labels']
+    if len(catalogue['id']) != len(TILE_SOURCES):
+        fail('Catalogue of %s has %d rows instead of %d' % (hdf5, len(catalogue['id']), len(TILE_SOURCES)))
+    rows = {int(i): (x, y) for i, x, y in zip(catalogue['id'][...], catalogue['x'][...], catalogue['y'][...])}
+    mapped = 0
+    for tile, label, merged in zip(labels['tile'][...], labels['id'][...], labels['mosaic_id'][...]):
+        x0, x1, y0, y1, z0, z1 = TILE_SOURCES[TILES[tiles[tile]][1][label - 1]]
+        x, y = rows.get(int(merged), (np.nan, np.nan))
+        if not (abs(x - (x0 + x1) / 2) < 1.0 and abs(y - (y0 + y1) / 2) < 1.0):
+            fail('Label %d of tile %s in %s points at the wrong source' % (label, tiles[tile], hdf5))
+        mapped += 1
+    if mapped != sum(len(found) for box, found in TILES.values()):
+        fail('%s holds %d tile labels instead of %d' % (hdf5, mapped, sum(len(found) for box, found in TILES.values())))
+
+def change(directory):
+    # SoFiA run again on the cube: the mask labels swapped (same size), the second
+    # source gone from the catalogue; the originals are kept to be restored
+    for name in ('cube_mask.fits', 'cube_cat.txt'):
+        os.replace(directory + '/out/' + name, directory + '/' + name + '.orig')
+    with open(directory + '/cube_mask.fits.orig', 'rb') as f:
+        raw = f.read()
+    mask = read_fits(directory + '/cube_mask.fits.orig')
+    start = len(raw) - mask.nbytes - (-mask.nbytes % 2880)
+    with open(directory + '/out/cube_mask.fits', 'wb') as f:
+        f.write(raw[:start] + np.where(mask > 0, 3 - mask, 0).astype('>i4').tobytes() + raw[start + mask.nbytes:])
+    write_catalogue(directory + '/out/cube_cat.txt', SOURCES[:1])
+    for name in ('cube_mask.fits', 'cube_cat.txt'):
+        stat = os.stat(directory + '/' + name + '.orig')
+        os.utime(directory + '/out/' + name, (stat.st_atime + 10, stat.st_mtime + 10))
+
+def restore(directory):
+    for name in ('cube_mask.fits', 'cube_cat.txt'):
+        os.replace(directory + '/' + name + '.orig', directory + '/out/' + name)
+
+def interrupt(hdf5, planes):
+    # Leave the file as a crash after 'planes' planes would: DATA complete up to
+    # there, nothing after it, no products yet
+    planes = int(planes)
+    with h5py.File(hdf5, 'r+') as f:
+        data = f['/SoFiA/DATA']
+        data[planes:] = 0
+        data.attrs.create('PROGRESS', planes, dtype='<u8')
+        for name in ('Statistics', 'MipMaps', 'Mask', 'Catalogue'):
+            if name in f['/SoFiA']:
+                del f['/SoFiA'][name]
+
+commands = {'make': make, 'data': check_data, 'lossy': check_lossy, 'clipped': check_clipped, 'same': check_same, 'filters': check_filters, 'frames': check_frames,
+            'sparse': check_sparse, 'detections': check_detections, 'swizzled': check_swizzled,
+            'statistics': check_statistics, 'mipmaps': check_mipmaps,
+            'catalogue': check_catalogue, 'columns': check_columns, 'drop': drop, 'fits': check_fits,
+            'header': check_header, 'cards': check_cards, 'complete': check_complete, 'interrupt': interrupt,
+            'hdus': check_hdus, 'images': check_images, 'log': check_log, 'attributes': check_attributes,
+            'mipmap-means': check_mipmap_means, 'labels': check_labels, 'change': change, 'restore': restore}
+commands[sys.argv[1]](*sys.argv[2:])
+EOF
+
+# ----------------------------------------------------------------- #
+# Helpers                                                           #
+# ----------------------------------------------------------------- #
+
+# run NAME ARGS...: convert with ARGS in the work directory; the log goes to NAME.log
+run() {
+    local name=$1
+    shift
+    (cd "$WORK" && "$BINARY" "$@" > "$WORK/$name.log" 2>&1)
+}
+
+# check NAME COMMAND...: report the outcome of the conversion and the check
+check() {
+    local name=$1
+    shift
+    if grep -q -E "^Error|Segmentation|Abort" "$WORK/$name.log" 2>/dev/null; then
+        echo "FAIL  $name: $(grep -m 1 -E "^Error|Segmentation|Abort" "$WORK/$name.log")"
+        FAILED=$((FAILED + 1))
+    elif message=$(cd "$WORK" && python3 "$CHECK" "$@" 2>&1); then
+        echo "PASS  $name"
+        PASSED=$((PASSED + 1))
+    else
+        echo "FAIL  $name: $message"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# run_ranks N NAME ARGS...: as run, on N MPI ranks; a job that hangs is stopped
+run_ranks() {
+    local ranks=$1
+    local name=$2
+    shift 2
+    (cd "$WORK" && timeout 300 $MPIRUN -np "$ranks" "$BINARY" "$@" > "$WORK/$name.log" 2>&1)
+}
+
+fresh() {
+    rm -f "$WORK"/out/*.hdf5
+}
+
+python3 "$CHECK" make "$WORK" || exit 1
+CUBE="sofia_input=cube.par"
+OUT=out/cube.hdf5
+
+# ----------------------------------------------------------------- #
+# Conversions                                                       #
+# ----------------------------------------------------------------- #
+
+fresh; run plain $CUBE
+check plain data $OUT cube.fits
+check plain-mask data $OUT out/cube_mask.fits - /SoFiA/Mask/DATA
+check plain-catalogue catalogue $OUT 2
+check plain-complete complete $OUT
+check plain-header header $OUT compact
+cp "$WORK/$OUT" "$WORK/reference.hdf5"
+
+PRODUCTS="hdf5.statistics=true hdf5.mipmaps=true hdf5.checksums=true"
+fresh; run products $CUBE $PRODUCTS general.max_memory=1
+check products-statistics statistics $OUT cube.fits
+check products-mipmaps mipmaps $OUT cube.fits
+cp "$WORK/$OUT" "$WORK/products.hdf5"
+
+fresh; run mipmap-means sofia_input=blocks.par hdf5.mipmaps=true
+check mipmap-means mipmap-means out/blocks.hdf5
+
+# Mismatches are warnings, so the conversion itself succeeds
+fresh; run checksums sofia_input=sums.par hdf5.checksums=true
+check checksums log checksums.log "!mismatch"
+fresh; run checksums-corrupt sofia_input=corrupt.par hdf5.checksums=true
+check checksums-corrupt log checksums-corrupt.log "Warning: DATASUM mismatch" "Warning: CHECKSUM mismatch"
+
+fresh; run dense-attributes $CUBE hdf5.dense_attributes=true
+check dense-attributes header $OUT dense
+
+fresh; run threads $CUBE general.multiprocessing=true general.ncpu=4 general.max_memory=1
+check threads same $OUT reference.hdf5
+
+fresh; cat "$WORK/cube.fits" | run stdin $CUBE input=-
+check stdin same $OUT reference.hdf5
+
+fresh; run direct-io $CUBE general.direct_io=true
+check direct-io same $OUT reference.hdf5
+
+fresh; run deflate $CUBE hdf5.compression=deflate hdf5.checksums=true general.max_memory=2
+check deflate data $OUT cube.fits
+check deflate-filters filters $OUT shuffle deflate fletcher32
+check deflate-mask data $OUT out/cube_mask.fits - /SoFiA/Mask/DATA
+
+fresh; run deflate-threads $CUBE hdf5.compression=deflate hdf5.compression_level=9 general.multiprocessing=true general.ncpu=4
+check deflate-threads data $OUT cube.fits
+
+# Zstd needs a build with make ZSTD=1; HDF5 readers need filter 32015, so the data
+# are checked through the reverse conversion
+fresh; run zstd $CUBE hdf5.compression=zstd hdf5.checksums=true general.multiprocessing=true general.ncpu=4 general.max_memory=1
+if grep -q "make ZSTD=1" "$WORK/zstd.log"; then
+    echo "SKIP  zstd: built without Zstd"
+else
+    check zstd-filters filters $OUT shuffle zstd fletcher32
+    check zstd-frames frames $OUT
+    mkdir -p "$WORK/reverse-zstd"
+    run zstd-reverse hdf5_input=$OUT general.directory=reverse-zstd
+    check zstd-reverse fits reverse-zstd/cube.fits cube.fits
+    check zstd-reverse-mask fits reverse-zstd/cube_mask.fits out/cube_mask.fits
+fi
+
+fresh; run deflate-int16 sofia_input=counts.par hdf5.compression=deflate hdf5.sparse=true
+check deflate-int16 data out/counts.hdf5 counts.fits
+
+fresh; run sparse $CUBE hdf5.sparse=true
+check sparse data $OUT cube.fits
+check sparse-chunks sparse $OUT
+
+fresh; run sparse-deflate $CUBE hdf5.sparse=true hdf5.compression=deflate hdf5.statistics=true
+check sparse-deflate data $OUT cube.fits
+check sparse-deflate-chunks sparse $OUT
+check sparse-deflate-statistics statistics $OUT cube.fits
+
+REGION=100:449,10:139,2:12
+fresh; run region $CUBE region=$REGION
+check region data $OUT cube.fits $REGION
+check region-mask data $OUT out/cube_mask.fits $REGION /SoFiA/Mask/DATA
+
+fresh; run region-deflate $CUBE region=$REGION hdf5.compression=deflate hdf5.sparse=true
+check region-deflate data $OUT cube.fits $REGION
+
+fresh; run region-stdin $CUBE region=$REGION input=- < "$WORK/cube.fits"
+check region-stdin data $OUT cube.fits $REGION
+
+# Union of the source boxes grown by 3 pixels, clipped to the cube
+fresh; run region-catalog $CUBE --region=catalog region.margin=3
+check region-catalog data $OUT cube.fits 37:563,17:123,0:14
+check region-catalog-mask data $OUT out/cube_mask.fits 37:563,17:123,0:14 /SoFiA/Mask/DATA
+check region-catalog-wcs attributes $OUT /SoFiA CRPIX1 263 CRPIX2 58 CRPIX3 1
+
+# Products of the planes written before the interruption are rebuilt from DATA
+fresh; run resume-first $CUBE $PRODUCTS general.max_memory=1
+python3 "$CHECK" interrupt "$WORK/$OUT" 7
+run resume $CUBE $PRODUCTS hdf5.resume=true general.max_memory=1
+check resume same $OUT products.hdf5
+check resume-complete complete $OUT
+
+fresh; run resume-deflate-first $CUBE hdf5.sparse=true hdf5.compression=deflate general.max_memory=1
+python3 "$CHECK" interrupt "$WORK/$OUT" 7
+run resume-deflate $CUBE hdf5.sparse=true hdf5.compression=deflate hdf5.resume=true general.max_memory=1
+check resume-deflate data $OUT cube.fits
+
+cp "$WORK/reference.hdf5" "$WORK/$OUT"
+run incremental $CUBE hdf5.incremental=true
+check incremental same $OUT reference.hdf5
+
+# Only the products SoFiA wrote again are replaced; the mask has the same size
+# and is recognised by its content
+python3 "$CHECK" change "$WORK"
+run incremental-changed $CUBE hdf5.incremental=true
+check incremental-changed log incremental-changed.log "Mask has changed" "!Cube has changed"
+check incremental-changed-data data $OUT cube.fits
+check incremental-changed-mask data $OUT out/cube_mask.fits - /SoFiA/Mask/DATA
+check incremental-changed-catalogue catalogue $OUT 1
+python3 "$CHECK" restore "$WORK"
+
+fresh; run round $CUBE hdf5.quantise=round
+check round lossy $OUT cube.fits round
+
+fresh; run float16 $CUBE hdf5.quantise=float16
+check float16 lossy $OUT cube.fits float16
+
+fresh; run float16-clipped sofia_input=bright.par hdf5.quantise=float16
+check float16-clipped clipped out/bright.hdf5 bright.fits
+
+fresh; run swizzle $CUBE hdf5.swizzle=ZYX
+check swizzle swizzled $OUT cube.fits
+
+fresh; run external $CUBE hdf5.external=true
+check external data $OUT cube.fits
+
+fresh; run detections $CUBE hdf5.detections=true hdf5.detection_margin=2
+check detections detections $OUT cube.fits
+
+fresh; run fs-profile $CUBE --fs-profile=lustre
+check fs-profile same $OUT reference.hdf5
+
+fresh; run in-memory $CUBE --in-memory=64
+check in-memory same $OUT reference.hdf5
+
+fresh; run stokes sofia_input=stokes.par hdf5.compression=deflate hdf5.statistics=true
+check stokes data out/stokes.hdf5 stokes.fits
+check stokes-statistics statistics out/stokes.hdf5 stokes.fits
+
+fresh; run stokes-image sofia_input=image.par
+check stokes-image data out/image.hdf5 image.fits
+
+fresh; run multi-hdu sofia_input=multi.par
+check multi-hdu hdus out/multi.hdf5 multi.fits
+mkdir -p "$WORK/reverse-multi"
+run multi-hdu-reverse hdf5_input=out/multi.hdf5 general.directory=reverse-multi
+check multi-hdu-reverse images reverse-multi/multi.fits multi.fits
+
+fresh; run mosaic mosaic=t00.par,t01.par,t10.par,t11.par mosaic.output=out/field.hdf5
+check mosaic data out/field.hdf5 cube.fits
+check mosaic-labels labels out/field.hdf5 t00 t01 t10 t11
+
+mkdir -p "$WORK/reverse"
+fresh; run reverse-input $CUBE hdf5.compression=deflate
+run reverse hdf5_input=$OUT general.directory=reverse
+check reverse fits reverse/cube.fits cube.fits
+check reverse-header cards reverse/cube.fits cube.fits
+check reverse-mask fits reverse/cube_mask.fits out/cube_mask.fits
+check reverse-mask-header cards reverse/cube_mask.fits out/cube_mask.fits cube
+check reverse-catalogue columns reverse/cube_cat.txt $OUT
+
+mkdir -p "$WORK/reverse-drop"
+python3 "$CHECK" drop "$WORK/$OUT" kin_pa w50 err_f_sum
+run reverse-drop hdf5_input=$OUT general.directory=reverse-drop
+check reverse-drop columns reverse-drop/cube_cat.txt $OUT
+
+# ----------------------------------------------------------------- #
+# MPI                                                               #
+# ----------------------------------------------------------------- #
+
+if [ -n "$MPIRUN" ]; then
+    # Compression is switched off with several ranks, so the products gathered from the ranks are compared instead
+    for options in "" "hdf5.checksums=true hdf5.statistics=true hdf5.mipmaps=true"; do
+        suffix=${options:+-products}
+        fresh; run mpi-serial$suffix $CUBE $options general.max_memory=1
+        cp "$WORK/$OUT" "$WORK/serial.hdf5"
+        for ranks in 2 4; do
+            fresh; run_ranks $ranks mpi-$ranks$suffix $CUBE $options general.max_memory=1
+            check mpi-$ranks$suffix same $OUT serial.hdf5
+        done
+    done
+    
+    # An error on one rank has to end the whole job instead of leaving the others waiting
+    fresh; run_ranks 2 mpi-abort $CUBE input=- < "$WORK/cube.fits"
+    status=$?
+    if [ $status -ne 0 ] && [ $status -ne 124 ] && grep -q "^Error" "$WORK/mpi-abort.log"; then
+        echo "PASS  mpi-abort"
+        PASSED=$((PASSED + 1))
+    else
+        echo "FAIL  mpi-abort: exit status $status"
+        FAILED=$((FAILED + 1))
+    fi
+fi
+
+# ----------------------------------------------------------------- #
+# Summary                                                           #
+# ----------------------------------------------------------------- #
+
+echo ""
+echo "$PASSED passed, $FAILED failed"
+[ "$FAILED" -eq 0 ]
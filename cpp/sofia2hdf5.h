@@ -0,0 +1,106 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (sofia2hdf5.h) - SoFiA to HDF5 Converter                 //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+
+/// @file   sofia2hdf5.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Public interface of libsofia2hdf5.
+
+#ifndef SOFIA2HDF5_H
+#define SOFIA2HDF5_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// ----------------------------------------------------------------- //
+// libsofia2hdf5                                                     //
+// ----------------------------------------------------------------- //
+// The single header for programs linking against libsofia2hdf5.a    //
+// or libsofia2hdf5.so, e.g. SoFiA itself right after source         //
+// finding. Images can be handed over as they are held in memory,    //
+// so no FITS file has to be written and read back:                  //
+//                                                                   //
+//   SofiaHDF5 *out = SofiaHDF5_new("cube.hdf5", "cube");            //
+//   SofiaHDF5_set_option(out, "hdf5.compression=deflate");          //
+//   FitsFile *cube = FitsFile_new_from_memory(header, size, data);  //
+//   SofiaHDF5_add_cube(out, cube);                                  //
+//   SofiaCatalog *cat = SofiaCatalog_new();                         //
+//   SofiaCatalog_add_source(cat, &source);  (for every source)      //
+//   SofiaHDF5_add_catalog(out, cat);                                //
+//   if (SofiaHDF5_write(out) != 0) ...                              //
+//                                                                   //
+// Headers are raw 80-character cards; data must be native-endian    //
+// and stay valid until SofiaHDF5_write() returns. They are only     //
+// read, never copied or freed: FitsFile_delete() releases the       //
+// wrapper alone. The objects are opaque and owned by the caller.    //
+//                                                                   //
+// FitsFile_new_from_memory(), SofiaHDF5_set_option() and            //
+// SofiaHDF5_write() report errors to the caller: the message goes   //
+// to stderr, the output file is closed and NULL or a non-zero       //
+// error code is returned. Memory taken by the failed call may not   //
+// all be released. Errors in worker threads, invalid arguments to   //
+// the other functions and, with MPI, errors on any rank still end   //
+// the process (or the MPI job).                                     //
+// ----------------------------------------------------------------- //
+
+#define SOFIA2HDF5_NAME_LENGTH 256  ///< Size of the source name buffer, including the terminating null.
+
+typedef struct SofiaHDF5 SofiaHDF5;
+typedef struct FitsFile FitsFile;
+typedef struct SofiaCatalog SofiaCatalog;
+
+// One row of a SoFiA source catalogue, in the units of the SoFiA ASCII catalogue
+typedef struct CatalogSource {
+    char name[SOFIA2HDF5_NAME_LENGTH];
+    int id;
+    double x, y, z;
+    double x_min, x_max, y_min, y_max, z_min, z_max;
+    double ra, dec, v_app;
+    double f_sum, err_f_sum;
+    double err_x, err_y, err_z;
+    double kin_pa, w50;
+    double rms;
+    int n_pix;
+    double v_sofia;
+} CatalogSource;
+
+// Images held by the caller; NULL if the header is not a valid image header
+FitsFile *FitsFile_new_from_memory(const char *header, const size_t header_size, void *data);
+void FitsFile_delete(FitsFile *self);
+
+// Catalogue built in memory; sources are copied
+SofiaCatalog *SofiaCatalog_new(void);
+void SofiaCatalog_delete(SofiaCatalog *self);
+void SofiaCatalog_add_source(SofiaCatalog *self, const CatalogSource *source);
+
+// Output file. Options are given as on the command line ("hdf5.sparse=true");
+// memory is in bytes
+SofiaHDF5 *SofiaHDF5_new(const char *filename, const char *basename);
+void SofiaHDF5_delete(SofiaHDF5 *self);
+int SofiaHDF5_set_option(SofiaHDF5 *self, const char *setting);
+void SofiaHDF5_set_max_memory(SofiaHDF5 *self, const size_t max_memory);
+void SofiaHDF5_set_threads(SofiaHDF5 *self, const int n_threads);
+void SofiaHDF5_add_cube(SofiaHDF5 *self, FitsFile *cube);
+void SofiaHDF5_add_mask(SofiaHDF5 *self, FitsFile *mask);
+void SofiaHDF5_add_catalog(SofiaHDF5 *self, SofiaCatalog *catalog);
+int SofiaHDF5_write(SofiaHDF5 *self);
+
+#endif
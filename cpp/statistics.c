@@ -0,0 +1,384 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (statistics.c) - SoFiA to HDF5 Converter                 //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "statistics.h"
+#include <math.h>
+
+// Fine histogram bins per bin of the cube histogram. The merged grid keeps at
+// least half of these per cube bin, so rebinning can only misplace values
+// within 1/16 of a cube bin from an edge.
+#define STATISTICS_FINE_FACTOR 32
+
+// ----------------------------------------------------------------- //
+// Plane kernels                                                     //
+// ----------------------------------------------------------------- //
+// One kernel per floating-point type. Blanks and infinities are     //
+// masked with finite_mask() rather than branched around, so a       //
+// plane full of NaN costs no mispredicted jumps and the sweep       //
+// over the plane is vectorised. The histograms are filled in a      //
+// second sweep while the plane is still in cache; their scattered   //
+// increments stay scalar.                                           //
+// ----------------------------------------------------------------- //
+
+// Count the finite values into n_bins bins of width 1 / scale over [min, max],
+// and into the fine bins of width 1 / fine_scale starting at fine_start / fine_scale;
+// values beyond either end, which only rounding can produce, go to the end bins
+#define STATISTICS_BIN_KERNEL(NAME, TYPE) \
+PRIVATE void NAME(const TYPE *data, const size_t size, const double min, const double max, const double scale, const size_t n_bins, int64_t *histogram, \
+                  const double fine_scale, const double fine_start, const size_t n_fine, int64_t *fine) \
+{ \
+    const int64_t last = (int64_t)n_bins - 1; \
+    const int64_t fine_last = (int64_t)n_fine - 1; \
+    \
+    for (size_t i = 0; i < size; i++) { \
+        const double value = (double)data[i]; \
+        const int64_t finite = (int64_t)(finite_mask(value) & 1); \
+        double clamped = value < max ? value : max; \
+        clamped = min < clamped ? clamped : min; \
+        const int64_t bin = (int64_t)((clamped - min) * scale); \
+        const int64_t fine_bin = (int64_t)(clamped * fine_scale - fine_start); \
+        histogram[bin < last ? bin : last] += finite; \
+        fine[fine_bin < fine_last ? fine_bin : fine_last] += finite; \
+    } \
+}
+
+#define STATISTICS_PLANE_KERNEL(NAME, TYPE, BIN) \
+PRIVATE void NAME(Statistics *self, const size_t index, const size_t slot, const TYPE *data, const size_t size) \
+{ \
+    double min = INFINITY; \
+    double max = -INFINITY; \
+    double sum = 0.0; \
+    double sum_sq = 0.0; \
+    uint64_t valid = 0; \
+    \
+    _Pragma("omp simd reduction(min:min) reduction(max:max) reduction(+:sum,sum_sq,valid)") \
+    for (size_t i = 0; i < size; i++) { \
+        const double value = (double)data[i]; \
+        const uint64_t finite = finite_mask(value); \
+        const double term = select_value(finite, value, 0.0); \
+        const double low = select_value(finite, value, INFINITY); \
+        const double high = select_value(finite, value, -INFINITY); \
+        min = low < min ? low : min; \
+        max = max < high ? high : max; \
+        sum += term; \
+        sum_sq += term * term; \
+        valid += finite & 1; \
+    } \
+    \
+    self->sum[index] = sum; \
+    self->sum_sq[index] = sum_sq; \
+    self->nan_count[index] = (int64_t)(size - valid); \
+    self->slot_used[slot] = 0; \
+    \
+    if (valid == 0) { \
+        self->min[index] = NAN; \
+        self->max[index] = NAN; \
+        return; \
+    } \
+    \
+    self->min[index] = min; \
+    self->max[index] = max; \
+    \
+    int64_t *fine = self->slot_histogram + slot * self->n_fine; \
+    Statistics_fine_grid(self, slot, min, max); \
+    memset(fine, 0, self->slot_used[slot] * sizeof(int64_t)); \
+    \
+    const double scale = max > min ? (double)self->n_bins / (max - min) : 0.0; \
+    const double fine_scale = ldexp(1.0, -self->slot_exponent[slot]); \
+    BIN(data, size, min, max, scale, self->n_bins, self->histogram + index * self->n_bins, \
+        fine_scale, (double)self->slot_origin[slot], self->slot_used[slot], fine); \
+}
+
+// ----------------------------------------------------------------- //
+// Fine histograms                                                   //
+// ----------------------------------------------------------------- //
+
+// floor(key / 2^shift), also for negative keys
+PRIVATE int64_t Statistics_coarsen(const int64_t key, const int shift)
+{
+    if (shift <= 0) return key;
+    if (shift >= 62) return key < 0 ? -1 : 0;
+    return key >= 0 ? key >> shift : -((-key - 1) >> shift) - 1;
+}
+
+// Choose the grid of the fine histogram of a slot for values in [min, max]:
+// the finest power of two on which the range covers at most n_fine bins, but
+// no finer than 2^-52 of the largest value, so that bin keys are exact
+PRIVATE void Statistics_fine_grid(Statistics *self, const size_t slot, const double min, const double max)
+{
+    const double extent = fabs(min) > fabs(max) ? fabs(min) : fabs(max);
+    int exponent = extent > 0.0 ? ilogb(extent) - 52 : 0;
+    if (max > min) {
+        // Half the range, which cannot overflow
+        const int range_exponent = ilogb((0.5 * max - 0.5 * min) / (double)(self->n_fine - 1)) + 2;
+        if (range_exponent > exponent) exponent = range_exponent;
+    }
+
+    int64_t first, last;
+    while (true) {
+        first = (int64_t)floor(ldexp(min, -exponent));
+        last = (int64_t)floor(ldexp(max, -exponent));
+        if (last - first < (int64_t)self->n_fine) break;
+        exponent++;
+    }
+
+    self->slot_exponent[slot] = exponent;
+    self->slot_origin[slot] = first;
+    self->slot_used[slot] = (size_t)(last - first + 1);
+    return;
+}
+
+// Add the fine histogram of a slot to that of cube s, coarsening the grid of
+// the cube by factors of two until both ranges fit
+PRIVATE void Statistics_merge_slot(Statistics *self, const size_t slot, const size_t s)
+{
+    const size_t used = self->slot_used[slot];
+    if (used == 0) return;
+
+    const int64_t *counts = self->slot_histogram + slot * self->n_fine;
+    const int exponent = self->slot_exponent[slot];
+    const int64_t origin = self->slot_origin[slot];
+    int64_t *fine = self->fine_histogram + s * self->n_fine;
+
+    if (self->fine_used[s] == 0) {
+        memcpy(fine, counts, used * sizeof(int64_t));
+        self->fine_exponent[s] = exponent;
+        self->fine_origin[s] = origin;
+        self->fine_used[s] = used;
+        return;
+    }
+
+    const int cube_exponent = self->fine_exponent[s];
+    const int64_t cube_origin = self->fine_origin[s];
+    const size_t cube_used = self->fine_used[s];
+    int target = cube_exponent > exponent ? cube_exponent : exponent;
+    int64_t first, last;
+
+    while (true) {
+        const int64_t cube_first = Statistics_coarsen(cube_origin, target - cube_exponent);
+        const int64_t cube_last = Statistics_coarsen(cube_origin + (int64_t)cube_used - 1, target - cube_exponent);
+        const int64_t slot_first = Statistics_coarsen(origin, target - exponent);
+        const int64_t slot_last = Statistics_coarsen(origin + (int64_t)used - 1, target - exponent);
+        first = cube_first < slot_first ? cube_first : slot_first;
+        last = cube_last > slot_last ? cube_last : slot_last;
+        if (last - first < (int64_t)self->n_fine) break;
+        target++;
+    }
+
+    if (target != cube_exponent || first != cube_origin) {
+        int64_t *scratch = self->fine_scratch;
+        memset(scratch, 0, self->n_fine * sizeof(int64_t));
+        for (size_t i = 0; i < cube_used; i++) {
+            scratch[Statistics_coarsen(cube_origin + (int64_t)i, target - cube_exponent) - first] += fine[i];
+        }
+        memcpy(fine, scratch, self->n_fine * sizeof(int64_t));
+    }
+
+    for (size_t i = 0; i < used; i++) {
+        fine[Statistics_coarsen(origin + (int64_t)i, target - exponent) - first] += counts[i];
+    }
+
+    self->fine_exponent[s] = target;
+    self->fine_origin[s] = first;
+    self->fine_used[s] = (size_t)(last - first + 1);
+    return;
+}
+
+STATISTICS_BIN_KERNEL(Statistics_bin_flt, float)
+STATISTICS_BIN_KERNEL(Statistics_bin_dbl, double)
+STATISTICS_PLANE_KERNEL(Statistics_plane_flt, float, Statistics_bin_flt)
+STATISTICS_PLANE_KERNEL(Statistics_plane_dbl, double, Statistics_bin_dbl)
+
+#undef STATISTICS_BIN_KERNEL
+#undef STATISTICS_PLANE_KERNEL
+
+// ----------------------------------------------------------------- //
+// Constructor and destructor                                        //
+// ----------------------------------------------------------------- //
+
+Statistics *Statistics_new(const size_t n_stokes, const size_t n_channels, const size_t plane_size, const size_t n_slots)
+{
+    Statistics *self = memory_alloc(sizeof(Statistics));
+    const size_t n_planes = n_stokes * n_channels;
+
+    self->n_stokes = n_stokes;
+    self->n_channels = n_channels;
+    self->n_bins = (size_t)sqrt((double)plane_size);
+    if (self->n_bins < 2) self->n_bins = 2;
+    self->n_slots = n_slots > 0 ? n_slots : 1;
+    self->n_fine = STATISTICS_FINE_FACTOR * self->n_bins;
+
+    self->min = memory_alloc(n_planes * sizeof(double));
+    self->max = memory_alloc(n_planes * sizeof(double));
+    self->sum = memory_alloc(n_planes * sizeof(double));
+    self->sum_sq = memory_alloc(n_planes * sizeof(double));
+    self->nan_count = memory_alloc(n_planes * sizeof(int64_t));
+    self->histogram = memory_alloc(n_planes * self->n_bins * sizeof(int64_t));
+    memset(self->histogram, 0, n_planes * self->n_bins * sizeof(int64_t));
+
+    self->cube_min = memory_alloc(n_stokes * sizeof(double));
+    self->cube_max = memory_alloc(n_stokes * sizeof(double));
+    self->cube_sum = memory_alloc(n_stokes * sizeof(double));
+    self->cube_sum_sq = memory_alloc(n_stokes * sizeof(double));
+    self->cube_nan_count = memory_alloc(n_stokes * sizeof(int64_t));
+    self->cube_histogram = memory_alloc(n_stokes * self->n_bins * sizeof(int64_t));
+    memset(self->cube_histogram, 0, n_stokes * self->n_bins * sizeof(int64_t));
+
+    self->slot_histogram = memory_alloc(self->n_slots * self->n_fine * sizeof(int64_t));
+    self->slot_origin = memory_alloc(self->n_slots * sizeof(int64_t));
+    self->slot_exponent = memory_alloc(self->n_slots * sizeof(int));
+    self->slot_used = memory_alloc(self->n_slots * sizeof(size_t));
+    memset(self->slot_used, 0, self->n_slots * sizeof(size_t));
+
+    self->fine_histogram = memory_alloc(n_stokes * self->n_fine * sizeof(int64_t));
+    self->fine_origin = memory_alloc(n_stokes * sizeof(int64_t));
+    self->fine_exponent = memory_alloc(n_stokes * sizeof(int));
+    self->fine_used = memory_alloc(n_stokes * sizeof(size_t));
+    self->fine_scratch = memory_alloc(self->n_fine * sizeof(int64_t));
+    memset(self->fine_histogram, 0, n_stokes * self->n_fine * sizeof(int64_t));
+    memset(self->fine_used, 0, n_stokes * sizeof(size_t));
+
+    return self;
+}
+
+void Statistics_delete(Statistics *self)
+{
+    if (self != NULL) {
+        memory_free(self->min);
+        memory_free(self->max);
+        memory_free(self->sum);
+        memory_free(self->sum_sq);
+        memory_free(self->nan_count);
+        memory_free(self->histogram);
+        memory_free(self->cube_min);
+        memory_free(self->cube_max);
+        memory_free(self->cube_sum);
+        memory_free(self->cube_sum_sq);
+        memory_free(self->cube_nan_count);
+        memory_free(self->cube_histogram);
+        memory_free(self->slot_histogram);
+        memory_free(self->slot_origin);
+        memory_free(self->slot_exponent);
+        memory_free(self->slot_used);
+        memory_free(self->fine_histogram);
+        memory_free(self->fine_origin);
+        memory_free(self->fine_exponent);
+        memory_free(self->fine_used);
+        memory_free(self->fine_scratch);
+        memory_free(self);
+    }
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Public methods                                                    //
+// ----------------------------------------------------------------- //
+
+bool Statistics_supports_type(const int data_type)
+{
+    return data_type == -32 || data_type == -64;
+}
+
+// Accumulate the statistics of one channel; 'data' must be in native byte order.
+// Different channels may be added from different threads at the same time, each
+// into its own slot. A slot is reused after Statistics_merge() has been called.
+void Statistics_add_plane(Statistics *self, const size_t index, const size_t slot, const void *data, const int data_type, const size_t size)
+{
+    check_null(self);
+    check_null(data);
+
+    if (index >= self->n_stokes * self->n_channels || slot >= self->n_slots) {
+        error_exit("Statistics channel index out of range.");
+    }
+
+    if (data_type == -32) Statistics_plane_flt(self, index, slot, (const float *)data, size);
+    else if (data_type == -64) Statistics_plane_dbl(self, index, slot, (const double *)data, size);
+
+    return;
+}
+
+// Merge the fine histograms of the channels first to first + count - 1, added
+// in slots 0 to count - 1, into those of their cubes. Not thread-safe.
+void Statistics_merge(Statistics *self, const size_t first, const size_t count)
+{
+    check_null(self);
+
+    if (count > self->n_slots || first + count > self->n_stokes * self->n_channels) {
+        error_exit("Statistics channel index out of range.");
+    }
+
+    for (size_t slot = 0; slot < count; slot++) {
+        Statistics_merge_slot(self, slot, (first + slot) / self->n_channels);
+    }
+
+    return;
+}
+
+// Combine the channel statistics into the cube minimum, maximum, sums and number
+// of blanks, and rebin the merged fine histograms into the cube histograms: a
+// fine bin that crosses an edge is split in proportion to its overlap with the
+// bins on either side. Under MPI the channel statistics must be complete, while
+// the cube histograms only count the channels merged by this process and are
+// summed over the processes afterwards.
+void Statistics_finalise(Statistics *self)
+{
+    check_null(self);
+
+    for (size_t s = 0; s < self->n_stokes; s++) {
+        double min = INFINITY;
+        double max = -INFINITY;
+        double sum = 0.0;
+        double sum_sq = 0.0;
+        int64_t nan_count = 0;
+
+        for (size_t c = 0; c < self->n_channels; c++) {
+            const size_t index = s * self->n_channels + c;
+            sum += self->sum[index];
+            sum_sq += self->sum_sq[index];
+            nan_count += self->nan_count[index];
+            if (isnan(self->min[index])) continue;
+            if (self->min[index] < min) min = self->min[index];
+            if (self->max[index] > max) max = self->max[index];
+        }
+
+        self->cube_sum[s] = sum;
+        self->cube_sum_sq[s] = sum_sq;
+        self->cube_nan_count[s] = nan_count;
+        self->cube_min[s] = min > max ? NAN : min;
+        self->cube_max[s] = min > max ? NAN : max;
+        if (min > max) continue;
+
+        const double scale = max > min ? (double)self->n_bins / (max - min) : 0.0;
+        const double n_bins = (double)self->n_bins;
+        const int64_t *fine = self->fine_histogram + s * self->n_fine;
+        int64_t *histogram = self->cube_histogram + s * self->n_bins;
+
+        for (size_t i = 0; i < self->fine_used[s]; i++) {
+            if (fine[i] == 0) continue;
+
+            // Position of the fine bin in units of cube bins, clipped to [min, max]
+            const double key = (double)(self->fine_origin[s] + (int64_t)i);
+            double low = (ldexp(key, self->fine_exponent[s]) - min) * scale;
+            double high = (ldexp(key + 1.0, self->fine_exponent[s]) - min) * scale;
+            low = low > 0.0 ? low : 0.0;
+            high = high < n_bins ? high : n_bins;
+
+            const double edge = floor(low) + 1.0;
+            const size_t bin = low < n_bins - 1.0 ? (size_t)low : self->n_bins - 1;
+            if (edge >= high || bin == self->n_bins - 1) {
+                histogram[bin] += fine[i];
+            }
+            else {
+                // A fine bin is narrower than a cube bin and crosses at most one edge
+                const int64_t upper = llround((double)fine[i] * (high - edge) / (high - low));
+                histogram[bin] += fine[i] - upper;
+                histogram[bin + 1] += upper;
+            }
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,87 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (statistics.h) - SoFiA to HDF5 Converter                 //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+/// @file   statistics.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Per-channel and whole-cube image statistics (header).
+
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "common.h"
+
+// ----------------------------------------------------------------- //
+// Class 'Statistics'                                                //
+// ----------------------------------------------------------------- //
+// Statistics following the CARTA (IDIA) HDF5 schema: per channel    //
+// (XY) and per Stokes cube (XYZ) minimum, maximum, sum, sum of      //
+// squares, number of blanked pixels and a histogram. Channels can   //
+// be added concurrently from several threads, each into its own     //
+// slot. Besides its own histogram, every channel is counted into    //
+// a fine histogram on a power-of-two grid, which is merged into     //
+// the fine histogram of its cube once the slots are complete. The   //
+// cube histogram is rebinned from that, so the data are only read   //
+// once.                                                             //
+// ----------------------------------------------------------------- //
+
+typedef CLASS Statistics {
+    size_t n_stokes;      // Number of independent cubes (Stokes planes)
+    size_t n_channels;    // Channels per cube
+    size_t n_bins;        // Histogram bins, sqrt(nx * ny) as in CARTA
+    size_t n_slots;       // Channels that can be added before Statistics_merge()
+    size_t n_fine;        // Bins of the fine histograms
+
+    // Per channel, index = stokes * n_channels + channel
+    double *min, *max;
+    double *sum, *sum_sq;
+    int64_t *nan_count;
+    int64_t *histogram;   // n_bins per channel, over [min, max] of that channel
+
+    // Per cube, index = stokes
+    double *cube_min, *cube_max;
+    double *cube_sum, *cube_sum_sq;
+    int64_t *cube_nan_count;
+    int64_t *cube_histogram; // n_bins per cube, over [min, max] of that cube
+
+    // Fine histograms: bin i counts the values in [(origin + i) * 2^exponent,
+    // (origin + i + 1) * 2^exponent); 'used' bins are occupied, none if 0
+    int64_t *slot_histogram, *slot_origin;
+    int *slot_exponent;
+    size_t *slot_used;
+    int64_t *fine_histogram, *fine_origin;
+    int *fine_exponent;
+    size_t *fine_used;
+    int64_t *fine_scratch;
+} Statistics;
+
+// Constructor and destructor
+PUBLIC Statistics *Statistics_new(const size_t n_stokes, const size_t n_channels, const size_t plane_size, const size_t n_slots);
+PUBLIC void Statistics_delete(Statistics *self);
+
+// Public methods
+PUBLIC bool Statistics_supports_type(const int data_type);
+PUBLIC void Statistics_add_plane(Statistics *self, const size_t index, const size_t slot, const void *data, const int data_type, const size_t size);
+PUBLIC void Statistics_merge(Statistics *self, const size_t first, const size_t count);
+PUBLIC void Statistics_finalise(Statistics *self);
+
+#endif
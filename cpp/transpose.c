@@ -0,0 +1,102 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (transpose.c) - SoFiA to HDF5 Converter                  //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+
+#include "transpose.h"
+#include "parallel.h"
+#include <stdint.h>
+
+typedef CLASS TransposeTask {
+    const unsigned char *source;
+    unsigned char *target;
+    size_t nz, ny, nx;
+    size_t word_size;
+    bool x_major;
+} TransposeTask;
+
+PRIVATE void transpose_row(const size_t y, void *context);
+
+// ----------------------------------------------------------------- //
+// Row kernels                                                       //
+// ----------------------------------------------------------------- //
+// Copy one image row of all planes into its spectra. Blocks of      //
+// TRANSPOSE_BLOCK x TRANSPOSE_BLOCK elements keep both the strided  //
+// reads across planes and the writes along spectra within cache.    //
+// Successive spectra of a row are 'step' elements apart in target.  //
+// ----------------------------------------------------------------- //
+
+#define TRANSPOSE_ROW_KERNEL(NAME, TYPE) \
+PRIVATE void NAME(const TYPE *source, TYPE *target, const size_t nz, const size_t ny, const size_t nx, const size_t step) \
+{ \
+    for (size_t z0 = 0; z0 < nz; z0 += TRANSPOSE_BLOCK) { \
+        const size_t z1 = z0 + TRANSPOSE_BLOCK < nz ? z0 + TRANSPOSE_BLOCK : nz; \
+        for (size_t x0 = 0; x0 < nx; x0 += TRANSPOSE_BLOCK) { \
+            const size_t x1 = x0 + TRANSPOSE_BLOCK < nx ? x0 + TRANSPOSE_BLOCK : nx; \
+            for (size_t x = x0; x < x1; x++) { \
+                TYPE *spectrum = target + x * step; \
+                for (size_t z = z0; z < z1; z++) spectrum[z] = source[z * ny * nx + x]; \
+            } \
+        } \
+    } \
+}
+
+TRANSPOSE_ROW_KERNEL(transpose_row_8, uint8_t)
+TRANSPOSE_ROW_KERNEL(transpose_row_16, uint16_t)
+TRANSPOSE_ROW_KERNEL(transpose_row_32, uint32_t)
+TRANSPOSE_ROW_KERNEL(transpose_row_64, uint64_t)
+
+#undef TRANSPOSE_ROW_KERNEL
+
+// ----------------------------------------------------------------- //
+// Public functions                                                  //
+// ----------------------------------------------------------------- //
+
+void transpose_to_spectra(const void *source, void *target, const size_t nz, const size_t ny, const size_t nx,
+                          const size_t word_size, const bool x_major, const int n_threads)
+{
+    check_null(source);
+    check_null(target);
+    
+    if (word_size != 1 && word_size != 2 && word_size != 4 && word_size != 8) {
+        error_exit("Unsupported word size for transposition.");
+    }
+    
+    TransposeTask task;
+    task.source = (const unsigned char *)source;
+    task.target = (unsigned char *)target;
+    task.nz = nz;
+    task.ny = ny;
+    task.nx = nx;
+    task.word_size = word_size;
+    task.x_major = x_major;
+    
+    parallel_for(ny, n_threads, transpose_row, &task);
+    
+    return;
+}
+
+// ----------------------------------------------------------------- //
+// Private functions                                                 //
+// ----------------------------------------------------------------- //
+
+// Transpose row y of the tile; x-major output interleaves the rows
+void transpose_row(const size_t y, void *context)
+{
+    const TransposeTask *task = (const TransposeTask *)context;
+    const size_t row = y * task->nx * task->word_size;
+    const size_t offset = (task->x_major ? y : y * task->nx) * task->nz * task->word_size;
+    const size_t step = (task->x_major ? task->ny : 1) * task->nz;
+    const void *source = task->source + row;
+    void *target = task->target + offset;
+    
+    switch (task->word_size) {
+        case 1: transpose_row_8(source, target, task->nz, task->ny, task->nx, step); break;
+        case 2: transpose_row_16(source, target, task->nz, task->ny, task->nx, step); break;
+        case 4: transpose_row_32(source, target, task->nz, task->ny, task->nx, step); break;
+        case 8: transpose_row_64(source, target, task->nz, task->ny, task->nx, step); break;
+    }
+    
+    return;
+}
@@ -0,0 +1,41 @@
+// ____________________________________________________________________ //
+//                                                                      //
+// sofia2hdf5 (transpose.h) - SoFiA to HDF5 Converter                  //
+// Copyright (C) 2025 Peter Kamphuis                                    //
+// ____________________________________________________________________ //
+//                                                                      //
+// This program is free software: you can redistribute it and/or modify //
+// it under the terms of the GNU General Public License as published by //
+// the Free Software Foundation, either version 3 of the License, or    //
+// (at your option) any later version.                                  //
+//                                                                      //
+// This program is distributed in the hope that it will be useful,      //
+// but WITHOUT ANY WARRANTY; without even the implied warranty of       //
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the         //
+// GNU General Public License for more details.                         //
+//                                                                      //
+// You should have received a copy of the GNU General Public License    //
+// along with this program. If not, see http://www.gnu.org/licenses/.   //
+// ____________________________________________________________________ //
+
+
+/// @file   transpose.h
+/// @author Peter Kamphuis
+/// @date   18/10/2026
+/// @brief  Cache-blocked transposition of image tiles into spectra (header).
+
+#ifndef TRANSPOSE_H
+#define TRANSPOSE_H
+
+#include <stdbool.h>
+#include "common.h"
+
+#define TRANSPOSE_BLOCK 32  ///< Edge of the square blocks copied at a time (elements).
+
+// Transpose a tile of 'ny' rows of 'nz' planes, stored as [nz][ny][nx], into
+// spectra: [ny][nx][nz] or, with 'x_major' set, [nx][ny][nz]. The rows are
+// shared out over up to n_threads threads; word_size must be 1, 2, 4 or 8.
+PUBLIC void transpose_to_spectra(const void *source, void *target, const size_t nz, const size_t ny, const size_t nx,
+                                 const size_t word_size, const bool x_major, const int n_threads);
+
+#endif
@@ -22,6 +22,9 @@ char *get_basename(const Parameter *input_parameters)
         return string_copy(output_filename);
     } else {
         const char *input_data = Parameter_get_str(input_parameters, "input.data");
+        if (strcmp(input_data, "-") == 0) {
+            error_exit("output.filename must be set when the cube is read from standard input.");
+        }
         if (strlen(input_data) > 0) {
             // Extract basename and remove extension
             char *temp_path = string_copy(input_data);